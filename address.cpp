@@ -195,6 +195,31 @@ bool Address::operator == (const Address& b) const
 }
 
 
+size_t Address::hash() const
+{
+    uint32_t h = 0;
+    uint16_t port = 0;
+    if (addr.ss_family == AF_INET) {
+        struct sockaddr_in *addr4ptr = (struct sockaddr_in *)&addr;
+        h = addr4ptr->sin_addr.s_addr;
+        port = addr4ptr->sin_port;
+    } else if (addr.ss_family == AF_INET6) {
+        struct sockaddr_in6 *addr6ptr = (struct sockaddr_in6 *)&addr;
+        const uint8_t *b = addr6ptr->sin6_addr.s6_addr;
+        port = addr6ptr->sin6_port;
+        if (IN6_IS_ADDR_V4MAPPED(&addr6ptr->sin6_addr))
+            memcpy(&h, b+12, 4);
+        else {
+            // FNV-1a
+            h = 2166136261U;
+            for (int i=0; i<16; i++)
+                h = (h ^ b[i]) * 16777619U;
+        }
+    }
+    return (size_t)((h ^ ((uint32_t)port << 16 | port)) * 2654435761U);
+}
+
+
 std::string Address::str() const
 {
     return ipstr(true);
@@ -152,6 +152,9 @@ void swift::Shutdown()
     if (api_debug)
         fprintf(stderr,"swift::Shutdown");
 
+    // Channels still open are not deleted, so put their paths in first
+    Channel::PutPaths();
+    PathCache::GetInstance()->Save();
     Channel::Shutdown();
 }
 
@@ -171,6 +174,8 @@ int swift::Open(std::string filename, SwarmID& swarmid, std::string trackerurl,
 
     if (swarmid.ttype() != FILE_TRANSFER)
         return -1;
+    if (chunk_size > SWIFT_MAX_CHUNK_SIZE)
+        return -1;
 
     SwarmData* swarm = SwarmManager::GetManager().AddSwarm(filename, swarmid.roothash(), trackerurl, force_check_diskvshash,
                        cipm, zerostate, activate, chunk_size, metadir);
@@ -422,6 +427,20 @@ void swift::SetMaxSpeed(int td, data_direction_t ddir, double speed)
         swarm->SetMaxSpeed(ddir,speed); // checks current set speed beforehand
 }
 
+void swift::SetCongestionControl(int td, cc_algo_t algo)
+{
+    if (api_debug)
+        fprintf(stderr,"swift::SetCongestionControl td %d algo %d\n", td, (int)algo);
+
+    SwarmData* swarm = SwarmManager::GetManager().FindSwarm(td);
+    if (swarm == NULL) {
+        LiveTransfer *lt = LiveTransfer::FindByTD(td);
+        if (lt != NULL)
+            lt->SetCongestionControl(algo);
+    } else
+        swarm->SetCongestionControl(algo);
+}
+
 double swift::GetCurrentSpeed(int td, data_direction_t ddir)
 {
     if (api_debug)
@@ -10,9 +10,15 @@
  */
 
 #include <cassert>
+#include <algorithm>
 #include "compat.h"
 #include "swift.h"
 #include "bin_utils.h"
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include <sched.h>
+#endif
 
 using namespace std;
 using namespace swift;
@@ -27,19 +33,76 @@ tint Channel::epoch = now_t::now/360000000LL*360000000LL; // make logs mergeable
 uint64_t Channel::global_dgrams_up=0, Channel::global_dgrams_down=0,
                   Channel::global_raw_bytes_up=0, Channel::global_raw_bytes_down=0,
                            Channel::global_bytes_up=0, Channel::global_bytes_down=0;
+uint64_t Channel::global_recv_wakeups=0, Channel::global_recv_batch_dgrams=0, Channel::global_recv_batch_max=0;
+uint64_t Channel::global_send_flushes=0, Channel::global_send_flush_dgrams=0, Channel::global_send_flush_max=0;
+int Channel::last_flush_dgrams = 0;
+uint64_t Channel::global_gso_sends=0, Channel::global_gso_segments=0, Channel::global_gro_segments=0;
+int Channel::shard_id = 0, Channel::shard_count = 1;
+uint64_t Channel::global_shard_forwarded=0, Channel::global_shard_received=0;
+uint64_t Channel::global_uring_sends=0, Channel::global_uring_recvs=0, Channel::global_uring_reads=0;
+uint64_t Channel::global_zerocopy_chunks=0, Channel::global_zerocopy_bytes=0;
+uint64_t Channel::global_paced_dgrams=0, Channel::global_txtime_dgrams=0, Channel::global_pacer_wakeups=0;
+uint64_t Channel::global_hs_rate_rejected=0, Channel::global_hs_unknown_rejected=0;
+uint64_t Channel::global_ack_msgs=0, Channel::global_ack_chunks=0;
+uint64_t Channel::global_hash_msgs=0, Channel::global_hash_bytes_up=0, Channel::global_hash_skipped=0;
 sckrwecb_t Channel::sock_open[] = {};
 int Channel::sock_count = 0;
 swift::tint Channel::last_tick = 0;
 int Channel::MAX_REORDERING = 4;
+int Channel::RECV_BATCH_SIZE = 32;
+int Channel::SEND_BATCH_SIZE = 64;
+bool Channel::UDP_OFFLOAD = false;
+bool Channel::REUSE_PORT = false;
+bool Channel::IO_URING = false;
+bool Channel::ZERO_COPY = false;
+int Channel::PACING = PACING_OFF;
+int Channel::CC_ALGO = CC_LEDBAT;
+int Channel::HANDSHAKE_RATE = 50;
+int Channel::HANDSHAKE_BURST = 100;
+int Channel::MAX_CHANNELS = SWIFT_MAX_CHANNELS;
+swift::tint Channel::ACK_DELAY = TINT_MSEC;
+int Channel::ACK_COUNT = 8;
+bool Channel::HAVE_RUNS = false;
+bool Channel::CHUNK_ADDR_64 = false;
 bool Channel::SELF_CONN_OK = false;
 swift::tint Channel::TIMEOUT = TINT_SEC*60;
 channels_t Channel::channels(1);
+std::vector<uint8_t> Channel::slot_gens(1);
+std::deque<uint32_t> Channel::free_slots;
+addrchannels_t Channel::peer_index;
 std::string Channel::trackerurl;
 FILE* Channel::debug_file = NULL;
 // Only in dev: ledbat log file
 FILE* Channel::debug_ledbat = NULL;
 tint Channel::MIN_PEX_REQUEST_INTERVAL = TINT_SEC;
 
+// Per-socket send queues, see QueueTo. Allocated on first use.
+struct send_queue_t {
+    evutil_socket_t sock;
+    int             count;
+    bool            txtime;     // socket takes SO_TXTIME stamps
+    send_slot_t     slots[DGRAM_MAX_SEND_BATCH];
+};
+static send_queue_t *send_queues[DGRAM_MAX_SOCK_OPEN] = {};
+static int send_queue_count = 0;
+static struct event evflush;
+static bool flush_scheduled = false;
+// Cleared when the kernel refuses a UDP_SEGMENT send
+static bool gso_ok = true;
+
+// Userspace pacer: datagrams held until their txtime, as a heap on it
+struct paced_slot_t {
+    evutil_socket_t sock;
+    send_slot_t     slot;
+    bool operator < (const paced_slot_t& b) const {
+        return slot.txtime > b.slot.txtime;
+    }
+};
+static std::vector<paced_slot_t> pacer_heap;
+static wheel_timer_t pacer_timer(&Channel::LibeventPaceCallback);
+
+static void send_queues_forget_owner(Channel *c);
+
 /*
  * Instance methods
  */
@@ -47,10 +110,11 @@ tint Channel::MIN_PEX_REQUEST_INTERVAL = TINT_SEC;
 Channel::Channel(ContentTransfer* transfer, int socket, Address peer_addr) :
     // Arno, 2011-10-03: Reordered to avoid g++ Wall warning
     peer_(peer_addr), socket_(socket==INVALID_SOCKET?default_socket():socket), // FIXME
-    transfer_(transfer), own_id_mentioned_(false),
+    transfer_(transfer), chunk_size_(transfer->chunk_size()), own_id_mentioned_(false),
     ack_in_right_basebin_(bin_t::NONE),
-    data_in_(TINT_NEVER,bin_t::NONE), data_in_dbl_(bin_t::NONE), data_out_size_(0),
-    data_out_cap_(bin_t::ALL),hint_in_size_(0), hint_out_size_(0), hint_queue_out_size_(0),
+    data_in_(TINT_NEVER,bin_t::NONE), data_in_dbl_(bin_t::NONE),
+    ack_agg_count_(0), ack_agg_first_(TINT_NEVER), ack_agg_owd_(TINT_NEVER),
+    data_out_cap_(bin_t::ALL), have_log_pos_(0), have_log_synced_(false), have_runs_pos_(0), hint_in_size_(0), hint_out_size_(0), hint_queue_out_size_(0),
     // Gertjan fix 996e21e8abfc7d88db3f3f8158f2a2c4fc8a8d3f
     // "Changed PEX rate limiting to per channel limiting"
     pex_requested_(false),  // Ric: init var that wasn't initialiazed
@@ -58,14 +122,14 @@ Channel::Channel(ContentTransfer* transfer, int socket, Address peer_addr) :
     pex_request_outstanding_(false),
     useless_pex_count_(0),
     rtt_avg_(TINT_SEC), dev_avg_(0), dip_avg_(TINT_SEC),
-    last_send_time_(0), last_recv_time_(0), last_data_out_time_(0), last_data_in_time_(0),
+    last_send_time_(0), last_recv_time_(0), last_data_out_time_(0), pace_time_(0), last_data_in_time_(0),
     last_loss_time_(0), next_send_time_(0), open_time_(NOW), cwnd_(1),
     cwnd_count1_(0), send_interval_(TINT_SEC),
     send_control_(PING_PONG_CONTROL), sent_since_recv_(0),
-    lastrecvwaskeepalive_(false), lastsendwaskeepalive_(false), keepalivereason_(NONE),
+    lastrecvwaskeepalive_(false), lastsendwaskeepalive_(false), chunk_read_wait_(false), chunk_addr_overflow_(false),
+    keepalivereason_(NONE),
     live_have_no_hint_(false), // Arno: live speed opt
-    ack_rcvd_recent_(0), ack_not_rcvd_recent_(0), owd_min_bin_(0), owd_min_bin_start_(NOW-LEDBAT_ROLLOVER),
-    owd_cur_(TINT_NEVER), owd_min_(TINT_NEVER),
+    ack_rcvd_recent_(0), ack_not_rcvd_recent_(0), path_cwnd_(0), data_out_sent_(0), data_out_lost_(0),
     dgrams_sent_(0), dgrams_rcvd_(0),
     raw_bytes_up_(0), raw_bytes_down_(0), bytes_up_(0), bytes_down_(0),
     old_movingfwd_bytes_(0),
@@ -75,25 +139,47 @@ Channel::Channel(ContentTransfer* transfer, int socket, Address peer_addr) :
     munro_ack_rcvd_(false),
     rtt_hint_tintbin_()
 {
-    // ARNOTODO: avoid infinitely growing vector
-    this->id_ = channels.size();
-    channels.push_back(this);
+    assert(SlotAvailable());
+    if (!free_slots.empty()) {
+        this->id_ = free_slots.front();
+        free_slots.pop_front();
+        channels[id_] = this;
+    } else {
+        this->id_ = channels.size();
+        channels.push_back(this);
+        slot_gens.push_back(0);
+    }
+
+    cc_ = CongestionController::Create(transfer->GetCongestionControl(),chunk_size_);
 
-    for (int i=0; i<10; i++) {
-        owd_min_bins_[i] = TINT_NEVER;
+    // Talked to before: timeouts from its RTT rather than a second
+    path_metrics_t m;
+    if (PathCache::GetInstance()->Get(peer_,&m)) {
+        rtt_avg_ = m.rtt_avg;
+        dev_avg_ = m.dev_avg;
+        dprintf("%s #%" PRIu32 " sendctrl rtt cached %" PRIi64 " dev %" PRIi64 "\n",tintstr(),id_,rtt_avg_,dev_avg_);
     }
 
-    evsend_ptr_ = new struct event;
-    evtimer_assign(evsend_ptr_,evbase,&Channel::LibeventSendCallback,this);
-    evtimer_add(evsend_ptr_,tint2tv(next_send_time_));
+    evsend_ptr_ = new wheel_timer_t(&Channel::LibeventSendCallback,this);
+    Timers()->Schedule(evsend_ptr_,NOW);
 
     //LIVE
     evsendlive_ptr_ = NULL;
 
     // RATELIMIT
     transfer_->GetChannels()->push_back(this);
+    transfer_->AddPeerIndex(peer_,this);
+    peer_index.insert(std::make_pair(peer_,this));
 
     hs_out_ = new Handshake(transfer->GetDefaultHandshake());
+    if (transfer->ttype() == FILE_TRANSFER && transfer->hashtree() != NULL) {
+        // Started from a swarm ID alone, the content may turn out to be
+        // beyond 32 bits, and our handshake can't be changed later
+        if (transfer->hashtree()->size() == 0 && CHUNK_ADDR_64)
+            hs_out_->ToChunkAddr64();
+        else
+            hs_out_->FitChunkAddr(transfer->hashtree()->size_in_chunks());
+    }
 
     dprintf("%s #%" PRIu32 " init channel %s transfer %d\n",tintstr(),id_,peer_.str().c_str(), transfer_->td());
     //fprintf(stderr,"new Channel %d %s\n", id_, peer_.str().c_str() );
@@ -104,7 +190,13 @@ Channel::~Channel()
 {
     dprintf("%s #%" PRIu32 " dealloc channel\n",tintstr(),id_);
     channels[id_] = NULL;
+    addrchannels_erase(peer_index,peer_,this);
+    slot_gens[id_] = (slot_gens[id_]+1) & ((1<<(SWIFT_SHARD_ID_SHIFT-SWIFT_CHANNEL_GEN_SHIFT))-1);
+    free_slots.push_back(id_);
+    // Queued datagrams (e.g. an explicit close) are still sent
+    send_queues_forget_owner(this);
     ClearEvents();
+    FreeChunkReads();
 
     // RATELIMIT
     if (transfer_ != NULL) {
@@ -115,6 +207,9 @@ Channel::~Channel()
                 break;
         }
         channels->erase(iter);
+        transfer_->RemovePeerIndex(peer_,this);
+        if (recv_peer_ != Address())
+            transfer_->RemovePeerIndex(recv_peer_,this);
     }
 
     if (hs_in_ != NULL) {
@@ -125,6 +220,10 @@ Channel::~Channel()
         delete hs_out_;
         hs_out_ = NULL;
     }
+    delete cc_;
+
+    // Remember the path for the next channel to the peer
+    PutPath();
 }
 
 
@@ -132,12 +231,12 @@ void Channel::ClearEvents()
 {
     // Arno, 2013-02-01: Be safer, _del not just on pending.
     if (evsend_ptr_ != NULL) {
-        evtimer_del(evsend_ptr_);
+        Timers()->Cancel(evsend_ptr_);
         delete evsend_ptr_;
         evsend_ptr_ = NULL;
     }
     if (evsendlive_ptr_ != NULL) {
-        evtimer_del(evsendlive_ptr_);
+        Timers()->Cancel(evsendlive_ptr_);
         delete evsendlive_ptr_;
         evsendlive_ptr_ = NULL;
     }
@@ -200,7 +299,12 @@ bool Channel::IsDiffSenderOrDuplicate(Address addr, uint32_t chid)
             // (HANDSHAKE). If so, close the channel if his port number is
             // larger than yours (such that one channel remains).
             //
-            recv_peer_ = addr;
+            if (recv_peer_ != addr) {
+                if (recv_peer_ != Address())
+                    transfer()->RemovePeerIndex(recv_peer_,this);
+                recv_peer_ = addr;
+                transfer()->AddPeerIndex(recv_peer_,this);
+            }
 
             Channel *c = transfer()->FindChannel(addr,this);
             if (c == NULL)
@@ -264,6 +368,27 @@ evutil_socket_t Channel::Bind(Address address, sckrwecb_t callbacks)
     dbnd_ensure(setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
                            (setsockoptptr_t)&rcvbuf, sizeof(int)) == 0);
     //setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (setsockoptptr_t)&enable, sizeof(int));
+#ifdef SO_REUSEPORT
+    // Shards bind the same port, the kernel spreads peers over them
+    if (REUSE_PORT)
+        dbnd_ensure(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (setsockoptptr_t)&enable, sizeof(int)) == 0);
+#endif
+#if defined(__linux__) && defined(UDP_GRO)
+    // Not fatal, UDP GRO needs Linux 5.0. RecvBatch only splits datagrams
+    // that come with a UDP_GRO cmsg.
+    if (UDP_OFFLOAD && setsockopt(fd, SOL_UDP, UDP_GRO, (setsockoptptr_t)&enable, sizeof(int)) != 0)
+        dprintf("%s UDP GRO not supported\n",tintstr());
+#endif
+#if defined(__linux__) && defined(SO_TXTIME)
+    // Not fatal either, without it the userspace pacer holds the datagrams
+    if (PACING == PACING_TXTIME) {
+        struct sock_txtime txt;
+        txt.clockid = CLOCK_MONOTONIC;
+        txt.flags = 0;
+        if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, (setsockoptptr_t)&txt, sizeof(txt)) != 0)
+            dprintf("%s SO_TXTIME not supported\n",tintstr());
+    }
+#endif
     if (address.get_family() == AF_INET6) {
         // Arno, 2012-12-04: Enable IPv4 on this IPv6 socket, addresses
         // show up as IPv4-mapped IPv6.
@@ -316,6 +441,633 @@ int Channel::SendTo(evutil_socket_t sock, const Address& addr, struct evbuffer *
     return r;
 }
 
+static send_queue_t *send_queue_find(evutil_socket_t sock, bool create)
+{
+    for (int i=0; i<send_queue_count; i++)
+        if (send_queues[i]->sock == sock)
+            return send_queues[i];
+    if (!create || send_queue_count == DGRAM_MAX_SOCK_OPEN)
+        return NULL;
+    if (send_queues[send_queue_count] == NULL)
+        send_queues[send_queue_count] = new send_queue_t;
+    send_queue_t *q = send_queues[send_queue_count++];
+    q->sock = sock;
+    q->count = 0;
+    q->txtime = false;
+#if defined(__linux__) && defined(SO_TXTIME)
+    struct sock_txtime txt;
+    socklen_t len = sizeof(txt);
+    if (Channel::PACING == PACING_TXTIME && getsockopt(sock, SOL_SOCKET, SO_TXTIME, &txt, &len) == 0)
+        q->txtime = txt.clockid == CLOCK_MONOTONIC;
+#endif
+    return q;
+}
+
+static void send_queues_forget_owner(Channel *c)
+{
+    for (int i=0; i<send_queue_count; i++)
+        for (int j=0; j<send_queues[i]->count; j++)
+            if (send_queues[i]->slots[j].owner == c)
+                send_queues[i]->slots[j].owner = NULL;
+    for (int i=0; i<pacer_heap.size(); i++)
+        if (pacer_heap[i].slot.owner == c)
+            pacer_heap[i].slot.owner = NULL;
+}
+
+static void pacer_arm()
+{
+    if (pacer_heap.empty())
+        Channel::Timers()->Cancel(&pacer_timer);
+    else
+        Channel::Timers()->Schedule(&pacer_timer, pacer_heap.front().slot.txtime-SWIFT_PACING_SLACK);
+}
+
+static void pacer_hold(evutil_socket_t sock, const Address& addr, dgram_t *d, Channel *owner, tint txtime)
+{
+    paced_slot_t p;
+    p.sock = sock;
+    p.slot.addr = addr;
+    p.slot.dgram = d;
+    p.slot.owner = owner;
+    p.slot.txtime = txtime;
+    pacer_heap.push_back(p);
+    std::push_heap(pacer_heap.begin(),pacer_heap.end());
+    if (pacer_heap.front().slot.dgram == d)
+        pacer_arm();
+}
+
+static void pacer_forget_socket(evutil_socket_t sock)
+{
+    size_t before = pacer_heap.size();
+    std::vector<paced_slot_t>::iterator iter;
+    for (iter=pacer_heap.begin(); iter!=pacer_heap.end(); ) {
+        if (iter->sock == sock) {
+            dgram_free(iter->slot.dgram);
+            iter = pacer_heap.erase(iter);
+        } else
+            iter++;
+    }
+    if (pacer_heap.size() == before)
+        return;
+    std::make_heap(pacer_heap.begin(),pacer_heap.end());
+    pacer_arm();
+}
+
+#ifndef _WIN32
+// Header and the by-reference chunk of a zero-copy dgram, returns how many
+static int dgram_iovecs(dgram_t *d, struct iovec *iov)
+{
+    iov[0].iov_base = d->data + d->off;
+    iov[0].iov_len = d->len - d->off;
+    if (d->ref == NULL)
+        return 1;
+    iov[1].iov_base = (void *)d->ref;
+    iov[1].iov_len = d->reflen;
+    return 2;
+}
+#endif
+
+int Channel::QueueTo(evutil_socket_t sock, const Address& addr, dgram_t *d, Channel *owner, tint txtime)
+{
+    send_queue_t *q = NULL;
+    if (SEND_BATCH_SIZE > 1)
+        q = send_queue_find(sock,true);
+    bool stamp = q != NULL && q->txtime && PACING == PACING_TXTIME;
+    if (txtime > NOW+SWIFT_PACING_SLACK && !stamp) {
+        // No kernel pacing on this socket, hold it till it's due
+        int length = dgram_get_length(d);
+        pacer_hold(sock,addr,d,owner,txtime);
+        return length;
+    }
+    if (q == NULL) {
+        int r = SendTo(sock,addr,d);
+        dgram_free(d);
+        if (r > 0 && owner != NULL)
+            owner->raw_bytes_up_ += r;
+        return r;
+    }
+
+    int length = dgram_get_length(d);
+    send_slot_t &slot = q->slots[q->count++];
+    slot.addr = addr;
+    slot.owner = owner;
+    slot.dgram = d;
+    slot.txtime = stamp ? txtime : 0;
+
+    if (q->count >= std::min(SEND_BATCH_SIZE,DGRAM_MAX_SEND_BATCH))
+        FlushSendQueue(sock);
+    else if (!flush_scheduled && evbase != NULL) {
+        // Run after the events that are already active in this iteration,
+        // i.e. after all channel timers that fired together.
+        event_assign(&evflush, evbase, -1, 0, &Channel::LibeventFlushCallback, NULL);
+        event_active(&evflush, EV_TIMEOUT, 0);
+        flush_scheduled = true;
+    }
+    return length;
+}
+
+int Channel::FlushSendQueue(evutil_socket_t sock)
+{
+    send_queue_t *q = send_queue_find(sock,false);
+    if (q == NULL || q->count == 0)
+        return 0;
+
+    int count = q->count, sent = 0;
+    size_t lens[DGRAM_MAX_SEND_BATCH];
+    bool stamped = false;
+    for (int i=0; i<count; i++) {
+        lens[i] = dgram_get_length(q->slots[i].dgram);
+        stamped |= q->slots[i].txtime != 0;
+    }
+    q->count = 0;
+
+#if defined(__linux__) && defined(SO_TXTIME)
+    // SO_TXTIME wants CLOCK_MONOTONIC nanoseconds, tint is wall clock
+    struct timespec mono;
+    clock_gettime(CLOCK_MONOTONIC,&mono);
+    int64_t monobase = (int64_t)mono.tv_sec*1000000000LL + mono.tv_nsec - usec_time()*1000LL;
+#endif
+
+    int i = 0;
+    if (IO_URING && !UDP_OFFLOAD && !stamped && Uring() != NULL) {
+        // GSO runs and SO_TXTIME stamps stay with sendmmsg
+        sent = UringSend(sock, q->slots, count);
+        i = count;
+    }
+    while (i < count) {
+        int r, nsegs[DGRAM_MAX_SEND_BATCH];
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+        struct mmsghdr msgs[DGRAM_MAX_SEND_BATCH];
+        // Zero-copy dgrams take two: header and chunk
+        struct iovec iovecs[2*DGRAM_MAX_SEND_BATCH];
+#if defined(UDP_SEGMENT) || defined(SO_TXTIME)
+        // Either a UDP_SEGMENT or a SCM_TXTIME, a stamped dgram goes alone
+        char cmsgbufs[DGRAM_MAX_SEND_BATCH][CMSG_SPACE(sizeof(uint64_t))];
+#endif
+        int n = 0, niov = 0;
+        for (int j=i; j<count; j+=nsegs[n++]) {
+            memset(&msgs[n].msg_hdr,0,sizeof(struct msghdr));
+            msgs[n].msg_hdr.msg_name = &(q->slots[j].addr.addr);
+            msgs[n].msg_hdr.msg_namelen = q->slots[j].addr.get_family_sockaddr_length();
+            msgs[n].msg_hdr.msg_iov = &iovecs[niov];
+            msgs[n].msg_hdr.msg_iovlen = dgram_iovecs(q->slots[j].dgram,&iovecs[niov]);
+            niov += msgs[n].msg_hdr.msg_iovlen;
+            nsegs[n] = 1;
+#ifdef UDP_SEGMENT
+            // GSO: a run of same-size datagrams to one peer, i.e. a DATA
+            // burst, goes down the stack as one, the last may be shorter.
+            // Segments must fit in an Ethernet frame.
+            if (UDP_OFFLOAD && gso_ok && lens[j] <= SWIFT_MAX_UDP_OVER_ETH_PAYLOAD && q->slots[j].txtime == 0) {
+                size_t total = lens[j];
+                int k = j+1;
+                while (k < count && k-j < SWIFT_MAX_GSO_SEGMENTS && lens[k] <= lens[j]
+                        && total+lens[k] <= SWIFT_MAX_GRO_DGRAM_SIZE-8-40
+                        && q->slots[k].addr == q->slots[j].addr && q->slots[k].txtime == 0) {
+                    int m = dgram_iovecs(q->slots[k].dgram,&iovecs[niov]);
+                    msgs[n].msg_hdr.msg_iovlen += m;
+                    niov += m;
+                    total += lens[k++];
+                    if (lens[k-1] < lens[j])
+                        break;
+                }
+                nsegs[n] = k-j;
+            }
+            if (nsegs[n] > 1) {
+                msgs[n].msg_hdr.msg_control = cmsgbufs[n];
+                msgs[n].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[n].msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segsize = lens[j];
+                memcpy(CMSG_DATA(cmsg),&segsize,sizeof(uint16_t));
+            }
+#endif
+#ifdef SO_TXTIME
+            if (q->slots[j].txtime != 0) {
+                // Pacing: the qdisc holds it till then
+                msgs[n].msg_hdr.msg_control = cmsgbufs[n];
+                msgs[n].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[n].msg_hdr);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_TXTIME;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+                uint64_t txtime = monobase + q->slots[j].txtime*1000LL;
+                memcpy(CMSG_DATA(cmsg),&txtime,sizeof(uint64_t));
+            }
+#endif
+        }
+        r = sendmmsg(sock, msgs, n, 0);
+        if (r < 0 && nsegs[0] > 1 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+            // Kernel or NIC can't do it, send them one by one from now on
+            print_error("UDP GSO send failed, disabling");
+            gso_ok = false;
+            continue;
+        }
+#else
+        const Address &addr = q->slots[i].addr;
+        r = sendto(sock,(const char *)dgram_pullup(q->slots[i].dgram),lens[i],0,
+                   (struct sockaddr*)&(addr.addr),addr.get_family_sockaddr_length());
+        r = r < 0 ? -1 : 1;
+        nsegs[0] = 1;
+#endif
+        if (r <= 0) {
+            // Arno: behaviour is to pretend the packet(s) got lost
+            print_error("can't send");
+            i += nsegs[0];
+            continue;
+        }
+        for (int m=0; m<r; m++) {
+            if (nsegs[m] > 1) {
+                global_gso_sends++;
+                global_gso_segments += nsegs[m];
+            }
+            if (q->slots[i].txtime != 0)
+                global_txtime_dgrams++;
+            for (int j=i; j<i+nsegs[m]; j++) {
+                global_dgrams_up++;
+                global_raw_bytes_up += lens[j];
+                if (q->slots[j].owner != NULL)
+                    q->slots[j].owner->raw_bytes_up_ += lens[j];
+            }
+            sent += nsegs[m];
+            i += nsegs[m];
+        }
+    }
+    for (i=0; i<count; i++)
+        dgram_free(q->slots[i].dgram);
+
+    global_send_flushes++;
+    global_send_flush_dgrams += sent;
+    if (sent > global_send_flush_max)
+        global_send_flush_max = sent;
+    last_flush_dgrams = sent;
+    dprintf("%s flush sent %d of %d dgrams\n",tintstr(),sent,count);
+
+    Time();
+    return sent;
+}
+
+void Channel::FlushSendQueues()
+{
+    for (int i=0; i<send_queue_count; i++)
+        FlushSendQueue(send_queues[i]->sock);
+}
+
+void Channel::LibeventFlushCallback(int fd, short event, void *arg)
+{
+    flush_scheduled = false;
+    FlushSendQueues();
+}
+
+int Channel::PaceDue()
+{
+    int due = 0;
+    while (!pacer_heap.empty() && pacer_heap.front().slot.txtime <= NOW+SWIFT_PACING_SLACK) {
+        std::pop_heap(pacer_heap.begin(),pacer_heap.end());
+        paced_slot_t p = pacer_heap.back();
+        pacer_heap.pop_back();
+        QueueTo(p.sock,p.slot.addr,p.slot.dgram,p.slot.owner);
+        due++;
+    }
+    pacer_arm();
+    return due;
+}
+
+void Channel::LibeventPaceCallback(int fd, short event, void *arg)
+{
+    Time();
+    global_pacer_wakeups++;
+    PaceDue();
+}
+
+
+/*
+ * io_uring backend: sends are submitted in one go at flush time and the
+ * dgrams freed on completion, receives stay posted on the socket so
+ * datagrams come in without a readiness wakeup plus recvmmsg. The ring's
+ * eventfd sits in the libevent loop.
+ */
+#define SWIFT_URING_ENTRIES 1024
+
+static IOUring *uring = NULL;
+static bool uring_failed = false;
+static struct event evuring;
+
+#ifndef _WIN32
+// Content unmapped once the sends reading from it complete
+struct uring_unmap_t {
+    void            *addr;
+    size_t          len;
+    int             refs;
+};
+
+struct uring_send_t {
+    uring_req_t     req;
+    struct msghdr   msg;
+    struct iovec    iov[2];
+    Address         addr;
+    dgram_t         *dgram;
+    bool            inflight;
+    uring_unmap_t   *unmap;
+    uring_send_t    *next;
+};
+static uring_send_t *uring_send_pool = NULL;
+static std::vector<uring_send_t *> uring_sends;
+
+struct uring_recv_t {
+    uring_req_t     req;
+    evutil_socket_t sock;
+    bool            closed;
+    struct msghdr   msg;
+    struct iovec    iov;
+#ifdef UDP_GRO
+    char            cmsgbuf[CMSG_SPACE(sizeof(int))];
+#endif
+    recv_slot_t     slot;
+};
+static std::vector<uring_recv_t *> uring_recvs;
+#endif
+
+static TimerWheel timerwheel;
+static bool timerwheel_init = false;
+
+TimerWheel *Channel::Timers()
+{
+    if (!timerwheel_init && evbase != NULL) {
+        timerwheel.Init(evbase);
+        timerwheel_init = true;
+    }
+    return &timerwheel;
+}
+
+
+IOUring *Channel::Uring()
+{
+    if (!IO_URING || uring_failed)
+        return NULL;
+    if (uring == NULL) {
+        uring = new IOUring();
+        if (!uring->Init(SWIFT_URING_ENTRIES)) {
+            print_error("io_uring not available, using libevent");
+            delete uring;
+            uring = NULL;
+            uring_failed = true;
+            return NULL;
+        }
+        event_assign(&evuring, evbase, uring->GetEventFD(), EV_READ|EV_PERSIST,
+                     LibeventUringCallback, NULL);
+        event_add(&evuring, NULL);
+    }
+    return uring;
+}
+
+void Channel::LibeventUringCallback(int fd, short event, void *arg)
+{
+    Time();
+    uring->Reap();
+    OnChunkReadsDone();
+}
+
+#ifndef _WIN32
+static void uring_send_done(uring_req_t *req, int res)
+{
+    uring_send_t *s = (uring_send_t *)req;
+    if (res < 0) {
+        // Arno: behaviour is to pretend the packet(s) got lost
+        errno = -res;
+        print_error("can't send");
+    }
+    dgram_free(s->dgram);
+    s->dgram = NULL;
+    s->inflight = false;
+    if (s->unmap != NULL && --s->unmap->refs == 0) {
+        munmap(s->unmap->addr, s->unmap->len);
+        delete s->unmap;
+    }
+    s->unmap = NULL;
+    s->next = uring_send_pool;
+    uring_send_pool = s;
+}
+
+static void uring_recv_post(uring_recv_t *r)
+{
+    r->slot.addr = Address();
+    r->iov.iov_base = r->slot.buf;
+    r->iov.iov_len = r->slot.size;
+    memset(&r->msg, 0, sizeof(r->msg));
+    r->msg.msg_name = &(r->slot.addr.addr);
+    r->msg.msg_namelen = sizeof(struct sockaddr_storage);
+    r->msg.msg_iov = &r->iov;
+    r->msg.msg_iovlen = 1;
+#ifdef UDP_GRO
+    r->msg.msg_control = r->cmsgbuf;
+    r->msg.msg_controllen = sizeof(r->cmsgbuf);
+#endif
+    uring->PrepRecvmsg(r->sock, &r->msg, &r->req);
+}
+
+static void uring_recv_done(uring_req_t *req, int res)
+{
+    uring_recv_t *r = (uring_recv_t *)req;
+    if (r->closed || res == -ECANCELED) {
+        delete[] r->slot.buf;
+        delete r;
+        return;
+    }
+    if (res >= 0) {
+        recv_slot_t &slot = r->slot;
+        slot.length = res;
+        slot.segsize = 0;
+#ifdef UDP_GRO
+        struct cmsghdr *cmsg;
+        for (cmsg = CMSG_FIRSTHDR(&r->msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&r->msg,cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int segsize;
+                memcpy(&segsize,CMSG_DATA(cmsg),sizeof(int));
+                if (segsize > 0 && segsize < slot.length)
+                    slot.segsize = segsize;
+            }
+        }
+#endif
+        Channel::global_raw_bytes_down += res;
+        int segsize = slot.segsize > 0 ? slot.segsize : std::max(slot.length,1);
+        int off = 0;
+        do {
+            int len = std::min(segsize,slot.length-off);
+            dgram_t dg;
+            dgram_wrap(&dg, slot.buf+off, len);
+            Channel::global_dgrams_down++;
+            Channel::global_uring_recvs++;
+            if (slot.segsize > 0)
+                Channel::global_gro_segments++;
+            Channel::ProcessDatagram(r->sock, slot.addr, &dg);
+            off += len;
+        } while (off < slot.length);
+    } else if (res == -ECONNREFUSED)
+        Channel::CloseChannelByAddress(r->slot.addr);
+    else if (res != -EAGAIN) {
+        errno = -res;
+        print_error("error on uring recvmsg");
+    }
+    // ProcessDatagram may have closed the socket
+    if (!r->closed)
+        uring_recv_post(r);
+    else {
+        delete[] r->slot.buf;
+        delete r;
+    }
+}
+#endif
+
+static void uring_cancel_recv(evutil_socket_t sock)
+{
+#ifndef _WIN32
+    for (int i=0; i<uring_recvs.size(); ) {
+        uring_recv_t *r = uring_recvs[i];
+        if (r->sock != sock) {
+            i++;
+            continue;
+        }
+        // Freed when the cancelled receive completes
+        r->closed = true;
+        uring->PrepCancel(&r->req, NULL);
+        uring_recvs[i] = uring_recvs.back();
+        uring_recvs.pop_back();
+    }
+    if (uring != NULL)
+        uring->Submit();
+#endif
+}
+
+bool Channel::UringArmRecv(evutil_socket_t sock)
+{
+#ifndef _WIN32
+    if (Uring() == NULL)
+        return false;
+    for (int i=0; i<uring_recvs.size(); i++)
+        if (uring_recvs[i]->sock == sock)
+            return true;
+    int n = std::max(1,std::min(RECV_BATCH_SIZE,DGRAM_MAX_RECV_BATCH));
+    int slotsize = UDP_OFFLOAD ? SWIFT_MAX_GRO_DGRAM_SIZE : SWIFT_MAX_RECV_DGRAM_SIZE;
+    for (int i=0; i<n; i++) {
+        uring_recv_t *r = new uring_recv_t;
+        r->req.done = uring_recv_done;
+        r->sock = sock;
+        r->closed = false;
+        r->slot.buf = new char[slotsize];
+        r->slot.size = slotsize;
+        uring_recvs.push_back(r);
+        uring_recv_post(r);
+    }
+    uring->Submit();
+    dprintf("%s uring posted %d receives on %d\n",tintstr(),n,sock);
+    return true;
+#else
+    return false;
+#endif
+}
+
+int Channel::UringSend(evutil_socket_t sock, send_slot_t *slots, int count)
+{
+    // Bytes are accounted at submission, owners may be gone at completion
+    int sent = 0;
+#ifndef _WIN32
+    for (int i=0; i<count; i++) {
+        uring_send_t *s = uring_send_pool;
+        if (s != NULL)
+            uring_send_pool = s->next;
+        else {
+            s = new uring_send_t;
+            s->unmap = NULL;
+            uring_sends.push_back(s);
+        }
+        s->req.done = uring_send_done;
+        s->inflight = false;
+        s->addr = slots[i].addr;
+        s->dgram = slots[i].dgram;
+        slots[i].dgram = NULL;
+        size_t length = dgram_get_length(s->dgram);
+        memset(&s->msg, 0, sizeof(s->msg));
+        s->msg.msg_name = &(s->addr.addr);
+        s->msg.msg_namelen = s->addr.get_family_sockaddr_length();
+        s->msg.msg_iov = s->iov;
+        s->msg.msg_iovlen = dgram_iovecs(s->dgram, s->iov);
+        if (!uring->PrepSendmsg(sock, &s->msg, &s->req)) {
+            // Ring full, send the old way
+            if (sendmsg(sock, &s->msg, 0) < 0) {
+                print_error("can't send");
+                uring_send_done(&s->req, 0);
+                continue;
+            }
+            uring_send_done(&s->req, 0);
+        } else {
+            s->inflight = true;
+            global_uring_sends++;
+        }
+        global_dgrams_up++;
+        global_raw_bytes_up += length;
+        if (slots[i].owner != NULL)
+            slots[i].owner->raw_bytes_up_ += length;
+        sent++;
+    }
+    uring->Submit();
+#endif
+    return sent;
+}
+
+static bool dgram_refers_into(const dgram_t *d, const void *addr, size_t len)
+{
+    return d != NULL && d->ref != NULL && d->ref >= (const uint8_t *)addr
+           && d->ref < (const uint8_t *)addr+len;
+}
+
+void Channel::UnmapWhenSent(void *addr, size_t len)
+{
+#ifndef _WIN32
+    for (int i=0; i<send_queue_count; i++)
+        for (int j=0; j<send_queues[i]->count; j++)
+            if (dgram_refers_into(send_queues[i]->slots[j].dgram,addr,len))
+                dgram_pullup(send_queues[i]->slots[j].dgram);
+    for (int i=0; i<pacer_heap.size(); i++)
+        if (dgram_refers_into(pacer_heap[i].slot.dgram,addr,len))
+            dgram_pullup(pacer_heap[i].slot.dgram);
+
+    uring_unmap_t *u = new uring_unmap_t;
+    u->addr = addr;
+    u->len = len;
+    u->refs = 0;
+    for (int i=0; i<uring_sends.size(); i++) {
+        uring_send_t *s = uring_sends[i];
+        if (s->inflight && s->unmap == NULL && dgram_refers_into(s->dgram,addr,len)) {
+            s->unmap = u;
+            u->refs++;
+        }
+    }
+    if (u->refs == 0) {
+        munmap(addr, len);
+        delete u;
+    } else
+        dprintf("%s unmap after %d uring sends\n",tintstr(),u->refs);
+#endif
+}
+
+int Channel::SendTo(evutil_socket_t sock, const Address& addr, dgram_t *d)
+{
+    int length = dgram_get_length(d);
+    int r = sendto(sock,(const char *)dgram_pullup(d),length,0,
+                   (struct sockaddr*)&(addr.addr),addr.get_family_sockaddr_length());
+    if (r<0)
+        print_error("can't send");
+    else {
+        global_dgrams_up++;
+        global_raw_bytes_up+=length;
+    }
+    dgram_drain(d,length); // Arno: on error, pretend the packet got lost
+    Time();
+    return r;
+}
+
 int Channel::RecvFrom(evutil_socket_t sock, Address& addr, struct evbuffer *evb)
 {
     // Arno, 2013-06-05: Incoming addr, so use largest possible sockaddr
@@ -355,9 +1107,105 @@ int Channel::RecvFrom(evutil_socket_t sock, Address& addr, struct evbuffer *evb)
     return length;
 }
 
+int Channel::RecvBatch(evutil_socket_t sock, recv_slot_t *slots, int n)
+{
+    // Drain up to n datagrams from the (non-blocking) socket into slots.
+    // Returns the number of slots filled, 0 when nothing was pending.
+    int count = 0;
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+    struct mmsghdr msgs[DGRAM_MAX_RECV_BATCH];
+    struct iovec iovecs[DGRAM_MAX_RECV_BATCH];
+#ifdef UDP_GRO
+    char cmsgbufs[DGRAM_MAX_RECV_BATCH][CMSG_SPACE(sizeof(int))];
+#endif
+    if (n > DGRAM_MAX_RECV_BATCH)
+        n = DGRAM_MAX_RECV_BATCH;
+    for (int i=0; i<n; i++) {
+        iovecs[i].iov_base = slots[i].buf;
+        iovecs[i].iov_len = slots[i].size;
+        memset(&msgs[i].msg_hdr,0,sizeof(struct msghdr));
+        msgs[i].msg_hdr.msg_name = &(slots[i].addr.addr);
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef UDP_GRO
+        msgs[i].msg_hdr.msg_control = cmsgbufs[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(cmsgbufs[i]);
+#endif
+    }
+    slots[0].addr = Address();
+    count = recvmmsg(sock, msgs, n, MSG_DONTWAIT, NULL);
+    if (count < 0) {
+        count = 0;
+        if (errno == ECONNREFUSED)
+            CloseChannelByAddress(slots[0].addr);
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            print_error("error on recvmmsg");
+    }
+    for (int i=0; i<count; i++) {
+        slots[i].length = msgs[i].msg_len;
+        slots[i].segsize = 0;
+#ifdef UDP_GRO
+        struct cmsghdr *cmsg;
+        for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr,cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int segsize;
+                memcpy(&segsize,CMSG_DATA(cmsg),sizeof(int));
+                if (segsize > 0 && segsize < slots[i].length)
+                    slots[i].segsize = segsize;
+            }
+        }
+        if (slots[i].segsize > 0) {
+            int nsegs = (slots[i].length+slots[i].segsize-1)/slots[i].segsize;
+            global_dgrams_down += nsegs;
+            global_gro_segments += nsegs;
+        } else
+#endif
+            global_dgrams_down++;
+        global_raw_bytes_down += msgs[i].msg_len;
+    }
+#else
+    // No recvmmsg, emulate with a recvfrom loop so we still get one libevent
+    // dispatch per batch.
+    for (count=0; count<n; count++) {
+        socklen_t addrlen = sizeof(struct sockaddr_storage);
+        slots[count].addr = Address();
+        int length = recvfrom(sock, slots[count].buf, slots[count].size, 0,
+                              (struct sockaddr*)&(slots[count].addr.addr), &addrlen);
+        if (length < 0) {
+#ifdef _WIN32
+            if (WSAGetLastError() == 10054)
+#else
+            if (errno == ECONNREFUSED)
+#endif
+                CloseChannelByAddress(slots[count].addr);
+#ifdef _WIN32
+            else if (WSAGetLastError() != WSAEWOULDBLOCK)
+#else
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+#endif
+                print_error("error on recv");
+            break;
+        }
+        slots[count].length = length;
+        slots[count].segsize = 0;
+        global_dgrams_down++;
+        global_raw_bytes_down += length;
+    }
+#endif
+    Time();
+    return count;
+}
+
 
 void Channel::CloseSocket(evutil_socket_t sock)
 {
+    pacer_forget_socket(sock);
+    FlushSendQueue(sock);
+    uring_cancel_recv(sock);
+    for (int i=0; i<send_queue_count; i++)
+        if (send_queues[i]->sock==sock)
+            std::swap(send_queues[i],send_queues[--send_queue_count]);
     for (int i=0; i<sock_count; i++)
         if (sock_open[i].sock==sock)
             sock_open[i] = sock_open[--sock_count];
@@ -371,13 +1219,177 @@ void Channel::Shutdown()
         CloseSocket(sock_open[sock_count].sock);
 }
 
+void Channel::PutPaths()
+{
+    for (int i=0; i<channels.size(); i++)
+        if (channels[i] != NULL)
+            channels[i]->PutPath();
+}
+
 int Channel::DecodeID(int scrambled)
 {
-    return scrambled ^ (int)start;
+    return (scrambled ^ (int)start) & (SWIFT_MAX_CHANNELS-1);
 }
 int Channel::EncodeID(int unscrambled)
 {
-    return unscrambled ^ (int)start;
+    int gen = unscrambled < slot_gens.size() ? slot_gens[unscrambled] : 0;
+    return (unscrambled | (gen<<SWIFT_CHANNEL_GEN_SHIFT) | (shard_id<<SWIFT_SHARD_ID_SHIFT)) ^ (int)start;
+}
+int Channel::ShardOfID(uint32_t scrambled)
+{
+    return (scrambled ^ (uint32_t)start) >> SWIFT_SHARD_ID_SHIFT;
+}
+int Channel::GenOfID(uint32_t scrambled)
+{
+    return ((scrambled ^ (uint32_t)start) & ((1<<SWIFT_SHARD_ID_SHIFT)-1)) >> SWIFT_CHANNEL_GEN_SHIFT;
+}
+bool Channel::SlotAvailable()
+{
+    return !free_slots.empty() || (int)channels.size() < std::min(MAX_CHANNELS,SWIFT_MAX_CHANNELS);
+}
+Channel *Channel::ChannelOfID(uint32_t scrambled)
+{
+    int i = DecodeID(scrambled);
+    if (ShardOfID(scrambled) != shard_id || i >= channels.size() || GenOfID(scrambled) != slot_gens[i])
+        return NULL;
+    return channels[i];
+}
+
+
+/*
+ * Sharding: N processes forked after the swarms are loaded, each with its
+ * own event loop and its own SO_REUSEPORT socket on the same port. The
+ * kernel hashes a peer to one of the sockets, so normally all its traffic
+ * reaches the shard that did the handshake. When it doesn't (e.g. after a
+ * shard went away) the datagram is handed off over a local socket pair to
+ * the shard whose ID is in the channel ID.
+ */
+#ifndef _WIN32
+static evutil_socket_t shard_pairs[SWIFT_MAX_SHARDS][2];
+static struct event evshard;
+#endif
+
+int Channel::ShardSetup(int n)
+{
+#if !defined(_WIN32) && defined(SO_REUSEPORT)
+    if (n < 1 || n > SWIFT_MAX_SHARDS)
+        return -1;
+    for (int i=0; i<n; i++) {
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, shard_pairs[i]) != 0) {
+            print_error("cannot create shard socket pair");
+            return -1;
+        }
+        make_socket_nonblocking(shard_pairs[i][0]);
+        make_socket_nonblocking(shard_pairs[i][1]);
+    }
+    shard_count = n;
+    return 0;
+#else
+    return n == 1 ? 0 : -1;
+#endif
+}
+
+int Channel::ShardStart(int id)
+{
+#if !defined(_WIN32) && defined(SO_REUSEPORT)
+    if (shard_count <= 1)
+        return 0;
+    shard_id = id;
+    if (id > 0) {
+        // Replace the sockets inherited from shard 0 by our own, keeping the
+        // descriptor numbers so sock_open and evrecv stay valid.
+        int n = sock_count;
+        for (int i=0; i<n; i++) {
+            evutil_socket_t old = sock_open[i].sock;
+            evutil_socket_t fd = Bind(BoundAddress(old),sock_open[i]);
+            sock_count--;
+            if (fd == INVALID_SOCKET || dup2(fd,old) < 0) {
+                print_error("cannot rebind shard socket");
+                return -1;
+            }
+            close_socket(fd);
+        }
+        // Channels (e.g. to the tracker) stay with shard 0
+        for (int i=0; i<channels.size(); i++) {
+            Channel *c = channels[i];
+            if (c != NULL) {
+                c->Close(CLOSE_DO_NOT_SEND);
+                delete c;
+            }
+        }
+        if (event_reinit(evbase) != 0)
+            return -1;
+    }
+#ifdef __linux__
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu > 1) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(id % ncpu, &cpus);
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+#endif
+    // Keep the read end of our pair and the write ends of the others
+    for (int i=0; i<shard_count; i++)
+        close_socket(i == id ? shard_pairs[i][1] : shard_pairs[i][0]);
+    event_assign(&evshard, evbase, shard_pairs[id][0], EV_READ|EV_PERSIST,
+                 LibeventShardCallback, NULL);
+    event_add(&evshard, NULL);
+    dprintf("%s shard %d of %d started\n",tintstr(),shard_id,shard_count);
+    return 0;
+#else
+    return shard_count <= 1 ? 0 : -1;
+#endif
+}
+
+void Channel::ShardForward(int shard, const Address& addr, dgram_t *d)
+{
+#ifndef _WIN32
+    // Handoff datagram: peer address followed by the original payload
+    struct iovec iov[2];
+    iov[0].iov_base = (void *)&addr.addr;
+    iov[0].iov_len = sizeof(addr.addr);
+    iov[1].iov_base = dgram_pullup(d);
+    iov[1].iov_len = dgram_get_length(d);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (sendmsg(shard_pairs[shard][1], &msg, 0) < 0)
+        dprintf("%s shard %d handoff failed\n",tintstr(),shard);
+    else
+        global_shard_forwarded++;
+#endif
+}
+
+void Channel::LibeventShardCallback(int fd, short event, void *arg)
+{
+#ifndef _WIN32
+    Time();
+    for (;;) {
+        Address addr;
+        // Any datagram may be handed off, DATA of the largest chunks too
+        dgram_t *dg = dgram_new_size(SWIFT_MAX_RECV_DGRAM_SIZE);
+        struct iovec iov[2];
+        iov[0].iov_base = (void *)&addr.addr;
+        iov[0].iov_len = sizeof(addr.addr);
+        iov[1].iov_base = dgram_reserve(dg, dg->cap);
+        iov[1].iov_len = dg->cap;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        ssize_t r = recvmsg(fd, &msg, 0);
+        if (r < (ssize_t)sizeof(addr.addr)) {
+            dgram_free(dg);
+            break;
+        }
+        dgram_commit(dg, r - sizeof(addr.addr));
+        global_shard_received++;
+        ProcessDatagram(default_socket(), addr, dg);
+        dgram_free(dg);
+    }
+#endif
 }
 
 
@@ -501,14 +1513,34 @@ int swift::evbuffer_add_hash(struct evbuffer *evb, const Sha1Hash& hash)
 }
 
 // PPSP
+bool swift::chunkaddr_fits(const bin_t &b, popt_chunk_addr_t chunk_addr)
+{
+    if (b.is_all() || b.is_none())
+        return true;
+    if (chunk_addr == POPT_CHUNK_ADDR_BIN32)
+        return b.toUInt() < 0xffffffff && b.toUInt() != 0x7fffffff;    // those are NONE and ALL
+    else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK32)
+        return b.base_offset()+b.base_length()-1 <= 0xffffffff;
+    else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK64)
+        return b.base_offset()+b.base_length()-1 < SWIFT_CHUNK64_MAX;
+    return true;
+}
+
 int swift::evbuffer_add_chunkaddr(struct evbuffer *evb, bin_t &b, popt_chunk_addr_t chunk_addr)
 {
     int ret = -1;
+    if (!chunkaddr_fits(b,chunk_addr))
+        return -1;
     if (chunk_addr == POPT_CHUNK_ADDR_BIN32)
         ret = evbuffer_add_32be(evb, bin_toUInt32(b));
     else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK32) {
         ret = evbuffer_add_32be(evb, (uint32_t)b.base_offset());
         ret = evbuffer_add_32be(evb, (uint32_t)(b.base_offset()+b.base_length()-1));  // end is inclusive
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BIN64)
+        ret = evbuffer_add_64be(evb, bin_toUInt64(b));
+    else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK64) {
+        ret = evbuffer_add_64be(evb, b.base_offset());
+        ret = evbuffer_add_64be(evb, b.base_offset()+b.base_length()-1);
     }
     return ret;
 }
@@ -587,6 +1619,14 @@ binvector swift::evbuffer_remove_chunkaddr(struct evbuffer *evb, popt_chunk_addr
         uint32_t echunk = evbuffer_remove_32be(evb);
         if (schunk <= echunk) // Bad input protection
             swift::chunk32_to_bin32(schunk,echunk,&bv);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BIN64) {
+        bin_t pos = bin_fromUInt64(evbuffer_remove_64be(evb));
+        bv.push_back(pos);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK64) {
+        uint64_t schunk = evbuffer_remove_64be(evb);
+        uint64_t echunk = evbuffer_remove_64be(evb);
+        if (schunk <= echunk && echunk < SWIFT_CHUNK64_MAX)
+            swift::chunk64_to_bin64(schunk,echunk,&bv);
     }
     return bv;
 }
@@ -611,12 +1651,348 @@ Address swift::evbuffer_remove_pexaddr(struct evbuffer *evb, int family)
 
 
 
+/*
+ * Pooled datagram buffers
+ */
+
+static dgram_t *dgram_pool = NULL;
+static int dgram_pool_count = 0;
+static dgram_t *dgram_big_pool = NULL;
+static int dgram_big_pool_count = 0;
+
+static dgram_t *dgram_pop(dgram_t **pool, int *count, size_t cap)
+{
+    dgram_t *d = *pool;
+    if (d != NULL) {
+        *pool = d->next;
+        (*count)--;
+    } else {
+        // Header and buffer in one allocation
+        d = (dgram_t *)malloc(sizeof(dgram_t)+cap);
+        d->data = (uint8_t *)(d+1);
+        d->cap = cap;
+    }
+    d->off = d->len = 0;
+    d->ref = NULL;
+    d->reflen = 0;
+    d->next = NULL;
+    return d;
+}
+
+dgram_t *swift::dgram_new()
+{
+    return dgram_pop(&dgram_pool,&dgram_pool_count,SWIFT_DGRAM_BUF_SIZE);
+}
+
+dgram_t *swift::dgram_new_size(size_t size)
+{
+    if (size <= SWIFT_DGRAM_BUF_SIZE)
+        return dgram_new();
+    if (size <= SWIFT_DGRAM_BIG_BUF_SIZE)
+        return dgram_pop(&dgram_big_pool,&dgram_big_pool_count,SWIFT_DGRAM_BIG_BUF_SIZE);
+    // Not pooled, dgram_free() knows by the capacity
+    dgram_t *d = (dgram_t *)malloc(sizeof(dgram_t)+size);
+    d->data = (uint8_t *)(d+1);
+    d->cap = size;
+    d->off = d->len = 0;
+    d->ref = NULL;
+    d->reflen = 0;
+    d->next = NULL;
+    return d;
+}
+
+void swift::dgram_free(dgram_t *d)
+{
+    if (d == NULL)
+        return;
+    if (d->cap == SWIFT_DGRAM_BUF_SIZE && dgram_pool_count < SWIFT_DGRAM_POOL_MAX) {
+        d->next = dgram_pool;
+        dgram_pool = d;
+        dgram_pool_count++;
+    } else if (d->cap == SWIFT_DGRAM_BIG_BUF_SIZE
+            && dgram_big_pool_count < SWIFT_DGRAM_BIG_POOL_MAX) {
+        d->next = dgram_big_pool;
+        dgram_big_pool = d;
+        dgram_big_pool_count++;
+    } else
+        free(d);
+}
+
+void swift::dgram_wrap(dgram_t *d, void *buf, size_t len)
+{
+    // Not for dgram_free
+    d->data = (uint8_t *)buf;
+    d->cap = d->len = len;
+    d->off = 0;
+    d->ref = NULL;
+    d->reflen = 0;
+    d->next = NULL;
+}
+
+size_t swift::dgram_get_length(const dgram_t *d)
+{
+    return d->len - d->off + d->reflen;
+}
+
+uint8_t *swift::dgram_pullup(dgram_t *d)
+{
+    if (d->ref != NULL) {
+        // Room was checked by dgram_add_ref
+        memcpy(d->data + d->len, d->ref, d->reflen);
+        d->len += d->reflen;
+        d->ref = NULL;
+        d->reflen = 0;
+    }
+    return d->data + d->off;
+}
+
+uint8_t *swift::dgram_reserve(dgram_t *d, size_t n)
+{
+    if (d->len + n > d->cap)
+        return NULL;
+    return d->data + d->len;
+}
+
+void swift::dgram_commit(dgram_t *d, size_t n)
+{
+    d->len += n;
+}
+
+void swift::dgram_drain(dgram_t *d, size_t n)
+{
+    if (d->ref != NULL)
+        dgram_pullup(d);
+    d->off = std::min(d->len, d->off + n);
+    if (d->off == d->len) // empty, reuse from the start
+        d->off = d->len = 0;
+}
+
+int swift::dgram_add(dgram_t *d, const void *buf, size_t n)
+{
+    if (d->len + n > d->cap)
+        return -1;
+    memcpy(d->data + d->len, buf, n);
+    d->len += n;
+    return 0;
+}
+
+int swift::dgram_add_ref(dgram_t *d, const void *buf, size_t n)
+{
+    if (d->ref != NULL || d->len + n > d->cap)
+        return -1;
+    d->ref = (const uint8_t *)buf;
+    d->reflen = n;
+    return 0;
+}
+
+int swift::dgram_add_string(dgram_t *d, std::string str)
+{
+    return dgram_add(d, str.c_str(), str.size());
+}
+
+int swift::dgram_add_8(dgram_t *d, uint8_t b)
+{
+    return dgram_add(d, &b, 1);
+}
+
+int swift::dgram_add_16be(dgram_t *d, uint16_t w)
+{
+    uint16_t wbe = htons(w);
+    return dgram_add(d, &wbe, 2);
+}
+
+int swift::dgram_add_32be(dgram_t *d, uint32_t i)
+{
+    uint32_t ibe = htonl(i);
+    return dgram_add(d, &ibe, 4);
+}
+
+int swift::dgram_add_64be(dgram_t *d, uint64_t l)
+{
+    uint32_t lbe[2];
+    lbe[0] = htonl((uint32_t)(l>>32));
+    lbe[1] = htonl((uint32_t)(l&0xffffffff));
+    return dgram_add(d, lbe, 8);
+}
+
+int swift::dgram_add_varint(dgram_t *d, uint64_t v)
+{
+    uint8_t buf[10];
+    int n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (uint8_t)(v|0x80);
+        v >>= 7;
+    }
+    buf[n++] = (uint8_t)v;
+    return dgram_add(d, buf, n);
+}
+
+int swift::dgram_add_hash(dgram_t *d, const Sha1Hash& hash)
+{
+    return dgram_add(d, hash.bits, Sha1Hash::SIZE);
+}
+
+// PPSP
+int swift::dgram_add_chunkaddr(dgram_t *d, bin_t &b, popt_chunk_addr_t chunk_addr)
+{
+    int ret = -1;
+    if (!chunkaddr_fits(b,chunk_addr))
+        return -1;
+    if (chunk_addr == POPT_CHUNK_ADDR_BIN32)
+        ret = dgram_add_32be(d, bin_toUInt32(b));
+    else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK32) {
+        ret = dgram_add_32be(d, (uint32_t)b.base_offset());
+        ret = dgram_add_32be(d, (uint32_t)(b.base_offset()+b.base_length()-1));  // end is inclusive
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BIN64)
+        ret = dgram_add_64be(d, bin_toUInt64(b));
+    else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK64) {
+        ret = dgram_add_64be(d, b.base_offset());
+        ret = dgram_add_64be(d, b.base_offset()+b.base_length()-1);
+    }
+    return ret;
+}
+
+int swift::dgram_add_pexaddr(dgram_t *d, Address& a)
+{
+    int ret = -1;
+    if (a.get_family() == AF_INET) {
+        ret = dgram_add_8(d, SWIFT_PEX_RESv4);
+        ret = dgram_add_32be(d, a.ipv4());
+        ret = dgram_add_16be(d, a.port());
+    } else {
+        struct in6_addr ipv6 = a.ipv6();
+
+        ret = dgram_add_8(d, SWIFT_PEX_RESv6);
+        ret = dgram_add(d, ipv6.s6_addr, 16);
+        ret = dgram_add_16be(d, a.port());
+    }
+    return ret;
+}
+
+int swift::dgram_remove(dgram_t *d, void *buf, size_t n)
+{
+    // Like evbuffer_remove: copies and consumes what is there, at most n
+    size_t avail = d->len - d->off;
+    if (n > avail)
+        n = avail;
+    memcpy(buf, d->data + d->off, n);
+    dgram_drain(d, n);
+    return n;
+}
+
+uint8_t swift::dgram_remove_8(dgram_t *d)
+{
+    uint8_t b;
+    if (dgram_remove(d, &b, 1) < 1)
+        return 0;
+    return b;
+}
+
+uint16_t swift::dgram_remove_16be(dgram_t *d)
+{
+    uint16_t wbe;
+    if (dgram_remove(d, &wbe, 2) < 2)
+        return 0;
+    return ntohs(wbe);
+}
+
+uint32_t swift::dgram_remove_32be(dgram_t *d)
+{
+    uint32_t ibe;
+    if (dgram_remove(d, &ibe, 4) < 4)
+        return 0;
+    return ntohl(ibe);
+}
+
+uint64_t swift::dgram_remove_64be(dgram_t *d)
+{
+    uint32_t lbe[2];
+    if (dgram_remove(d, lbe, 8) < 8)
+        return 0;
+    uint64_t l = ntohl(lbe[0]);
+    l<<=32;
+    l |= ntohl(lbe[1]);
+    return l;
+}
+
+bool swift::dgram_remove_varint(dgram_t *d, uint64_t *v)
+{
+    *v = 0;
+    for (int shift=0; shift<64 && dgram_get_length(d) > 0; shift+=7) {
+        uint8_t b = dgram_remove_8(d);
+        *v |= ((uint64_t)(b&0x7f))<<shift;
+        if (!(b&0x80))
+            return true;
+    }
+    return false;
+}
+
+Sha1Hash swift::dgram_remove_hash(dgram_t *d)
+{
+    if (dgram_get_length(d) < Sha1Hash::SIZE) {
+        dgram_drain(d, Sha1Hash::SIZE);
+        return Sha1Hash::ZERO;
+    }
+    Sha1Hash hash(false, (const char *)dgram_pullup(d));
+    dgram_drain(d, Sha1Hash::SIZE);
+    return hash;
+}
+
+// PPSP
+binvector swift::dgram_remove_chunkaddr(dgram_t *d, popt_chunk_addr_t chunk_addr)
+{
+    binvector bv;
+    if (chunk_addr == POPT_CHUNK_ADDR_BIN32) {
+        bin_t pos = bin_fromUInt32(dgram_remove_32be(d));
+        bv.push_back(pos);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK32) {
+        uint32_t schunk = dgram_remove_32be(d);
+        uint32_t echunk = dgram_remove_32be(d);
+        if (schunk <= echunk) // Bad input protection
+            swift::chunk32_to_bin32(schunk,echunk,&bv);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BIN64) {
+        bin_t pos = bin_fromUInt64(dgram_remove_64be(d));
+        bv.push_back(pos);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK64) {
+        uint64_t schunk = dgram_remove_64be(d);
+        uint64_t echunk = dgram_remove_64be(d);
+        if (schunk <= echunk && echunk < SWIFT_CHUNK64_MAX)
+            swift::chunk64_to_bin64(schunk,echunk,&bv);
+    }
+    return bv;
+}
+
+Address swift::dgram_remove_pexaddr(dgram_t *d, int family)
+{
+    if (family == AF_INET) {
+        uint32_t ipv4 = dgram_remove_32be(d);
+        uint16_t port = dgram_remove_16be(d);
+        Address addr(ipv4,port);
+        return addr;
+    } else {
+        struct in6_addr ipv6;
+        memset(&ipv6,0,sizeof(ipv6));
+        dgram_remove(d, ipv6.s6_addr, 16);
+        uint16_t port = dgram_remove_16be(d);
+        Address addr(ipv6,port);
+        return addr;
+    }
+}
+
+
 /** Convert a chunk32 chunk specification to a list of bins. A chunk32 spec is
  * a (start chunk ID, end chunk ID) pair, where chunk ID is just a numbering
  * from 0 to N of all chunks, equivalent to the leaves in a bin tree. This
  * method finds which bins describe this range.
  */
 void swift::chunk32_to_bin32(uint32_t schunk, uint32_t echunk, binvector *bvptr)
+{
+    chunk64_to_bin64(schunk,echunk,bvptr);
+}
+
+
+/** The same for 64-bit chunk IDs, which must be below SWIFT_CHUNK64_MAX */
+void swift::chunk64_to_bin64(uint64_t schunk, uint64_t echunk, binvector *bvptr)
 {
     bin_t s(0,schunk);
     bin_t e(0,echunk);
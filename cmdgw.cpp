@@ -238,6 +238,16 @@ void CmdGwGotMAXSPEED(SwarmID &swarmid, data_direction_t ddir, double speed)
 }
 
 
+void CmdGwGotCONGESTION(SwarmID &swarmid, cc_algo_t algo)
+{
+    // Set congestion control for new channels of the specified download
+    cmd_gw_t* req = CmdGwFindRequestBySwarmID(swarmid);
+    if (req == NULL)
+        return;
+    swift::SetCongestionControl(req->td, algo);
+}
+
+
 void CmdGwGotSETMOREINFO(SwarmID &swarmid, bool enable)
 {
     cmd_gw_t* req = CmdGwFindRequestBySwarmID(swarmid);
@@ -337,7 +347,9 @@ void CmdGwSendINFO(cmd_gw_t* req, int dlstatus)
                 oss << "\"raw_bytes_up\": " << c->raw_bytes_up() << ", ";
                 oss << "\"raw_bytes_down\": " << c->raw_bytes_down() << ", ";
                 oss << "\"bytes_up\": " << c->bytes_up() << ", ";
-                oss << "\"bytes_down\": " << c->bytes_down() << " ";
+                oss << "\"bytes_down\": " << c->bytes_down() << ", ";
+                oss << "\"cc\": \"" << CongestionController::Name(c->GetCongestionController()->algo()) << "\", ";
+                oss << "\"cwnd\": " << c->GetCwnd() << " ";
                 oss << "}";
             }
         }
@@ -345,7 +357,29 @@ void CmdGwSendINFO(cmd_gw_t* req, int dlstatus)
         oss << "\"raw_bytes_up\": " << Channel::global_raw_bytes_up << ", ";
         oss << "\"raw_bytes_down\": " << Channel::global_raw_bytes_down << ", ";
         oss << "\"bytes_up\": " << Channel::global_bytes_up << ", ";
-        oss << "\"bytes_down\": " << Channel::global_bytes_down << " ";
+        oss << "\"bytes_down\": " << Channel::global_bytes_down << ", ";
+        oss << "\"recv_wakeups\": " << Channel::global_recv_wakeups << ", ";
+        oss << "\"recv_batch_dgrams\": " << Channel::global_recv_batch_dgrams << ", ";
+        oss << "\"recv_batch_max\": " << Channel::global_recv_batch_max << ", ";
+        oss << "\"send_flushes\": " << Channel::global_send_flushes << ", ";
+        oss << "\"send_flush_dgrams\": " << Channel::global_send_flush_dgrams << ", ";
+        oss << "\"send_flush_max\": " << Channel::global_send_flush_max << ", ";
+        oss << "\"gso_sends\": " << Channel::global_gso_sends << ", ";
+        oss << "\"gso_dgrams\": " << Channel::global_gso_segments << ", ";
+        oss << "\"gro_dgrams\": " << Channel::global_gro_segments << ", ";
+        oss << "\"uring_sends\": " << Channel::global_uring_sends << ", ";
+        oss << "\"uring_recvs\": " << Channel::global_uring_recvs << ", ";
+        oss << "\"uring_reads\": " << Channel::global_uring_reads << ", ";
+        oss << "\"zerocopy_chunks\": " << Channel::global_zerocopy_chunks << ", ";
+        oss << "\"zerocopy_bytes\": " << Channel::global_zerocopy_bytes << ", ";
+        oss << "\"hash_msgs\": " << Channel::global_hash_msgs << ", ";
+        oss << "\"hash_bytes_up\": " << Channel::global_hash_bytes_up << ", ";
+        oss << "\"hash_skipped\": " << Channel::global_hash_skipped << ", ";
+        oss << "\"paced_dgrams\": " << Channel::global_paced_dgrams << ", ";
+        oss << "\"txtime_dgrams\": " << Channel::global_txtime_dgrams << ", ";
+        oss << "\"pacer_wakeups\": " << Channel::global_pacer_wakeups << ", ";
+        oss << "\"hs_rate_rejected\": " << Channel::global_hs_rate_rejected << ", ";
+        oss << "\"hs_unknown_rejected\": " << Channel::global_hs_unknown_rejected << " ";
         oss << "}";
 
         oss << "\r\n";
@@ -936,6 +970,23 @@ int CmdGwHandleCommand(evutil_socket_t cmdsock, char *copyline)
         std::string swarmidhexstr(swarmidhexcstr);
         SwarmID swarmid(swarmidhexstr);
         CmdGwGotMAXSPEED(swarmid,ddir,speed*1024.0);
+    } else if (!strcmp(method,"CONGESTION")) {
+        // CONGESTION roothash ledbat|bbr\r\n
+        token = strtok_r(paramstr," ",&savetok); //
+        if (token == NULL)
+            return ERROR_MISS_ARG;
+        char *swarmidhexcstr = token;
+        token = strtok_r(NULL,"",&savetok);       // algorithm
+        if (token == NULL)
+            return ERROR_MISS_ARG;
+        int algo = CongestionController::ByName(token);
+        if (algo < 0) {
+            dprintf("cmd: CONGESTION: unknown algorithm %s\n",token);
+            return ERROR_BAD_ARG;
+        }
+        std::string swarmidhexstr(swarmidhexcstr);
+        SwarmID swarmid(swarmidhexstr);
+        CmdGwGotCONGESTION(swarmid,(cc_algo_t)algo);
     } else if (!strcmp(method,"CHECKPOINT")) {
         // CHECKPOINT roothash\r\n
         char *swarmidhexcstr = paramstr;
@@ -1139,16 +1190,16 @@ bool swift::CmdGwTunnelCheckChannel(uint32_t channel)
 }
 
 
-void swift::CmdGwTunnelUDPDataCameIn(Address srcaddr, uint32_t srcchan, struct evbuffer* evb)
+void swift::CmdGwTunnelUDPDataCameIn(Address srcaddr, uint32_t srcchan, dgram_t *dg)
 {
     // Message received on UDP socket, forward over TCP conn.
 
     if (cmd_gw_debug)
-        fprintf(stderr,"cmdgw: TunnelUDPData:DataCameIn " PRISIZET " bytes from %s/%08x\n", evbuffer_get_length(evb),
+        fprintf(stderr,"cmdgw: TunnelUDPData:DataCameIn " PRISIZET " bytes from %s/%08x\n", dgram_get_length(dg),
                 srcaddr.str().c_str(), srcchan);
 
-    size_t evb_len = evbuffer_get_length(evb);
-    uint8_t *data = evbuffer_pullup(evb, evb_len);
+    size_t evb_len = dgram_get_length(dg);
+    uint8_t *data = dgram_pullup(dg);
     std::string data_str((const char *) data, evb_len);
     /*
      *  Format:
@@ -1166,7 +1217,7 @@ void swift::CmdGwTunnelUDPDataCameIn(Address srcaddr, uint32_t srcchan, struct e
 
     send(cmd_tunnel_sock, msg_str.c_str(), msg_len, 0);
 
-    evbuffer_drain(evb, evb_len);
+    dgram_drain(dg, evb_len);
 }
 
 
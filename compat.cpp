@@ -380,6 +380,24 @@ namespace swift
     }
 
 
+    int64_t file_mtime_utf8(std::string pathname)
+    {
+        int ret = 0;
+#ifdef WIN32
+        struct __stat64 st;
+        wchar_t *utf16c = utf8to16(pathname);
+        ret = _wstat64(utf16c, &st);
+        free(utf16c);
+#else
+        struct stat st;
+        ret = stat(pathname.c_str(), &st); // TODO: UNIX with locale != UTF-8
+#endif
+        if (ret < 0)
+            return -1;
+        return st.st_mtime;
+    }
+
+
     int mkdir_utf8(std::string dirname)
     {
 #ifdef WIN32
@@ -216,6 +216,9 @@ namespace swift
     /* Returns -1 on error, 0 on non-existence, 1 on existence and being a non-dir, 2 on existence and being a dir */
     int file_exists_utf8(std::string pathname);
 
+// Returns the last modification time (seconds since the epoch) of a file or dir in UTF-8, -1 on error
+    int64_t file_mtime_utf8(std::string pathname);
+
 // mkdir with filename in UTF-8
     int mkdir_utf8(std::string dirname);
 
@@ -0,0 +1,362 @@
+/*
+ *  congestion.cpp
+ *  LEDBAT and BBR congestion controllers, see congestion.h
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+using namespace swift;
+
+#define SS_RTT_GROWTH_MIN       (4*TINT_MSEC)
+
+#define SWIFT_BBR_HIGH_GAIN     2.885   // 2/ln(2), doubles the rate per round
+#define SWIFT_BBR_BW_ROUNDS     10      // bandwidth filter length
+#define SWIFT_BBR_FULL_BW_GROWTH 1.25
+#define SWIFT_BBR_FULL_BW_ROUNDS 3
+#define SWIFT_BBR_MIN_RTT_WIN   (10*TINT_SEC)
+#define SWIFT_BBR_PROBE_RTT_TIME (200*TINT_MSEC)
+#define SWIFT_BBR_MIN_CWND      4
+#define SWIFT_BBR_CYCLE         8
+
+static const double bbr_cycle_gains[SWIFT_BBR_CYCLE] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+tint LedbatController::TARGET = TINT_MSEC*25;
+float LedbatController::GAIN = 1;
+uint32_t LedbatController::MSS = 1024;
+int LedbatController::MIN_CWND = 2;
+int LedbatController::ALLOWED_INCREASE = 1;
+int LedbatController::CURRENT_FILTER = 4;
+tint LedbatController::ROLLOVER = TINT_SEC*60;
+
+
+CongestionController *CongestionController::Create(cc_algo_t algo, uint32_t chunk_size)
+{
+    if (algo == CC_BBR)
+        return new BbrController();
+    else
+        return new LedbatController(chunk_size);
+}
+
+const char *CongestionController::Name(cc_algo_t algo)
+{
+    return algo == CC_BBR ? "bbr" : "ledbat";
+}
+
+int CongestionController::ByName(std::string name)
+{
+    if (name == "ledbat")
+        return CC_LEDBAT;
+    else if (name == "bbr")
+        return CC_BBR;
+    else
+        return -1;
+}
+
+
+/*
+ * LEDBAT, RFC 6817
+ */
+
+LedbatController::LedbatController(uint32_t chunk_size) : chunk_size_(chunk_size), slow_start_(true),
+    owd_min_bin_(0), owd_min_bin_start_(0), owd_cur_(TINT_NEVER), owd_min_(TINT_NEVER), owd_samples_(0),
+    flightsize_(0), acked_bytes_(0), acked_bytes_prev_(0), acked_start_(0), rtt_min_(TINT_NEVER),
+    last_loss_time_(0), rtt_avg_(TINT_SEC)
+{
+    for (int i=0; i<BASE_HISTORY; i++)
+        owd_min_bins_[i] = TINT_NEVER;
+    cwnd_bytes_ = MinCwndBytes();
+    cwnd_ = cwnd_bytes_/chunk_size_;
+}
+
+double LedbatController::MinCwndBytes() const
+{
+    return std::max((double)MIN_CWND*MSS,(double)chunk_size_);
+}
+
+void LedbatController::Start(float cwnd, tint rtt_avg)
+{
+    cwnd_bytes_ = std::max((double)cwnd*chunk_size_,MinCwndBytes());
+    cwnd_ = cwnd_bytes_/chunk_size_;
+    rtt_avg_ = rtt_avg;
+}
+
+void LedbatController::UpdateBaseDelay(tint owd)
+{
+    if (owd_min_bin_start_ == 0)
+        owd_min_bin_start_ = NOW;
+    if (NOW-owd_min_bin_start_ >= ROLLOVER) {
+        // Next bucket, and any skipped while idle are empty
+        tint periods = (NOW-owd_min_bin_start_)/ROLLOVER;
+        for (tint i=0; i<periods && i<BASE_HISTORY; i++) {
+            owd_min_bin_ = (owd_min_bin_+1) % BASE_HISTORY;
+            owd_min_bins_[owd_min_bin_] = TINT_NEVER;
+        }
+        owd_min_bin_start_ += periods*ROLLOVER;
+        owd_min_bins_[owd_min_bin_] = owd;
+        owd_min_ = TINT_NEVER;
+        for (int i=0; i<BASE_HISTORY; i++)
+            owd_min_ = std::min(owd_min_,owd_min_bins_[i]);
+    } else if (owd < owd_min_bins_[owd_min_bin_]) {
+        owd_min_bins_[owd_min_bin_] = owd;
+        owd_min_ = std::min(owd_min_,owd);
+    }
+}
+
+void LedbatController::UpdateCurrentDelay(tint owd)
+{
+    // Minimum over the last RTT, cuts the noise of single late samples.
+    // At most CURRENT_FILTER samples though, the RTT grows with the queue.
+    // Oldest first with rising owd, so the minimum is at the front.
+    owd_samples_++;
+    while (!owd_current_.empty() && owd_current_.back().owd >= owd)
+        owd_current_.pop_back();
+    owd_current_.push_back(ledbat_sample_t(owd,NOW,owd_samples_));
+    while (owd_current_.front().time < NOW-rtt_avg_
+            || owd_current_.front().seq+CURRENT_FILTER <= owd_samples_)
+        owd_current_.pop_front();
+    owd_cur_ = owd_current_.front().owd;
+}
+
+double LedbatController::BytesInUse()
+{
+    // In flight, but no more than was acked in an RTT: the lost count as
+    // in flight until they time out, which on a LAN is many RTTs later
+    if (NOW-acked_start_ >= rtt_avg_) {
+        acked_bytes_prev_ = NOW-acked_start_ < 2*rtt_avg_ ? acked_bytes_ : 0;
+        acked_bytes_ = 0;
+        acked_start_ = NOW;
+    }
+    return std::min((double)flightsize_*chunk_size_,std::max(acked_bytes_,acked_bytes_prev_));
+}
+
+void LedbatController::OnAck(int acked, tint rtt, tint owd)
+{
+    UpdateBaseDelay(owd);
+    UpdateCurrentDelay(owd);
+
+    double bytes = (double)acked*chunk_size_;
+    double cwnd = cwnd_bytes_;
+    tint queuing_delay = owd_cur_ - owd_min_;
+    if (rtt > 0 && rtt < rtt_min_)
+        rtt_min_ = rtt;
+    if (slow_start_) {
+        // Delay past half the target, or, where the receiver queues more
+        // than the path, the RTT grown by an eighth (HyStart)
+        tint rtt_growth = std::max(rtt_min_/8,SS_RTT_GROWTH_MIN);
+        if (queuing_delay > TARGET/2 || (rtt > 0 && rtt > rtt_min_+rtt_growth)) {
+            // The delay is an RTT behind, undo the doubling since
+            slow_start_ = false;
+            cwnd_bytes_ = std::max(cwnd_bytes_/2,MinCwndBytes());
+            cwnd = cwnd_bytes_;
+            dprintf("%s ledbat slow start done at %.0f bytes, delay %" PRIi64 "\n",tintstr(),cwnd_bytes_,
+                    queuing_delay);
+        } else
+            cwnd_bytes_ += bytes;
+    }
+    if (!slow_start_) {
+        double off_target = (double)(TARGET - queuing_delay)/TARGET;
+        cwnd_bytes_ += GAIN * off_target * bytes * MSS / cwnd_bytes_;
+    }
+    // No growth past what is in use. As the channel paces rather than
+    // clocks out by acks, in flight may lag the window, so no cut either.
+    double max_allowed = BytesInUse()*(slow_start_ ? 2 : 1) + ALLOWED_INCREASE*MSS;
+    acked_bytes_ += bytes;
+    if (cwnd_bytes_ > max_allowed && cwnd_bytes_ > cwnd)
+        cwnd_bytes_ = std::max(cwnd,max_allowed);
+    if (cwnd_bytes_ < MinCwndBytes())
+        cwnd_bytes_ = MinCwndBytes();
+
+    dprintf("%s ledbat owd %" PRIi64 " current %" PRIi64 " base %" PRIi64 " cwnd %.0f\n",tintstr(),owd,owd_cur_,
+            owd_min_,cwnd_bytes_);
+}
+
+void LedbatController::OnLoss()
+{
+    // Halve, once per RTT
+    slow_start_ = false;
+    if (last_loss_time_ < NOW-rtt_avg_) {
+        cwnd_bytes_ = std::max(cwnd_bytes_/2,MinCwndBytes());
+        last_loss_time_ = NOW;
+        dprintf("%s ledbat backoff %.0f\n",tintstr(),cwnd_bytes_);
+    }
+}
+
+void LedbatController::Update(tint rtt_avg, int inflight)
+{
+    rtt_avg_ = rtt_avg;
+    flightsize_ = inflight;
+    cwnd_ = cwnd_bytes_/chunk_size_;
+    send_interval_ = (tint)(rtt_avg*chunk_size_/cwnd_bytes_);
+}
+
+
+/*
+ * BBR: Cardwell et al., "BBR: Congestion-Based Congestion Control", 2016.
+ * The delivery rate is measured over the acks of the last min RTT, as a
+ * channel has no per-send delivery state.
+ */
+
+BbrController::BbrController() : state_(BBR_STARTUP), state_start_(0), pacing_gain_(SWIFT_BBR_HIGH_GAIN),
+    cwnd_gain_(SWIFT_BBR_HIGH_GAIN), bw_(0), min_rtt_(TINT_NEVER), min_rtt_time_(0), delivered_(0),
+    round_(0), round_start_(0), full_bw_(0), full_bw_rounds_(0), cycle_(0), cycle_start_(0),
+    probe_rtt_done_(0)
+{
+}
+
+void BbrController::Start(float cwnd, tint rtt_avg)
+{
+    // After a keep-alive the estimates and the state are kept, min RTT
+    // expiry sorts them. On a LAN a channel may go in and out of keep-alive
+    // between acks, starting over would keep it in STARTUP.
+    cwnd_ = cwnd;
+    if (min_rtt_ == TINT_NEVER) {
+        min_rtt_ = rtt_avg;
+        min_rtt_time_ = NOW;
+    }
+    if (bw_ == 0) {
+        bw_ = (double)cwnd*TINT_SEC/std::max(rtt_avg,(tint)1);
+        bw_samples_.push_back(std::make_pair(round_,bw_));
+    }
+    round_start_ = NOW;
+    send_interval_ = (tint)(TINT_SEC/(pacing_gain_*bw_));
+}
+
+void BbrController::OnAck(int acked, tint rtt, tint owd)
+{
+    delivered_ += acked;
+    bool expired = min_rtt_ != TINT_NEVER && NOW-min_rtt_time_ > SWIFT_BBR_MIN_RTT_WIN;
+    if (rtt > 0 && (rtt < min_rtt_ || expired)) {
+        if (expired && state_ != BBR_PROBE_RTT) {
+            // Not seen the empty pipe in a while, go and look
+            SetState(BBR_PROBE_RTT);
+            probe_rtt_done_ = NOW + std::max((tint)SWIFT_BBR_PROBE_RTT_TIME,min_rtt_);
+        }
+        min_rtt_ = rtt;
+        min_rtt_time_ = NOW;
+    }
+    if (min_rtt_ == TINT_NEVER)
+        return; // Not started
+
+    // Delivery rate since the ack a min RTT ago. Acks may come in bursts,
+    // so no faster than the acked were sent.
+    delivered_t d = { NOW, rtt > 0 ? NOW-rtt : NOW, delivered_ };
+    delivered_samples_.push_back(d);
+    tint window = std::max(min_rtt_,(tint)TINT_MSEC);
+    while (delivered_samples_.size() > 2 && delivered_samples_[1].time <= NOW-window)
+        delivered_samples_.pop_front();
+    const delivered_t &first = delivered_samples_.front();
+    tint elapsed = std::max(NOW-first.time,d.sent-first.sent);
+    if (NOW-first.time >= window/2 && elapsed > 0) {
+        double sample = (double)(delivered_-first.delivered)*TINT_SEC/elapsed;
+        while (!bw_samples_.empty() && bw_samples_.back().second <= sample)
+            bw_samples_.pop_back();
+        bw_samples_.push_back(std::make_pair(round_,sample));
+        bw_ = bw_samples_.front().second;
+    }
+
+    if (NOW-round_start_ >= min_rtt_)
+        NewRound();
+}
+
+void BbrController::NewRound()
+{
+    round_++;
+    round_start_ = NOW;
+    while (bw_samples_.size() > 1 && bw_samples_.front().first+SWIFT_BBR_BW_ROUNDS <= round_)
+        bw_samples_.pop_front();
+    if (!bw_samples_.empty())
+        bw_ = bw_samples_.front().second;
+
+    if (state_ == BBR_STARTUP) {
+        // Pipe full when the rate stops growing
+        if (bw_ >= full_bw_*SWIFT_BBR_FULL_BW_GROWTH) {
+            full_bw_ = bw_;
+            full_bw_rounds_ = 0;
+        } else if (++full_bw_rounds_ >= SWIFT_BBR_FULL_BW_ROUNDS) {
+            dprintf("%s bbr pipe full at %.1f chunks/s\n",tintstr(),bw_);
+            SetState(BBR_DRAIN);
+        }
+    }
+}
+
+void BbrController::SetState(bbr_state_t state)
+{
+    dprintf("%s bbr state %d->%d bw %.1f min_rtt %" PRIi64 "\n",tintstr(),state_,state,bw_,min_rtt_);
+    state_ = state;
+    state_start_ = NOW;
+    switch (state) {
+    case BBR_STARTUP:
+        pacing_gain_ = cwnd_gain_ = SWIFT_BBR_HIGH_GAIN;
+        break;
+    case BBR_DRAIN:
+        pacing_gain_ = 1/SWIFT_BBR_HIGH_GAIN;
+        cwnd_gain_ = SWIFT_BBR_HIGH_GAIN;
+        break;
+    case BBR_PROBE_BW:
+        // Start anywhere but in the drain phase
+        cycle_ = rand() % SWIFT_BBR_CYCLE;
+        if (cycle_ == 1)
+            cycle_ = 2;
+        cycle_start_ = NOW;
+        pacing_gain_ = bbr_cycle_gains[cycle_];
+        cwnd_gain_ = 2;
+        break;
+    case BBR_PROBE_RTT:
+        pacing_gain_ = cwnd_gain_ = 1;
+        break;
+    }
+}
+
+void BbrController::OnLoss()
+{
+    // Loss is not a congestion signal to BBR, the delivery rate is
+}
+
+void BbrController::Update(tint rtt_avg, int inflight)
+{
+    if (bw_ <= 0 || min_rtt_ == TINT_NEVER) {
+        send_interval_ = rtt_avg/cwnd_;
+        return;
+    }
+    double bdp = bw_*min_rtt_/TINT_SEC;
+    switch (state_) {
+    case BBR_DRAIN:
+        // In flight counts the lost until they time out, so give up after
+        // a few RTTs, a startup queue takes about three to drain
+        if (inflight <= bdp || NOW-state_start_ >= rtt_avg*4)
+            SetState(BBR_PROBE_BW);
+        break;
+    case BBR_PROBE_BW:
+        // Next gain after a min RTT; the drain phase ends once drained
+        if (NOW-cycle_start_ >= min_rtt_ || (pacing_gain_ < 1 && inflight <= bdp)) {
+            cycle_ = (cycle_+1) % SWIFT_BBR_CYCLE;
+            cycle_start_ = NOW;
+            pacing_gain_ = bbr_cycle_gains[cycle_];
+        }
+        break;
+    case BBR_PROBE_RTT:
+        if (NOW >= probe_rtt_done_) {
+            min_rtt_time_ = NOW;
+            SetState(full_bw_rounds_ >= SWIFT_BBR_FULL_BW_ROUNDS ? BBR_PROBE_BW : BBR_STARTUP);
+        }
+        break;
+    default:
+        break;
+    }
+
+    cwnd_ = std::max((double)SWIFT_BBR_MIN_CWND, cwnd_gain_*bdp);
+    if (state_ == BBR_PROBE_RTT) {
+        // Sends are clocked by the interval, so keep the minimum in flight
+        cwnd_ = SWIFT_BBR_MIN_CWND;
+        send_interval_ = min_rtt_/SWIFT_BBR_MIN_CWND;
+    } else
+        send_interval_ = (tint)(TINT_SEC/(pacing_gain_*bw_));
+    // The channel paces, it does not keep to a window: wait for acks,
+    // which reschedule the channel
+    if (inflight >= cwnd_)
+        send_interval_ = std::max(send_interval_,min_rtt_);
+    if (send_interval_ < 1)
+        send_interval_ = 1;
+}
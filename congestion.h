@@ -0,0 +1,200 @@
+/*
+ *  congestion.h
+ *  Congestion controllers for the DATA a channel sends. The channel's own
+ *  send control (ping-pong, slow start, keep-alive) hands over to one of
+ *  these once a transfer is under way. A controller is told of acks and
+ *  losses, and sets the window and the interval between sends:
+ *
+ *  LEDBAT: background, backs off when one-way delay grows past a target,
+ *          RFC 6817.
+ *  BBR:    throughput, estimates the bottleneck bandwidth and the minimum
+ *          RTT, and paces at that rate with a window of about one BDP.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+#include "compat.h"
+#include <deque>
+
+namespace swift
+{
+
+    typedef enum {
+        CC_LEDBAT = 0,
+        CC_BBR = 1
+    } cc_algo_t;
+
+    class CongestionController
+    {
+    public:
+        CongestionController() : cwnd_(1), send_interval_(TINT_SEC) {}
+        virtual ~CongestionController() {}
+
+        virtual cc_algo_t algo() const = 0;
+        /** Take over from slow start, at window cwnd (chunks) */
+        virtual void    Start(float cwnd, tint rtt_avg) = 0;
+        /** acked chunks acked by one ACK, with the RTT sample and the
+         *  one-way delay the peer saw. Called in all send control modes. */
+        virtual void    OnAck(int acked, tint rtt, tint owd) = 0;
+        /** A chunk timed out */
+        virtual void    OnLoss() = 0;
+        /** Set cwnd() and send_interval() for the next send, given the
+         *  channel's smoothed RTT and the chunks in flight */
+        virtual void    Update(tint rtt_avg, int inflight) = 0;
+
+        float           cwnd() const {
+            return cwnd_;
+        }
+        tint            send_interval() const {
+            return send_interval_;
+        }
+
+        /** New controller for a transfer with chunks of chunk_size bytes */
+        static CongestionController *Create(cc_algo_t algo, uint32_t chunk_size);
+        static const char *Name(cc_algo_t algo);
+        /** Algorithm by name, -1 if unknown */
+        static int      ByName(std::string name);
+
+    protected:
+        float   cwnd_;
+        tint    send_interval_;
+    };
+
+
+    /** RFC 6817. The window is kept in bytes, counted in MSS of 1 KB
+        whatever the chunk size, so the gains mean the same for all. */
+    class LedbatController : public CongestionController
+    {
+    public:
+        LedbatController(uint32_t chunk_size=1024);
+        cc_algo_t algo() const {
+            return CC_LEDBAT;
+        }
+        void    Start(float cwnd, tint rtt_avg);
+        void    OnAck(int acked, tint rtt, tint owd);
+        void    OnLoss();
+        void    Update(tint rtt_avg, int inflight);
+
+        /** Minimum one-way delay over the base history */
+        tint    base_delay() const {
+            return owd_min_;
+        }
+        /** Filtered one-way delay of the last RTT */
+        tint    current_delay() const {
+            return owd_cur_;
+        }
+        double  cwnd_bytes() const {
+            return cwnd_bytes_;
+        }
+        bool    slow_start() const {
+            return slow_start_;
+        }
+
+        static tint     TARGET;
+        static float    GAIN;
+        static uint32_t MSS;
+        static int      MIN_CWND;           // MSS
+        static int      ALLOWED_INCREASE;   // MSS
+        /** Current delay: minimum of the last RTT's samples, at most this many */
+        static int      CURRENT_FILTER;
+        /** Base delay history: BASE_HISTORY buckets of ROLLOVER each */
+        static tint     ROLLOVER;
+        enum { BASE_HISTORY = 10 };
+
+    protected:
+        uint32_t chunk_size_;
+        double  cwnd_bytes_;
+        bool    slow_start_;
+        /** Base delay: minimum one-way delay per ROLLOVER period */
+        tint    owd_min_bins_[BASE_HISTORY];
+        int     owd_min_bin_;
+        tint    owd_min_bin_start_;
+        tint    owd_cur_;
+        tint    owd_min_;
+        /** Current delay samples of the last RTT, oldest first with
+            rising owd */
+        struct ledbat_sample_t {
+            tint        owd, time;
+            uint64_t    seq;
+            ledbat_sample_t(tint o, tint t, uint64_t s) : owd(o), time(t), seq(s) {}
+        };
+        std::deque<ledbat_sample_t> owd_current_;
+        uint64_t owd_samples_;
+        int     flightsize_;
+        /** Bytes acked this RTT and the one before */
+        double  acked_bytes_, acked_bytes_prev_;
+        tint    acked_start_;
+        tint    rtt_min_;
+        tint    last_loss_time_;
+        tint    rtt_avg_;
+
+        double  MinCwndBytes() const;
+        double  BytesInUse();
+        void    UpdateBaseDelay(tint owd);
+        void    UpdateCurrentDelay(tint owd);
+    };
+
+
+    class BbrController : public CongestionController
+    {
+    public:
+        typedef enum {
+            BBR_STARTUP,
+            BBR_DRAIN,
+            BBR_PROBE_BW,
+            BBR_PROBE_RTT
+        } bbr_state_t;
+
+        BbrController();
+        cc_algo_t algo() const {
+            return CC_BBR;
+        }
+        void    Start(float cwnd, tint rtt_avg);
+        void    OnAck(int acked, tint rtt, tint owd);
+        void    OnLoss();
+        void    Update(tint rtt_avg, int inflight);
+
+        /** Bottleneck bandwidth estimate, chunks/s */
+        double  bw() const {
+            return bw_;
+        }
+        tint    min_rtt() const {
+            return min_rtt_;
+        }
+        bbr_state_t state() const {
+            return state_;
+        }
+
+    protected:
+        bbr_state_t state_;
+        tint    state_start_;
+        double  pacing_gain_, cwnd_gain_;
+        /** Windowed max of delivery rate samples: (round, chunks/s) */
+        std::deque< std::pair<uint64_t,double> > bw_samples_;
+        double  bw_;
+        tint    min_rtt_, min_rtt_time_;
+        /** Acks of the last RTT or so */
+        struct delivered_t {
+            tint        time, sent;
+            uint64_t    delivered;
+        };
+        std::deque<delivered_t> delivered_samples_;
+        uint64_t delivered_;
+        uint64_t round_;
+        tint    round_start_;
+        double  full_bw_;
+        int     full_bw_rounds_;
+        int     cycle_;
+        tint    cycle_start_;
+        tint    probe_rtt_done_;
+
+        void    NewRound();
+        void    SetState(bbr_state_t state);
+    };
+
+}
+
+#endif
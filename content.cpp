@@ -32,7 +32,7 @@ uint64_t ContentTransfer::cleancounter = 0;
 #define TRACKER_RETRY_INTERVAL_MAX  (1800*TINT_SEC) // 30 minutes
 
 ContentTransfer::ContentTransfer(transfer_t ttype) :  ttype_(ttype),
-    swarm_id_(), mychannels_(), callbacks_(), picker_(NULL), hashtree_(NULL),
+    swarm_id_(), mychannels_(), callbacks_(), have_log_start_(0), picker_(NULL), hashtree_(NULL),
     speedupcount_(0), speeddwcount_(0), trackerurl_(),
     tracker_retry_interval_(TRACKER_RETRY_INTERVAL_START),
     tracker_retry_time_(NOW),
@@ -43,6 +43,7 @@ ContentTransfer::ContentTransfer(transfer_t ttype) :  ttype_(ttype),
     cur_speed_[DDIR_DOWNLOAD] = MovingAverageSpeed();
     max_speed_[DDIR_UPLOAD] = DBL_MAX;
     max_speed_[DDIR_DOWNLOAD] = DBL_MAX;
+    cc_algo_ = (cc_algo_t)Channel::CC_ALGO;
 }
 
 
@@ -269,6 +270,10 @@ void ContentTransfer::ConnectToTracker(bool stop)
         int port = evhttp_uri_get_port(evu);
 
         Address trackaddr(host,port);
+        if (!Channel::SlotAvailable()) {
+            dprintf("%s F%d content contact tracker: no free channel slot\n",tintstr(),td_);
+            return;
+        }
         Channel *c = new Channel(this,INVALID_SOCKET,trackaddr);
     } else {
         // External tracker
@@ -314,7 +319,7 @@ bool ContentTransfer::OnPexIn(const Address& addr)
             return false; // already connected or connecting, Gertjan fix = return false
     }
     // Gertjan fix: PEX redo
-    if (mychannels_.size()<SWIFT_MAX_OUTGOING_CONNECTIONS)
+    if (mychannels_.size()<SWIFT_MAX_OUTGOING_CONNECTIONS && Channel::SlotAvailable())
         new Channel(this,Channel::default_socket(),addr);
     return true;
 }
@@ -426,25 +431,51 @@ uint32_t ContentTransfer::GetNumSeeders()
 
 void ContentTransfer::AddPeer(Address &peer)
 {
+    if (!Channel::SlotAvailable()) {
+        dprintf("%s F%d add peer %s: no free channel slot\n",tintstr(),td_,peer.str().c_str());
+        return;
+    }
     Channel *c = new Channel(this,INVALID_SOCKET,peer);
 }
 
 
 Channel * ContentTransfer::FindChannel(const Address &addr, Channel *notc)
 {
-    channels_t::iterator iter;
-    for (iter=mychannels_.begin(); iter!=mychannels_.end(); iter++) {
-        Channel *c = *iter;
-        if (c != NULL) {
-            if (c != notc && (c->peer() == addr || c->recv_peer() == addr)) {
-                return c;
-            }
-        }
+    std::pair<addrchannels_t::iterator,addrchannels_t::iterator> range = peer_index_.equal_range(addr);
+    addrchannels_t::iterator iter;
+    for (iter=range.first; iter!=range.second; iter++) {
+        if (iter->second != notc)
+            return iter->second;
     }
     return NULL;
 }
 
 
+void ContentTransfer::AddPeerIndex(const Address &addr, Channel *c)
+{
+    peer_index_.insert(std::make_pair(addr,c));
+}
+
+
+void ContentTransfer::RemovePeerIndex(const Address &addr, Channel *c)
+{
+    addrchannels_erase(peer_index_,addr,c);
+}
+
+
+void swift::addrchannels_erase(addrchannels_t &index, const Address &addr, Channel *c)
+{
+    std::pair<addrchannels_t::iterator,addrchannels_t::iterator> range = index.equal_range(addr);
+    addrchannels_t::iterator iter;
+    for (iter=range.first; iter!=range.second; iter++) {
+        if (iter->second == c) {
+            index.erase(iter);
+            return;
+        }
+    }
+}
+
+
 
 /*
  * Progress Monitoring
@@ -469,6 +500,7 @@ void ContentTransfer::RemoveProgressCallback(ProgressCallback cb)
 
 void ContentTransfer::Progress(bin_t bin)
 {
+    LogHave(bin);
     int minlayer = bin.layer();
     // Arno, 2012-10-02: Callback may call RemoveCallback and thus mess up iterator, so use copy
     progcallbackregs_t copycbs(callbacks_);
@@ -479,6 +511,15 @@ void ContentTransfer::Progress(bin_t bin)
     }
 }
 
+void ContentTransfer::LogHave(bin_t bin)
+{
+    have_log_.push_back(bin);
+    if (have_log_.size() > SWIFT_HAVE_LOG_SIZE) {
+        have_log_.pop_front();
+        have_log_start_++;
+    }
+}
+
 void ContentTransfer::SetTD(int td)
 {
     td_ = td;
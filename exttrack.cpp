@@ -25,6 +25,7 @@ using namespace swift;
 
 // https://wiki.theory.org/BitTorrentSpecification#peer_id
 #define BT_PEER_ID_LENGTH   20 // bytes
+#define BT_INFOHASH_LENGTH  20 // bytes, longer hashes truncated as in BEP 52
 #define BT_PEER_ID_PREFIX   "-SW1000-"
 
 #define BT_BENCODE_STRING_SEP       ":"
@@ -133,7 +134,7 @@ std::string ExternalTrackerClient::CreateQuery(ContentTransfer *transfer, Addres
     std::ostringstream oss;
 
     oss << "info_hash=";
-    esc = evhttp_uriencode((const char *)infohash.bytes(),Sha1Hash::SIZE,false);
+    esc = evhttp_uriencode((const char *)infohash.bytes(),std::min((size_t)BT_INFOHASH_LENGTH,Sha1Hash::SIZE),false);
     if (esc == NULL)
         return "";
     oss << esc;
@@ -11,10 +11,17 @@
 #include "bin_utils.h"
 //#include <openssl/sha.h>
 #include "sha1.h"
+#include "sha256.h"
 #include <cassert>
 #include <cstring>
 #include <cstdlib>
 #include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
 #include "swift.h"
 
 #include <iostream>
@@ -23,33 +30,62 @@ using namespace swift;
 
 const Sha1Hash Sha1Hash::ZERO = Sha1Hash();
 
-void SHA1(const void *data, size_t length, unsigned char *hash)
+// The Merkle hash function, see SWIFT_MERKLE_SHA256
+#ifdef SWIFT_MERKLE_SHA256
+#define MERKLE_CTX          blk_SHA256_CTX
+#define MERKLE_Init         blk_SHA256_Init
+#define MERKLE_Update       blk_SHA256_Update
+#define MERKLE_Final        blk_SHA256_Final
+#define MERKLE_Multi        blk_SHA256_Multi
+#else
+#define MERKLE_CTX          blk_SHA_CTX
+#define MERKLE_Init         blk_SHA1_Init
+#define MERKLE_Update       blk_SHA1_Update
+#define MERKLE_Final        blk_SHA1_Final
+#define MERKLE_Multi        blk_SHA1_Multi
+#endif
+
+static void MerkleHash(const void *data, size_t length, unsigned char *hash)
 {
-    blk_SHA_CTX ctx;
-    blk_SHA1_Init(&ctx);
-    blk_SHA1_Update(&ctx, data, length);
-    blk_SHA1_Final(hash, &ctx);
+    MERKLE_CTX ctx;
+    MERKLE_Init(&ctx);
+    MERKLE_Update(&ctx, data, length);
+    MERKLE_Final(hash, &ctx);
 }
 
 Sha1Hash::Sha1Hash(const Sha1Hash& left, const Sha1Hash& right)
 {
-    blk_SHA_CTX ctx;
-    blk_SHA1_Init(&ctx);
-    blk_SHA1_Update(&ctx, left.bits,SIZE);
-    blk_SHA1_Update(&ctx, right.bits,SIZE);
-    blk_SHA1_Final(bits, &ctx);
+    MERKLE_CTX ctx;
+    MERKLE_Init(&ctx);
+    MERKLE_Update(&ctx, left.bits,SIZE);
+    MERKLE_Update(&ctx, right.bits,SIZE);
+    MERKLE_Final(bits, &ctx);
 }
 
 Sha1Hash::Sha1Hash(const char* data, size_t length)
 {
     if (length==-1)
         length = strlen(data);
-    SHA1((unsigned char*)data,length,bits);
+    MerkleHash((unsigned char*)data,length,bits);
 }
 
 Sha1Hash::Sha1Hash(const uint8_t* data, size_t length)
 {
-    SHA1(data,length,bits);
+    MerkleHash(data,length,bits);
+}
+
+void Sha1Hash::HashChunks(const uint8_t *ptrs[], const size_t lens[], Sha1Hash out[], int n)
+{
+    unsigned long len[8];
+    unsigned char hashout[8][HASHSZ];
+    for (int i=0; i<n; i+=8) {
+        int m = std::min(8,n-i);
+        for (int j=0; j<m; j++)
+            len[j] = lens[i+j];
+        MERKLE_Multi(ptrs+i,len,hashout,m);
+        for (int j=0; j<m; j++)
+            memcpy(out[i+j].bits,hashout[j],HASHSZ);
+    }
 }
 
 Sha1Hash::Sha1Hash(bool hex, const char* hash)
@@ -58,7 +94,7 @@ Sha1Hash::Sha1Hash(bool hex, const char* hash)
         int val;
         for (int i=0; i<SIZE; i++) {
             if (sscanf(hash+i*2, "%2x", &val)!=1) {
-                memset(bits,0,20);
+                memset(bits,0,HASHSZ);
                 return;
             }
             bits[i] = val;
@@ -202,7 +238,91 @@ int MmapHashTree::OpenHashFile()
 }
 
 
-// Reads complete file and constructs hash tree
+/** Bytes a Submit() worker reads at once */
+#define SUBMIT_READ_SIZE    (4*1024*1024)
+
+namespace swift
+{
+    /** Work shared by the Submit() threads. Blocks are 2^layer chunks,
+        hashed up to their top node when all their chunks are in the content. */
+    struct submit_state_t {
+        int                     layer;
+        uint64_t                nblocks;
+        std::atomic<uint64_t>   next;
+        std::atomic<uint64_t>   donec;
+        std::atomic<uint64_t>   bytes;
+        std::atomic<bool>       failed;
+        /** MULTIFILE: Storage::Read() is not thread-safe then */
+        bool                    serialreads;
+        std::mutex              readmutex;
+    };
+}
+
+int MmapHashTree::SUBMIT_THREADS = 0;
+hashprogress_cb_t MmapHashTree::SUBMIT_PROGRESS = NULL;
+
+
+void MmapHashTree::SubmitBlocks(submit_state_t *st, bool report)
+{
+    uint64_t blockc = ((uint64_t)1)<<st->layer;
+    char *buf = new char[blockc*chunk_size_];
+    const uint8_t **ptrs = new const uint8_t *[blockc];
+    size_t *lens = new size_t[blockc];
+    Sha1Hash *out = new Sha1Hash[blockc];
+    uint8_t *pairs = new uint8_t[blockc*HASHSZ];
+    uint64_t b;
+    while (!st->failed && (b = st->next++) < st->nblocks) {
+        uint64_t first = b<<st->layer;
+        uint64_t nchunks = std::min(blockc,sizec_-first);
+        size_t want = nchunks*chunk_size_;
+        ssize_t rd;
+        if (st->serialreads) {
+            std::lock_guard<std::mutex> lock(st->readmutex);
+            rd = storage_->Read(buf,want,first*chunk_size_);
+        } else
+            rd = storage_->Read(buf,want,first*chunk_size_);
+        // Only the last chunk may be short
+        ssize_t minrd = (first+nchunks == sizec_) ? (nchunks-1)*chunk_size_ : want;
+        if (rd < minrd) {
+            st->failed = true;
+            break;
+        }
+        for (uint64_t i=0; i<nchunks; i++) {
+            ptrs[i] = (const uint8_t *)buf+i*chunk_size_;
+            lens[i] = std::min((size_t)(rd-i*chunk_size_),(size_t)chunk_size_);
+        }
+        Sha1Hash::HashChunks(ptrs,lens,out,nchunks);
+        for (uint64_t i=0; i<nchunks; i++)
+            hashes_[bin_t(0,first+i).toUInt()] = out[i];
+        for (int l=1; l<=st->layer; l++) {
+            // Parents whose chunks are all in the content, from copies of the child pairs
+            uint64_t o = first>>l, n = 0;
+            for (; (o+n+1)<<l <= first+nchunks; n++) {
+                bin_t pos(l,o+n);
+                memcpy(pairs+n*2*HASHSZ,hashes_[pos.left().toUInt()].bits,HASHSZ);
+                memcpy(pairs+n*2*HASHSZ+HASHSZ,hashes_[pos.right().toUInt()].bits,HASHSZ);
+                ptrs[n] = pairs+n*2*HASHSZ;
+                lens[n] = 2*HASHSZ;
+            }
+            Sha1Hash::HashChunks(ptrs,lens,out,n);
+            for (uint64_t i=0; i<n; i++)
+                hashes_[bin_t(l,o+i).toUInt()] = out[i];
+        }
+        st->bytes += rd;
+        st->donec += nchunks;
+        if (report && SUBMIT_PROGRESS != NULL)
+            SUBMIT_PROGRESS(storage_->GetOSPathName(),st->donec,sizec_);
+    }
+    delete[] pairs;
+    delete[] out;
+    delete[] lens;
+    delete[] ptrs;
+    delete[] buf;
+}
+
+
+// Reads complete file and constructs hash tree. Worker threads hash blocks
+// of chunks, the calling thread the layers above.
 void MmapHashTree::Submit()
 {
     size_ = storage_->GetReservedSize();
@@ -233,31 +353,62 @@ void MmapHashTree::Submit()
         SetBroken();
         return;
     }
-    size_t last_piece_size = (sizec_ - 1) % (chunk_size_) + 1;
-    char *chunk = new char[chunk_size_];
-    for (uint64_t i=0; i<sizec_; i++) {
 
-        ssize_t rd = storage_->Read(chunk,chunk_size_,i*chunk_size_);
-        if (rd<(chunk_size_) && i!=sizec_-1) {
-            free(hashes_);
-            hashes_=NULL;
-            SetBroken();
-            return;
+    int nthreads = SUBMIT_THREADS;
+    if (nthreads <= 0)
+        nthreads = std::max(1u,std::thread::hardware_concurrency());
+    submit_state_t st;
+    st.layer = 0;
+    while ((((uint64_t)chunk_size_)<<(st.layer+1)) <= SUBMIT_READ_SIZE)
+        st.layer++;
+    // Small content: enough blocks to keep all threads busy
+    while (st.layer > 0 && (sizec_>>st.layer) < 4*(uint64_t)nthreads)
+        st.layer--;
+    st.nblocks = (sizec_ + (((uint64_t)1)<<st.layer)-1) >> st.layer;
+    st.next = 0;
+    st.donec = 0;
+    st.bytes = 0;
+    st.failed = false;
+    int64_t fdoffset;
+#ifdef _WIN32
+    st.serialreads = true; // compat pread() seeks
+#else
+    st.serialreads = (storage_->GetReadFD(chunk_size_,0,&fdoffset) < 0);
+#endif
+    nthreads = (int)std::min((uint64_t)nthreads,st.nblocks);
+
+    dprintf("%s hashtree submit %d threads blocks of %d chunks\n",tintstr(),nthreads,1<<st.layer);
+    std::vector<std::thread> workers;
+    for (int t=1; t<nthreads; t++) {
+        try {
+            workers.push_back(std::thread(&MmapHashTree::SubmitBlocks,this,&st,false));
+        } catch (std::system_error &) {
+            print_error("hashtree: cannot start thread, hashing with fewer");
+            break;
         }
-        bin_t pos(0,i);
-        hashes_[pos.toUInt()] = Sha1Hash(chunk,rd);
-        ack_out_.set(pos);
-        while (pos.is_right()) {
-            pos = pos.parent();
+    }
+    SubmitBlocks(&st,true);
+    for (int t=0; t<workers.size(); t++)
+        workers[t].join();
+
+    if (st.failed) {
+        memory_unmap(hash_fd_,hashes_,hashes_size);
+        hashes_=NULL;
+        SetBroken();
+        return;
+    }
+    for (int l=st.layer+1; l<64 && (((uint64_t)1)<<l) <= sizec_; l++) {
+        for (uint64_t o=0; (o+1)<<l <= sizec_; o++) {
+            bin_t pos(l,o);
             hashes_[pos.toUInt()] = Sha1Hash(hashes_[pos.left().toUInt()],hashes_[pos.right().toUInt()]);
         }
-        complete_+=rd;
-        completec_++;
     }
-    delete chunk;
     for (int p=0; p<peak_count_; p++) {
+        ack_out_.set(peaks_[p]);
         peak_hashes_[p] = hashes_[peaks_[p].toUInt()];
     }
+    complete_ = st.bytes;
+    completec_ = sizec_;
 
     Sha1Hash calcroothash = DeriveRoot();
     if (root_hash_ != Sha1Hash::ZERO && calcroothash != root_hash_) {
@@ -17,9 +17,22 @@
 namespace swift
 {
 
+// The Merkle hash function is SHA-1, or SHA-256 when built with
+// SWIFT_MERKLE_SHA256. Swarm IDs, .mhash files and INTEGRITY messages all
+// carry hashes of that size, so a swarm and its peers use one function.
+#ifdef SWIFT_MERKLE_SHA256
+#define HASHSZ 32
+#else
 #define HASHSZ 20
+#endif
+
+    /** Called on the submitting thread as MmapHashTree::Submit() hashes
+        content, with the chunks done so far and the total. */
+    typedef void (*hashprogress_cb_t)(const std::string &ospathname, uint64_t donec, uint64_t sizec);
 
-    /** SHA-1 hash, 20 bytes of data */
+    struct submit_state_t;
+
+    /** Merkle hash, 20 bytes of SHA-1 or 32 of SHA-256, see HASHSZ */
     struct Sha1Hash {
         uint8_t    bits[HASHSZ];
 
@@ -36,6 +49,8 @@ namespace swift
         Sha1Hash(const Sha1Hash& h) {
             memcpy(bits,h.bits,SIZE);
         }
+        /** Hash n buffers, several at once if the SHA backend can. */
+        static void HashChunks(const uint8_t *ptrs[], const size_t lens[], Sha1Hash out[], int n);
 
         std::string    hex() const;
         bool    operator == (const Sha1Hash& b) const {
@@ -57,8 +72,7 @@ namespace swift
     };
 
 // Arno: The chunk size parameter can now be configured via the constructor,
-// for values up to 8192. Above that you'll have to edit the
-// SWIFT_MAX_SEND_DGRAM_SIZE in swift.h
+// for values up to SWIFT_MAX_CHUNK_SIZE in swift.h, a bit under 64K.
 //
 #define SWIFT_DEFAULT_CHUNK_SIZE 1024
 
@@ -164,6 +178,7 @@ namespace swift
 
         int             OpenHashFile();
         void            Submit();
+        void            SubmitBlocks(submit_state_t *st, bool report);
         void            RecoverProgress();
         bool            RecoverPeakHashes();
         Sha1Hash        DeriveRoot();
@@ -172,6 +187,11 @@ namespace swift
 
     public:
 
+        /** Threads hashing content in Submit(), 0 for one per core */
+        static int               SUBMIT_THREADS;
+        /** Progress of Submit(), NULL for none */
+        static hashprogress_cb_t SUBMIT_PROGRESS;
+
         MmapHashTree(Storage *storage, const Sha1Hash& root=Sha1Hash::ZERO, uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE,
                      std::string hash_filename="", bool force_check_diskvshash=true, std::string binmap_filename="");
 
@@ -1071,7 +1071,7 @@ void HttpGwNewRequestCallback(struct evhttp_request *evreq, void *arg)
 
     // 2. Parse swift URI
     if (uri.length() <= 1)     {
-        evhttp_send_error(evreq,400,"Path must be root hash in hex, 40 bytes.");
+        evhttp_send_error(evreq,400,"Path must be root hash in hex.");
         dprintf("%s @%i http get: ERROR 400 Path must be root hash in hex\n",tintstr(),0);
         return;
     }
@@ -0,0 +1,289 @@
+/*
+ *  iouring.cpp
+ *  Minimal io_uring submission/completion ring on the raw syscalls.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "iouring.h"
+#include <string.h>
+
+#if defined(__linux__) && defined(SWIFT_IOURING)
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#endif
+
+using namespace swift;
+
+IOUring::IOUring() : ring_fd_(-1), event_fd_(-1), sq_ptr_(NULL), cq_ptr_(NULL), sqes_(NULL),
+    sq_size_(0), cq_size_(0), sqes_size_(0), sq_entries_(0), sq_local_tail_(0), queued_(0), inflight_(0)
+{
+}
+
+#if defined(__linux__) && defined(SWIFT_IOURING)
+
+IOUring::~IOUring()
+{
+    if (sqes_ != NULL)
+        munmap(sqes_, sqes_size_);
+    if (cq_ptr_ != NULL && cq_ptr_ != sq_ptr_)
+        munmap(cq_ptr_, cq_size_);
+    if (sq_ptr_ != NULL)
+        munmap(sq_ptr_, sq_size_);
+    if (event_fd_ >= 0)
+        close(event_fd_);
+    if (ring_fd_ >= 0)
+        close(ring_fd_);
+}
+
+bool IOUring::Init(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd_ = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring_fd_ < 0)
+        return false;
+
+    sq_size_ = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    cq_size_ = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_size_ = cq_size_ = sq_size_ > cq_size_ ? sq_size_ : cq_size_;
+    sq_ptr_ = mmap(NULL, sq_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        sq_ptr_ = NULL;
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        cq_ptr_ = sq_ptr_;
+    else {
+        cq_ptr_ = mmap(NULL, cq_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            cq_ptr_ = NULL;
+            return false;
+        }
+    }
+    sqes_size_ = p.sq_entries*sizeof(struct io_uring_sqe);
+    sqes_ = mmap(NULL, sqes_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = NULL;
+        return false;
+    }
+
+    char *sq = (char *)sq_ptr_, *cq = (char *)cq_ptr_;
+    sq_head_ = (unsigned *)(sq+p.sq_off.head);
+    sq_tail_ = (unsigned *)(sq+p.sq_off.tail);
+    sq_mask_ = (unsigned *)(sq+p.sq_off.ring_mask);
+    sq_array_ = (unsigned *)(sq+p.sq_off.array);
+    cq_head_ = (unsigned *)(cq+p.cq_off.head);
+    cq_tail_ = (unsigned *)(cq+p.cq_off.tail);
+    cq_mask_ = (unsigned *)(cq+p.cq_off.ring_mask);
+    cqes_ = cq+p.cq_off.cqes;
+    sq_entries_ = p.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+
+    // Completions poke the eventfd, so the ring can sit in a libevent loop
+    event_fd_ = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (event_fd_ < 0)
+        return false;
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_EVENTFD, &event_fd_, 1) < 0)
+        return false;
+    return true;
+}
+
+void *IOUring::GetSQE()
+{
+    if (ring_fd_ < 0)
+        return NULL;
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_local_tail_-head >= sq_entries_) {
+        Submit();
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_local_tail_-head >= sq_entries_)
+            return NULL;
+    }
+    unsigned idx = sq_local_tail_ & *sq_mask_;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)sqes_ + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    sq_local_tail_++;
+    queued_++;
+    return sqe;
+}
+
+bool IOUring::PrepRead(int fd, void *buf, unsigned len, uint64_t offset, uring_req_t *req)
+{
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)GetSQE();
+    if (sqe == NULL)
+        return false;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    return true;
+}
+
+bool IOUring::PrepWrite(int fd, const void *buf, unsigned len, uint64_t offset, uring_req_t *req)
+{
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)GetSQE();
+    if (sqe == NULL)
+        return false;
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    return true;
+}
+
+bool IOUring::PrepSendmsg(int fd, const struct msghdr *msg, uring_req_t *req)
+{
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)GetSQE();
+    if (sqe == NULL)
+        return false;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    return true;
+}
+
+bool IOUring::PrepRecvmsg(int fd, struct msghdr *msg, uring_req_t *req)
+{
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)GetSQE();
+    if (sqe == NULL)
+        return false;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    return true;
+}
+
+bool IOUring::PrepCancel(uring_req_t *target, uring_req_t *req)
+{
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)GetSQE();
+    if (sqe == NULL)
+        return false;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)target;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    return true;
+}
+
+int IOUring::SubmitAndWait(unsigned n)
+{
+    if (ring_fd_ < 0)
+        return -1;
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    int r;
+    do {
+        r = syscall(__NR_io_uring_enter, ring_fd_, queued_, n, n ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (r < 0 && errno == EINTR);
+    if (r > 0) {
+        queued_ -= r;
+        inflight_ += r;
+    }
+    return r;
+}
+
+int IOUring::Submit()
+{
+    if (queued_ == 0)
+        return 0;
+    return SubmitAndWait(0);
+}
+
+int IOUring::Reap()
+{
+    if (ring_fd_ < 0)
+        return 0;
+    uint64_t ticks;
+    if (read(event_fd_, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN)
+        return 0;
+    int n = 0;
+    for (;;) {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+            break;
+        struct io_uring_cqe *cqe = (struct io_uring_cqe *)cqes_ + (head & *cq_mask_);
+        uring_req_t *req = (uring_req_t *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(cq_head_, head+1, __ATOMIC_RELEASE);
+        inflight_--;
+        n++;
+        // May queue new operations, e.g. rearm a receive
+        if (req != NULL && req->done != NULL)
+            req->done(req, res);
+    }
+    Submit();
+    return n;
+}
+
+#else
+
+IOUring::~IOUring()
+{
+}
+
+bool IOUring::Init(unsigned entries)
+{
+    return false;
+}
+
+void *IOUring::GetSQE()
+{
+    return NULL;
+}
+
+bool IOUring::PrepRead(int fd, void *buf, unsigned len, uint64_t offset, uring_req_t *req)
+{
+    return false;
+}
+
+bool IOUring::PrepWrite(int fd, const void *buf, unsigned len, uint64_t offset, uring_req_t *req)
+{
+    return false;
+}
+
+bool IOUring::PrepSendmsg(int fd, const struct msghdr *msg, uring_req_t *req)
+{
+    return false;
+}
+
+bool IOUring::PrepRecvmsg(int fd, struct msghdr *msg, uring_req_t *req)
+{
+    return false;
+}
+
+bool IOUring::PrepCancel(uring_req_t *target, uring_req_t *req)
+{
+    return false;
+}
+
+int IOUring::SubmitAndWait(unsigned n)
+{
+    return -1;
+}
+
+int IOUring::Submit()
+{
+    return 0;
+}
+
+int IOUring::Reap()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ *  iouring.h
+ *  Minimal io_uring submission/completion ring, used as optional I/O
+ *  backend for UDP and chunk reads. Talks to the kernel through the raw
+ *  syscalls, so no liburing is needed. Only built in with -DSWIFT_IOURING
+ *  on Linux, elsewhere Init() fails and callers use the libevent path.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct msghdr;
+
+namespace swift
+{
+
+    /** Embed as first member of a request, done() is called with the
+     *  result (bytes or -errno) when the operation completes. */
+    struct uring_req_t {
+        void (*done)(uring_req_t *req, int res);
+    };
+
+    class IOUring
+    {
+    public:
+        IOUring();
+        ~IOUring();
+
+        /** Set up a ring with room for entries submissions. */
+        bool    Init(unsigned entries);
+        bool    IsOpen() {
+            return ring_fd_ >= 0;
+        }
+        /** eventfd signalled on completions, to hook into libevent */
+        int     GetEventFD() {
+            return event_fd_;
+        }
+
+        /** Queue an operation. Buffers must stay valid until req->done().
+         *  Returns false when the submission queue is full. */
+        bool    PrepRead(int fd, void *buf, unsigned len, uint64_t offset, uring_req_t *req);
+        bool    PrepWrite(int fd, const void *buf, unsigned len, uint64_t offset, uring_req_t *req);
+        bool    PrepSendmsg(int fd, const struct msghdr *msg, uring_req_t *req);
+        bool    PrepRecvmsg(int fd, struct msghdr *msg, uring_req_t *req);
+        /** Cancel the operation of target, req gets -ENOENT if it was done */
+        bool    PrepCancel(uring_req_t *target, uring_req_t *req);
+
+        /** Hand queued operations to the kernel, returns how many */
+        int     Submit();
+        /** Submit and block until at least n operations completed */
+        int     SubmitAndWait(unsigned n);
+        /** Call done() for all completed operations, returns how many */
+        int     Reap();
+        /** Operations submitted but not yet reaped */
+        unsigned InFlight() {
+            return inflight_;
+        }
+
+    protected:
+        void   *GetSQE();
+
+        int         ring_fd_, event_fd_;
+        void        *sq_ptr_, *cq_ptr_, *sqes_;
+        size_t      sq_size_, cq_size_, sqes_size_;
+        unsigned    *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+        unsigned    *cq_head_, *cq_tail_, *cq_mask_;
+        void        *cqes_;
+        unsigned    sq_entries_, sq_local_tail_, queued_, inflight_;
+    };
+
+}
+
+#endif
@@ -38,8 +38,6 @@
  *
  *  - sendrecv.cpp Don't add DATA+bin+etc if read of data fails.
  *
- *  - avoid infinitely growing vector of channels.
- *
  *  - Crash on end-of-HTTP request for live.
  *
  *  - Replace divergence with time based approached using timestamp from SIGNED_INTEGRITY
@@ -316,6 +314,7 @@ int LiveTransfer::AddData(const void *buf, uint32_t nbyte)
         // New chunk is here
         bin_t chunkbin(0,last_chunkid_);
         ack_out_.set(chunkbin);
+        LogHave(chunkbin);
 
         last_chunkid_++;
         offset_ += chunk_size_;
@@ -629,11 +628,10 @@ void Channel::LiveSend()
     //fprintf(stderr,"live: LiveSend: channel %d\n", id() );
 
     if (evsendlive_ptr_ == NULL) {
-        evsendlive_ptr_ = new struct event;
         // Arno, 2013-02-01: Don't reassign, causes crashes.
-        evtimer_assign(evsendlive_ptr_,evbase,&Channel::LibeventSendCallback,this);
+        evsendlive_ptr_ = new wheel_timer_t(&Channel::LibeventSendCallback,this);
     }
     //fprintf(stderr,"live: LiveSend: next %" PRIi64 "\n", next_send_time_ );
-    evtimer_add(evsendlive_ptr_,tint2tv(next_send_time_));
+    Timers()->Schedule(evsendlive_ptr_,next_send_time_);
 }
 
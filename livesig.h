@@ -19,7 +19,7 @@
 #define SWIFT_LIVESIG_H_
 
 // Length of fake signature in SIGNED_INTEGRITY when Content Integrity Protection off
-#define SWIFT_CIPM_NONE_KEYLEN  21  // bytes, must be larger than Sha1Hash::SIZE
+#define SWIFT_CIPM_NONE_KEYLEN  (HASHSZ+1)  // bytes, must be larger than Sha1Hash::SIZE
 #define SWIFT_CIPM_NONE_SIGLEN  20  // bytes
 
 
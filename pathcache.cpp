@@ -0,0 +1,174 @@
+/*
+ *  pathcache.cpp
+ *  LRU cache of the RTT, window and loss rate last seen on the path to a
+ *  peer, see PathCache in swift.h. Kept in a text file across runs, a line
+ *  per peer: address, RTT and deviation (usec), window (chunks), loss
+ *  rate, time of the update (usec since the epoch).
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+#include "compat.h"
+
+using namespace swift;
+
+
+PathCache * PathCache::__singleton = NULL;
+
+tint PathCache::MAX_AGE = 3600*TINT_SEC;
+
+
+PathCache::PathCache(size_t capacity) : capacity_(capacity), dirty_(false)
+{
+    if (__singleton == NULL)
+        __singleton = this;
+}
+
+
+PathCache::~PathCache()
+{
+    if (__singleton == this)
+        __singleton = NULL;
+}
+
+
+PathCache * PathCache::GetInstance()
+{
+    if (__singleton == NULL)
+        new PathCache();
+    return __singleton;
+}
+
+
+bool PathCache::Get(const Address &peer, path_metrics_t *m)
+{
+    // A peer back on another port, as it restarted or is a leecher on an
+    // ephemeral one, is on the same path as far as we know
+    Address host(peer);
+    host.set_port((uint16_t)0);
+    path_metrics_t hm;
+    bool found = Find(host,&hm);
+    if (Find(peer,m))
+        return true;
+    if (found)
+        *m = hm;
+    return found;
+}
+
+
+void PathCache::Put(const Address &peer, const path_metrics_t &m)
+{
+    Address host(peer);
+    host.set_port((uint16_t)0);
+    Store(peer,m);
+    Store(host,m);
+}
+
+
+bool PathCache::Find(const Address &peer, path_metrics_t *m)
+{
+    std::unordered_map<Address,pathlru_t::iterator,AddressHash>::iterator iter = index_.find(peer);
+    if (iter == index_.end())
+        return false;
+    if (iter->second->second.updated < NOW-MAX_AGE) {
+        // Routes and cross traffic will have changed
+        lru_.erase(iter->second);
+        index_.erase(iter);
+        return false;
+    }
+    lru_.splice(lru_.begin(),lru_,iter->second);
+    *m = iter->second->second;
+    return true;
+}
+
+
+void PathCache::Store(const Address &peer, const path_metrics_t &m)
+{
+    dirty_ = true;
+    std::unordered_map<Address,pathlru_t::iterator,AddressHash>::iterator iter = index_.find(peer);
+    if (iter != index_.end()) {
+        iter->second->second = m;
+        lru_.splice(lru_.begin(),lru_,iter->second);
+        return;
+    }
+    if (capacity_ == 0)
+        return;
+    if (lru_.size() >= capacity_) {
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+    lru_.push_front(std::make_pair(peer,m));
+    index_[peer] = lru_.begin();
+}
+
+
+void PathCache::Clear()
+{
+    lru_.clear();
+    index_.clear();
+}
+
+
+int PathCache::SetFile(std::string filename)
+{
+    filename_ = filename;
+    FILE *fp = fopen_utf8(filename.c_str(),"r");
+    if (fp == NULL)
+        return 0;   // first run
+    // Oldest first, so the most recent end up in front
+    std::vector< std::pair<Address,path_metrics_t> > loaded;
+    char addrstr[256];
+    path_metrics_t m;
+    while (fscanf(fp,"%255s %" SCNi64 " %" SCNi64 " %f %f %" SCNi64 "\n",addrstr,&m.rtt_avg,&m.dev_avg,&m.cwnd_bytes,
+                  &m.loss_rate,&m.updated) == 6) {
+        Address peer(addrstr);
+        if (peer != Address() && m.rtt_avg > 0 && m.updated >= NOW-MAX_AGE)
+            loaded.push_back(std::make_pair(peer,m));
+    }
+    fclose(fp);
+    for (int i=loaded.size()-1; i>=0; i--)
+        Store(loaded[i].first,loaded[i].second);
+    dirty_ = false;
+    dprintf("%s path cache: %d peers from %s\n",tintstr(),(int)loaded.size(),filename.c_str());
+    return loaded.size();
+}
+
+
+int PathCache::Save()
+{
+    if (filename_ == "" || !dirty_)
+        return 0;
+    // Shards share the file, so each replaces it whole
+    char suffix[32];
+    sprintf(suffix,".tmp%d",Channel::shard_id);
+    std::string tmpname = filename_+suffix;
+    FILE *fp = fopen_utf8(tmpname.c_str(),"w");
+    if (fp == NULL) {
+        print_error("cannot write path cache");
+        return -1;
+    }
+    pathlru_t::iterator iter;
+    for (iter=lru_.begin(); iter!=lru_.end(); iter++) {
+        const Address &peer = iter->first;
+        const path_metrics_t &m = iter->second;
+        char addrstr[256];
+        if (peer.get_family() == AF_INET6)
+            sprintf(addrstr,"[%s]:%d",peer.ipstr().c_str(),(int)peer.port());
+        else
+            strcpy(addrstr,peer.str().c_str());
+        fprintf(fp,"%s %" PRIi64 " %" PRIi64 " %.0f %.4f %" PRIi64 "\n",addrstr,m.rtt_avg,m.dev_avg,m.cwnd_bytes,
+                m.loss_rate,m.updated);
+    }
+    fclose(fp);
+    dirty_ = false;
+#ifdef _WIN32
+    remove_utf8(filename_);
+#endif
+    if (rename(tmpname.c_str(),filename_.c_str()) < 0) {
+        print_error("cannot replace path cache");
+        remove_utf8(tmpname);
+        return -1;
+    }
+    return lru_.size();
+}
@@ -15,43 +15,57 @@ using namespace std;
 
 tint Channel::MIN_DEV = 50*TINT_MSEC;
 tint Channel::MAX_SEND_INTERVAL = TINT_SEC*58;
-//const uint32_t Channel::LEDBAT_BASE_HISTORY = 10;
-uint32_t Channel::LEDBAT_ROLLOVER = TINT_SEC*30;
-tint Channel::LEDBAT_TARGET = TINT_MSEC*25;
-float Channel::LEDBAT_GAIN = 1.0/LEDBAT_TARGET;
-tint Channel::LEDBAT_DELAY_BIN = TINT_SEC*30;
 tint Channel::MAX_POSSIBLE_RTT = TINT_SEC*10;
 const char* Channel::SEND_CONTROL_MODES[] = {"keepalive", "pingpong",
-                                             "slowstart", "standard_aimd", "ledbat", "closing"
+                                             "slowstart", "standard_aimd", "cc", "closing"
                                             };
 
 
 tint Channel::NextSendTime()
 {
     TimeoutDataOut(); // precaution to know free cwnd
+    tint next;
     switch (send_control_) {
     case KEEP_ALIVE_CONTROL:
-        return KeepAliveNextSendTime();
+        next = KeepAliveNextSendTime();
+        break;
     case PING_PONG_CONTROL:
-        return PingPongNextSendTime();
+        next = PingPongNextSendTime();
+        break;
     case SLOW_START_CONTROL:
-        return SlowStartNextSendTime();
+        next = SlowStartNextSendTime();
+        break;
     case AIMD_CONTROL:
-        return AimdNextSendTime();
-    case LEDBAT_CONTROL:
-        return LedbatNextSendTime();
+        next = AimdNextSendTime();
+        break;
+    case CC_CONTROL:
+        next = CcNextSendTime();
+        break;
     case CLOSE_CONTROL:
         return TINT_NEVER;
     default:
         fprintf(stderr,"send_control.cpp: unknown control %d\n", send_control_);
         return TINT_NEVER;
     }
+    // Pending ACKs go on their own if nothing else goes before
+    return std::min(next,AckDueTime());
+}
+
+tint Channel::AckDueTime()
+{
+    if (ack_agg_count_ == 0)
+        return TINT_NEVER;
+    if (ack_agg_count_ >= ACK_COUNT)
+        return NOW;
+    return ack_agg_first_ + ACK_DELAY;
 }
 
 tint Channel::SwitchSendControl(send_control_t control_mode)
 {
     dprintf("%s #%" PRIu32 " sendctrl switch %s->%s\n",tintstr(),id(),
             SEND_CONTROL_MODES[send_control_],SEND_CONTROL_MODES[control_mode]);
+    if (send_control_ == SLOW_START_CONTROL || send_control_ == AIMD_CONTROL || send_control_ == CC_CONTROL)
+        NotePath(); // before keep-alive resets it
     switch (control_mode) {
     case KEEP_ALIVE_CONTROL:
         send_interval_ = rtt_avg_; //max(TINT_SEC/10,rtt_avg_);
@@ -68,11 +82,13 @@ tint Channel::SwitchSendControl(send_control_t control_mode)
         break;
     case SLOW_START_CONTROL:
 // Ric: TODO test
-        cwnd_ = 4;
+        cwnd_ = max(4.0f,path_cwnd_);
+        path_cwnd_ = 0;
         break;
     case AIMD_CONTROL:
         break;
-    case LEDBAT_CONTROL:
+    case CC_CONTROL:
+        cc_->Start(cwnd_,rtt_avg_);
         break;
     case CLOSE_CONTROL:
         break;
@@ -84,6 +100,40 @@ tint Channel::SwitchSendControl(send_control_t control_mode)
     return NextSendTime();
 }
 
+void Channel::NotePath()
+{
+    path_.rtt_avg = rtt_avg_;
+    path_.dev_avg = dev_avg_;
+    path_.cwnd_bytes = cwnd_*chunk_size_;
+}
+
+void Channel::GetPath()
+{
+    // The cross traffic may have changed since, so half. In bytes, as the
+    // transfer it was learnt with may have had another chunk size.
+    path_metrics_t m;
+    if (PathCache::GetInstance()->Get(peer_,&m) && m.loss_rate < SWIFT_PATH_CACHE_MAX_LOSS) {
+        path_cwnd_ = m.cwnd_bytes/chunk_size_/2;
+        dprintf("%s #%" PRIu32 " sendctrl cwnd cached %.1f\n",tintstr(),id_,path_cwnd_);
+    }
+}
+
+void Channel::PutPath()
+{
+    if (send_control_ == SLOW_START_CONTROL || send_control_ == AIMD_CONTROL || send_control_ == CC_CONTROL)
+        NotePath();
+    else if (path_.rtt_avg == 0 && dgrams_rcvd_ > 0 && rtt_avg_ != TINT_SEC) {
+        // Sent no DATA, the RTT still does for the timeouts
+        path_.rtt_avg = rtt_avg_;
+        path_.dev_avg = dev_avg_;
+    }
+    if (path_.rtt_avg > 0) {
+        path_.loss_rate = data_out_sent_ ? (float)data_out_lost_/data_out_sent_ : 0;
+        path_.updated = NOW;
+        PathCache::GetInstance()->Put(peer_,path_);
+    }
+}
+
 tint Channel::KeepAliveNextSendTime()
 {
     if (sent_since_recv_>=3 && last_recv_time_<NOW-3*MAX_SEND_INTERVAL) {
@@ -92,15 +142,15 @@ tint Channel::KeepAliveNextSendTime()
     }
     if (ack_rcvd_recent_ && hint_in_size_) {
         if (keepalivereason_==NOTHING_TO_SEND) {
-            lprintf("\t\t==== Switch back to LEDBAT ==== \n");
+            lprintf("\t\t==== Switch back to %s ==== \n",CongestionController::Name(cc_->algo()));
             keepalivereason_ = NONE;
-            return SwitchSendControl(LEDBAT_CONTROL);
+            return SwitchSendControl(CC_CONTROL);
         } else {
             lprintf("\t\t==== Switch to Slow Start Control ==== \n");
             return SwitchSendControl(SLOW_START_CONTROL);
         }
     }
-    if (data_in_.time!=TINT_NEVER)
+    if (AckDueTime()<=NOW)
         return NOW;
 
     if (live_have_no_hint_) {
@@ -153,7 +203,7 @@ tint Channel::PingPongNextSendTime()    // FIXME INFINITE LOOP
         lprintf("\t\t==== Switch to Slow Start Control ==== \n");
         return SwitchSendControl(SLOW_START_CONTROL);
     }
-    if (data_in_.time!=TINT_NEVER)
+    if (AckDueTime()<=NOW)
         return NOW;
     if (last_recv_time_>last_send_time_)
         return NOW;
@@ -164,37 +214,40 @@ tint Channel::PingPongNextSendTime()    // FIXME INFINITE LOOP
 
 tint Channel::CwndRateNextSendTime()
 {
-    if (data_in_.time!=TINT_NEVER)
-        return NOW; // TODO: delayed ACKs
+    if (AckDueTime()<=NOW)
+        return NOW;
     if (last_recv_time_<NOW-rtt_avg_*8) {
         lprintf("\t\t==== Switch to Keep Alive Control (last_recv_time_<NOW-rtt_avg_*8) ==== \n");
         return SwitchSendControl(KEEP_ALIVE_CONTROL);
     }
-    send_interval_ = rtt_avg_/cwnd_;
+    if (send_control_ == CC_CONTROL)
+        send_interval_ = cc_->send_interval();
+    else
+        send_interval_ = rtt_avg_/cwnd_;
     if (send_interval_>max(rtt_avg_,TINT_SEC)*4) {
         lprintf("\t\t==== Switch to Keep Alive Control (send_interval_>max(rtt_avg_,TINT_SEC)*4) ==== \n");
         return SwitchSendControl(KEEP_ALIVE_CONTROL);
     }
     // Ric: test
     /*
-    if (data_out_size_<(int)cwnd_) {
-        dprintf("%s #%" PRIu32 " sendctrl send interval %" PRIi64 "us (cwnd %.2f, data_out %" PRIu32 ")\n",
-                tintstr(),id_,send_interval_,cwnd_,data_out_size_);
+    if (data_out_.size()<(int)cwnd_) {
+        dprintf("%s #%" PRIu32 " sendctrl send interval %" PRIi64 "us (cwnd %.2f, data_out %d)\n",
+                tintstr(),id_,send_interval_,cwnd_,data_out_.size());
         return last_data_out_time_ + send_interval_ - timer_delay_;
     } else {
-        dprintf("%s #%" PRIu32 " sendctrl avoid sending (cwnd %.2f, data_out %" PRIu32 ")\n",
-                tintstr(),id_,cwnd_,data_out_size_);
+        dprintf("%s #%" PRIu32 " sendctrl avoid sending (cwnd %.2f, data_out %d)\n",
+                tintstr(),id_,cwnd_,data_out_.size());
         assert(data_out_.front().time!=TINT_NEVER);
         return data_out_.front().time + ack_timeout();
     }*/
     // start test
-    if (data_out_size_<(int)cwnd_ || cwnd_ >= 1) {
-        dprintf("%s #%" PRIu32 " sendctrl send interval %" PRIi64 "us (cwnd %.2f, data_out %" PRIu32 ")\n",
-                tintstr(),id_,send_interval_,cwnd_,data_out_size_);
+    if (data_out_.size()<(int)cwnd_ || cwnd_ >= 1) {
+        dprintf("%s #%" PRIu32 " sendctrl send interval %" PRIi64 "us (cwnd %.2f, data_out %d)\n",
+                tintstr(),id_,send_interval_,cwnd_,data_out_.size());
         return last_data_out_time_ + send_interval_ - reschedule_delay_;
     } else {
-        dprintf("%s #%" PRIu32 " sendctrl avoid sending (cwnd %.2f, data_out %" PRIu32 ")\n",
-                tintstr(),id_,cwnd_,data_out_size_);
+        dprintf("%s #%" PRIu32 " sendctrl avoid sending (cwnd %.2f, data_out %d)\n",
+                tintstr(),id_,cwnd_,data_out_.size());
         assert(data_out_.front().time!=TINT_NEVER);
         return data_out_.front().time + ack_timeout();
     }
@@ -217,14 +270,14 @@ tint Channel::SlowStartNextSendTime()
 {
     if (ack_not_rcvd_recent_) {
         BackOffOnLosses();
-        lprintf("\t\t==== Switch to LEDBAT Control (1) ==== \n");
-        return SwitchSendControl(LEDBAT_CONTROL);//AIMD_CONTROL);
+        lprintf("\t\t==== Switch to CC Control (1) ==== \n");
+        return SwitchSendControl(CC_CONTROL);//AIMD_CONTROL);
     }
     // Ric: TODO test
     // if (rtt_avg_/cwnd_<TINT_SEC/10) {
     if (rtt_avg_/cwnd_<TINT_SEC/20) {
-        lprintf("\t\t==== Switch to LEDBAT Control (2) ==== \n");
-        return SwitchSendControl(LEDBAT_CONTROL);//AIMD_CONTROL);
+        lprintf("\t\t==== Switch to CC Control (2) ==== \n");
+        return SwitchSendControl(CC_CONTROL);//AIMD_CONTROL);
     }
     cwnd_+=ack_rcvd_recent_;
     ack_rcvd_recent_=0;
@@ -245,52 +298,15 @@ tint Channel::AimdNextSendTime()
     return CwndRateNextSendTime();
 }
 
-tint Channel::LedbatNextSendTime()
+tint Channel::CcNextSendTime()
 {
-
+    cc_->Update(rtt_avg_,data_out_.size());
+    cwnd_ = cc_->cwnd();
     if (ack_rcvd_recent_) {
-
-        // reset the min value
-        owd_min_ = TINT_NEVER;
-
-        // Ric: TODO for the moment we only use one sample!!
-        for (int i=0; i<10; i++) {
-            if (owd_min_>owd_min_bins_[i])
-                owd_min_ = owd_min_bins_[i];
-        }
-
-        // We may apply a filter over the elements.. as suggested in the rfc
-        ttqueue::iterator it = owd_current_.begin();
-        int32_t count = 0;
-        tint total = 0;
-        tint timeout = NOW - rtt_avg_;
-        // use the acks received during the last rtt, or at least 4 values
-        while (it != owd_current_.end() && (it->second > timeout || count < 4)) {
-            total += it->first;
-            count++;
-            it++;
-        }
-        owd_cur_ = total/count;
-
-        dprintf("%s #%" PRIu32 " sendctrl using %" PRIi32 " samples from the last rtt value [%" PRIi64 "], current owd: %"
-                PRIi64 "\n",
-                tintstr(),id_,count, rtt_avg_, owd_cur_);
-
-        if (ack_not_rcvd_recent_)
-            BackOffOnLosses(0.8);
-
+        // Losses were the controller's to deal with
         ack_rcvd_recent_ = 0;
-
-        tint queueing_delay = owd_cur_ - owd_min_;
-        tint off_target = LEDBAT_TARGET - queueing_delay;
-        cwnd_ += LEDBAT_GAIN * off_target / cwnd_;
-        if (cwnd_<1)
-            cwnd_ = 1;
-        if (owd_cur_==TINT_NEVER || owd_min_==TINT_NEVER)
-// Ric: TODO test
-            cwnd_ = 40;
+        ack_not_rcvd_recent_ = 0;
     }
-
     return CwndRateNextSendTime();
 }
 
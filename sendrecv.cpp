@@ -45,8 +45,26 @@ struct event Channel::evrecv;
 #define HINT_GRANULARITY    1 // chunks
 
 
+static int ChunkAddrSize(popt_chunk_addr_t ca)
+{
+    switch (ca) {
+    case POPT_CHUNK_ADDR_BIN32:
+        return 4;
+    case POPT_CHUNK_ADDR_BYTE64:
+        return 2*8;
+    case POPT_CHUNK_ADDR_CHUNK32:
+        return 2*4;
+    case POPT_CHUNK_ADDR_BIN64:
+        return 8;
+    case POPT_CHUNK_ADDR_CHUNK64:
+        return 2*8;
+    }
+    return 0;
+}
+
 
-void Channel::AddRequiredHashes(struct evbuffer *evb, bin_t pos, bool isretransmit)
+
+void Channel::AddRequiredHashes(dgram_t *dg, bin_t pos, bool isretransmit)
 {
     // We're either seeder or know what content integrity protection method
     // is because seeder told us, so hs_out_ is guiding here so we can
@@ -58,12 +76,12 @@ void Channel::AddRequiredHashes(struct evbuffer *evb, bin_t pos, bool isretransm
         // Arno, 2013-02-25: Need to send peak bins always (also CIPM None)
         // to cold clients to communicate tree size
         if (ack_in_.is_empty() && hashtree() != NULL && hashtree()->peak_count() > 0) {
-            AddUnsignedPeakHashes(evb);
+            AddUnsignedPeakHashes(dg);
         }
 
         if (hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_MERKLE) {
             if (pos != bin_t::NONE)
-                AddFileUncleHashes(evb,pos);
+                AddFileUncleHashes(dg,pos,isretransmit);
         }
     } else {
         // LIVE
@@ -105,7 +123,7 @@ void Channel::AddRequiredHashes(struct evbuffer *evb, bin_t pos, bool isretransm
             }
             // Don't send when peer has chunks in range, or when it's downloading from us (e.g. chunks earlier than munro)
             if (munro != bin_t::NONE && ack_in_.is_empty(munro) && !munro_ack_rcvd_ && !ahead) {
-                AddLiveSignedMunroHash(evb,munro);
+                AddLiveSignedMunroHash(dg,munro);
                 last_sent_munro_ = munro;
             }
         } else {
@@ -117,29 +135,31 @@ void Channel::AddRequiredHashes(struct evbuffer *evb, bin_t pos, bool isretransm
             dprintf("%s #%" PRIu32 " munro for %s is %s\n",tintstr(),id_,pos.str().c_str(), munro.str().c_str());
 
             if (isretransmit || diff)
-                AddLiveSignedMunroHash(evb,munro);
+                AddLiveSignedMunroHash(dg,munro);
 
             if (hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_UNIFIED_MERKLE)
-                AddLiveUncleHashes(evb,pos,munro,isretransmit);
+                AddLiveUncleHashes(dg,pos,munro,isretransmit);
         }
     }
 }
 
 
-void Channel::AddUnsignedPeakHashes(struct evbuffer *evb)
+void Channel::AddUnsignedPeakHashes(dgram_t *dg)
 {
     for (int i=0; i<hashtree()->peak_count(); i++) {
         bin_t peak = hashtree()->peak(i);
-        evbuffer_add_8(evb, SWIFT_INTEGRITY);
-        evbuffer_add_chunkaddr(evb,peak,hs_out_->chunk_addr_);
-        evbuffer_add_hash(evb, hashtree()->peak_hash(i));
+        dgram_add_8(dg, SWIFT_INTEGRITY);
+        AddChunkAddr(dg,peak);
+        dgram_add_hash(dg, hashtree()->peak_hash(i));
         dprintf("%s #%" PRIu32 " +phash %s\n",tintstr(),id_,peak.str().c_str());
+        global_hash_msgs++;
+        global_hash_bytes_up += 1+ChunkAddrSize(hs_out_->chunk_addr_)+Sha1Hash::SIZE;
     }
 }
 
 
 // SIGNPEAK
-void Channel::AddLiveSignedMunroHash(struct evbuffer *evb, bin_t munro)
+void Channel::AddLiveSignedMunroHash(dgram_t *dg, bin_t munro)
 {
     BinHashSigTuple bhst = BinHashSigTuple::NOBULL;
     if (hs_out_->cont_int_prot_ == POPT_CONT_INT_PROT_NONE) {
@@ -160,36 +180,58 @@ void Channel::AddLiveSignedMunroHash(struct evbuffer *evb, bin_t munro)
     }
 
     if (hs_out_->cont_int_prot_ != POPT_CONT_INT_PROT_NONE) {
-        evbuffer_add_8(evb, SWIFT_INTEGRITY);
-        evbuffer_add_chunkaddr(evb,bhst.bin(),hs_out_->chunk_addr_);
-        evbuffer_add_hash(evb, bhst.hash());
+        dgram_add_8(dg, SWIFT_INTEGRITY);
+        AddChunkAddr(dg,bhst.bin());
+        dgram_add_hash(dg, bhst.hash());
     }
 
     dprintf("%s #%" PRIu32 " +mhash %s\n",tintstr(),id_,bhst.bin().str().c_str());
 
     //fprintf(stderr,"AddLiveSignedMunroHash: speak %s %s\n", bhst.bin().str().c_str(), bhst.hash().hex().c_str() );
 
-    evbuffer_add_8(evb, SWIFT_SIGNED_INTEGRITY);
-    evbuffer_add_chunkaddr(evb,bhst.bin(),hs_out_->chunk_addr_);
-    evbuffer_add_64be(evb, bhst.sigtint().time());
-    evbuffer_add(evb, bhst.sigtint().sig().bits(), bhst.sigtint().sig().length());
+    dgram_add_8(dg, SWIFT_SIGNED_INTEGRITY);
+    AddChunkAddr(dg,bhst.bin());
+    dgram_add_64be(dg, bhst.sigtint().time());
+    dgram_add(dg, bhst.sigtint().sig().bits(), bhst.sigtint().sig().length());
 
     dprintf("%s #%" PRIu32 " +sigh %s %d\n",tintstr(),id_,bhst.bin().str().c_str(), bhst.sigtint().sig().length());
 }
 
 
 
-void Channel::AddFileUncleHashes(struct evbuffer *evb, bin_t pos)
+bool Channel::UncleSent(bin_t uncle, bool resend)
+{
+    // Forget what the peer didn't confirm in time, the datagram may
+    // have been lost
+    tint timeout = NOW-ack_timeout();
+    while (!uncles_out_q_.empty() && uncles_out_q_.front().time<timeout) {
+        std::map<bin_t,tint>::iterator iter = uncles_out_.find(uncles_out_q_.front().bin);
+        if (iter != uncles_out_.end() && iter->second == uncles_out_q_.front().time)
+            uncles_out_.erase(iter);
+        uncles_out_q_.pop_front();
+    }
+
+    std::map<bin_t,tint>::iterator iter = uncles_out_.find(uncle);
+    if (iter != uncles_out_.end() && !resend) {
+        global_hash_skipped++;
+        return true;
+    }
+    uncles_out_[uncle] = NOW;
+    uncles_out_q_.push_back(tintbin(NOW,uncle));
+    return false;
+}
+
+
+void Channel::AddFileUncleHashes(dgram_t *dg, bin_t pos, bool isretransmit)
 {
     bin_t peak = hashtree()->peak_for(pos);
     binvector bv;
-    while (pos!=peak && ((NOW&3)==3 || !pos.parent().contains(data_out_cap_)) &&
-            ack_in_.is_empty(pos.parent())) {
-        // Ric: TODO optimise.. send based on pkt loss statistics
-        //      the above is correct but should not happen at the beginning!
-        //while (pos!=peak && ack_in_.is_empty(pos.parent()) ) {
+    // Up to where the peer has verified hashes. Those sent recently
+    // are on their way, unless we're resending as the DATA got lost.
+    while (pos!=peak && ack_in_.is_empty(pos.parent())) {
         bin_t uncle = pos.sibling();
-        bv.push_back(uncle);
+        if (!UncleSent(uncle,isretransmit))
+            bv.push_back(uncle);
         pos = pos.parent();
     }
 
@@ -197,16 +239,18 @@ void Channel::AddFileUncleHashes(struct evbuffer *evb, bin_t pos)
     binvector::reverse_iterator iter;
     for (iter=bv.rbegin(); iter != bv.rend(); iter++) {
         bin_t uncle = *iter;
-        evbuffer_add_8(evb, SWIFT_INTEGRITY);
-        evbuffer_add_chunkaddr(evb,uncle,hs_out_->chunk_addr_);
-        evbuffer_add_hash(evb, hashtree()->hash(uncle));
+        dgram_add_8(dg, SWIFT_INTEGRITY);
+        AddChunkAddr(dg,uncle);
+        dgram_add_hash(dg, hashtree()->hash(uncle));
         dprintf("%s #%" PRIu32 " +hash %s\n",tintstr(),id_,uncle.str().c_str());
+        global_hash_msgs++;
+        global_hash_bytes_up += 1+ChunkAddrSize(hs_out_->chunk_addr_)+Sha1Hash::SIZE;
     }
 
 }
 
 //SIGNPEAK
-void Channel::AddLiveUncleHashes(struct evbuffer *evb, bin_t pos, bin_t munro, bool isretransmit)
+void Channel::AddLiveUncleHashes(dgram_t *dg, bin_t pos, bin_t munro, bool isretransmit)
 {
     binvector bv;
     if (isretransmit) {
@@ -218,13 +262,10 @@ void Channel::AddLiveUncleHashes(struct evbuffer *evb, bin_t pos, bin_t munro, b
         }
     } else {
         // Select only unsent uncles
-        // Ric: TODO check (remove data_out_cap??)
-        //      For the moment lets keep the old behaviour
-        while (pos!=munro && ((NOW&3)==3 || !pos.parent().contains(data_out_cap_)) &&
-                ack_in_.is_empty(pos.parent())) {
-            //while (pos!=munro && ack_in_.is_empty(pos.parent()) ) {
+        while (pos!=munro && ack_in_.is_empty(pos.parent())) {
             bin_t uncle = pos.sibling();
-            bv.push_back(uncle);
+            if (!UncleSent(uncle))
+                bv.push_back(uncle);
             pos = pos.parent();
         }
     }
@@ -233,16 +274,18 @@ void Channel::AddLiveUncleHashes(struct evbuffer *evb, bin_t pos, bin_t munro, b
     binvector::reverse_iterator iter;
     for (iter=bv.rbegin(); iter != bv.rend(); iter++) {
         bin_t uncle = *iter;
-        evbuffer_add_8(evb, SWIFT_INTEGRITY);
-        evbuffer_add_chunkaddr(evb,uncle,hs_out_->chunk_addr_);
+        dgram_add_8(dg, SWIFT_INTEGRITY);
+        AddChunkAddr(dg,uncle);
         Sha1Hash h = hashtree()->hash(uncle);
         if (h == Sha1Hash::ZERO) {
             // TEMP SIGNPEAKTODO
             fprintf(stderr,"SENDING ZERO HASH %s. PRESS\n", uncle.str().c_str());
             fflush(stderr);
         }
-        evbuffer_add_hash(evb,h);
+        dgram_add_hash(dg,h);
         dprintf("%s #%" PRIu32 " +hash %s\n",tintstr(),id_,uncle.str().c_str());
+        global_hash_msgs++;
+        global_hash_bytes_up += 1+ChunkAddrSize(hs_out_->chunk_addr_)+Sha1Hash::SIZE;
         pos = pos.parent();
     }
 }
@@ -335,7 +378,7 @@ bin_t Channel::DequeueHint(bool *retransmitptr)
 }
 
 
-void Channel::AddHandshake(struct evbuffer *evb)
+void Channel::AddHandshake(dgram_t *dg)
 {
     // If peer not responding, try legacy swift protocol
 #if ENABLE_FALLBACK_TO_LEGACY_PROTO == 1
@@ -347,85 +390,107 @@ void Channel::AddHandshake(struct evbuffer *evb)
     if (hs_out_->version_ == VER_SWIFT_LEGACY) {
         //dprintf("%s #%" PRIu32 " +hs swift legacy\n",tintstr(),id_ );
         if (hs_in_ == NULL) { // initiating
-            evbuffer_add_8(evb, SWIFT_INTEGRITY);
-            evbuffer_add_32be(evb, bin_toUInt32(bin_t::ALL));
-            evbuffer_add_hash(evb, transfer()->swarm_id().roothash());
+            dgram_add_8(dg, SWIFT_INTEGRITY);
+            dgram_add_32be(dg, bin_toUInt32(bin_t::ALL));
+            dgram_add_hash(dg, transfer()->swarm_id().roothash());
             dprintf("%s #%" PRIu32 " +hash ALL %s\n",
                     tintstr(),id_,transfer()->swarm_id().hex().c_str());
         }
-        evbuffer_add_8(evb, SWIFT_HANDSHAKE);
+        dgram_add_8(dg, SWIFT_HANDSHAKE);
 
         if (send_control_==CLOSE_CONTROL) {
             encoded = 0;
         } else
             encoded = EncodeID(id_);
-        evbuffer_add_32be(evb, encoded);
+        dgram_add_32be(dg, encoded);
 
         dprintf("%s #%" PRIu32 " +hs %x swift\n",tintstr(),id_,encoded);
     } else { // IETF PPSP compliant
         //dprintf("%s #%" PRIu32 " +hs ppsp\n",tintstr(),id_ );
-        evbuffer_add_8(evb, SWIFT_HANDSHAKE);
+        dgram_add_8(dg, SWIFT_HANDSHAKE);
         if (send_control_==CLOSE_CONTROL) {
             encoded = 0;
         } else
             encoded = EncodeID(id_);
-        evbuffer_add_32be(evb, encoded);
+        dgram_add_32be(dg, encoded);
 
         // Send protocol options
         std::ostringstream cross;
         if (send_control_ !=CLOSE_CONTROL) {
-            evbuffer_add_8(evb, POPT_VERSION);
-            evbuffer_add_8(evb, hs_out_->version_);
+            dgram_add_8(dg, POPT_VERSION);
+            dgram_add_8(dg, hs_out_->version_);
             cross << "v" << hs_out_->version_ << " ";
-            evbuffer_add_8(evb, POPT_MIN_VERSION);
-            evbuffer_add_8(evb, hs_out_->min_version_);
+            dgram_add_8(dg, POPT_MIN_VERSION);
+            dgram_add_8(dg, hs_out_->min_version_);
             cross << "nv" << hs_out_->version_ << " ";
 
             if (hs_in_ == NULL) { // initiating, send swarm ID
-                evbuffer_add_8(evb, POPT_SWARMID);
+                dgram_add_8(dg, POPT_SWARMID);
                 if (transfer()->ttype() == FILE_TRANSFER) {
-                    evbuffer_add_16be(evb, Sha1Hash::SIZE);
-                    evbuffer_add_hash(evb, transfer()->swarm_id().roothash());
+                    dgram_add_16be(dg, Sha1Hash::SIZE);
+                    dgram_add_hash(dg, transfer()->swarm_id().roothash());
                 } else {
                     SwarmPubKey spubkey = transfer()->swarm_id().spubkey();
-                    evbuffer_add_16be(evb, spubkey.length());
-                    evbuffer_add(evb,spubkey.bits(),spubkey.length());
+                    dgram_add_16be(dg, spubkey.length());
+                    dgram_add(dg,spubkey.bits(),spubkey.length());
                 }
                 cross << "sid " << transfer()->swarm_id().hex() << " ";
             }
-            evbuffer_add_8(evb, POPT_CONT_INT_PROT);
-            evbuffer_add_8(evb, hs_out_->cont_int_prot_);
+            dgram_add_8(dg, POPT_CONT_INT_PROT);
+            dgram_add_8(dg, hs_out_->cont_int_prot_);
             cross << "cipm " << hs_out_->cont_int_prot_ << " ";
             if (hs_out_->cont_int_prot_ == POPT_CONT_INT_PROT_MERKLE) {
-                evbuffer_add_8(evb, POPT_MERKLE_HASH_FUNC);
-                evbuffer_add_8(evb, hs_out_->merkle_func_);
+                dgram_add_8(dg, POPT_MERKLE_HASH_FUNC);
+                dgram_add_8(dg, hs_out_->merkle_func_);
                 cross << "mhf " << hs_out_->merkle_func_ << " ";
             }
             if (transfer()->ttype() == LIVE_TRANSFER && hs_out_->cont_int_prot_ != POPT_CONT_INT_PROT_NONE) {
-                evbuffer_add_8(evb, POPT_LIVE_SIG_ALG);
-                evbuffer_add_8(evb, hs_out_->live_sig_alg_);
+                dgram_add_8(dg, POPT_LIVE_SIG_ALG);
+                dgram_add_8(dg, hs_out_->live_sig_alg_);
                 cross << "lsa " << hs_out_->live_sig_alg_ << " ";
             }
-            evbuffer_add_8(evb, POPT_CHUNK_ADDR);
-            evbuffer_add_8(evb, hs_out_->chunk_addr_);
+            dgram_add_8(dg, POPT_CHUNK_ADDR);
+            dgram_add_8(dg, hs_out_->chunk_addr_);
             cross << "cam " << hs_out_->chunk_addr_ << " ";
             if (transfer()->ttype() == LIVE_TRANSFER) {
-                evbuffer_add_8(evb, POPT_LIVE_DISC_WND);
+                dgram_add_8(dg, POPT_LIVE_DISC_WND);
                 // For POPT_CHUNK_ADDR_CHUNK32, saves all chunks
                 // PPSPTODO forget
                 if (hs_out_->chunk_addr_ == POPT_CHUNK_ADDR_BIN32 || hs_out_->chunk_addr_ == POPT_CHUNK_ADDR_CHUNK32)
-                    evbuffer_add_32be(evb, (uint32_t)hs_out_->live_disc_wnd_);
+                    dgram_add_32be(dg, (uint32_t)hs_out_->live_disc_wnd_);
                 else
-                    evbuffer_add_64be(evb, hs_out_->live_disc_wnd_);
+                    dgram_add_64be(dg, hs_out_->live_disc_wnd_);
                 cross << "ldw " << std::hex << hs_out_->live_disc_wnd_ << std::dec << " ";
             }
+            // Bit per message, the first byte's MSB for message 0. Older
+            // peers misparse POPT_SUPP_MSGS and lose what follows in the
+            // datagram, so only answer peers that list HAVE_RUNS, and only
+            // offer it when told all peers understand it.
+            bool suppmsgs = (hs_in_ == NULL) ? HAVE_RUNS : hs_in_->Supports(SWIFT_HAVE_RUNS);
+            if (suppmsgs) {
+                uint8_t size8 = (SWIFT_MESSAGE_COUNT+7)/8;
+                dgram_add_8(dg, POPT_SUPP_MSGS);
+                dgram_add_8(dg, size8);
+                cross << "msgs " << std::hex;
+                for (int i8=0; i8<size8; i8++) {
+                    uint8_t bits = 0;
+                    for (int b=0; b<8; b++)
+                        if (hs_out_->Supports((messageid_t)(i8*8+b)))
+                            bits |= 0x80>>b;
+                    dgram_add_8(dg, bits);
+                    cross << (int)bits;
+                }
+                cross << std::dec << " ";
+            }
         }
         dprintf("%s #%" PRIu32 " +hs %x ppsp %s\n",tintstr(),id_,encoded, cross.str().c_str());
 
-        evbuffer_add_8(evb, POPT_END);
+        dgram_add_8(dg, POPT_END);
     }
 
     have_out_.clear();
+    have_log_synced_ = false;
+    have_runs_pos_ = 0;
 }
 
 
@@ -452,7 +517,7 @@ void Channel::Send()
             lprintf("%lu \t %d \t %d \t %li \t %d \t %d \t %d \t %.2f \n", NOW-open_time_, 0, 0, NOW-last_send_time_, 0, 0, 0,
                     cwnd_);
             break;
-        case LEDBAT_CONTROL:
+        case CC_CONTROL:
             lprintf("%lu \t %d \t %d \t %li \t %d \t %d \t %d \t %.2f \t %li\n", NOW-open_time_, 0, 0, NOW-last_send_time_, 0, 0, 0,
                     cwnd_, hint_in_size_);
             break;
@@ -464,65 +529,115 @@ void Channel::Send()
             break;
         }
 
-    struct evbuffer *evb = evbuffer_new();
+    dgram_t *dg = NewDataDgram();
     uint32_t pcid = 0;
     if (hs_in_ != NULL)
         pcid =  hs_in_->peer_channel_id_;
 
-    evbuffer_add_32be(evb,pcid);
+    dgram_add_32be(dg,pcid);
     bin_t data = bin_t::NONE;
     int evbnonadplen = 0;
+    chunk_read_wait_ = false;
     if (send_control_==CLOSE_CONTROL) // Arno: send explicit close
-        AddHandshake(evb);
+        AddHandshake(dg);
     else {
         if (is_established()) {
             // FIXME: seeder check
-            AddHave(evb);
-            AddAck(evb);
+            AddHave(dg);
+            AddAck(dg);
             //LIVE
             if (hashtree() == NULL || !hashtree()->is_complete()) {
-                AddHint(evb);
+                AddHint(dg);
                 /* Gertjan fix: 7aeea65f3efbb9013f601b22a57ee4a423f1a94d
                 "Only call Reschedule for 'reverse PEX' if the channel is in keep-alive mode"
                  */
-                AddPexReq(evb);
+                AddPexReq(dg);
                 if (ENABLE_CANCEL)
-                    AddCancel(evb);
+                    AddCancel(dg);
             }
-            AddPex(evb);
+            AddPex(dg);
             TimeoutDataOut();
-            data = AddData(evb);
+            data = AddData(dg);
         } else  {
-            AddHandshake(evb);
-            AddHave(evb); // Arno, 2011-10-28: from AddHandShake. Why double?
-            AddHave(evb);
-            AddAck(evb);
+            AddHandshake(dg);
+            AddHave(dg); // Arno, 2011-10-28: from AddHandShake. Why double?
+            AddHave(dg);
+            AddAck(dg);
         }
     }
-    lastsendwaskeepalive_ = (evbuffer_get_length(evb) == 4);
+    if (CloseOnChunkAddrOverflow(dg))
+        return;
+    if (chunk_read_wait_ && dgram_get_length(dg) == 4) {
+        // Nothing but the DATA we're reading, the read completing resends
+        dprintf("%s #%" PRIu32 " waiting for chunk read\n",tintstr(),id_);
+        dgram_free(dg);
+        return;
+    }
+    lastsendwaskeepalive_ = (dgram_get_length(dg) == 4);
 
-    if (evbuffer_get_length(evb)==4) {// only the channel id; bare keep-alive
+    if (dgram_get_length(dg)==4) {// only the channel id; bare keep-alive
         data = bin_t::ALL;
     }
 
     dprintf("%s #%" PRIu32 " sent %ib %s:%x\n",
-            tintstr(),id_,(int)evbuffer_get_length(evb),peer().str().c_str(),
+            tintstr(),id_,(int)dgram_get_length(dg),peer().str().c_str(),
             pcid);
     last_send_time_ = NOW;
 
-    int r = SendTo(socket_,peer(),evb);
+    // raw_bytes_up_ is credited when the datagram actually leaves, see FlushSendQueue
+    int r = QueueTo(socket_,peer(),dg,this);
     if (r==-1)
         print_error("swift can't send datagram");
     else {
-        raw_bytes_up_ += r;
         sent_since_recv_++;
         dgrams_sent_++;
     }
-    evbuffer_free(evb);
-    Reschedule();
+    if (PACING != PACING_OFF && !data.is_none() && data != bin_t::ALL && !chunk_read_wait_
+            && (send_control_ == SLOW_START_CONTROL || send_control_ == AIMD_CONTROL
+                || send_control_ == CC_CONTROL))
+        SendPacedWindow();
+    if (chunk_read_wait_)
+        dprintf("%s #%" PRIu32 " waiting for chunk read\n",tintstr(),id_);
+    else
+        Reschedule();
 }
 
-void Channel::AddHint(struct evbuffer *evb)
+
+void Channel::SendPacedWindow()
+{
+    // Instead of a wakeup per send_interval_, queue the DATA up to a window
+    // ahead now, each stamped with the time it is to leave. The next Send
+    // is then due when the last of them has gone, see CwndRateNextSendTime.
+    tint horizon = NOW + std::min(rtt_avg_,(tint)SWIFT_PACING_HORIZON);
+    uint32_t pcid = hs_in_ != NULL ? hs_in_->peer_channel_id_ : 0;
+    for (int n=1; n<SWIFT_PACING_MAX_BURST && data_out_.size()<(int)cwnd_; n++) {
+        tint txtime = last_data_out_time_ + send_interval_;
+        if (txtime > horizon || send_control_ == KEEP_ALIVE_CONTROL)
+            break;
+        dgram_t *dg = NewDataDgram();
+        dgram_add_32be(dg,pcid);
+        pace_time_ = txtime;
+        bin_t data = AddData(dg);
+        pace_time_ = 0;
+        if (CloseOnChunkAddrOverflow(dg))
+            return;
+        if (data.is_none()) {
+            // May carry hashes still
+            if (dgram_get_length(dg) == 4)
+                dgram_free(dg);
+            else if (QueueTo(socket_,peer(),dg,this) != -1)
+                dgrams_sent_++;
+            break;
+        }
+        dprintf("%s #%" PRIu32 " paced %s for %s\n",tintstr(),id_,data.str().c_str(),tintstr(txtime));
+        if (QueueTo(socket_,peer(),dg,this,txtime) != -1) {
+            dgrams_sent_++;
+            global_paced_dgrams++;
+        }
+    }
+}
+
+void Channel::AddHint(dgram_t *dg)
 {
 
     // LIVE source
@@ -669,8 +784,8 @@ void Channel::AddHint(struct evbuffer *evb)
             if (DEBUGTRAFFIC) {
                 fprintf(stderr,"hint c%d: ask %s\n", id(), hint.str().c_str());
             }
-            evbuffer_add_8(evb, SWIFT_REQUEST);
-            evbuffer_add_chunkaddr(evb,hint,hs_out_->chunk_addr_);
+            dgram_add_8(dg, SWIFT_REQUEST);
+            AddChunkAddr(dg,hint);
             dprintf("%s #%" PRIu32 " +hint %s [%" PRIi64 "]\n",tintstr(),id_,hint.str().c_str(),hint_out_size_);
             dprintf("%s #%" PRIu32 " +hint base %s width %d\n",tintstr(),id_,hint.base_left().str().c_str(),
                     (int)hint.base_length());
@@ -722,24 +837,7 @@ void Channel::AddHint(struct evbuffer *evb)
 #endif
 }
 
-static int ChunkAddrSize(popt_chunk_addr_t ca)
-{
-    switch (ca) {
-    case POPT_CHUNK_ADDR_BIN32:
-        return 4;
-    case POPT_CHUNK_ADDR_BYTE64:
-        return 2*8;
-    case POPT_CHUNK_ADDR_CHUNK32:
-        return 2*4;
-    case POPT_CHUNK_ADDR_BIN64:
-        return 8;
-    case POPT_CHUNK_ADDR_CHUNK64:
-        return 2*8;
-    }
-    return 0;
-}
-
-void Channel::AddCancel(struct evbuffer *evb)
+void Channel::AddCancel(dgram_t *dg)
 {
 
     // SIGNPEAKTODO
@@ -747,18 +845,40 @@ void Channel::AddCancel(struct evbuffer *evb)
 
 
     // Arno, 2013-01-15: take into account chunk addressing scheme
-    while (SWIFT_MAX_NONDATA_DGRAM_SIZE-evbuffer_get_length(evb) >= 1+ChunkAddrSize(hs_out_->chunk_addr_)
+    while (SWIFT_MAX_NONDATA_DGRAM_SIZE-dgram_get_length(dg) >= 1+ChunkAddrSize(hs_out_->chunk_addr_)
             && !cancel_out_.empty()) {
         bin_t cancel = cancel_out_.front();
         cancel_out_.pop_front();
-        evbuffer_add_8(evb, SWIFT_CANCEL);
-        evbuffer_add_chunkaddr(evb,cancel,hs_out_->chunk_addr_);
+        dgram_add_8(dg, SWIFT_CANCEL);
+        AddChunkAddr(dg,cancel);
         dprintf("%s #%" PRIu32 " +cancel %s\n",
                 tintstr(),id_,cancel.str().c_str());
     }
 }
 
-bin_t Channel::AddData(struct evbuffer *evb)
+/*
+ * io_uring chunk reads. A channel keeps up to SWIFT_URING_READAHEAD reads
+ * in flight for the chunks the peer asked for next, AddData only picks a
+ * chunk once it has been read so the loop never waits for the disk.
+ */
+#define SWIFT_URING_READAHEAD   8
+
+// Channels to reschedule once all completions of a Reap are in, so that a
+// send finds the read-ahead done as well.
+static std::vector<uint32_t> chunk_read_waiters;
+
+struct swift::chunk_read_t {
+    uring_req_t req;
+    Channel     *owner;  // NULL once the channel is gone
+    bin_t       bin;
+    tint        time;
+    bool        wanted;  // AddData is waiting for it
+    bool        done;
+    int         res;
+    dgram_t     *buf;
+};
+
+bin_t Channel::AddData(dgram_t *dg)
 {
     // RATELIMIT
     if (transfer()->GetCurrentSpeed(DDIR_UPLOAD) > transfer()->GetMaxSpeed(DDIR_UPLOAD)) {
@@ -775,8 +895,10 @@ bin_t Channel::AddData(struct evbuffer *evb)
     bin_t tosend = bin_t::NONE;
     bool isretransmit = false;
     tint luft = send_interval_>>4; // may wake up a bit earlier
+    // Pacing: rate control as of when this one leaves
+    tint sendtime = pace_time_ ? pace_time_ : NOW;
 
-    if ((data_out_size_<cwnd_ || cwnd_>0) && last_data_out_time_+send_interval_-reschedule_delay_<=NOW+luft) {
+    if ((data_out_.size()<cwnd_ || cwnd_>0) && last_data_out_time_+send_interval_-reschedule_delay_<=sendtime+luft) {
         tosend = DequeueHint(&isretransmit);
         if (tosend.is_none()) {
             dprintf("%s #%" PRIu32 " sendctrl no idea what data to send\n",tintstr(),id_);
@@ -788,11 +910,25 @@ bin_t Channel::AddData(struct evbuffer *evb)
         }
     } else
         dprintf("%s #%" PRIu32 " sendctrl wait cwnd %f data_out %i next %s\n",
-                tintstr(),id_,cwnd_,data_out_size_,tintstr(last_data_out_time_+send_interval_));
+                tintstr(),id_,cwnd_,data_out_.size(),tintstr(last_data_out_time_+send_interval_));
+
+    // Zero-copy: complete content goes out straight from the page cache
+    const uint8_t *mapped = NULL;
+    size_t mappedlen = 0;
+    if (!tosend.is_none() && ZERO_COPY && transfer()->ttype() == FILE_TRANSFER && hashtree()->is_complete())
+        mapped = transfer()->GetStorage()->GetMappedRange(transfer()->chunk_size(),
+                 tosend.base_offset()*transfer()->chunk_size(), &mappedlen);
+
+    // io_uring: don't wait for the disk, send when the read is in
+    chunk_read_t *cr = NULL;
+    if (!tosend.is_none() && mapped == NULL && IO_URING && !ChunkReady(tosend,isretransmit,&cr)) {
+        chunk_read_wait_ = true;
+        tosend = bin_t::NONE;
+    }
 
     // Add required hashes. Also for initial peaks and munros
     // Note this is called always, not just when there are requests pending.
-    AddRequiredHashes(evb,tosend,isretransmit);
+    AddRequiredHashes(dg,tosend,isretransmit);
 
     if (tosend.is_none()) {// && (last_data_out_time_>NOW-TINT_SEC || data_out_.empty()))
         transfer()->OnSendNoData();
@@ -803,49 +939,58 @@ bin_t Channel::AddData(struct evbuffer *evb)
         data_out_cap_ = tosend;
 
     // Send hashes in separate datagram if first would get too big
-    SendIfTooBig(evb);
+    SendIfTooBig(dg);
 
     // Add chunk
-    evbuffer_add_8(evb, SWIFT_DATA);
-    evbuffer_add_chunkaddr(evb,tosend,hs_out_->chunk_addr_);
+    dgram_add_8(dg, SWIFT_DATA);
+    AddChunkAddr(dg,tosend);
     // PPSPTODO LEDBAT current system time 64-bit
     if (hs_in_ != NULL && hs_in_->version_ == VER_PPSPP_v1) {
         // NOTE: Time updates NOW, so customary behavior where NOW is not
         // updated during the handling of a message (just at start) is no longer
         // there. Not sure if this matters.
-        evbuffer_add_64be(evb, Time());
+        dgram_add_64be(dg, pace_time_ ? pace_time_ : Time());
     }
 
-    struct evbuffer_iovec vec;
-    if (evbuffer_reserve_space(evb, transfer()->chunk_size(), &vec, 1) < 0) {
-        print_error("error on evbuffer_reserve_space");
+    // Read straight into the datagram
+    uint8_t *chunk = dgram_reserve(dg, transfer()->chunk_size());
+    if (chunk == NULL) {
+        print_error("error on dgram_reserve");
         return bin_t::NONE;
     }
 
     if (DEBUGTRAFFIC)
         dprintf("%s #%" PRIu32 " ?data reading swarm %llu\n",tintstr(),id_, tosend.base_offset()*transfer()->chunk_size());
 
-    ssize_t r = transfer()->GetStorage()->Read((char *)vec.iov_base,
-                transfer()->chunk_size(),tosend.base_offset()*transfer()->chunk_size());
+    ssize_t r;
+    if (mapped != NULL) {
+        // Room for the chunk was reserved above, so a pullup can't fail
+        dgram_add_ref(dg, mapped, mappedlen);
+        r = mappedlen;
+        global_zerocopy_chunks++;
+        global_zerocopy_bytes += r;
+    } else if (cr != NULL) {
+        r = cr->res;
+        memcpy(chunk,dgram_pullup(cr->buf),r);
+        dgram_free(cr->buf);
+        delete cr;
+    } else
+        r = transfer()->GetStorage()->Read((char *)chunk,
+                                           transfer()->chunk_size(),tosend.base_offset()*transfer()->chunk_size());
     // TODO: corrupted data, retries, caching
     if (r <= 0) {
         print_error("error on reading");
 
         dprintf("%s #%" PRIu32 " !data %s\n",tintstr(),id_,tosend.str().c_str());
-        vec.iov_len = 0;
-        evbuffer_commit_space(evb, &vec, 1);
         return bin_t::NONE;
     }
     // assert(dgram.space()>=r+4+1);
-    vec.iov_len = r;
-    if (evbuffer_commit_space(evb, &vec, 1) < 0) {
-        print_error("error on evbuffer_commit_space");
-        return bin_t::NONE;
-    }
+    if (mapped == NULL)
+        dgram_commit(dg, r);
 
-    last_data_out_time_ = NOW;
-    data_out_.push_back(tosend);
-    data_out_size_++;
+    last_data_out_time_ = pace_time_ ? pace_time_ : NOW;
+    data_out_.push_back(tintbin(last_data_out_time_,tosend),isretransmit);
+    data_out_sent_++;
     bytes_up_ += r;
     global_bytes_up += r;
 
@@ -859,7 +1004,160 @@ bin_t Channel::AddData(struct evbuffer *evb)
 }
 
 
-void Channel::SendIfTooBig(struct evbuffer *evb)
+void Channel::OnChunkRead(uring_req_t *req, int res)
+{
+    chunk_read_t *cr = (chunk_read_t *)req;
+    cr->done = true;
+    cr->res = res;
+    if (cr->owner == NULL) {
+        dgram_free(cr->buf);
+        delete cr;
+        return;
+    }
+    global_uring_reads++;
+    if (cr->wanted)
+        chunk_read_waiters.push_back(cr->owner->id());
+}
+
+void Channel::OnChunkReadsDone()
+{
+    std::vector<uint32_t> waiters;
+    waiters.swap(chunk_read_waiters);
+    for (int i=0; i<waiters.size(); i++) {
+        Channel *c = channel(waiters[i]);
+        if (c != NULL && c->chunk_read_wait_ && c->send_control_ != CLOSE_CONTROL)
+            c->Reschedule();
+    }
+}
+
+bool Channel::ChunkReady(bin_t tosend, bool isretransmit, chunk_read_t **crp)
+{
+    *crp = NULL;
+    uint32_t chunksize = transfer()->chunk_size();
+    IOUring *ring = Uring();
+    if (ring == NULL)
+        return true;
+
+    // Drop read-ahead the peer no longer wants
+    std::deque<chunk_read_t *>::iterator iter;
+    for (iter=chunk_reads_.begin(); iter!=chunk_reads_.end(); ) {
+        chunk_read_t *cr = *iter;
+        if (cr->done && cr->bin != tosend && (ack_in_.is_filled(cr->bin) || cr->time < NOW-2*TINT_SEC)) {
+            dgram_free(cr->buf);
+            delete cr;
+            iter = chunk_reads_.erase(iter);
+        } else
+            iter++;
+    }
+
+    for (iter=chunk_reads_.begin(); iter!=chunk_reads_.end(); iter++)
+        if ((*iter)->bin == tosend)
+            break;
+    if (iter != chunk_reads_.end() && (*iter)->done) {
+        chunk_read_t *cr = *iter;
+        chunk_reads_.erase(iter);
+        // Failed read: retry synchronously
+        if (cr->res > 0)
+            *crp = cr;
+        else {
+            dgram_free(cr->buf);
+            delete cr;
+        }
+        return true;
+    }
+
+    if (iter != chunk_reads_.end())
+        (*iter)->wanted = true;
+    else {
+        // Read tosend plus what the peer asked for after it
+        std::vector<bin_t> toread;
+        toread.push_back(tosend);
+        for (tbqueue::iterator h=hint_in_.begin(); h!=hint_in_.end()
+                && chunk_reads_.size()+toread.size() < SWIFT_URING_READAHEAD; h++) {
+            bin_t hint = h->bin;
+            for (uint64_t i=0; i<hint.base_length()
+                    && chunk_reads_.size()+toread.size() < SWIFT_URING_READAHEAD; i++) {
+                bin_t b(0,hint.base_offset()+i);
+                if (b == tosend || ack_in_.is_filled(b))
+                    continue;
+                bool queued = false;
+                for (int j=0; j<chunk_reads_.size() && !queued; j++)
+                    queued = chunk_reads_[j]->bin == b;
+                if (!queued)
+                    toread.push_back(b);
+            }
+        }
+        for (int i=0; i<toread.size(); i++) {
+            int64_t fdoffset;
+            int fd = transfer()->GetStorage()->GetReadFD(chunksize,toread[i].base_offset()*chunksize,&fdoffset);
+            if (fd < 0) {
+                if (i == 0)
+                    return true;
+                break;
+            }
+            chunk_read_t *cr = new chunk_read_t;
+            cr->req.done = OnChunkRead;
+            cr->owner = this;
+            cr->bin = toread[i];
+            cr->time = NOW;
+            cr->wanted = i == 0;
+            cr->done = false;
+            cr->res = 0;
+            cr->buf = dgram_new_size(chunksize);
+            if (!ring->PrepRead(fd,dgram_reserve(cr->buf,chunksize),chunksize,fdoffset,&cr->req)) {
+                dgram_free(cr->buf);
+                delete cr;
+                if (i == 0)
+                    return true;
+                break;
+            }
+            chunk_reads_.push_back(cr);
+        }
+        ring->Submit();
+        dprintf("%s #%" PRIu32 " uring reading %s +%d\n",tintstr(),id_,tosend.str().c_str(),(int)toread.size()-1);
+    }
+
+    // Not in yet, put it back where DequeueHint took it from
+    if (isretransmit)
+        data_out_tmo_.push_front(tintbin(NOW,tosend));
+    else {
+        hint_in_.push_front(tintbin(NOW,tosend));
+        hint_in_size_ += tosend.base_length();
+    }
+    return false;
+}
+
+void Channel::FreeChunkReads()
+{
+    for (int i=0; i<chunk_reads_.size(); i++) {
+        chunk_read_t *cr = chunk_reads_[i];
+        if (cr->done) {
+            dgram_free(cr->buf);
+            delete cr;
+        } else
+            cr->owner = NULL; // freed by OnChunkRead
+    }
+    chunk_reads_.clear();
+}
+
+
+dgram_t *Channel::NewDataDgram()
+{
+    // The pooled ones leave room for all else next to a chunk of up to 8K,
+    // bigger chunks get one from the pool of large buffers
+    return dgram_new_size(SWIFT_DGRAM_BUF_SIZE-8192+chunk_size_);
+}
+
+
+// IP fragments a UDP payload of len bytes takes on an Ethernet path
+static size_t EthFragments(size_t len)
+{
+    size_t frag = SWIFT_MAX_UDP_OVER_ETH_PAYLOAD+8;
+    return (len+8+frag-1)/frag;
+}
+
+
+void Channel::SendIfTooBig(dgram_t *dg)
 {
     // Arno, 2011-11-03: May happen when first data packet is sent to empty
     // leech, then peak + uncle hashes may be so big that they don't fit in eth
@@ -869,31 +1167,39 @@ void Channel::SendIfTooBig(struct evbuffer *evb)
     // Arno, 2013-05-14: Don't work if this is first msg, as peer_channel_id
     // will be unknown. Then just continue adding to the first datagram and
     // hope for the best.
-    if (is_established() && transfer()->chunk_size() == SWIFT_DEFAULT_CHUNK_SIZE
-            && evbuffer_get_length(evb) > SWIFT_MAX_NONDATA_DGRAM_SIZE) {
+    // Large chunks are IP fragmented anyway, split when the hashes would
+    // take a fragment more than the DATA alone, or not fit in UDP at all.
+    size_t datalen = 1+ChunkAddrSize(hs_out_->chunk_addr_)+8+chunk_size_;
+    if (is_established() && dgram_get_length(dg) > 4
+            && (EthFragments(dgram_get_length(dg)+datalen) > EthFragments(4+datalen)
+                || dgram_get_length(dg)+datalen > SWIFT_MAX_UDP_PAYLOAD)) {
 
         dprintf("%s #%" PRIu32 " fsent %ib %s:%x\n",
-                tintstr(),id_,(int)evbuffer_get_length(evb),peer().str().c_str(),
+                tintstr(),id_,(int)dgram_get_length(dg),peer().str().c_str(),
                 hs_in_->peer_channel_id_);
-        int ret = Channel::SendTo(socket_,peer(),evb); // kind of fragmentation
-        if (ret > 0)
-            raw_bytes_up_ += ret;
-        evbuffer_add_32be(evb, hs_in_->peer_channel_id_);
+        dgram_t *frag = dgram_new();
+        dgram_add(frag, dgram_pullup(dg), dgram_get_length(dg));
+        dgram_drain(dg, dgram_get_length(dg));
+        Channel::QueueTo(socket_,peer(),frag,this); // kind of fragmentation
+        dgram_add_32be(dg, hs_in_->peer_channel_id_);
     }
 }
 
 
-void Channel::AddAck(struct evbuffer *evb)
+void Channel::AddAck(dgram_t *dg)
 {
+    // Anything going out takes the ACKs pending along
+    if (ack_agg_count_ > 0)
+        AddAckRanges(dg);
     if (data_in_==tintbin())
         //if (data_in_.bin==bin64_t::NONE)
         return;
     // sometimes, we send a HAVE (e.g. in case the peer did repetitive send)
-    evbuffer_add_8(evb, data_in_.time==TINT_NEVER?SWIFT_HAVE:SWIFT_ACK);
-    evbuffer_add_chunkaddr(evb,data_in_.bin,hs_out_->chunk_addr_);
+    dgram_add_8(dg, data_in_.time==TINT_NEVER?SWIFT_HAVE:SWIFT_ACK);
+    AddChunkAddr(dg,data_in_.bin);
     // PPSPTODO LEDBAT one-way delay
     if (data_in_.time!=TINT_NEVER)
-        evbuffer_add_64be(evb, data_in_.time);
+        dgram_add_64be(dg, data_in_.time);
 
     if (DEBUGTRAFFIC)
         fprintf(stderr,"send c%d: ACK %i\n", id(), bin_toUInt32(data_in_.bin));
@@ -935,11 +1241,93 @@ void Channel::AddAck(struct evbuffer *evb)
 }
 
 
-void Channel::AddHave(struct evbuffer *evb)
+void Channel::AddChunkAddr(dgram_t *dg, bin_t b)
+{
+    if (!chunkaddr_fits(b,hs_out_->chunk_addr_)) {
+        dprintf("%s #%" PRIu32 " chunk addr %d can't express %s\n",tintstr(),id_,hs_out_->chunk_addr_,b.str().c_str());
+        chunk_addr_overflow_ = true;
+        return;
+    }
+    dgram_add_chunkaddr(dg,b,hs_out_->chunk_addr_);
+}
+
+
+bool Channel::CloseOnChunkAddrOverflow(dgram_t *dg)
+{
+    if (!chunk_addr_overflow_)
+        return false;
+    // E.g. the content turned out larger than our handshake can address
+    dgram_free(dg);
+    chunk_addr_overflow_ = false;
+    dprintf("%s #%" PRIu32 " closing, beyond chunk addr %d\n",tintstr(),id_,hs_out_->chunk_addr_);
+    Close(CLOSE_SEND);
+    return true;
+}
+
+
+void Channel::AddAckRanges(dgram_t *dg)
+{
+    while (ack_agg_count_ > 0 && dgram_get_length(dg) < SWIFT_MAX_NONDATA_DGRAM_SIZE-SWIFT_ACK_RANGE_MAX_SIZE) {
+        // Widen to the run of chunks received
+        bin_t b = ack_agg_.find_filled();
+        if (b.is_none()) {
+            ack_agg_count_ = 0;
+            break;
+        }
+        ack_agg_.reset(b);
+        bin_t::uint_t start = b.base_offset(), end = start+b.base_length()-1;
+        while (start > 0 && ack_agg_.is_filled(bin_t(0,start-1)))
+            ack_agg_.reset(bin_t(0,--start));
+        while (ack_agg_.is_filled(bin_t(0,end+1)))
+            ack_agg_.reset(bin_t(0,++end));
+        ack_agg_count_ -= end-start+1;
+
+        binvector bv;
+        chunk64_to_bin64(start,end,&bv);
+        if (hs_out_->chunk_addr_ == POPT_CHUNK_ADDR_CHUNK32 && end > 0xffffffff)
+            chunk_addr_overflow_ = true;
+        else if (hs_out_->chunk_addr_ == POPT_CHUNK_ADDR_CHUNK32) {
+            dgram_add_8(dg, SWIFT_ACK);
+            dgram_add_32be(dg, (uint32_t)start);
+            dgram_add_32be(dg, (uint32_t)end);
+            dgram_add_64be(dg, ack_agg_owd_);
+            global_ack_msgs++;
+        } else if (hs_out_->chunk_addr_ == POPT_CHUNK_ADDR_CHUNK64) {
+            dgram_add_8(dg, SWIFT_ACK);
+            dgram_add_64be(dg, start);
+            dgram_add_64be(dg, end);
+            dgram_add_64be(dg, ack_agg_owd_);
+            global_ack_msgs++;
+        } else {
+            binvector::iterator iter;
+            for (iter=bv.begin(); iter!=bv.end(); iter++) {
+                dgram_add_8(dg, SWIFT_ACK);
+                AddChunkAddr(dg,*iter);
+                dgram_add_64be(dg, ack_agg_owd_);
+                global_ack_msgs++;
+            }
+        }
+        global_ack_chunks += end-start+1;
+
+        binvector::iterator iter;
+        for (iter=bv.begin(); iter!=bv.end(); iter++) {
+            have_out_.set(*iter);
+            if (iter->layer()>2)
+                data_in_dbl_ = *iter;
+        }
+        dprintf("%s #%" PRIu32 " +ack %" PRIu64 "-%" PRIu64 " %" PRIi64 "\n",
+                tintstr(),id_,(uint64_t)start,(uint64_t)end,ack_agg_owd_);
+    }
+    if (ack_agg_count_ > 0)
+        ack_agg_first_ = NOW;   // rest in the next datagram
+}
+
+
+void Channel::AddHave(dgram_t *dg)
 {
     if (!data_in_dbl_.is_none()) { // TODO: do redundancy better
-        evbuffer_add_8(evb, SWIFT_HAVE);
-        evbuffer_add_chunkaddr(evb,data_in_dbl_,hs_out_->chunk_addr_);
+        dgram_add_8(dg, SWIFT_HAVE);
+        AddChunkAddr(dg,data_in_dbl_);
         data_in_dbl_=bin_t::NONE;
     }
     if (DEBUGTRAFFIC)
@@ -953,8 +1341,8 @@ void Channel::AddHave(struct evbuffer *evb)
         // Say we have peaks
         for (int i=0; i<hashtree()->peak_count(); i++) {
             bin_t peak = hashtree()->peak(i);
-            evbuffer_add_8(evb, SWIFT_HAVE);
-            evbuffer_add_chunkaddr(evb,peak,hs_out_->chunk_addr_);
+            dgram_add_8(dg, SWIFT_HAVE);
+            AddChunkAddr(dg,peak);
             dprintf("%s #%" PRIu32 " +have %s\n",tintstr(),id_,peak.str().c_str());
         }
         return;
@@ -970,28 +1358,125 @@ void Channel::AddHave(struct evbuffer *evb)
         if (lt->am_source())
             transfer_ack_out_ptr = lt->ack_out_signed();
     }
-    for (int count=0; count<4; count++) {
-        bin_t ack = binmap_t::find_complement(have_out_, *(transfer_ack_out_ptr), 0); // FIXME: do rotating queue
-        if (ack.is_none())
-            break;
-        ack = transfer_ack_out_ptr->cover(ack);
-        have_out_.set(ack);
-        evbuffer_add_8(evb, SWIFT_HAVE);
-        evbuffer_add_chunkaddr(evb,ack,hs_out_->chunk_addr_);
+    bool logged = transfer_ack_out_ptr == transfer()->ack_out();
+    int count = 0;
+    if (logged && !have_log_synced_ && hs_in_ != NULL && hs_in_->Supports(SWIFT_HAVE_RUNS)
+            && transfer()->ttype() == FILE_TRANSFER && have_runs_pos_ < hashtree()->size_in_chunks()) {
+        // All had so far in one go, then what comes in after from the log
+        if (have_runs_pos_ == 0)
+            have_log_pos_ = transfer()->have_log_end();
+        have_log_synced_ = AddHaveRuns(dg);
+    } else if (logged && have_log_synced_ && have_log_pos_ >= transfer()->have_log_start()) {
+        // What came in since the last send
+        uint64_t end = transfer()->have_log_end();
+        while (count<4 && have_log_pos_<end) {
+            bin_t ack = transfer()->have_log_at(have_log_pos_++);
+            if (have_out_.is_filled(ack) || !transfer_ack_out_ptr->is_filled(ack))
+                continue;
+            AddHaveMsg(dg,transfer_ack_out_ptr->cover(ack));
+            count++;
+        }
+    } else {
+        // New channel or fallen behind the log: all not announced yet
+        for ( ; count<4; count++) {
+            bin_t ack = binmap_t::find_complement(have_out_, *(transfer_ack_out_ptr), 0);
+            if (ack.is_none())
+                break;
+            AddHaveMsg(dg,transfer_ack_out_ptr->cover(ack));
+        }
+        have_log_synced_ = logged && count<4;
+        have_log_pos_ = transfer()->have_log_end();
+    }
+    if (DEBUGTRAFFIC)
+        fprintf(stderr,"\n");
+}
 
-        if (DEBUGTRAFFIC)
-            fprintf(stderr," %i", bin_toUInt32(ack));
 
-        dprintf("%s #%" PRIu32 " +have %s\n",tintstr(),id_,ack.str().c_str());
+bool Channel::AddHaveRuns(dgram_t *dg)
+{
+    binmap_t *ack_out = transfer()->ack_out();
+    uint64_t nchunks = hashtree()->size_in_chunks();
+    int room = SWIFT_MAX_NONDATA_DGRAM_SIZE-(int)dgram_get_length(dg)-SWIFT_HAVE_RUNS_HDR_SIZE;
+
+    // Alternating runs had and not, from the first had, up to the last
+    uint64_t start = have_runs_pos_, pos = start;
+    bool filled = false;
+    std::vector<uint64_t> runs;
+    while (pos < nchunks && runs.size() < 0xffff) {
+        uint64_t end = pos;
+        while (end < nchunks && ack_out->is_filled(bin_t(0,end)) == filled) {
+            bin_t c = ack_out->cover(bin_t(0,end));
+            if (c.is_none() || !c.contains(bin_t(0,end)))
+                end++;
+            else
+                end = c.base_offset()+c.base_length();
+        }
+        end = std::min(end,nchunks);
+        if (!filled && runs.empty())
+            start = end;
+        else if (!filled && end == nchunks) {
+            pos = end;
+            break;
+        }
+        else {
+            int size = 1;
+            for (uint64_t v=end-pos; v>=0x80; v>>=7)
+                size++;
+            if (room < size)
+                break;
+            room -= size;
+            runs.push_back(end-pos);
+        }
+        pos = end;
+        filled = !filled;
+    }
+    have_runs_pos_ = runs.empty() ? start : pos;
+    if (runs.empty())
+        return have_runs_pos_ >= nchunks;
+    if (!hs_out_->IsChunkAddr64() && pos-1 > 0xffffffff) {
+        chunk_addr_overflow_ = true;
+        return true;
+    }
+
+    dgram_add_8(dg, SWIFT_HAVE_RUNS);
+    if (hs_out_->IsChunkAddr64())
+        dgram_add_64be(dg, start);
+    else
+        dgram_add_32be(dg, (uint32_t)start);
+    dgram_add_16be(dg, (uint16_t)runs.size());
+    pos = start;
+    for (size_t i=0; i<runs.size(); i++) {
+        dgram_add_varint(dg, runs[i]);
+        if (i%2 == 0) {
+            binvector bv;
+            chunk64_to_bin64(pos,pos+runs[i]-1,&bv);
+            binvector::iterator iter;
+            for (iter=bv.begin(); iter!=bv.end(); iter++)
+                have_out_.set(*iter);
+        }
+        pos += runs[i];
     }
+    dprintf("%s #%" PRIu32 " +have runs %" PRIu64 " n:%d\n",tintstr(),id_,start,(int)runs.size());
+    return have_runs_pos_ >= nchunks;
+}
+
+
+void Channel::AddHaveMsg(dgram_t *dg, bin_t ack)
+{
+    have_out_.set(ack);
+    dgram_add_8(dg, SWIFT_HAVE);
+    AddChunkAddr(dg,ack);
+
     if (DEBUGTRAFFIC)
-        fprintf(stderr,"\n");
+        fprintf(stderr," %i", bin_toUInt32(ack));
+
+    dprintf("%s #%" PRIu32 " +have %s\n",tintstr(),id_,ack.str().c_str());
 }
 
 
-void    Channel::Recv(struct evbuffer *evb)
+void    Channel::Recv(dgram_t *dg)
 {
-    dprintf("%s #%" PRIu32 " recvd %ib\n",tintstr(),id_,(int)evbuffer_get_length(evb)+4);
+    dprintf("%s #%" PRIu32 " recvd %ib\n",tintstr(),id_,(int)dgram_get_length(dg)+4);
     dgrams_rcvd_++;
 
     if (!transfer()->IsOperational()) {
@@ -1000,7 +1485,7 @@ void    Channel::Recv(struct evbuffer *evb)
         return;
     }
 
-    lastrecvwaskeepalive_ = (evbuffer_get_length(evb) == 0);
+    lastrecvwaskeepalive_ = (dgram_get_length(dg) == 0);
     if (lastrecvwaskeepalive_)
         // Update speed measurements such that they decrease when DL stops
         transfer()->OnRecvData(0);
@@ -1013,94 +1498,97 @@ void    Channel::Recv(struct evbuffer *evb)
         //fprintf(stderr,"%s #%" PRIu32 " sendctrl rtt init %" PRIi64 "\n",tintstr(),id_,rtt_avg_);
     }
 
-    bin_t data = evbuffer_get_length(evb) ? bin_t::NONE : bin_t::ALL;
+    bin_t data = dgram_get_length(dg) ? bin_t::NONE : bin_t::ALL;
 
     if (DEBUGTRAFFIC)
-        fprintf(stderr,"recv c%" PRIu32 ": size " PRISIZET "\n", id(), evbuffer_get_length(evb));
+        fprintf(stderr,"recv c%" PRIu32 ": size " PRISIZET "\n", id(), dgram_get_length(dg));
 
     Handshake *hishs = NULL;
     if (hs_in_ == NULL) { // first reply from client
         if (hs_out_->version_ == VER_SWIFT_LEGACY) // I sent PPSPP_v1 HS, did not respond, now trying legacy
-            hishs = StaticOnHandshake(peer_,id(),true,VER_SWIFT_LEGACY,evb);
+            hishs = StaticOnHandshake(peer_,id(),true,VER_SWIFT_LEGACY,dg);
         else
-            hishs = StaticOnHandshake(peer_,id(),false,VER_PPSPP_v1,evb);
+            hishs = StaticOnHandshake(peer_,id(),false,VER_PPSPP_v1,dg);
         if (hishs == NULL)
             return;
         else
             OnHandshake(hishs);
     }
-    while (evbuffer_get_length(evb) && send_control_!=CLOSE_CONTROL) {
-        uint8_t type = evbuffer_remove_8(evb);
+    while (dgram_get_length(dg) && send_control_!=CLOSE_CONTROL) {
+        uint8_t type = dgram_remove_8(dg);
 
         if (DEBUGTRAFFIC)
             fprintf(stderr,"GOT %d\n", type);
 
         switch (type) {
         case SWIFT_HANDSHAKE: // explicit close
-            hishs = StaticOnHandshake(peer_,id(),true,hs_in_->version_,evb);
+            hishs = StaticOnHandshake(peer_,id(),true,hs_in_->version_,dg);
             if (hishs == NULL)
                 return;
             OnHandshake(hishs);
             break;
         case SWIFT_DATA:
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
-                OnDataZeroState(evb);
+                OnDataZeroState(dg);
             else
-                data=OnData(evb);
+                data=OnData(dg);
             break;
         case SWIFT_HAVE:
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
-                OnHaveZeroState(evb);
+                OnHaveZeroState(dg);
             else
-                OnHave(evb);
+                OnHave(dg);
+            break;
+        case SWIFT_HAVE_RUNS:
+            OnHaveRuns(dg);
             break;
         case SWIFT_ACK:
-            OnAck(evb);
+            OnAck(dg);
             break;
         case SWIFT_INTEGRITY:
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
-                OnHashZeroState(evb);
+                OnHashZeroState(dg);
             else
-                OnHash(evb);
+                OnHash(dg);
             break;
         case SWIFT_SIGNED_INTEGRITY: // PPSP
-            OnSignedHash(evb);
+            OnSignedHash(dg);
             break;
         case SWIFT_REQUEST:
-            OnHint(evb);
+            OnHint(dg);
             break;
         case SWIFT_CANCEL: // PPSP
-            OnCancel(evb);
+            OnCancel(dg);
             break;
         case SWIFT_PEX_RESv4:
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
-                OnPexAddZeroState(evb,AF_INET);
+                OnPexAddZeroState(dg,AF_INET);
             else
-                OnPexAdd(evb,AF_INET);
+                OnPexAdd(dg,AF_INET);
             break;
         case SWIFT_PEX_RESv6: // PPSP
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
-                OnPexAddZeroState(evb,AF_INET6);
+                OnPexAddZeroState(dg,AF_INET6);
             else
-                OnPexAdd(evb,AF_INET6);
+                OnPexAdd(dg,AF_INET6);
             break;
         case SWIFT_PEX_REScert: // PPSP
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
-                OnPexAddCertZeroState(evb);
+                OnPexAddCertZeroState(dg);
             else
-                OnPexAddCert(evb);
+                OnPexAddCert(dg);
             break;
         case SWIFT_PEX_REQ:
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
-                OnPexReqZeroState(evb);
+                OnPexReqZeroState(dg);
             else
                 OnPexReq();
             break;
         case SWIFT_CHOKE: // PPSP
-            OnChoke(evb);
+            OnChoke(dg);
             break;
         case SWIFT_UNCHOKE: // PPSP
-            OnUnchoke(evb);
+            OnUnchoke(dg);
             break;
         default:
             dprintf("%s #%" PRIu32 " ?msg id unknown %i\n",tintstr(),id_,(int)type);
@@ -1136,7 +1624,7 @@ void Channel::CloseOnError()
  * Arno: FAXME: HASH+DATA should be handled as a transaction: only when the
  * hashes check out should they be stored in the hashtree, otherwise revert.
  */
-void Channel::OnHash(struct evbuffer *evb)
+void Channel::OnHash(dgram_t *dg)
 {
     if (hs_in_->cont_int_prot_ != POPT_CONT_INT_PROT_MERKLE
             && hs_in_->cont_int_prot_ != POPT_CONT_INT_PROT_UNIFIED_MERKLE) {
@@ -1144,16 +1632,16 @@ void Channel::OnHash(struct evbuffer *evb)
         return;
     }
 
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = dgram_remove_chunkaddr(dg,hs_in_->chunk_addr_);
     if (bv.size() == 0 || bv.size() > 1) {
         // chunk spec for hash must be power-of-2 range, so must fit in single bin
         dprintf("%s #%" PRIu32 " ?hash bad chunk spec\n",tintstr(),id_);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dgram_drain(dg, dgram_get_length(dg));
         Close(CLOSE_DO_NOT_SEND);
         return;
     }
     bin_t pos = bv.front();
-    Sha1Hash hash = evbuffer_remove_hash(evb);
+    Sha1Hash hash = dgram_remove_hash(dg);
 
     dprintf("%s #%" PRIu32 " -hash %s\n",tintstr(),id_,pos.str().c_str());
     if (hashtree() != NULL && (hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_MERKLE
@@ -1273,36 +1761,36 @@ bin_t Channel::DequeueHintOut(uint64_t size)
 }
 
 
-bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted data
+bin_t Channel::OnData(dgram_t *dg)     // TODO: HAVE NONE for corrupted data
 {
 
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = dgram_remove_chunkaddr(dg,hs_in_->chunk_addr_);
     if (bv.size() == 0 || bv.size() > 1) {
         // Chunk spec must denote single chunk
         dprintf("%s #%" PRIu32 " ?data bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dgram_drain(dg, dgram_get_length(dg));
         return bin_t::NONE;
     }
     bin_t pos = bv.front();
     tint peer_time = TINT_NEVER;
     if (hs_out_->version_ == VER_PPSPP_v1)
-        peer_time = evbuffer_remove_64be(evb);
+        peer_time = dgram_remove_64be(dg);
 
     // Arno: Assuming DATA last message in datagram
-    if (evbuffer_get_length(evb) > transfer()->chunk_size()) {
+    if (dgram_get_length(dg) > transfer()->chunk_size()) {
         dprintf("%s #%" PRIu32 " !data chunk size mismatch %s: exp %" PRIu32 " got " PRISIZET "\n",tintstr(),id_,
-                pos.str().c_str(), transfer()->chunk_size(), evbuffer_get_length(evb));
+                pos.str().c_str(), transfer()->chunk_size(), dgram_get_length(dg));
         fprintf(stderr,"WARNING: chunk size mismatch: exp %" PRIu32 " got " PRISIZET "\n",transfer()->chunk_size(),
-                evbuffer_get_length(evb));
+                dgram_get_length(dg));
     }
 
-    int length = (evbuffer_get_length(evb) < transfer()->chunk_size()) ? evbuffer_get_length(
-                     evb) : transfer()->chunk_size();
+    int length = (dgram_get_length(dg) < transfer()->chunk_size()) ? dgram_get_length(
+                     dg) : transfer()->chunk_size();
     if (!transfer()->ack_out()->is_empty(pos)) {
         // Arno, 2012-01-24: print message for duplicate
         dprintf("%s #%" PRIu32 " Ddata %s\n",tintstr(),id_,pos.str().c_str());
-        evbuffer_drain(evb, length);
+        dgram_drain(dg, length);
         data_in_ = tintbin(TINT_NEVER,transfer()->ack_out()->cover(pos));
 
         // Arno, 2012-01-24: Make sure data interarrival periods don't get
@@ -1311,7 +1799,7 @@ bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted
         return bin_t::NONE;
     }
 
-    uint8_t *data = evbuffer_pullup(evb, length);
+    uint8_t *data = dgram_pullup(dg);
 
     //fprintf(stderr,"OnData: Got chunk %d / %" PRIi64 "\n", length, swift::SeqComplete(transfer()->fd()) );
 
@@ -1320,7 +1808,7 @@ bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted
                                || hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_UNIFIED_MERKLE)) {
         // Check integrity
         if (!hashtree()->OfferData(pos, (char*)data, length)) {
-            evbuffer_drain(evb, length);
+            dgram_drain(dg, length);
             dprintf("%s #%" PRIu32 " !data %s\n",tintstr(),id_,pos.str().c_str());
             return bin_t::NONE;
         }
@@ -1336,7 +1824,7 @@ bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted
             transfer()->ack_out()->set(pos);
     }
 
-    evbuffer_drain(evb, length);
+    dgram_drain(dg, length);
     dprintf("%s #%" PRIu32 " -data %s\n",tintstr(),id_,pos.str().c_str());
 
     if (DEBUGTRAFFIC)
@@ -1349,11 +1837,13 @@ bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted
     //    transfer()->OnRecvData( pow((double)2,(double)5)*((double)transfer()->chunk_size()) );
     transfer()->OnRecvData(transfer()->chunk_size());
 
-    data_in_ = tintbin(NOW,bin_t::NONE);
-    data_in_.bin = pos;
+    // Acked with the others since the last ACK, see AddAckRanges()
+    if (ack_agg_count_ == 0)
+        ack_agg_first_ = NOW;
+    ack_agg_.set(pos);
+    ack_agg_count_++;
     // Ric: the time of the ack is the owd.
-    if (peer_time!=TINT_NEVER)
-        data_in_.time = NOW - peer_time;
+    ack_agg_owd_ = peer_time!=TINT_NEVER ? NOW - peer_time : NOW;
 
     UpdateDIP(pos);
     CleanHintOut(pos);
@@ -1373,22 +1863,10 @@ bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted
 }
 
 
-void Channel::UpdateRTT(tint owd)
+void Channel::UpdateRTT(int acked, tint rtt, tint owd)
 {
-
-    // one-way delay calculations
-    std::pair <tint,tint> delay(owd, NOW);
-    owd_current_.push_front(delay);
-
-    if (owd_min_bin_start_+ LEDBAT_ROLLOVER < NOW) {
-        owd_min_bin_start_ = NOW;
-        owd_min_bin_ = owd_min_bin_ == 9 ? 0 : owd_min_bin_ + 1;
-        owd_min_bins_[owd_min_bin_] = owd;
-    } else if (owd_min_bins_[owd_min_bin_]>owd)
-        owd_min_bins_[owd_min_bin_] = owd;
-
-    ack_rcvd_recent_++;
-
+    cc_->OnAck(acked,rtt,owd);
+    ack_rcvd_recent_ += acked;
 }
 
 void Channel::UpdateDIP(bin_t pos)
@@ -1422,8 +1900,8 @@ void Channel::UpdateDIP(bin_t pos)
             rtt_avg_ = diff;
         }
         // Ric: check if our values are wrong!
-        tint owd = data_in_.time;
-        if (owd != TINT_NEVER && owd<<2 > rtt_avg_) {
+        tint owd = ack_agg_owd_;
+        if (owd<<2 > rtt_avg_) {
             dprintf("%s #%" PRIu32 " rtt adjust %" PRIi64 " -> %" PRIi64 "\n",tintstr(),id_,rtt_avg_,diff);
             rtt_avg_ = owd<<2;
         }
@@ -1432,21 +1910,26 @@ void Channel::UpdateDIP(bin_t pos)
 }
 
 
-void Channel::OnAck(struct evbuffer *evb)
+void Channel::OnAck(dgram_t *dg)
 {
 
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = dgram_remove_chunkaddr(dg,hs_in_->chunk_addr_);
     if (bv.size() == 0) {
         // Could not parse chunk spec
         dprintf("%s #%" PRIu32 " ?ack bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dgram_drain(dg, dgram_get_length(dg));
         return;
     }
-    tint peer_owd = evbuffer_remove_64be(evb);
+    tint peer_owd = dgram_remove_64be(dg);
 
     munro_ack_rcvd_ = true;
 
+    // A range may be split into bins: credit each, then one RTT and delay
+    // sample for the lot
+    int acked = 0;
+    tint last_sent = TINT_NEVER;
+    bool any_resent = false;
     binvector::iterator iter;
     for (iter=bv.begin(); iter != bv.end(); iter++) {
         bin_t ackd_pos = *iter;
@@ -1463,68 +1946,52 @@ void Channel::OnAck(struct evbuffer *evb)
 
         //fprintf(stderr,"OnAck: got bin %s is_complete %d\n", ackd_pos.str(), (int)ack_in_.is_complete_arno( transfer()->ack_out()->get_height() ));
 
-        int di = 0, ri = 0;
-        // find an entry for the send (data out) event
-        while (di<data_out_.size() && (data_out_[di]==tintbin() || !ackd_pos.contains(data_out_[di].bin)))
-            di++;
-        // FUTURE: delayed acks
-        // rule out retransmits
+        // find the sends (data out events) acked. Acked retransmits still
+        // queued are skipped when dequeued.
         // Ric: by ruling out retransmits we screw up ledbat calculations
-        while (ri<data_out_tmo_.size() && !ackd_pos.contains(data_out_tmo_[ri].bin))
-            ri++;
-
-        dprintf("%s #%" PRIu32 " %cack %s owd:%" PRIi64 "\n",tintstr(),id_,
-                di==data_out_.size() ? (ri==data_out_tmo_.size() ? '?':'R') : '-',ackd_pos.str().c_str(),peer_owd);
-
-        if (di!=data_out_.size()) {
-            // Ric: FIXME assuming direct sending of acks
-            tint rtt = NOW-data_out_[di].time;
-
-            // Ric: quickly adapt to new network changes! (with large owd samples the previous rtt values influence
-            //if (owd > rtt_avg_)
-            //   rtt_avg_ = (rtt_avg_*3 + rtt) >> 2;
-            //else
-            rtt_avg_ = (rtt_avg_*7 + rtt) >> 3;
-            dev_avg_ = (dev_avg_*3 + tintabs(rtt-rtt_avg_)) >> 2;
-            assert(data_out_[di].time!=TINT_NEVER);
-            dprintf("%s #%" PRIu32 " rtt:%" PRIu64 ", rtt_avg:%" PRIu64 " dev:%" PRIu64 "\n", tintstr(), id_,rtt, rtt_avg_,
-                    dev_avg_);
-
-            UpdateRTT(peer_owd);
-            dprintf("%s #%" PRIu32 " setting null %s\n",tintstr(),id_, data_out_[di].bin.str().c_str());
-            // early loss detection by packet reordering
-            /* TODO do we really need it?
-            for (int re=0; re<di-MAX_REORDERING; re++) {
-               if (data_out_[re]==tintbin())
-                   continue;
-               ack_not_rcvd_recent_++;
-               data_out_size_--;
-               data_out_tmo_.push_back(data_out_[re].bin);
-               dprintf("%s #%" PRIu32 " Rdata %s\n",tintstr(),id_,data_out_.front().bin.str().c_str());
-               data_out_cap_ = bin_t::ALL;
-               data_out_[re] = tintbin();
-            }*/
-            data_out_size_--;
-            data_out_[di]=tintbin();
-        } else if (ri!=data_out_tmo_.size()) {
-            // Ric: TODO test
-            //UpdateRTT(peer_owd);
-            data_out_tmo_[ri]=tintbin();
-        }
-
-    }
-
-    // clear zeroed items
-    // TODO: do we really need it?
-    /*while (!data_out_.empty() && ( data_out_.front()==tintbin() ||
-            ack_in_.is_filled(data_out_.front().bin) ) ) {
-        dprintf("%s #%" PRIu32 " removing %s\n",tintstr(),id_, data_out_.front().bin.str().c_str());
-        data_out_.pop_front();
+        tint sent;
+        bool resent;
+        int nackd = data_out_.remove(ackd_pos,&sent,&resent);
+
+        dprintf("%s #%" PRIu32 " %cack %s owd:%" PRIi64 " n:%d\n",tintstr(),id_,
+                nackd==0 ? '?' : '-',ackd_pos.str().c_str(),peer_owd,nackd);
+
+        if (nackd > 0) {
+            acked += nackd;
+            any_resent |= resent;
+            if (last_sent == TINT_NEVER || sent > last_sent)
+                last_sent = sent;
+        }
+    }
+
+    if (acked > 0) {
+        // Ric: FIXME assuming direct sending of acks
+        // A range ack goes out on the latest of its chunks to arrive, or
+        // at most ACK_DELAY after the first.
+        // Paced DATA is stamped with when it was to leave. Acked before
+        // that means the qdisc ignores SO_TXTIME, i.e. isn't fq or etf.
+        tint rtt = NOW-last_sent;
+        if (rtt < 0) {
+            if (PACING == PACING_TXTIME) {
+                print_error("qdisc ignores SO_TXTIME, pacing in swift");
+                PACING = PACING_USER;
+            }
+            rtt = 0;
+        }
+
+        // Ric: quickly adapt to new network changes! (with large owd samples the previous rtt values influence
+        //if (owd > rtt_avg_)
+        //   rtt_avg_ = (rtt_avg_*3 + rtt) >> 2;
+        //else
+        rtt_avg_ = (rtt_avg_*7 + rtt) >> 3;
+        dev_avg_ = (dev_avg_*3 + tintabs(rtt-rtt_avg_)) >> 2;
+        dprintf("%s #%" PRIu32 " rtt:%" PRIu64 ", rtt_avg:%" PRIu64 " dev:%" PRIu64 "\n", tintstr(), id_,rtt, rtt_avg_,
+                dev_avg_);
+
+        // Which send of a resent chunk was acked is unknown, so no RTT
+        // sample for the congestion controller
+        UpdateRTT(acked,any_resent ? 0 : rtt,peer_owd);
     }
-    while (!data_out_tmo_.empty() && ( data_out_tmo_.front()==tintbin() ||
-            ack_in_.is_filled(data_out_tmo_.front().bin) ) )
-        data_out_tmo_.pop_front();
-    assert(data_out_.empty() || data_out_.front().time!=TINT_NEVER);*/
 }
 
 
@@ -1533,45 +2000,39 @@ void Channel::TimeoutDataOut()
     // losses: timeouted packets
     // Ric: aggressively timeout only if in active transmission (using cc like LEDBAT)
     tint timeout = NOW - ack_timeout();
-    if (send_control_!=LEDBAT_CONTROL)
+    if (send_control_!=CC_CONTROL)
         timeout -= ack_timeout()<<1;
 
-    while (!data_out_.empty() &&
-            (data_out_.front().time<timeout || data_out_.front()==tintbin())) {
-        if (data_out_.front()!=tintbin() && ack_in_.is_empty(data_out_.front().bin)) {
+    while (!data_out_.empty() && data_out_.front().time<timeout) {
+        if (ack_in_.is_empty(data_out_.front().bin)) {
             ack_not_rcvd_recent_++;
+            data_out_lost_++;
+            cc_->OnLoss();
             data_out_cap_ = bin_t::ALL;
             // Ric: keep the original timing... otherwise calculations are wrong once
             //      we get the ack back
             data_out_tmo_.push_back(data_out_.front());
-            data_out_size_--;
             dprintf("%s #%" PRIu32 " Tdata %s\n",tintstr(),id_,data_out_.front().bin.str().c_str());
         }
         data_out_.pop_front();
     }
-    // clear retransmit queue of older items
-    while (!data_out_tmo_.empty() && (data_out_tmo_.front()==tintbin()
+    // clear retransmit queue of older and acked items
+    while (!data_out_tmo_.empty() && (ack_in_.is_filled(data_out_tmo_.front().bin)
                                       || data_out_tmo_.front().time<NOW-MAX_POSSIBLE_RTT)) {
         data_out_tmo_.pop_front();
-        //data_out_size_--;
-    }
-
-    // use the same value to clean the delay samples
-    while (owd_current_.size() > 4 && owd_current_.back().second < timeout) {
-        owd_current_.pop_back();
     }
 }
 
 
-void Channel::OnHave(struct evbuffer *evb)
+void Channel::OnHave(dgram_t *dg)
 {
 
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = dgram_remove_chunkaddr(dg,hs_in_->chunk_addr_);
     if (bv.size() == 0) {
         // Could not parse chunk spec
         dprintf("%s #%" PRIu32 " ?have bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dgram_drain(dg, dgram_get_length(dg));
         return;
     }
     binvector::iterator iter;
@@ -1580,21 +2041,59 @@ void Channel::OnHave(struct evbuffer *evb)
 
         if (ackd_pos.is_none()) // safety catch
             return; // wow, peer has hashes
+        OnHaveBin(ackd_pos);
+    }
+}
 
-        // PPPLUG
-        if (!hashtree()->is_complete() && transfer()->ttype() == FILE_TRANSFER) {
-            FileTransfer *ft = (FileTransfer *)transfer();
 
-            // Ric: update the availability if needed
-            ft->availability()->set(id_, ack_in_, ackd_pos);
-        }
+void Channel::OnHaveBin(bin_t ackd_pos)
+{
+    // PPPLUG
+    if (!hashtree()->is_complete() && transfer()->ttype() == FILE_TRANSFER) {
+        FileTransfer *ft = (FileTransfer *)transfer();
 
-        ack_in_.set(ackd_pos);
-        dprintf("%s #%" PRIu32 " -have %s\n",tintstr(),id_,ackd_pos.str().c_str());
+        // Ric: update the availability if needed
+        ft->availability()->set(id_, ack_in_, ackd_pos);
+    }
 
-        if (transfer()->ttype() == LIVE_TRANSFER) {
-            OnHaveLive(ackd_pos);
+    ack_in_.set(ackd_pos);
+    dprintf("%s #%" PRIu32 " -have %s\n",tintstr(),id_,ackd_pos.str().c_str());
+
+    if (transfer()->ttype() == LIVE_TRANSFER) {
+        OnHaveLive(ackd_pos);
+    }
+}
+
+
+void Channel::OnHaveRuns(dgram_t *dg)
+{
+    uint64_t pos, max;
+    if (hs_in_->IsChunkAddr64()) {
+        pos = dgram_remove_64be(dg);
+        max = SWIFT_CHUNK64_MAX;
+    } else {
+        pos = dgram_remove_32be(dg);
+        max = ((uint64_t)1)<<32;
+    }
+    int nruns = dgram_remove_16be(dg);
+    // A zero-state seeder has it all and keeps no peer binmaps
+    bool ignore = transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState();
+    for (int i=0; i<nruns; i++) {
+        uint64_t len;
+        if (!dgram_remove_varint(dg,&len) || len > max || pos+len > max) {
+            dprintf("%s #%" PRIu32 " ?have bad runs\n",tintstr(),id_);
+            Close(CLOSE_DO_NOT_SEND);
+            dgram_drain(dg, dgram_get_length(dg));
+            return;
         }
+        if (i%2 == 0 && len > 0 && !ignore) {
+            binvector bv;
+            chunk64_to_bin64(pos,pos+len-1,&bv);
+            binvector::iterator iter;
+            for (iter=bv.begin(); iter!=bv.end(); iter++)
+                OnHaveBin(*iter);
+        }
+        pos += len;
     }
 }
 
@@ -1620,7 +2119,7 @@ void Channel::OnHaveLive(bin_t ackd_pos)
 
                     // 3. Empty all bins before start of window
                     binvector cbv;
-                    swift::chunk32_to_bin32(0, firstbasepos.layer_offset(), &cbv); // firsbasepos exclusive
+                    swift::chunk64_to_bin64(0, firstbasepos.layer_offset(), &cbv); // firsbasepos exclusive
                     binvector::iterator iter;
                     for (iter=cbv.begin(); iter != cbv.end(); iter++) {
                         bin_t cpos = *iter;
@@ -1643,15 +2142,15 @@ void Channel::OnHaveLive(bin_t ackd_pos)
 }
 
 
-void Channel::OnHint(struct evbuffer *evb)
+void Channel::OnHint(dgram_t *dg)
 {
 
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = dgram_remove_chunkaddr(dg,hs_in_->chunk_addr_);
     if (bv.size() == 0) {
         // Could not parse chunk spec
         dprintf("%s #%" PRIu32 " ?hint bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dgram_drain(dg, dgram_get_length(dg));
         return;
     }
 
@@ -1681,17 +2180,17 @@ void Channel::OnHint(struct evbuffer *evb)
 }
 
 /*
- * Read full HANDSHAKE message from evb outside of a Channel context.
+ * Read full HANDSHAKE message from dg outside of a Channel context.
  */
 Handshake *Channel::StaticOnHandshake(Address &addr, uint32_t cid, bool ver_known, popt_version_t ver,
-                                      struct evbuffer *evb)
+                                      dgram_t *dg)
 {
     dprintf("StaticOnHandshake: %s id %" PRIu32 " known %d ver %d\n", addr.str().c_str(), cid, (int)ver_known, ver);
 
     Handshake *hs = new Handshake();
 
     if (!ver_known) {
-        uint8_t msgid = evbuffer_remove_8(evb);
+        uint8_t msgid = dgram_remove_8(dg);
         if (msgid == SWIFT_INTEGRITY)
             ver = VER_SWIFT_LEGACY;
         else if (msgid == SWIFT_HANDSHAKE)
@@ -1708,34 +2207,35 @@ Handshake *Channel::StaticOnHandshake(Address &addr, uint32_t cid, bool ver_know
         hs->version_ = VER_SWIFT_LEGACY;
         if (cid == 0) {
             // He is initiating. Initiating handshake has SWIFT_HASH + root hash, reply doesn't
-            if (evbuffer_get_length(evb)<4+1+4+Sha1Hash::SIZE) {
-                dprintf("%s #0 incorrect size %i initial handshake packet %s\n", tintstr(),(int)evbuffer_get_length(evb),
+            if (dgram_get_length(dg)<4+1+4+Sha1Hash::SIZE) {
+                dprintf("%s #0 incorrect size %i initial handshake packet %s\n", tintstr(),(int)dgram_get_length(dg),
                         addr.str().c_str());
                 delete hs;
                 return NULL;
             }
-            bin_t pos = bin_fromUInt32(evbuffer_remove_32be(evb));
+            bin_t pos = bin_fromUInt32(dgram_remove_32be(dg));
             if (!pos.is_all()) {
                 dprintf("%s #%" PRIu32 " ?hs that is not the root hash %s\n",tintstr(), cid, addr.str().c_str());
                 delete hs;
                 return NULL;
             }
-            Sha1Hash roothash = evbuffer_remove_hash(evb);
+            Sha1Hash roothash = dgram_remove_hash(dg);
             SwarmID swarmid(roothash);
             hs->SetSwarmID(swarmid);
             dprintf("%s #%" PRIu32 " -hash ALL %s\n",tintstr(),cid,swarmid.hex().c_str());
         }
 
         // Read SWIFT_HANDSHAKE
-        uint8_t msgid = evbuffer_remove_8(evb);
-        hs->peer_channel_id_ = evbuffer_remove_32be(evb);
+        uint8_t msgid = dgram_remove_8(dg);
+        hs->peer_channel_id_ = dgram_remove_32be(dg);
         hs->ResetToLegacy();
 
         dprintf("%s #%" PRIu32 " -hs swift %x\n",tintstr(),cid,hs->peer_channel_id_);
     } else if (ver == VER_PPSPP_v1) {
         // IETF PPSP compliant
         dprintf("%s #%" PRIu32 " -hs ietf ppsp\n", tintstr(),cid);
-        hs->peer_channel_id_ = evbuffer_remove_32be(evb);
+        hs->peer_channel_id_ = dgram_remove_32be(dg);
+        hs->supp_msgs_ = SWIFT_SUPP_MSGS_STANDARD;  // unless said otherwise
         bool end=false;
         uint8_t size8 = 0, i8=0;
         uint16_t size = 0;
@@ -1743,68 +2243,73 @@ Handshake *Channel::StaticOnHandshake(Address &addr, uint32_t cid, bool ver_know
         uint8_t *msgbitmapbytes = NULL;
         SwarmID swarmid;
         std::ostringstream cross;
-        while (!end && evbuffer_get_length(evb) > 0) {
-            popt_t poid = (popt_t)evbuffer_remove_8(evb);
+        while (!end && dgram_get_length(dg) > 0) {
+            popt_t poid = (popt_t)dgram_remove_8(dg);
             //dprintf("%s #%" PRIu32 " -hs popt %d\n", tintstr(),cid, (int)poid );
             switch (poid) {
             case POPT_VERSION:
-                hs->version_ = (popt_version_t)evbuffer_remove_8(evb);
+                hs->version_ = (popt_version_t)dgram_remove_8(dg);
                 cross << "v" << hs->version_ << " ";
                 break;
             case POPT_MIN_VERSION:
-                hs->min_version_ = (popt_version_t)evbuffer_remove_8(evb);
+                hs->min_version_ = (popt_version_t)dgram_remove_8(dg);
                 cross << "nv" << hs->min_version_ << " ";
                 break;
             case POPT_SWARMID:
-                size = evbuffer_remove_16be(evb);
-                if (size > POPT_MAX_SWARMID_SIZE || evbuffer_get_length(evb) < size) {
+                size = dgram_remove_16be(dg);
+                if (size > POPT_MAX_SWARMID_SIZE || dgram_get_length(dg) < size) {
                     dprintf("%s #%" PRIu32 " ?hs popt swarmid too big\n",tintstr(),cid);
                     delete hs;
                     return NULL;
                 }
                 swarmidbytes = new uint8_t[size];
-                evbuffer_remove(evb,swarmidbytes,size);
+                dgram_remove(dg,swarmidbytes,size);
                 swarmid = SwarmID(swarmidbytes,size);
                 delete swarmidbytes;
                 hs->SetSwarmID(swarmid);
                 cross << "sid " << swarmid.hex() << " ";
                 break;
             case POPT_CONT_INT_PROT:
-                hs->cont_int_prot_ = (popt_cont_int_prot_t)evbuffer_remove_8(evb);
+                hs->cont_int_prot_ = (popt_cont_int_prot_t)dgram_remove_8(dg);
                 cross << "cipm " << hs->cont_int_prot_ << " ";
                 break;
             case POPT_MERKLE_HASH_FUNC:
-                hs->merkle_func_ = (popt_merkle_func_t)evbuffer_remove_8(evb);
+                hs->merkle_func_ = (popt_merkle_func_t)dgram_remove_8(dg);
                 cross << "mhf " << hs->merkle_func_ << " ";
                 break;
             case POPT_LIVE_SIG_ALG:
-                hs->live_sig_alg_ = (popt_live_sig_alg_t)evbuffer_remove_8(evb);
+                hs->live_sig_alg_ = (popt_live_sig_alg_t)dgram_remove_8(dg);
                 cross << "lsa " << hs->live_sig_alg_ << " ";
                 break;
             case POPT_CHUNK_ADDR:
-                hs->chunk_addr_ = (popt_chunk_addr_t)evbuffer_remove_8(evb);
+                hs->chunk_addr_ = (popt_chunk_addr_t)dgram_remove_8(dg);
                 cross << "cam " << hs->chunk_addr_ << " ";
                 break;
             case POPT_LIVE_DISC_WND:
                 if (hs->chunk_addr_ == POPT_CHUNK_ADDR_BIN32 || hs->chunk_addr_ == POPT_CHUNK_ADDR_CHUNK32)
-                    hs->live_disc_wnd_ = evbuffer_remove_32be(evb);
+                    hs->live_disc_wnd_ = dgram_remove_32be(dg);
                 else
-                    hs->live_disc_wnd_ = evbuffer_remove_64be(evb);
+                    hs->live_disc_wnd_ = dgram_remove_64be(dg);
                 cross << "ldw " << std::hex << hs->live_disc_wnd_ << std::dec << " ";
                 break;
             case POPT_SUPP_MSGS:
-                size8 = evbuffer_remove_8(evb);
-                if (size8 > 8 || evbuffer_get_length(evb) < size8) {
+                size8 = dgram_remove_8(dg);
+                if (size8 > 8 || dgram_get_length(dg) < size8) {
                     dprintf("%s #%" PRIu32 " ?hs popt supp msgs too big\n",tintstr(),cid);
                     delete hs;
                     return NULL;
                 }
-                msgbitmapbytes = evbuffer_pullup(evb,size8);
-                evbuffer_drain(evb, size);
+                msgbitmapbytes = dgram_pullup(dg);
+                hs->supp_msgs_ = 0;
                 cross << "msgs " << std::hex;
-                for (i8=0; i8<size8; i8++)
+                for (i8=0; i8<size8; i8++) {
+                    for (int b=0; b<8; b++)
+                        if (msgbitmapbytes[i8] & (0x80>>b))
+                            hs->supp_msgs_ |= ((uint64_t)1)<<(i8*8+b);
                     cross << (int)msgbitmapbytes[i8];
-                cross << std::dec;
+                }
+                cross << std::dec << " ";
+                dgram_drain(dg, size8);
                 break;
             case POPT_END:
                 end = true;
@@ -1848,9 +2353,8 @@ void Channel::OnHandshake(Handshake *hishs)
 
     // Self-connection check
     if (!SELF_CONN_OK) {
-        uint32_t try_id = DecodeID(hishs->peer_channel_id_);
         // Arno, 2012-05-29: Fixed duplicate test
-        if (channel(try_id) == this) {
+        if (ChannelOfID(hishs->peer_channel_id_) == this) {
             // this is a self-connection
             dprintf("%s #%" PRIu32 " -hs closing self\n",tintstr(),id_);
             Close(CLOSE_SEND);
@@ -1862,6 +2366,15 @@ void Channel::OnHandshake(Handshake *hishs)
 
     if (hs_in_->version_ == VER_SWIFT_LEGACY)
         hs_out_->ResetToLegacy(); // he speaks legacy, so will I
+    else if (hs_in_->IsChunkAddr64() && !hs_out_->IsChunkAddr64() && last_send_time_ == 0) {
+        // He addresses 64-bit, content may be beyond our 32. Our handshake
+        // is not out yet, so we can still switch.
+        hs_out_->ToChunkAddr64();
+        dprintf("%s #%" PRIu32 " -hs chunk addr 64 %d\n",tintstr(),id_,hs_out_->chunk_addr_);
+    }
+
+    // Talked to before: slow start from the window it had
+    GetPath();
 
     // FUTURE: channel forking
     if (is_established()) // when this was reply to our HS
@@ -1869,15 +2382,15 @@ void Channel::OnHandshake(Handshake *hishs)
 }
 
 
-void Channel::OnCancel(struct evbuffer *evb)
+void Channel::OnCancel(dgram_t *dg)
 {
 
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = dgram_remove_chunkaddr(dg,hs_in_->chunk_addr_);
     if (bv.size() == 0) {
         // Could not parse chunk spec
         dprintf("%s #%" PRIu32 " ?cancel bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dgram_drain(dg, dgram_get_length(dg));
         return;
     }
 
@@ -1951,9 +2464,9 @@ void Channel::OnCancel(struct evbuffer *evb)
 }
 
 
-void Channel::OnPexAdd(struct evbuffer *evb, int family)
+void Channel::OnPexAdd(dgram_t *dg, int family)
 {
-    Address addr = evbuffer_remove_pexaddr(evb,family);
+    Address addr = dgram_remove_pexaddr(dg,family);
     dprintf("%s #%" PRIu32 " -pex %s %s\n",tintstr(),id_,(addr.get_family() == AF_INET) ? "v4" : "v6", addr.str().c_str());
 
     if (transfer()->OnPexIn(addr))
@@ -1966,17 +2479,17 @@ void Channel::OnPexAdd(struct evbuffer *evb, int family)
 }
 
 
-void Channel::OnPexAddCert(struct evbuffer *evb)
+void Channel::OnPexAddCert(dgram_t *dg)
 {
-    OnPexAddCertZeroState(evb);
+    OnPexAddCertZeroState(dg);
     dprintf("%s #%" PRIu32 " -pex cert\n",tintstr(),id_);
 }
 
 
-void Channel::OnChoke(struct evbuffer *evb)
+void Channel::OnChoke(dgram_t *dg)
 {
     if (hs_in_->version_ == VER_SWIFT_LEGACY) { // FRAGRAND support
-        evbuffer_remove_32be(evb); // read 4 random bytes
+        dgram_remove_32be(dg); // read 4 random bytes
         return;
     }
 
@@ -1984,33 +2497,33 @@ void Channel::OnChoke(struct evbuffer *evb)
     dprintf("%s #%" PRIu32 " -choke\n",tintstr(),id_);
 }
 
-void Channel::OnUnchoke(struct evbuffer *evb)
+void Channel::OnUnchoke(dgram_t *dg)
 {
     //PPSPTODO
     dprintf("%s #%" PRIu32 " -unchoke\n",tintstr(),id_);
 }
 
 
-void Channel::OnSignedHash(struct evbuffer *evb)
+void Channel::OnSignedHash(dgram_t *dg)
 {
     if (transfer()->ttype() != LIVE_TRANSFER) {
         dprintf("%s #%" PRIu32 " ?sigh not live swarm\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dgram_drain(dg, dgram_get_length(dg));
         return;
     }
 
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = dgram_remove_chunkaddr(dg,hs_in_->chunk_addr_);
     if (bv.size() == 0 || bv.size() > 1) {
         // chunk spec for hash must be power-of-2 range, so must fit in single bin
         dprintf("%s #%" PRIu32 " ?sigh bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dgram_drain(dg, dgram_get_length(dg));
         return;
     }
     bin_t pos = bv.front();
 
-    tint source_tint = evbuffer_remove_64be(evb);
+    tint source_tint = dgram_remove_64be(dg);
 
     uint16_t siglen = SWIFT_CIPM_NONE_SIGLEN;
     LiveHashTree *umt = (LiveHashTree *)hashtree();
@@ -2021,10 +2534,10 @@ void Channel::OnSignedHash(struct evbuffer *evb)
     if (sigdata == NULL) {
         dprintf("%s #%" PRIu32 " ?sigh no mem siglen %" PRIu32 "\n",tintstr(),id_,siglen);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dgram_drain(dg, dgram_get_length(dg));
         return;
     }
-    evbuffer_remove(evb,sigdata,siglen);
+    dgram_remove(dg,sigdata,siglen);
     Signature sig(sigdata,siglen);
     delete sigdata;
 
@@ -2064,7 +2577,7 @@ void Channel::OnSignedHash(struct evbuffer *evb)
  * Sending messages
  */
 
-void Channel::AddPex(struct evbuffer *evb)
+void Channel::AddPex(dgram_t *dg)
 {
     // Gertjan fix: Reverse PEX
     // PEX messages sent to facilitate NAT/FW puncturing get priority
@@ -2072,15 +2585,16 @@ void Channel::AddPex(struct evbuffer *evb)
         do {
             tintbin pex_peer = reverse_pex_out_.front();
             reverse_pex_out_.pop_front();
-            if (channels[(int) pex_peer.bin.toUInt()] == NULL)
+            Channel *c = ChannelOfID((uint32_t)pex_peer.bin.toUInt());
+            if (c == NULL)
                 continue;
-            Address a = channels[(int) pex_peer.bin.toUInt()]->peer();
+            Address a = c->peer();
             // Arno, 2012-02-28: Don't send private addresses to non-private peers.
             if (!a.is_private() || (a.is_private() && peer().is_private())) {
-                evbuffer_add_pexaddr(evb, a);
+                dgram_add_pexaddr(dg, a);
                 dprintf("%s #%" PRIu32 " +pex (reverse) %s\n",tintstr(),id_,a.str().c_str());
             }
-        } while (!reverse_pex_out_.empty() && (SWIFT_MAX_NONDATA_DGRAM_SIZE-evbuffer_get_length(evb)) >= 7);
+        } while (!reverse_pex_out_.empty() && (SWIFT_MAX_NONDATA_DGRAM_SIZE-dgram_get_length(dg)) >= 7);
 
         // Arno: 2012-02-23: Don't think this is right. Bit of DoS thing,
         // that you only get back the addr of people that got your addr.
@@ -2108,22 +2622,24 @@ void Channel::AddPex(struct evbuffer *evb)
         tries++;
     }
 
-    evbuffer_add_pexaddr(evb, a);
+    dgram_add_pexaddr(dg, a);
     dprintf("%s #%" PRIu32 " +pex %s\n",tintstr(),id_,a.str().c_str());
 
     pex_requested_ = false;
     /* Ensure that we don't add the same id to the reverse_pex_out_ queue
        more than once. */
     int chid = c->id();
+    uint32_t myid = EncodeID(id_);
     for (tbqueue::iterator i = channels[chid]->reverse_pex_out_.begin();
             i != channels[chid]->reverse_pex_out_.end(); i++)
-        if ((int)(i->bin.toUInt()) == id_)
+        if ((uint32_t)(i->bin.toUInt()) == myid)
             return;
 
     dprintf("%s #%" PRIu32 " adding pex for channel %" PRIu32 " at time %s\n", tintstr(), chid,
             id_, tintstr(NOW + 2 * TINT_SEC));
     // Arno, 2011-10-03: should really be a queue of (tint,channel id(= uint32_t)) pairs.
-    channels[chid]->reverse_pex_out_.push_back(tintbin(NOW + 2 * TINT_SEC, bin_t(id_)));
+    // Queued by wire ID, so a channel in a reused slot doesn't get our address
+    channels[chid]->reverse_pex_out_.push_back(tintbin(NOW + 2 * TINT_SEC, bin_t((bin_t::uint_t)myid)));
     if (channels[chid]->send_control_ == KEEP_ALIVE_CONTROL &&
             channels[chid]->next_send_time_ > NOW + 2 * TINT_SEC)
         channels[chid]->Reschedule();
@@ -2138,7 +2654,7 @@ void Channel::OnPexReq(void)
         pex_requested_ = true;
 }
 
-void Channel::AddPexReq(struct evbuffer *evb)
+void Channel::AddPexReq(dgram_t *dg)
 {
     // Rate limit the number of PEX requests
     if (NOW < next_pex_request_time_)
@@ -2163,7 +2679,7 @@ void Channel::AddPexReq(struct evbuffer *evb)
     }
 
     dprintf("%s #%" PRIu32 " +pex req\n", tintstr(), id_);
-    evbuffer_add_8(evb, SWIFT_PEX_REQ);
+    dgram_add_8(dg, SWIFT_PEX_REQ);
     /* Add a little more than the minimum interval, such that the other party is
        less likely to drop it due to too high rate */
     next_pex_request_time_ = NOW + MIN_PEX_REQUEST_INTERVAL * 1.1;
@@ -2182,44 +2698,117 @@ void Channel::LibeventReceiveCallback(evutil_socket_t fd, short event, void *arg
     Time();
     dprintf("%s recv callback\n",tintstr());
 
-    RecvDatagram(fd);
+    // From now on receives posted on the ring bring the datagrams in
+    if (IO_URING && UringArmRecv(fd))
+        return;
+
+    int n = RecvDatagram(fd);
+    global_recv_wakeups++;
+    global_recv_batch_dgrams += n;
+    if (n > global_recv_batch_max)
+        global_recv_batch_max = n;
     event_add(&evrecv, NULL);
 }
 
-void Channel::RecvDatagram(evutil_socket_t socket)
+// Preallocated ring of receive slots for RecvBatch, (re)allocated when
+// RECV_BATCH_SIZE or UDP_OFFLOAD changes.
+static recv_slot_t *recv_ring = NULL;
+static char *recv_ring_bufs = NULL;
+static int recv_ring_size = 0, recv_ring_slotsize = 0;
+
+int Channel::RecvDatagram(evutil_socket_t socket)
 {
-    struct evbuffer *evb = evbuffer_new();
-    Address addr;
-    Handshake *hishs = NULL;
+    // Returns the number of datagrams read from the socket
+    int batchsize = std::max(1,std::min(RECV_BATCH_SIZE,DGRAM_MAX_RECV_BATCH));
+    // GRO may deliver up to 64K at once
+    int slotsize = UDP_OFFLOAD ? SWIFT_MAX_GRO_DGRAM_SIZE : SWIFT_MAX_RECV_DGRAM_SIZE;
+    if (recv_ring_size != batchsize || recv_ring_slotsize != slotsize) {
+        delete[] recv_ring;
+        delete[] recv_ring_bufs;
+        recv_ring = new recv_slot_t[batchsize];
+        recv_ring_bufs = new char[batchsize*slotsize];
+        for (int i=0; i<batchsize; i++) {
+            recv_ring[i].buf = recv_ring_bufs+i*slotsize;
+            recv_ring[i].size = slotsize;
+        }
+        recv_ring_size = batchsize;
+        recv_ring_slotsize = slotsize;
+    }
+
+    int count = RecvBatch(socket, recv_ring, recv_ring_size);
+    int ndgrams = 0;
+    dprintf("%s recv batch %d\n",tintstr(),count);
+    for (int i=0; i<count; i++) {
+        // Slot is not reused until the next wakeup, so parse in place.
+        // Split GRO coalesced datagrams into the original ones.
+        int segsize = recv_ring[i].segsize > 0 ? recv_ring[i].segsize : recv_ring[i].length;
+        int off = 0;
+        do {
+            int len = std::min(segsize,recv_ring[i].length-off);
+            dgram_t dg;
+            dgram_wrap(&dg, recv_ring[i].buf+off, len);
+            ProcessDatagram(socket, recv_ring[i].addr, &dg);
+            off += len;
+            ndgrams++;
+        } while (off < recv_ring[i].length);
+    }
+    return ndgrams;
+}
 
-    RecvFrom(socket, addr, evb);
-    size_t evboriglen = evbuffer_get_length(evb);
+void Channel::ProcessDatagram(evutil_socket_t socket, Address &addr, dgram_t *dg)
+{
+    // Dispatches a received datagram to its channel. dg is consumed but
+    // stays owned by the caller.
+    Handshake *hishs = NULL;
+    size_t evboriglen = dgram_get_length(dg);
 
     dprintf("%s recvdgram " PRISIZET "\n",tintstr(),evboriglen);
 
-//#define return_log(...) { fprintf(stderr,__VA_ARGS__); evbuffer_free(evb); return; }
-#define return_log(...) { dprintf(__VA_ARGS__); evbuffer_free(evb); if (hishs != NULL) { delete hishs; } return; }
-    if (evbuffer_get_length(evb)<4)
+//#define return_log(...) { fprintf(stderr,__VA_ARGS__); return; }
+#define return_log(...) { dprintf(__VA_ARGS__); if (hishs != NULL) { delete hishs; } return; }
+    if (dgram_get_length(dg)<4)
         return_log("socket layer weird: datagram < 4 bytes from %s (prob ICMP unreach)\n",addr.str().c_str());
 
-    uint32_t mych = evbuffer_remove_32be(evb);
+    if (shard_count > 1) {
+        // Hand off to the shard owning the channel, before consuming anything
+        uint32_t wireid;
+        memcpy(&wireid, dgram_pullup(dg), sizeof(wireid));
+        wireid = ntohl(wireid);
+        int owner = ShardOfID(wireid);
+        if (wireid != 0 && owner != shard_id && owner < shard_count && !CmdGwTunnelCheckChannel(wireid)) {
+            dprintf("%s #%" PRIu32 " handoff to shard %d\n",tintstr(),DecodeID(wireid),owner);
+            ShardForward(owner, addr, dg);
+            return;
+        }
+    }
+
+    uint32_t mych = dgram_remove_32be(dg);
 
     Channel* channel = NULL;
     if (mych==0) { // peer initiates handshake
 
-        hishs = StaticOnHandshake(addr,0,false,VER_PPSPP_v1,evb);
+        // Handshake floods are cut off before parsing
+        if (!HandshakeRateOK(addr)) {
+            global_hs_rate_rejected++;
+            return_log("%s #0 ?hs over rate from %s\n",tintstr(),addr.str().c_str());
+        }
+
+        hishs = StaticOnHandshake(addr,0,false,VER_PPSPP_v1,dg);
         if (hishs == NULL) // dprintf already called
             return_log("%s #0 ?hs bad\n",tintstr());
 
         SwarmID swarmid = hishs->GetSwarmID();
         int td = swift::Find(swarmid,true); // Activate
         if (td < 0) {
-            // No known swarm, check if available as zero state
+            // No known swarm, check if available as zero state. The
+            // content dir is only looked at when its filter says maybe.
             ZeroState *zs = ZeroState::GetInstance();
-            td = zs->Find(swarmid.roothash());
+            if (zs->MayHave(swarmid.roothash()))
+                td = zs->Find(swarmid.roothash());
             if (td == -1) {
                 // Don't reply to strangers knocking
                 //StaticSendClose(socket,addr,hishs->peer_channel_id_);
+                global_hs_unknown_rejected++;
                 return_log("%s #0 swarm %s unknown, requested by %s\n",tintstr(),hishs->GetSwarmID().hex().c_str(),addr.str().c_str());
             }
         }
@@ -2262,7 +2851,7 @@ void Channel::RecvDatagram(evutil_socket_t socket)
             }
         }
         if (channel == NULL) {
-            if (ct->GetChannels()->size() < SWIFT_MAX_INCOMING_CONNECTIONS) {
+            if (ct->GetChannels()->size() < SWIFT_MAX_INCOMING_CONNECTIONS && Channel::SlotAvailable()) {
                 //fprintf(stderr,"Channel::RecvDatagram: HANDSHAKE: create new channel %s\n", addr.str().c_str() );
                 channel = new Channel(ct, socket, addr);
             } else {
@@ -2278,15 +2867,18 @@ void Channel::RecvDatagram(evutil_socket_t socket)
 
     } else if (CmdGwTunnelCheckChannel(mych)) {
         // SOCKTUNNEL
-        CmdGwTunnelUDPDataCameIn(addr,mych,evb);
-        evbuffer_free(evb);
+        CmdGwTunnelUDPDataCameIn(addr,mych,dg);
         return;
     } else { // peer responds to my handshake (and other messages)
+        if (ShardOfID(mych) != shard_id)
+            return_log("%s invalid channel ID %" PRIu32 ", %s\n",tintstr(),mych,addr.str().c_str());
+        int gen = GenOfID(mych);
         mych = DecodeID(mych);
         if (mych>=channels.size())
             return_log("%s invalid channel #%" PRIu32 ", %s\n",tintstr(),mych,addr.str().c_str());
         channel = channels[mych];
-        if (!channel)
+        // Stale datagram for an earlier channel in this slot
+        if (!channel || gen != slot_gens[mych])
             return_log("%s #%" PRIu32 " is already closed\n",tintstr(),mych);
         if (channel->IsDiffSenderOrDuplicate(addr,mych)) {
             dprintf("%s #%" PRIu32 " ?channel diff or dup\n",tintstr(),mych);
@@ -2304,9 +2896,7 @@ void Channel::RecvDatagram(evutil_socket_t socket)
 
     // Process messages
     if (channel->send_control_!=CLOSE_CONTROL)
-        channel->Recv(evb);
-
-    evbuffer_free(evb);
+        channel->Recv(dg);
 
     //SAFECLOSE
     if (channel->send_control_==CLOSE_CONTROL) {
@@ -2326,16 +2916,55 @@ void Channel::CloseChannelByAddress(const Address &addr)
     // fprintf(stderr,"CloseChannelByAddress: address is %s\n", addr.str().c_str() );
 
     dprintf("%s #-1 close channel by address %s\n",tintstr(), addr.str().c_str());
-    channels_t::iterator iter;
-    for (iter = channels.begin(); iter != channels.end(); iter++) {
-        Channel *c = *iter;
-        if (c != NULL && c->peer_ == addr) {
-            dprintf("%s #%" PRIu32 " close by addr\n",tintstr(),c->id());
-            c->Close(CLOSE_DO_NOT_SEND);
-            delete c; // safe, not in a send event, and doesn't modify channels
-            break;
+    addrchannels_t::iterator iter = peer_index.find(addr);
+    if (iter != peer_index.end()) {
+        Channel *c = iter->second;
+        dprintf("%s #%" PRIu32 " close by addr\n",tintstr(),c->id());
+        c->Close(CLOSE_DO_NOT_SEND);
+        delete c; // safe, not in a send event
+    }
+}
+
+
+// Handshake rate limiting: tokens per source IP, refilled at HANDSHAKE_RATE
+struct hs_bucket_t {
+    float   tokens;
+    tint    last;
+};
+typedef std::unordered_map<Address,hs_bucket_t,AddressHash> hsbuckets_t;
+static hsbuckets_t hs_buckets;
+#define SWIFT_HS_MAX_SOURCES    65536
+
+bool Channel::HandshakeRateOK(const Address &addr)
+{
+    if (HANDSHAKE_RATE <= 0)
+        return true;
+    Address ip(addr);
+    ip.set_port((uint16_t)0);   // a flood needn't stick to one port
+    if (hs_buckets.size() >= SWIFT_HS_MAX_SOURCES) {
+        // Forget sources that are back at a full bucket anyway, or all
+        tint full = (tint)HANDSHAKE_BURST*TINT_SEC/HANDSHAKE_RATE;
+        hsbuckets_t::iterator iter;
+        for (iter=hs_buckets.begin(); iter!=hs_buckets.end(); ) {
+            if (NOW-iter->second.last >= full)
+                iter = hs_buckets.erase(iter);
+            else
+                iter++;
         }
+        if (hs_buckets.size() >= SWIFT_HS_MAX_SOURCES)
+            hs_buckets.clear();
     }
+    std::pair<hsbuckets_t::iterator,bool> ins = hs_buckets.insert(std::make_pair(ip,hs_bucket_t()));
+    hs_bucket_t &b = ins.first->second;
+    if (ins.second)
+        b.tokens = HANDSHAKE_BURST;
+    else
+        b.tokens = std::min((float)HANDSHAKE_BURST, b.tokens + (float)(NOW-b.last)*HANDSHAKE_RATE/TINT_SEC);
+    b.last = NOW;
+    if (b.tokens < 1)
+        return false;
+    b.tokens--;
+    return true;
 }
 
 void Channel::Close(close_send_t closesend)
@@ -2380,18 +3009,16 @@ void Channel::Reschedule()
         dprintf("%s #%" PRIu32 " cannot requeue for %s, closed\n",tintstr(),id_,tintstr(next_send_time_));
         return;
     }
-    struct timeval currtv;
     // remove pending events if in keep-alive mode
-    if (send_control_ == KEEP_ALIVE_CONTROL && evtimer_pending(evsend_ptr_, &currtv)) {
-        evtimer_del(evsend_ptr_);
-    }
+    if (send_control_ == KEEP_ALIVE_CONTROL)
+        Timers()->Cancel(evsend_ptr_);
 
     dprintf("%s schedule\n",tintstr());
 
     // Ric: before rescheduling check if we already have scheduled it in the past.
     // calculate the delay only if the reschedule has been called after a send, ignore reschedules
     // triggered by something received.
-    if (last_send_time_>next_send_time_ && next_send_time_<NOW && send_control_ == LEDBAT_CONTROL) {
+    if (last_send_time_>next_send_time_ && next_send_time_<NOW && send_control_ == CC_CONTROL) {
         dprintf("%s #%" PRIu32 " Already something scheduled for: %s\n",tintstr(),id_, tintstr(next_send_time_));
         reschedule_delay_ = NOW - next_send_time_;
         dprintf("%s #%" PRIu32 " reschedule delay :%" PRIi64 "\n",tintstr(),id_,reschedule_delay_);
@@ -2416,8 +3043,7 @@ void Channel::Reschedule()
 
             LibeventSendCallback(-1,EV_TIMEOUT,this);
         } else {
-            struct timeval duetv = *tint2tv(duein);
-            evtimer_add(evsend_ptr_,&duetv);
+            Timers()->Schedule(evsend_ptr_,next_send_time_);
             dprintf("%s #%" PRIu32 " requeue for %s in %" PRIi64 "\n",tintstr(),id_,tintstr(next_send_time_), duein);
         }
     } else {
@@ -2455,15 +3081,13 @@ void Channel::StaticSendClose(evutil_socket_t socket,Address &addr, uint32_t pee
     if (peer_channel_id == 0)
         return; // safety catch
 
-    struct evbuffer *evb = evbuffer_new();
-    evbuffer_add_32be(evb, peer_channel_id);  // His channel ID
-    evbuffer_add_8(evb, SWIFT_HANDSHAKE);
-    evbuffer_add_32be(evb, 0);  // Initial channel ID
-    evbuffer_add_8(evb, POPT_END); // Empty protocol options list
+    dgram_t *dg = dgram_new();
+    dgram_add_32be(dg, peer_channel_id);  // His channel ID
+    dgram_add_8(dg, SWIFT_HANDSHAKE);
+    dgram_add_32be(dg, 0);  // Initial channel ID
+    dgram_add_8(dg, POPT_END); // Empty protocol options list
 
-    int r = SendTo(socket,addr,evb);
+    int r = QueueTo(socket,addr,dg);
     if (r==-1)
         print_error("swift can't send datagram");
-
-    evbuffer_free(evb);
 }
@@ -17,6 +17,7 @@
 #include <string.h>
 
 #include "sha1.h"
+#include "shax86.h"
 
 #if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
@@ -121,16 +122,16 @@
 #define T_40_59(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, ((B&C)+(D&(B^C))) , 0x8f1bbcdc, A, B, C, D, E )
 #define T_60_79(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (B^C^D) ,  0xca62c1d6, A, B, C, D, E )
 
-static void blk_SHA1_Block(blk_SHA_CTX *ctx, const unsigned int *data)
+static void blk_SHA1_Block(unsigned int H[5], const unsigned int *data)
 {
     unsigned int A,B,C,D,E;
     unsigned int array[16];
 
-    A = ctx->H[0];
-    B = ctx->H[1];
-    C = ctx->H[2];
-    D = ctx->H[3];
-    E = ctx->H[4];
+    A = H[0];
+    B = H[1];
+    C = H[2];
+    D = H[3];
+    E = H[4];
 
     /* Round 1 - iterations 0-16 take their input from 'data' */
     T_0_15(0, A, B, C, D, E);
@@ -222,11 +223,52 @@ static void blk_SHA1_Block(blk_SHA_CTX *ctx, const unsigned int *data)
     T_60_79(78, C, D, E, A, B);
     T_60_79(79, B, C, D, E, A);
 
-    ctx->H[0] += A;
-    ctx->H[1] += B;
-    ctx->H[2] += C;
-    ctx->H[3] += D;
-    ctx->H[4] += E;
+    H[0] += A;
+    H[1] += B;
+    H[2] += C;
+    H[3] += D;
+    H[4] += E;
+}
+
+static void blk_SHA1_Blocks(unsigned int H[5], const unsigned char *data, unsigned long nblocks)
+{
+    for (; nblocks; nblocks--, data += 64)
+        blk_SHA1_Block(H, (const unsigned int *)data);
+}
+
+/*
+ * Backends. The block function for single messages, and for blk_SHA1_Multi()
+ * whether to hash 8 messages at once with AVX2.
+ */
+static void (*sha1_blocks)(unsigned int H[5], const unsigned char *data, unsigned long nblocks) = blk_SHA1_Blocks;
+
+static int sha1_pick_backend(void)
+{
+    int backend = SHA1_BACKEND_PORTABLE;
+    if (sha_x86_has_shani())
+        backend |= SHA1_BACKEND_SHANI;
+    if (sha_x86_has_avx2())
+        backend |= SHA1_BACKEND_AVX2;
+    blk_SHA1_SetBackend(backend);
+    return backend;
+}
+
+static int sha1_backend = sha1_pick_backend();
+
+int blk_SHA1_Backend(void)
+{
+    return sha1_backend;
+}
+
+int blk_SHA1_SetBackend(int backend)
+{
+    if ((backend & SHA1_BACKEND_SHANI) && !sha_x86_has_shani())
+        return -1;
+    if ((backend & SHA1_BACKEND_AVX2) && !sha_x86_has_avx2())
+        return -1;
+    sha1_blocks = (backend & SHA1_BACKEND_SHANI) ? sha1_shani_blocks : blk_SHA1_Blocks;
+    sha1_backend = backend;
+    return 0;
 }
 
 void blk_SHA1_Init(blk_SHA_CTX *ctx)
@@ -258,12 +300,12 @@ void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *data, unsigned long len)
         data = ((const char *)data + left);
         if (lenW)
             return;
-        blk_SHA1_Block(ctx, ctx->W);
+        sha1_blocks(ctx->H, (const unsigned char *)ctx->W, 1);
     }
-    while (len >= 64) {
-        blk_SHA1_Block(ctx, (const unsigned int*)data);
-        data = ((const char *)data + 64);
-        len -= 64;
+    if (len >= 64) {
+        sha1_blocks(ctx->H, (const unsigned char *)data, len/64);
+        data = ((const char *)data + (len & ~63UL));
+        len &= 63;
     }
     if (len)
         memcpy(ctx->W, data, len);
@@ -287,3 +329,55 @@ void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx)
     for (i = 0; i < 5; i++)
         put_be32(hashout + i*4, ctx->H[i]);
 }
+
+/* Same-length messages, 8 at once. Padding as blk_SHA1_Final() */
+static void blk_SHA1_x8(const unsigned char *data[8], unsigned long len, unsigned char hashout[][20])
+{
+    unsigned int H[8][5];
+    unsigned char tail[8][128];
+    const unsigned char *tailp[8];
+    unsigned long full = len/64, rem = len & 63;
+    unsigned long ntail = (rem < 56) ? 1 : 2;
+    unsigned long long bits = (unsigned long long)len << 3;
+    int l, i;
+
+    for (l = 0; l < 8; l++) {
+        H[l][0] = 0x67452301;
+        H[l][1] = 0xefcdab89;
+        H[l][2] = 0x98badcfe;
+        H[l][3] = 0x10325476;
+        H[l][4] = 0xc3d2e1f0;
+        memcpy(tail[l], data[l] + full*64, rem);
+        memset(tail[l] + rem, 0, 128 - rem);
+        tail[l][rem] = 0x80;
+        put_be32(tail[l] + ntail*64 - 8, (unsigned int)(bits >> 32));
+        put_be32(tail[l] + ntail*64 - 4, (unsigned int)bits);
+        tailp[l] = tail[l];
+    }
+    sha1_avx2_x8_blocks(H, data, full);
+    sha1_avx2_x8_blocks(H, tailp, ntail);
+    for (l = 0; l < 8; l++)
+        for (i = 0; i < 5; i++)
+            put_be32(hashout[l] + i*4, H[l][i]);
+}
+
+void blk_SHA1_Multi(const unsigned char *data[], const unsigned long len[], unsigned char hashout[][20], int n)
+{
+    int i = 0, j;
+    blk_SHA_CTX ctx;
+
+    if (sha1_backend & SHA1_BACKEND_AVX2) {
+        for (; i+8 <= n; i += 8) {
+            for (j = 1; j < 8 && len[i+j] == len[i]; j++)
+                ;
+            if (j < 8)
+                break;
+            blk_SHA1_x8(data+i, len[i], hashout+i);
+        }
+    }
+    for (; i < n; i++) {
+        blk_SHA1_Init(&ctx);
+        blk_SHA1_Update(&ctx, data[i], len[i]);
+        blk_SHA1_Final(hashout[i], &ctx);
+    }
+}
@@ -19,5 +19,20 @@ void blk_SHA1_Init(blk_SHA_CTX *ctx);
 void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *dataIn, unsigned long len);
 void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx);
 
+/*
+ * Block function backends, flags. All the CPU supports are used by default.
+ * SHA-NI hashes single messages, AVX2 8 messages of the same length at once
+ * in blk_SHA1_Multi(). What is left goes to the portable code.
+ */
+#define SHA1_BACKEND_PORTABLE   0
+#define SHA1_BACKEND_AVX2       1
+#define SHA1_BACKEND_SHANI      2
+
+int blk_SHA1_Backend(void);
+/* Returns -1 if the CPU lacks it. Not to be called while hashing. */
+int blk_SHA1_SetBackend(int backend);
+/* Hashes n messages */
+void blk_SHA1_Multi(const unsigned char *data[], const unsigned long len[], unsigned char hashout[][20], int n);
+
 #endif
 
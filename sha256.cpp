@@ -0,0 +1,212 @@
+/*
+ *  sha256.cpp
+ *  SHA-256, portable block function and the backend dispatch. Laid out as
+ *  sha1.cpp, the x86 block functions are in shax86.cpp.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <string.h>
+
+#include "sha256.h"
+#include "shax86.h"
+
+#define ROR(x,n)    (((x) >> (n)) | ((x) << (32-(n))))
+#define S0(x)       (ROR(x,2) ^ ROR(x,13) ^ ROR(x,22))
+#define S1(x)       (ROR(x,6) ^ ROR(x,11) ^ ROR(x,25))
+#define s0(x)       (ROR(x,7) ^ ROR(x,18) ^ ((x) >> 3))
+#define s1(x)       (ROR(x,17) ^ ROR(x,19) ^ ((x) >> 10))
+
+#define get_be32(p)    ( \
+    ((unsigned int)*((const unsigned char *)(p) + 0) << 24) | \
+    ((unsigned int)*((const unsigned char *)(p) + 1) << 16) | \
+    ((unsigned int)*((const unsigned char *)(p) + 2) <<  8) | \
+    ((unsigned int)*((const unsigned char *)(p) + 3) <<  0) )
+#define put_be32(p, v)    do { \
+    unsigned int __v = (v); \
+    *((unsigned char *)(p) + 0) = __v >> 24; \
+    *((unsigned char *)(p) + 1) = __v >> 16; \
+    *((unsigned char *)(p) + 2) = __v >>  8; \
+    *((unsigned char *)(p) + 3) = __v >>  0; } while (0)
+
+static const unsigned int K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const unsigned int H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static void blk_SHA256_Blocks(unsigned int H[8], const unsigned char *data, unsigned long nblocks)
+{
+    unsigned int W[16];
+    int t;
+
+    for (; nblocks; nblocks--, data += 64) {
+        unsigned int a = H[0], b = H[1], c = H[2], d = H[3];
+        unsigned int e = H[4], f = H[5], g = H[6], h = H[7];
+        for (t = 0; t < 64; t++) {
+            unsigned int T1, T2;
+            if (t < 16)
+                W[t] = get_be32(data + 4*t);
+            else
+                W[t&15] += s1(W[(t-2)&15]) + W[(t-7)&15] + s0(W[(t-15)&15]);
+            T1 = h + S1(e) + (g ^ (e & (f ^ g))) + K[t] + W[t&15];
+            T2 = S0(a) + ((a & b) | (c & (a | b)));
+            h = g;
+            g = f;
+            f = e;
+            e = d + T1;
+            d = c;
+            c = b;
+            b = a;
+            a = T1 + T2;
+        }
+        H[0] += a;
+        H[1] += b;
+        H[2] += c;
+        H[3] += d;
+        H[4] += e;
+        H[5] += f;
+        H[6] += g;
+        H[7] += h;
+    }
+}
+
+static void (*sha256_blocks)(unsigned int H[8], const unsigned char *data, unsigned long nblocks) = blk_SHA256_Blocks;
+
+static int sha256_pick_backend(void)
+{
+    // Unlike SHA-1, SHA-NI alone outruns AVX2 x8 on batches, so only fall
+    // back to AVX2 without it
+    int backend = SHA256_BACKEND_PORTABLE;
+    if (sha_x86_has_shani())
+        backend = SHA256_BACKEND_SHANI;
+    else if (sha_x86_has_avx2())
+        backend = SHA256_BACKEND_AVX2;
+    blk_SHA256_SetBackend(backend);
+    return backend;
+}
+
+static int sha256_backend = sha256_pick_backend();
+
+int blk_SHA256_Backend(void)
+{
+    return sha256_backend;
+}
+
+int blk_SHA256_SetBackend(int backend)
+{
+    if ((backend & SHA256_BACKEND_SHANI) && !sha_x86_has_shani())
+        return -1;
+    if ((backend & SHA256_BACKEND_AVX2) && !sha_x86_has_avx2())
+        return -1;
+    sha256_blocks = (backend & SHA256_BACKEND_SHANI) ? sha256_shani_blocks : blk_SHA256_Blocks;
+    sha256_backend = backend;
+    return 0;
+}
+
+void blk_SHA256_Init(blk_SHA256_CTX *ctx)
+{
+    ctx->size = 0;
+    memcpy(ctx->H, H0, sizeof(H0));
+}
+
+void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, unsigned long len)
+{
+    int lenW = ctx->size & 63;
+
+    ctx->size += len;
+
+    if (lenW) {
+        int left = 64 - lenW;
+        if (len < left)
+            left = len;
+        memcpy(lenW + (char *)ctx->W, data, left);
+        lenW = (lenW + left) & 63;
+        len -= left;
+        data = ((const char *)data + left);
+        if (lenW)
+            return;
+        sha256_blocks(ctx->H, (const unsigned char *)ctx->W, 1);
+    }
+    if (len >= 64) {
+        sha256_blocks(ctx->H, (const unsigned char *)data, len/64);
+        data = ((const char *)data + (len & ~63UL));
+        len &= 63;
+    }
+    if (len)
+        memcpy(ctx->W, data, len);
+}
+
+void blk_SHA256_Final(unsigned char hashout[32], blk_SHA256_CTX *ctx)
+{
+    static const unsigned char pad[64] = { 0x80 };
+    unsigned char padlen[8];
+    int i;
+
+    put_be32(padlen, (unsigned int)(ctx->size >> 29));
+    put_be32(padlen + 4, (unsigned int)(ctx->size << 3));
+
+    i = ctx->size & 63;
+    blk_SHA256_Update(ctx, pad, 1+ (63 & (55 - i)));
+    blk_SHA256_Update(ctx, padlen, 8);
+
+    for (i = 0; i < 8; i++)
+        put_be32(hashout + i*4, ctx->H[i]);
+}
+
+/* Same-length messages, 8 at once. Padding as blk_SHA256_Final() */
+static void blk_SHA256_x8(const unsigned char *data[8], unsigned long len, unsigned char hashout[][32])
+{
+    unsigned int H[8][8];
+    unsigned char tail[8][128];
+    const unsigned char *tailp[8];
+    unsigned long full = len/64, rem = len & 63;
+    unsigned long ntail = (rem < 56) ? 1 : 2;
+    unsigned long long bits = (unsigned long long)len << 3;
+    int l, i;
+
+    for (l = 0; l < 8; l++) {
+        memcpy(H[l], H0, sizeof(H0));
+        memcpy(tail[l], data[l] + full*64, rem);
+        memset(tail[l] + rem, 0, 128 - rem);
+        tail[l][rem] = 0x80;
+        put_be32(tail[l] + ntail*64 - 8, (unsigned int)(bits >> 32));
+        put_be32(tail[l] + ntail*64 - 4, (unsigned int)bits);
+        tailp[l] = tail[l];
+    }
+    sha256_avx2_x8_blocks(H, data, full);
+    sha256_avx2_x8_blocks(H, tailp, ntail);
+    for (l = 0; l < 8; l++)
+        for (i = 0; i < 8; i++)
+            put_be32(hashout[l] + i*4, H[l][i]);
+}
+
+void blk_SHA256_Multi(const unsigned char *data[], const unsigned long len[], unsigned char hashout[][32], int n)
+{
+    int i = 0, j;
+    blk_SHA256_CTX ctx;
+
+    if (sha256_backend & SHA256_BACKEND_AVX2) {
+        for (; i+8 <= n; i += 8) {
+            for (j = 1; j < 8 && len[i+j] == len[i]; j++)
+                ;
+            if (j < 8)
+                break;
+            blk_SHA256_x8(data+i, len[i], hashout+i);
+        }
+    }
+    for (; i < n; i++) {
+        blk_SHA256_Init(&ctx);
+        blk_SHA256_Update(&ctx, data[i], len[i]);
+        blk_SHA256_Final(hashout[i], &ctx);
+    }
+}
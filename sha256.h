@@ -0,0 +1,36 @@
+/*
+ *  sha256.h
+ *  SHA-256 (FIPS 180-4) with the same interface as the blk_SHA1_* of sha1.h,
+ *  for Merkle hash trees built with SWIFT_MERKLE_SHA256.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#ifndef SWIFT_SHA256_H
+#define SWIFT_SHA256_H
+
+typedef struct {
+    unsigned long long size;
+    unsigned int H[8];
+    unsigned int W[16];
+} blk_SHA256_CTX;
+
+void blk_SHA256_Init(blk_SHA256_CTX *ctx);
+void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *dataIn, unsigned long len);
+void blk_SHA256_Final(unsigned char hashout[32], blk_SHA256_CTX *ctx);
+
+/*
+ * Block function backends, flags as for SHA-1. By default SHA-NI if the CPU
+ * has it, else AVX2.
+ */
+#define SHA256_BACKEND_PORTABLE 0
+#define SHA256_BACKEND_AVX2     1
+#define SHA256_BACKEND_SHANI    2
+
+int blk_SHA256_Backend(void);
+/* Returns -1 if the CPU lacks it. Not to be called while hashing. */
+int blk_SHA256_SetBackend(int backend);
+/* Hashes n messages */
+void blk_SHA256_Multi(const unsigned char *data[], const unsigned long len[], unsigned char hashout[][32], int n);
+
+#endif
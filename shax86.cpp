@@ -0,0 +1,334 @@
+/*
+ *  shax86.cpp
+ *  SHA-1 and SHA-256 block functions for x86: SHA-NI, and AVX2 hashing 8
+ *  messages at once. Picked at runtime by sha1.cpp and sha256.cpp, see
+ *  blk_SHA1_SetBackend() and blk_SHA256_SetBackend().
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <string.h>
+#include "shax86.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+static void sha_x86_cpuid(int *shani, int *avx2)
+{
+    unsigned int a,b,c,d;
+    *shani = *avx2 = 0;
+    if (!__get_cpuid(1,&a,&b,&c,&d))
+        return;
+    int ssse3 = (c>>9)&1, sse41 = (c>>19)&1, osxsave = (c>>27)&1, avx = (c>>28)&1;
+    if (__get_cpuid_max(0,NULL) < 7)
+        return;
+    __cpuid_count(7,0,a,b,c,d);
+    *shani = ((b>>29)&1) && ssse3 && sse41;
+    if (((b>>5)&1) && osxsave && avx) {
+        // The OS must save the YMM registers too
+        unsigned int xcr0lo, xcr0hi;
+        __asm__ ("xgetbv" : "=a" (xcr0lo), "=d" (xcr0hi) : "c" (0));
+        *avx2 = (xcr0lo&6) == 6;
+    }
+}
+
+int sha_x86_has_shani(void)
+{
+    int shani, avx2;
+    sha_x86_cpuid(&shani,&avx2);
+    return shani;
+}
+
+int sha_x86_has_avx2(void)
+{
+    int shani, avx2;
+    sha_x86_cpuid(&shani,&avx2);
+    return avx2;
+}
+
+
+/*
+ * SHA-NI. Every step does 4 rounds, 0-19 below. Step g uses message words
+ * M[g&3], and computes those of later steps: sha1msg1 for step g+3, the
+ * xor for g+2 and sha1msg2 for g+1.
+ */
+#define SHANI_STEP(g) do { \
+    if ((g) == 0) \
+        E[0] = _mm_add_epi32(E[0], M[0]); \
+    else \
+        E[(g)&1] = _mm_sha1nexte_epu32(E[(g)&1], M[(g)&3]); \
+    E[((g)+1)&1] = ABCD; \
+    if ((g) >= 3 && (g) <= 18) \
+        M[((g)+1)&3] = _mm_sha1msg2_epu32(M[((g)+1)&3], M[(g)&3]); \
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E[(g)&1], (g)/5); \
+    if ((g) >= 1 && (g) <= 16) \
+        M[((g)-1)&3] = _mm_sha1msg1_epu32(M[((g)-1)&3], M[(g)&3]); \
+    if ((g) >= 2 && (g) <= 17) \
+        M[((g)+2)&3] = _mm_xor_si128(M[((g)+2)&3], M[(g)&3]); \
+} while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha1_shani_blocks(unsigned int H[5], const unsigned char *data, unsigned long nblocks)
+{
+    const __m128i BSWAP = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)H), 0x1B);
+    __m128i E[2], M[4];
+    E[0] = _mm_set_epi32(H[4], 0, 0, 0);
+
+    for (; nblocks; nblocks--, data += 64) {
+        __m128i ABCD_SAVE = ABCD, E0_SAVE = E[0];
+        for (int i=0; i<4; i++)
+            M[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+16*i)), BSWAP);
+
+        SHANI_STEP(0);  SHANI_STEP(1);  SHANI_STEP(2);  SHANI_STEP(3);
+        SHANI_STEP(4);  SHANI_STEP(5);  SHANI_STEP(6);  SHANI_STEP(7);
+        SHANI_STEP(8);  SHANI_STEP(9);  SHANI_STEP(10); SHANI_STEP(11);
+        SHANI_STEP(12); SHANI_STEP(13); SHANI_STEP(14); SHANI_STEP(15);
+        SHANI_STEP(16); SHANI_STEP(17); SHANI_STEP(18); SHANI_STEP(19);
+
+        E[0] = _mm_sha1nexte_epu32(E[0], E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+    }
+    _mm_storeu_si128((__m128i *)H, _mm_shuffle_epi32(ABCD, 0x1B));
+    H[4] = _mm_extract_epi32(E[0], 3);
+}
+
+
+/*
+ * AVX2: one 32-bit lane per message. The input words come in rows of 8 per
+ * message, transposed to 8 words of the same index.
+ */
+#define ROL8(x,n)   _mm256_or_si256(_mm256_slli_epi32(x,n), _mm256_srli_epi32(x,32-(n)))
+#define ROR8(x,n)   ROL8(x,32-(n))
+
+__attribute__((target("avx2")))
+static inline void sha_avx2_transpose(__m256i r[8])
+{
+    __m256i t[8], u[8];
+    for (int i=0; i<8; i+=2) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i+1]);
+        t[i+1] = _mm256_unpackhi_epi32(r[i], r[i+1]);
+    }
+    for (int i=0; i<8; i+=4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i+2]);
+        u[i+1] = _mm256_unpackhi_epi64(t[i], t[i+2]);
+        u[i+2] = _mm256_unpacklo_epi64(t[i+1], t[i+3]);
+        u[i+3] = _mm256_unpackhi_epi64(t[i+1], t[i+3]);
+    }
+    for (int i=0; i<4; i++) {
+        r[i] = _mm256_permute2x128_si256(u[i], u[i+4], 0x20);
+        r[i+4] = _mm256_permute2x128_si256(u[i], u[i+4], 0x31);
+    }
+}
+
+#define AVX2_ROUND(t, f, k) do { \
+    if ((t) >= 16) \
+        W[(t)&15] = ROL8(_mm256_xor_si256(_mm256_xor_si256(W[((t)-3)&15], W[((t)-8)&15]), \
+                                          _mm256_xor_si256(W[((t)-14)&15], W[(t)&15])), 1); \
+    __m256i tmp = _mm256_add_epi32(_mm256_add_epi32(ROL8(a,5), f), \
+                                   _mm256_add_epi32(_mm256_add_epi32(e, k), W[(t)&15])); \
+    e = d; d = c; c = ROL8(b,30); b = a; a = tmp; \
+} while (0)
+
+#define F_0_19      _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)))
+#define F_20_39     _mm256_xor_si256(_mm256_xor_si256(b, c), d)
+#define F_40_59     _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)))
+
+__attribute__((target("avx2")))
+void sha1_avx2_x8_blocks(unsigned int H[8][5], const unsigned char *data[8], unsigned long nblocks)
+{
+    const __m256i BSWAP = _mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+                                           3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+    const __m256i K0 = _mm256_set1_epi32(0x5a827999), K1 = _mm256_set1_epi32(0x6ed9eba1);
+    const __m256i K2 = _mm256_set1_epi32(0x8f1bbcdc), K3 = _mm256_set1_epi32(0xca62c1d6);
+    unsigned int lanes[5][8];
+    for (int i=0; i<5; i++)
+        for (int l=0; l<8; l++)
+            lanes[i][l] = H[l][i];
+    __m256i s[5];
+    for (int i=0; i<5; i++)
+        s[i] = _mm256_loadu_si256((const __m256i *)lanes[i]);
+
+    for (unsigned long blk=0; blk<nblocks; blk++) {
+        __m256i W[16];
+        for (int half=0; half<2; half++) {
+            for (int l=0; l<8; l++)
+                W[8*half+l] = _mm256_loadu_si256((const __m256i *)(data[l]+64*blk+32*half));
+            sha_avx2_transpose(W+8*half);
+            for (int i=0; i<8; i++)
+                W[8*half+i] = _mm256_shuffle_epi8(W[8*half+i], BSWAP);
+        }
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+        for (int t=0; t<20; t++)
+            AVX2_ROUND(t, F_0_19, K0);
+        for (int t=20; t<40; t++)
+            AVX2_ROUND(t, F_20_39, K1);
+        for (int t=40; t<60; t++)
+            AVX2_ROUND(t, F_40_59, K2);
+        for (int t=60; t<80; t++)
+            AVX2_ROUND(t, F_20_39, K3);
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+    }
+
+    for (int i=0; i<5; i++)
+        _mm256_storeu_si256((__m256i *)lanes[i], s[i]);
+    for (int i=0; i<5; i++)
+        for (int l=0; l<8; l++)
+            H[l][i] = lanes[i][l];
+}
+
+
+static const unsigned int sha256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * SHA-NI SHA-256. The state is kept as ABEF and CDGH. Every step does 4
+ * rounds, 0-15 below, on message words M[g&3], and computes those of later
+ * steps: sha256msg1 for step g+3, sha256msg2 for g+1.
+ */
+#define SHANI256_STEP(g) do { \
+    MSG = _mm_add_epi32(M[(g)&3], _mm_loadu_si128((const __m128i *)(sha256_K+4*(g)))); \
+    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG); \
+    if ((g) >= 3 && (g) <= 14) { \
+        TMP = _mm_alignr_epi8(M[(g)&3], M[((g)-1)&3], 4); \
+        M[((g)+1)&3] = _mm_sha256msg2_epu32(_mm_add_epi32(M[((g)+1)&3], TMP), M[(g)&3]); \
+    } \
+    MSG = _mm_shuffle_epi32(MSG, 0x0E); \
+    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG); \
+    if ((g) >= 1 && (g) <= 12) \
+        M[((g)-1)&3] = _mm_sha256msg1_epu32(M[((g)-1)&3], M[(g)&3]); \
+} while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha256_shani_blocks(unsigned int H[8], const unsigned char *data, unsigned long nblocks)
+{
+    const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i STATE0, STATE1, MSG, TMP, M[4];
+
+    TMP = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)H), 0xB1);         // CDAB
+    STATE1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(H+4)), 0x1B);  // EFGH
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);                                   // ABEF
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);                                // CDGH
+
+    for (; nblocks; nblocks--, data += 64) {
+        __m128i ABEF_SAVE = STATE0, CDGH_SAVE = STATE1;
+        for (int i=0; i<4; i++)
+            M[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+16*i)), BSWAP);
+
+        SHANI256_STEP(0);  SHANI256_STEP(1);  SHANI256_STEP(2);  SHANI256_STEP(3);
+        SHANI256_STEP(4);  SHANI256_STEP(5);  SHANI256_STEP(6);  SHANI256_STEP(7);
+        SHANI256_STEP(8);  SHANI256_STEP(9);  SHANI256_STEP(10); SHANI256_STEP(11);
+        SHANI256_STEP(12); SHANI256_STEP(13); SHANI256_STEP(14); SHANI256_STEP(15);
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);          // FEBA
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);       // DCHG
+    _mm_storeu_si128((__m128i *)H, _mm_blend_epi16(TMP, STATE1, 0xF0));       // DCBA
+    _mm_storeu_si128((__m128i *)(H+4), _mm_alignr_epi8(STATE1, TMP, 8));      // HGFE
+}
+
+
+/* AVX2 SHA-256, one 32-bit lane per message as for SHA-1 */
+#define S0_8(x)     _mm256_xor_si256(_mm256_xor_si256(ROR8(x,2), ROR8(x,13)), ROR8(x,22))
+#define S1_8(x)     _mm256_xor_si256(_mm256_xor_si256(ROR8(x,6), ROR8(x,11)), ROR8(x,25))
+#define s0_8(x)     _mm256_xor_si256(_mm256_xor_si256(ROR8(x,7), ROR8(x,18)), _mm256_srli_epi32(x,3))
+#define s1_8(x)     _mm256_xor_si256(_mm256_xor_si256(ROR8(x,17), ROR8(x,19)), _mm256_srli_epi32(x,10))
+
+__attribute__((target("avx2")))
+void sha256_avx2_x8_blocks(unsigned int H[8][8], const unsigned char *data[8], unsigned long nblocks)
+{
+    const __m256i BSWAP = _mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+                                           3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+    unsigned int lanes[8][8];
+    for (int i=0; i<8; i++)
+        for (int l=0; l<8; l++)
+            lanes[i][l] = H[l][i];
+    __m256i s[8];
+    for (int i=0; i<8; i++)
+        s[i] = _mm256_loadu_si256((const __m256i *)lanes[i]);
+
+    for (unsigned long blk=0; blk<nblocks; blk++) {
+        __m256i W[16];
+        for (int half=0; half<2; half++) {
+            for (int l=0; l<8; l++)
+                W[8*half+l] = _mm256_loadu_si256((const __m256i *)(data[l]+64*blk+32*half));
+            sha_avx2_transpose(W+8*half);
+            for (int i=0; i<8; i++)
+                W[8*half+i] = _mm256_shuffle_epi8(W[8*half+i], BSWAP);
+        }
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int t=0; t<64; t++) {
+            if (t >= 16)
+                W[t&15] = _mm256_add_epi32(_mm256_add_epi32(s1_8(W[(t-2)&15]), W[(t-7)&15]),
+                                           _mm256_add_epi32(s0_8(W[(t-15)&15]), W[t&15]));
+            __m256i ch = _mm256_xor_si256(g, _mm256_and_si256(e, _mm256_xor_si256(f, g)));
+            __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1_8(e)),
+                                          _mm256_add_epi32(_mm256_add_epi32(ch, _mm256_set1_epi32(sha256_K[t])), W[t&15]));
+            __m256i t2 = _mm256_add_epi32(S0_8(a), maj);
+            h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+            d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+        }
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+        s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g);
+        s[7] = _mm256_add_epi32(s[7], h);
+    }
+
+    for (int i=0; i<8; i++)
+        _mm256_storeu_si256((__m256i *)lanes[i], s[i]);
+    for (int i=0; i<8; i++)
+        for (int l=0; l<8; l++)
+            H[l][i] = lanes[i][l];
+}
+
+#else
+
+int sha_x86_has_shani(void)
+{
+    return 0;
+}
+
+int sha_x86_has_avx2(void)
+{
+    return 0;
+}
+
+void sha1_shani_blocks(unsigned int H[5], const unsigned char *data, unsigned long nblocks)
+{
+}
+
+void sha1_avx2_x8_blocks(unsigned int H[8][5], const unsigned char *data[8], unsigned long nblocks)
+{
+}
+
+void sha256_shani_blocks(unsigned int H[8], const unsigned char *data, unsigned long nblocks)
+{
+}
+
+void sha256_avx2_x8_blocks(unsigned int H[8][8], const unsigned char *data[8], unsigned long nblocks)
+{
+}
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ *  shax86.h
+ *  SHA-1 and SHA-256 block functions for x86, see shax86.cpp. Picked at
+ *  runtime by sha1.cpp and sha256.cpp when the CPU has them.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#ifndef SWIFT_SHAX86_H
+#define SWIFT_SHAX86_H
+
+int sha_x86_has_shani(void);
+int sha_x86_has_avx2(void);
+
+void sha1_shani_blocks(unsigned int H[5], const unsigned char *data, unsigned long nblocks);
+void sha1_avx2_x8_blocks(unsigned int H[8][5], const unsigned char *data[8], unsigned long nblocks);
+void sha256_shani_blocks(unsigned int H[8], const unsigned char *data, unsigned long nblocks);
+void sha256_avx2_x8_blocks(unsigned int H[8][8], const unsigned char *data[8], unsigned long nblocks);
+
+#endif
@@ -30,7 +30,7 @@ Storage::Storage(std::string ospathname, std::string destdir, int td, uint64_t l
     Operational(),
     state_(STOR_STATE_INIT),
     os_pathname_(ospathname), destdir_(destdir), ht_(NULL), spec_size_(0),
-    single_fd_(-1), reserved_size_(-1), total_size_from_spec_(-1), last_sf_(NULL),
+    single_fd_(-1), single_map_(NULL), single_map_size_(0), reserved_size_(-1), total_size_from_spec_(-1), last_sf_(NULL),
     td_(td), alloc_cb_(NULL), live_disc_wnd_bytes_(live_disc_wnd_bytes), meta_mfspec_os_pathname_(metamfspecospathname)
 {
     // SIGNPEAK
@@ -105,6 +105,12 @@ Storage::Storage(std::string ospathname, std::string destdir, int td, uint64_t l
 
 Storage::~Storage()
 {
+#ifndef _WIN32
+    if (single_map_ != NULL && single_map_ != MAP_FAILED) {
+        // Queued and in-flight datagrams may still point into the mapping
+        Channel::UnmapWhenSent((void *)single_map_, single_map_size_);
+    }
+#endif
     if (single_fd_ != -1)
         close(single_fd_);
 
@@ -437,6 +443,49 @@ int Storage::OpenSingleFile()
 
 
 
+int Storage::GetReadFD(size_t nbyte, int64_t offset, int64_t *fdoffset)
+{
+    if (state_ == STOR_STATE_SINGLE_FILE) {
+        *fdoffset = offset;
+        return single_fd_;
+    } else if (state_ == STOR_STATE_SINGLE_LIVE_WRAP) {
+        *fdoffset = offset % live_disc_wnd_bytes_;
+        return single_fd_;
+    }
+    // MULTIFILE: chunks may straddle files, leave to Read
+    return -1;
+}
+
+
+const uint8_t *Storage::GetMappedRange(size_t nbyte, int64_t offset, size_t *mappedlen)
+{
+#ifndef _WIN32
+    if (state_ != STOR_STATE_SINGLE_FILE)
+        return NULL;
+    if (single_map_ == NULL) {
+        // Map once, on first use. A failed mmap is not retried.
+        single_map_size_ = file_size(single_fd_);
+        if (single_map_size_ <= 0 || (uint64_t)single_map_size_ > (size_t)-1) {
+            single_map_ = (const uint8_t *)MAP_FAILED;
+            return NULL;
+        }
+        single_map_ = (const uint8_t *)mmap(NULL, single_map_size_, PROT_READ, MAP_SHARED, single_fd_, 0);
+        if (single_map_ == MAP_FAILED) {
+            print_error("storage: mmap failed, no zero-copy");
+            return NULL;
+        }
+        dprintf("%s %s storage: mapped %" PRIi64 " bytes\n", tintstr(), roothashhex().c_str(), single_map_size_);
+    }
+    if (single_map_ == MAP_FAILED || offset < 0 || offset >= single_map_size_)
+        return NULL;
+    *mappedlen = std::min((int64_t)nbyte, single_map_size_-offset);
+    return single_map_ + offset;
+#else
+    return NULL;
+#endif
+}
+
+
 ssize_t Storage::Read(void *buf, size_t nbyte, int64_t offset)
 {
     //dprintf("%s %s storage: Read: nbyte " PRISIZET " off %" PRIi64 "\n", tintstr(), roothashhex().c_str(), nbyte, offset );
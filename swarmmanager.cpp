@@ -58,7 +58,8 @@ namespace swift
         id_(-1), rootHash_(rootHash), active_(false), latestUse_(0), stateToBeRemoved_(false), contentToBeRemoved_(false),
         ft_(NULL),
         filename_(filename), trackerurl_(trackerurl), forceCheckDiskVSHash_(force_check_diskvshash), contIntProtMethod_(cipm),
-        chunkSize_(chunk_size), zerostate_(zerostate), cached_(false), metadir_(metadir)
+        chunkSize_(chunk_size), zerostate_(zerostate), ccAlgo_((cc_algo_t)Channel::CC_ALGO), cached_(false),
+        metadir_(metadir)
     {
     }
 
@@ -66,8 +67,8 @@ namespace swift
         id_(-1), rootHash_(sd.rootHash_), active_(false), latestUse_(0), stateToBeRemoved_(false), contentToBeRemoved_(false),
         ft_(NULL),
         filename_(sd.filename_), trackerurl_(sd.trackerurl_), forceCheckDiskVSHash_(sd.forceCheckDiskVSHash_),
-        contIntProtMethod_(sd.contIntProtMethod_), chunkSize_(sd.chunkSize_), zerostate_(sd.zerostate_), cached_(false),
-        metadir_(sd.metadir_)
+        contIntProtMethod_(sd.contIntProtMethod_), chunkSize_(sd.chunkSize_), zerostate_(sd.zerostate_),
+        ccAlgo_(sd.ccAlgo_), cached_(false), metadir_(sd.metadir_)
     {
     }
 
@@ -155,6 +156,14 @@ namespace swift
             cachedMaxSpeeds_[ddir] = speed;
     }
 
+    void SwarmData::SetCongestionControl(cc_algo_t algo)
+    {
+        // Kept for when the swarm is (re)activated
+        ccAlgo_ = algo;
+        if (ft_)
+            ft_->SetCongestionControl(algo);
+    }
+
     void SwarmData::AddProgressCallback(ProgressCallback cb, uint8_t agg)
     {
         if (ft_) {
@@ -420,6 +429,7 @@ namespace swift
         if (swarm->rootHash_ == Sha1Hash::ZERO)
             swarm->rootHash_ = swarm->ft_->swarm_id().roothash();
         assert(swarm->RootHash() != Sha1Hash::ZERO);
+        swarm->ft_->SetCongestionControl(swarm->ccAlgo_);
         if (swarm->cached_) {
             swarm->cached_ = false;
             swarm->SetMaxSpeed(DDIR_DOWNLOAD, swarm->cachedMaxSpeeds_[DDIR_DOWNLOAD]);
@@ -62,6 +62,7 @@ namespace swift
         uint32_t chunkSize_;
         bool zerostate_;
         double cachedMaxSpeeds_[2];
+        cc_algo_t ccAlgo_;
         bool cachedStorageReady_;
         std::list<std::string> cachedStorageFilenames_;
         uint64_t cachedSize_;
@@ -99,6 +100,7 @@ namespace swift
         std::string OSPathName();
 
         void SetMaxSpeed(data_direction_t ddir, double speed);
+        void SetCongestionControl(cc_algo_t algo);
         void AddProgressCallback(ProgressCallback cb, uint8_t agg);
         void RemoveProgressCallback(ProgressCallback cb);
 
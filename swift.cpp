@@ -13,6 +13,10 @@
 #include <cfloat>
 #include <sstream>
 #include <iostream>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <signal.h>
+#endif
 
 #include <event2/http.h>
 #include <event2/http_struct.h>
@@ -26,6 +30,7 @@ using namespace swift;
 // Local constants
 #define RESCAN_DIR_INTERVAL 30 // seconds
 #define REPORT_INTERVAL      1 // 1 second. Use cmdgw_report_interval for larger intervals
+#define PATH_CACHE_SAVE_INTERVAL 60 // seconds
 
 // Arno, 2012-09-18: LIVE: Somehow Win32 works better when reading at a slower pace
 #ifdef WIN32
@@ -81,6 +86,22 @@ void usage(void)
     fprintf(stderr,"  -a live signature algorithm\n");
     fprintf(stderr,"  -W live discard window in chunks\n");
     fprintf(stderr,"  -I live source address (used with ext tracker)\n");
+    fprintf(stderr,"  -R, --recvbatch\tmax datagrams read per wakeup (default: %d)\n",
+            Channel::RECV_BATCH_SIZE);
+    fprintf(stderr,"  -O, --udpoffload\tsend DATA bursts with UDP GSO and receive with GRO (Linux)\n");
+    fprintf(stderr,"  -U, --shards\t\tseed with N processes sharing the listen port via SO_REUSEPORT\n");
+    fprintf(stderr,"  -X, --iouring\t\tUDP and chunk reads via io_uring (Linux, built with SWIFT_IOURING)\n");
+    fprintf(stderr,"  -Z, --zerocopy\tsend complete content from an mmap of the file without copying\n");
+    fprintf(stderr,"  -F, --pacing\t\tqueue DATA a window at a time, paced by 1: swift, 2: the kernel (SO_TXTIME, fq/etf qdisc)\n");
+    fprintf(stderr,"  -A, --cc\t\tcongestion control: ledbat (background, default) or bbr (throughput)\n");
+    fprintf(stderr,"  -J, --pathcache\tkeep the RTT and window of peers in this file, to start from on reconnects\n");
+    fprintf(stderr,"  -Y, --ackdelay\tmax ms an ACK waits to be sent with others (default: %d)\n",
+            (int)(Channel::ACK_DELAY/TINT_MSEC));
+    fprintf(stderr,"  -V, --ackcount\tACK at once every N chunks received (default: %d, 1 for no delay)\n",
+            Channel::ACK_COUNT);
+    fprintf(stderr,"  -b, --hashthreads\tthreads hashing content when opening it (default: 0, one per core)\n");
+    fprintf(stderr,"  -x, --haveruns\toffer HAVE_RUNS to peers we connect to, only when all run this version\n");
+    fprintf(stderr,"  -Q, --chunkaddr64\t64-bit chunk addressing for content of unknown size, needs peers of this version\n");
 }
 #define quit(...) {fprintf(stderr,__VA_ARGS__); exit(1); }
 int HandleSwiftSwarm(std::string filename, SwarmID &swarmid, std::string trackerurl, Address srcaddr, bool printurl,
@@ -96,6 +117,7 @@ void HandleLiveSource(std::string livesource_input, std::string filename, std::s
 void AttemptCheckpoint();
 
 void ReportCallback(int fd, short event, void *arg);
+void HashProgressCallback(const std::string &ospathname, uint64_t donec, uint64_t sizec);
 void EndCallback(int fd, short event, void *arg);
 void RescanDirCallback(int fd, short event, void *arg);
 int CreateMultifileSpec(std::string specfilename, int argc, char *argv[], int argidx);
@@ -127,6 +149,7 @@ bool report_progress = false;
 bool quiet=false;
 bool exitoncomplete=false;
 bool httpgw_enabled=false,cmdgw_enabled=false;
+int nshards = 1;
 // Gertjan fix
 bool do_nat_test = false;
 bool generate_multifile=false;
@@ -192,6 +215,19 @@ int utf8main(int argc, char** argv)
         {"ldw",required_argument, 0, 'W'}, // PPSP
         {"ia",required_argument, 0, 'I'}, // EXTTRACK
         {"quiet", no_argument, 0, 'q'}, // be quiet!
+        {"recvbatch",required_argument, 0, 'R'}, // max datagrams read per wakeup
+        {"udpoffload",no_argument, 0, 'O'}, // UDP GSO/GRO
+        {"shards",required_argument, 0, 'U'}, // SO_REUSEPORT shard processes
+        {"iouring",no_argument, 0, 'X'}, // io_uring I/O backend
+        {"zerocopy",no_argument, 0, 'Z'}, // DATA from mmap'd content
+        {"pacing",required_argument, 0, 'F'}, // paced DATA windows
+        {"cc",required_argument, 0, 'A'}, // congestion control
+        {"pathcache",required_argument, 0, 'J'}, // RTT and window per peer across runs
+        {"ackdelay",required_argument, 0, 'Y'}, // delayed ACKs
+        {"ackcount",required_argument, 0, 'V'}, // delayed ACKs
+        {"hashthreads",required_argument, 0, 'b'}, // parallel hash tree construction
+        {"haveruns",no_argument, 0, 'x'}, // POPT_SUPP_MSGS with HAVE_RUNS
+        {"chunkaddr64",no_argument, 0, 'Q'}, // CHUNK64/BIN64 before the size is known
         {0, 0, 0, 0}
     };
 
@@ -214,7 +250,7 @@ int utf8main(int argc, char** argv)
 
     std::string optargstr;
     int c,n;
-    while (-1 != (c = getopt_long(argc, argv, ":h:f:d:l:t:D:L:pg:s:c:o:u:y:z:w:BNHmqM:e:r:ji:kC:1:2:3:4:T:GW:P:K:S:a:I:n:",
+    while (-1 != (c = getopt_long(argc, argv, ":h:f:d:l:t:D:L:pg:s:c:o:u:y:z:w:BNHmqM:e:r:ji:kC:1:2:3:4:T:GW:P:K:S:a:I:n:R:OU:XZF:A:J:Y:V:b:xQ",
                                   long_options, 0))) {
         switch (c) {
         case 'h':
@@ -329,6 +365,8 @@ int utf8main(int argc, char** argv)
             n = sscanf(optarg,"%i",&chunk_size);
             if (n != 1)
                 quit("chunk size must be bytes as int\n");
+            if (chunk_size < 1 || chunk_size > SWIFT_MAX_CHUNK_SIZE)
+                quit("chunk size must be between 1 and %d bytes\n", SWIFT_MAX_CHUNK_SIZE);
             break;
         case 'm': // printurl
             printurl = true;
@@ -429,6 +467,63 @@ int utf8main(int argc, char** argv)
             if (srcaddr==Address())
                 quit("address must be hostname:port, ip:port or just port\n");
             break;
+        case 'R':
+            n = sscanf(optarg,"%i",&Channel::RECV_BATCH_SIZE);
+            if (n != 1 || Channel::RECV_BATCH_SIZE < 1 || Channel::RECV_BATCH_SIZE > DGRAM_MAX_RECV_BATCH)
+                quit("recvbatch must be an int between 1 and %d\n", DGRAM_MAX_RECV_BATCH);
+            break;
+        case 'O':
+            Channel::UDP_OFFLOAD = true;
+            break;
+        case 'X':
+            Channel::IO_URING = true;
+            break;
+        case 'Z':
+            Channel::ZERO_COPY = true;
+            break;
+        case 'F':
+            n = sscanf(optarg,"%i",&Channel::PACING);
+            if (n != 1 || Channel::PACING < PACING_OFF || Channel::PACING > PACING_TXTIME)
+                quit("pacing must be 0 (off), 1 (swift) or 2 (kernel)\n");
+            break;
+        case 'A':
+            Channel::CC_ALGO = CongestionController::ByName(optarg);
+            if (Channel::CC_ALGO < 0)
+                quit("congestion control must be ledbat or bbr\n");
+            break;
+        case 'J':
+            Channel::Time();
+            PathCache::GetInstance()->SetFile(optarg);
+            break;
+        case 'Y': {
+            int ms;
+            n = sscanf(optarg,"%i",&ms);
+            if (n != 1 || ms < 0)
+                quit("ackdelay must be an int >= 0\n");
+            Channel::ACK_DELAY = ms*TINT_MSEC;
+            break;
+        }
+        case 'V':
+            n = sscanf(optarg,"%i",&Channel::ACK_COUNT);
+            if (n != 1 || Channel::ACK_COUNT < 1)
+                quit("ackcount must be an int >= 1\n");
+            break;
+        case 'b':
+            n = sscanf(optarg,"%i",&MmapHashTree::SUBMIT_THREADS);
+            if (n != 1 || MmapHashTree::SUBMIT_THREADS < 0)
+                quit("hashthreads must be an int >= 0\n");
+            break;
+        case 'x':
+            Channel::HAVE_RUNS = true;
+            break;
+        case 'Q':
+            Channel::CHUNK_ADDR_64 = true;
+            break;
+        case 'U':
+            n = sscanf(optarg,"%i",&nshards);
+            if (n != 1 || nshards < 1 || nshards > SWIFT_MAX_SHARDS)
+                quit("shards must be an int between 1 and %d\n", SWIFT_MAX_SHARDS);
+            break;
         case 'T': // ZEROSTATE
             double t=0.0;
             n = sscanf(optarg,"%lf",&t);
@@ -440,6 +535,8 @@ int utf8main(int argc, char** argv)
 
     }   // arguments parsed
 
+    if (report_progress && !quiet)
+        MmapHashTree::SUBMIT_PROGRESS = HashProgressCallback;
 
     // Change dir to destdir, if set, or to tempdir if HTTPGW
     if (destdir == "") {
@@ -453,6 +550,15 @@ int utf8main(int argc, char** argv)
     if (httpgw_enabled && !quiet)
         fprintf(stderr,"CWD %s\n",getcwd_utf8().c_str());
 
+    if (nshards > 1) {
+        // Shards share nothing but the port, so only plain seeding
+        if (bindaddr==Address() || httpgw_enabled || cmdgw_enabled || statsaddr!=Address() || livesource_input != "")
+            quit("shards only work when seeding with -l, without gateways or live source\n");
+        if (Channel::ShardSetup(nshards) < 0)
+            quit("cannot set up %d shards\n", nshards);
+        Channel::REUSE_PORT = true;
+    }
+
     if (bindaddr!=Address()) { // seeding
         if (Listen(bindaddr)<=0)
             quit("cant listen to %s\n",bindaddr.str().c_str())
@@ -574,6 +680,26 @@ int utf8main(int argc, char** argv)
         quit("Not client, not live server, not a gateway, not zero state seeder?");
 
 
+#ifndef _WIN32
+    // Fork the shards after the swarms are loaded, so they hash check once
+    if (nshards > 1) {
+        int shard = 0;
+        for (int i=1; i<nshards && shard==0; i++) {
+            pid_t pid = fork();
+            if (pid < 0)
+                quit("cannot fork shard %d\n", i);
+            if (pid == 0) {
+                shard = i;
+#ifdef __linux__
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+            }
+        }
+        if (Channel::ShardStart(shard) < 0)
+            quit("cannot start shard %d\n", shard);
+    }
+#endif
+
     // Arno, 2012-01-04: Allow download and quit mode
     if (single_td != -1 && !(swarmid == SwarmID::NOSWARMID) && wait_time == 0) {
         wait_time = TINT_NEVER;
@@ -911,6 +1037,19 @@ void AttemptCheckpoint()
 }
 
 
+void HashProgressCallback(const std::string &ospathname, uint64_t donec, uint64_t sizec)
+{
+    // Called while content is hashed, before the event loop runs
+    static tint last = 0;
+    tint now = usec_time();
+    if (now-last < TINT_SEC && donec != sizec)
+        return;
+    last = now;
+    fprintf(stderr,"hashing %s: %" PRIu64 " of %" PRIu64 " chunks, %" PRIu64 "%%\n",
+            ospathname.c_str(), donec, sizec, donec*100/sizec);
+}
+
+
 void ReportCallback(int fd, short event, void *arg)
 {
     // Called every second to print/calc some stats
@@ -940,6 +1079,42 @@ void ReportCallback(int fd, short event, void *arg)
 
             fprintf(stderr, "\n");
 
+            if (Channel::global_recv_wakeups)
+                fprintf(stderr,"recv %.2f dgram/wakeup (max %" PRIu64 ")\n",
+                        (double)Channel::global_recv_batch_dgrams/Channel::global_recv_wakeups,
+                        Channel::global_recv_batch_max);
+            if (Channel::global_send_flushes)
+                fprintf(stderr,"send %.2f dgram/flush (max %" PRIu64 ")\n",
+                        (double)Channel::global_send_flush_dgrams/Channel::global_send_flushes,
+                        Channel::global_send_flush_max);
+            if (Channel::global_gso_sends || Channel::global_gro_segments)
+                fprintf(stderr,"gso %" PRIu64 " sends %" PRIu64 " dgrams, gro %" PRIu64 " dgrams\n",
+                        Channel::global_gso_sends, Channel::global_gso_segments, Channel::global_gro_segments);
+            if (Channel::global_uring_sends || Channel::global_uring_recvs || Channel::global_uring_reads)
+                fprintf(stderr,"uring sends %" PRIu64 " recvs %" PRIu64 " reads %" PRIu64 "\n",
+                        Channel::global_uring_sends, Channel::global_uring_recvs, Channel::global_uring_reads);
+            if (Channel::global_zerocopy_chunks)
+                fprintf(stderr,"zerocopy %" PRIu64 " chunks %" PRIu64 " bytes\n",
+                        Channel::global_zerocopy_chunks, Channel::global_zerocopy_bytes);
+            if (Channel::global_paced_dgrams)
+                fprintf(stderr,"paced %" PRIu64 " dgrams, %" PRIu64 " by kernel, pacer wakeups %" PRIu64 "\n",
+                        Channel::global_paced_dgrams, Channel::global_txtime_dgrams, Channel::global_pacer_wakeups);
+            if (Channel::global_hs_rate_rejected || Channel::global_hs_unknown_rejected)
+                fprintf(stderr,"handshakes rejected %" PRIu64 " over rate %" PRIu64 " unknown swarm\n",
+                        Channel::global_hs_rate_rejected, Channel::global_hs_unknown_rejected);
+            if (Channel::global_ack_msgs)
+                fprintf(stderr,"acks %" PRIu64 " msgs for %" PRIu64 " chunks\n",
+                        Channel::global_ack_msgs, Channel::global_ack_chunks);
+            if (Channel::global_hash_msgs && Channel::global_bytes_up)
+                fprintf(stderr,"hashes %" PRIu64 " msgs %.1f%% of data bytes, %" PRIu64 " not resent\n",
+                        Channel::global_hash_msgs,
+                        100.0*Channel::global_hash_bytes_up/Channel::global_bytes_up,
+                        Channel::global_hash_skipped);
+            if (Channel::shard_count > 1)
+                fprintf(stderr,"shard %d/%d handoff out %" PRIu64 " in %" PRIu64 "\n",
+                        Channel::shard_id, Channel::shard_count,
+                        Channel::global_shard_forwarded, Channel::global_shard_received);
+
             if (up/1048576 > 1)
                 fprintf(stderr,"upload %.2f MB/s (%lf B/s)\n", up/(1<<20), up);
             else
@@ -1018,6 +1193,10 @@ void ReportCallback(int fd, short event, void *arg)
     if (cmdgw_report_interval == 1 || ((cmdgw_report_counter % cmdgw_report_interval) == 0))
         CmdGwUpdateDLStatesCallback();
 
+    // A daemon is killed rather than ends, so save the paths now and then
+    if ((cmdgw_report_counter % PATH_CACHE_SAVE_INTERVAL) == 0)
+        PathCache::GetInstance()->Save();
+
     cmdgw_report_counter++;
 
     evtimer_add(&evreport, tint2tv(REPORT_INTERVAL*TINT_SEC));
@@ -70,6 +70,7 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <list>
 #include <algorithm>
 #include <string>
@@ -84,6 +85,9 @@
 #include "avgspeed.h"
 #include "avail.h"
 #include "exttrack.h"
+#include "iouring.h"
+#include "timerwheel.h"
+#include "congestion.h"
 
 
 namespace swift
@@ -137,12 +141,51 @@ namespace swift
 
 
 #define SWIFT_MAX_UDP_OVER_ETH_PAYLOAD        (1500-20-8)
+// Largest UDP payload over IPv4
+#define SWIFT_MAX_UDP_PAYLOAD                (65535-20-8)
 // Arno: Maximum size of non-DATA messages in a UDP packet we send.
 #define SWIFT_MAX_NONDATA_DGRAM_SIZE         (SWIFT_MAX_UDP_OVER_ETH_PAYLOAD-SWIFT_DEFAULT_CHUNK_SIZE-1-4)
-// Arno: Maximum size of a UDP packet we send. Note: depends on CHUNKSIZE 8192
+// Channel ID and DATA header: message id, CHUNK64 address, timestamp
+#define SWIFT_MAX_DATA_HDR_SIZE              (4+1+8+8+8)
+// Largest chunk a DATA datagram can carry. A 64 KB chunk doesn't fit.
+#define SWIFT_MAX_CHUNK_SIZE                 (SWIFT_MAX_UDP_PAYLOAD-SWIFT_MAX_DATA_HDR_SIZE)
+// Arno: Maximum size of a UDP packet we send from a pooled buffer, for
+// chunks up to 8192. See dgram_new_size() for bigger.
 #define SWIFT_MAX_SEND_DGRAM_SIZE            (SWIFT_MAX_NONDATA_DGRAM_SIZE+1+4+8192)
-// Arno: Maximum size of a UDP packet we are willing to accept. Note: depends on CHUNKSIZE 8192
-#define SWIFT_MAX_RECV_DGRAM_SIZE            (SWIFT_MAX_SEND_DGRAM_SIZE*2)
+// Arno: Maximum size of a UDP packet we are willing to accept
+#define SWIFT_MAX_RECV_DGRAM_SIZE            SWIFT_MAX_UDP_PAYLOAD
+// Maximum size of the super-datagram UDP GSO sends or GRO delivers
+#define SWIFT_MAX_GRO_DGRAM_SIZE             65535
+// Size of the buffers in the datagram pool, see dgram_new()
+#define SWIFT_DGRAM_BUF_SIZE                 (SWIFT_MAX_SEND_DGRAM_SIZE*2)
+// Max number of free buffers kept in the datagram pool
+#define SWIFT_DGRAM_POOL_MAX                 1024
+// Size of the buffers in the pool for large chunks, room for a DATA of the
+// largest chunk and all else, see dgram_new_size()
+#define SWIFT_DGRAM_BIG_BUF_SIZE             (SWIFT_DGRAM_BUF_SIZE-8192+SWIFT_MAX_CHUNK_SIZE)
+// Max number of free buffers kept in the pool for large chunks
+#define SWIFT_DGRAM_BIG_POOL_MAX             64
+// Max number of segments in one UDP GSO send (UDP_MAX_SEGMENTS in Linux)
+#define SWIFT_MAX_GSO_SEGMENTS               64
+// Pacing: how far ahead a channel queues DATA, at most this many at once,
+// and how early the userspace pacer may let a datagram go (usec)
+#define SWIFT_PACING_HORIZON                 (25*TINT_MSEC)
+#define SWIFT_PACING_MAX_BURST               64
+#define SWIFT_PACING_SLACK                   250
+// Path cache: addresses and hosts whose RTT and window are remembered, and
+// above which loss rate a remembered window is not started from
+#define SWIFT_PATH_CACHE_SIZE                4096
+#define SWIFT_PATH_CACHE_MAX_LOSS            0.1
+// Size of an ACK of a range of chunks: type, start, end, one-way delay
+#define SWIFT_ACK_RANGE_MAX_SIZE             (1+8+8+8)
+// HAVE_RUNS: type, first chunk, number of runs, then their lengths
+#define SWIFT_HAVE_RUNS_HDR_SIZE             (1+8+2)
+// Chunk IDs from CHUNK64 specs must be below this, such that the bins
+// covering them fit in bin_t
+#define SWIFT_CHUNK64_MAX                    (((uint64_t)1)<<62)
+// Bins completed a transfer remembers for its channels to announce, see
+// ContentTransfer::LogHave()
+#define SWIFT_HAVE_LOG_SIZE                  1024
 
 #define layer2bytes(ln,cs)    (uint64_t)( ((double)cs)*pow(2.0,(double)ln))
 #define bytes2layer(bn,cs)  (int)log2(  ((double)bn)/((double)cs) )
@@ -240,6 +283,24 @@ namespace swift
             return addr.ss_family;
         }
         socklen_t get_family_sockaddr_length() const;
+        /** Hash that agrees with ==, i.e. an IPv4-mapped IPv6 address
+         *  hashes like the IPv4 address */
+        size_t hash() const;
+    };
+
+    struct AddressHash {
+        size_t operator()(const Address &a) const {
+            return a.hash();
+        }
+    };
+
+    /** What a channel learnt of the path to a peer */
+    struct path_metrics_t {
+        tint    rtt_avg, dev_avg;
+        float   cwnd_bytes; // last window sending DATA, in bytes as chunk sizes differ
+        float   loss_rate;  // of the DATA sent, timed out
+        tint    updated;
+        path_metrics_t() : rtt_avg(0), dev_avg(0), cwnd_bytes(0), loss_rate(0), updated(0) {}
     };
 
 
@@ -255,6 +316,52 @@ namespace swift
         sockcb_t   on_error;
     };
 
+    /** Slot in the preallocated receive ring used by Channel::RecvBatch().
+     *  buf is owned by the caller and must hold size bytes, which should be
+     *  SWIFT_MAX_RECV_DGRAM_SIZE, or SWIFT_MAX_GRO_DGRAM_SIZE with UDP_OFFLOAD.
+     *  With UDP GRO the kernel may coalesce several same-size datagrams from
+     *  one peer into a slot, segsize is then the size of each (the last may
+     *  be shorter), and 0 otherwise. */
+    struct recv_slot_t {
+        Address         addr;
+        int             length;
+        int             segsize;
+        char            *buf;
+        int             size;
+    };
+
+    /** Datagram buffer used on the send and receive paths. Messages are
+     *  appended at len and parsed with a cursor at off, so bytes are never
+     *  moved. Buffers come from a free list of SWIFT_DGRAM_BUF_SIZE buffers,
+     *  see dgram_new(), from one of SWIFT_DGRAM_BIG_BUF_SIZE buffers for large
+     *  chunks, see dgram_new_size(), or wrap memory owned by someone else, see
+     *  dgram_wrap().
+     *  A DATA payload may follow the buffer by reference, see dgram_add_ref(). */
+    struct dgram_t {
+        uint8_t         *data;
+        size_t          cap;
+        size_t          off;
+        size_t          len;
+        const uint8_t   *ref;   // payload sent after data[off,len), not owned
+        size_t          reflen;
+        dgram_t         *next;  // free list
+    };
+
+    class Channel;
+
+    /** Datagram waiting in a socket's send queue for the next
+     *  Channel::FlushSendQueue(). owner is the Channel to credit the bytes
+     *  to, or NULL for channel-less sends such as StaticSendClose. */
+    struct send_slot_t {
+        Address          addr;
+        dgram_t         *dgram;
+        Channel         *owner;
+        tint             txtime;    // SO_TXTIME departure, 0 for now
+    };
+
+    /** Chunk read submitted to the io_uring backend, see Channel::ChunkReady */
+    struct chunk_read_t;
+
     struct now_t  {
         static tint now;
     };
@@ -315,6 +422,116 @@ namespace swift
     };
 
 
+    /** Sends of single chunks awaiting acknowledgement, oldest first, with
+        an index by chunk. Acks unlink entries wherever they are in the
+        queue, so there are no tombstones and lookup is O(1). */
+    class tbinflight
+    {
+        struct entry_t {
+            tintbin     tb;
+            bool        resent;
+            uint32_t    prev, next;
+        };
+        enum { NIL = 0xffffffff };
+        std::vector<entry_t>    entries_;
+        std::unordered_map<bin_t::uint_t,uint32_t> index_;
+        uint32_t    head_, tail_, free_;
+
+        void unlink(uint32_t i) {
+            entry_t &e = entries_[i];
+            if (e.prev == NIL)
+                head_ = e.next;
+            else
+                entries_[e.prev].next = e.next;
+            if (e.next == NIL)
+                tail_ = e.prev;
+            else
+                entries_[e.next].prev = e.prev;
+            index_.erase(e.tb.bin.base_offset());
+            e.next = free_;
+            free_ = i;
+        }
+    public:
+        tbinflight() : head_(NIL), tail_(NIL), free_(NIL) {}
+        int size() const {
+            return index_.size();
+        }
+        bool empty() const {
+            return head_ == NIL;
+        }
+        const tintbin&  front() const {
+            return entries_[head_].tb;
+        }
+        void            pop_front() {
+            unlink(head_);
+        }
+        /** Append a send; a resend of a chunk still in flight replaces the
+            earlier one. */
+        void            push_back(const tintbin& tb, bool resent=false) {
+            std::unordered_map<bin_t::uint_t,uint32_t>::iterator iter = index_.find(tb.bin.base_offset());
+            if (iter != index_.end()) {
+                unlink(iter->second);
+                resent = true;
+            }
+            uint32_t i = free_;
+            if (i == NIL) {
+                i = entries_.size();
+                entries_.push_back(entry_t());
+            } else
+                free_ = entries_[i].next;
+            entry_t &e = entries_[i];
+            e.tb = tb;
+            e.resent = resent;
+            e.prev = tail_;
+            e.next = NIL;
+            if (tail_ == NIL)
+                head_ = i;
+            else
+                entries_[tail_].next = i;
+            tail_ = i;
+            index_[tb.bin.base_offset()] = i;
+        }
+        /** Remove the sends of chunks in range, returns how many, and in
+            *last the time of the latest of them. *resent is set if any was
+            a resend, so the ack may be for an earlier one (Karn). Costs the
+            lesser of the range and the number in flight. */
+        int             remove(bin_t range, tint *last, bool *resent=NULL) {
+            int n = 0;
+            *last = TINT_NEVER;
+            if (resent)
+                *resent = false;
+            if (range.base_length() <= index_.size()) {
+                bin_t::uint_t off = range.base_offset(), end = off+range.base_length();
+                for ( ; off<end; off++) {
+                    std::unordered_map<bin_t::uint_t,uint32_t>::iterator iter = index_.find(off);
+                    if (iter == index_.end())
+                        continue;
+                    tint t = entries_[iter->second].tb.time;
+                    if (n++ == 0 || t > *last)
+                        *last = t;
+                    if (resent && entries_[iter->second].resent)
+                        *resent = true;
+                    unlink(iter->second);
+                }
+            } else {
+                for (uint32_t i=head_; i!=NIL; ) {
+                    uint32_t next = entries_[i].next;
+                    if (range.contains(entries_[i].tb.bin)) {
+                        tint t = entries_[i].tb.time;
+                        if (n++ == 0 || t > *last)
+                            *last = t;
+                        if (resent && entries_[i].resent)
+                            *resent = true;
+                        unlink(i);
+                    }
+                    i = next;
+                }
+            }
+            return n;
+        }
+    };
+
+
     /** swift protocol message types; these are used on the wire. */
     typedef enum {
         SWIFT_HANDSHAKE = 0,
@@ -332,15 +549,34 @@ namespace swift
         SWIFT_UNCHOKE = 11,
         SWIFT_PEX_RESv6 = 12,
         SWIFT_PEX_REScert = 13,
-        SWIFT_MESSAGE_COUNT = 14
+        SWIFT_HAVE_RUNS = 14,   // extension, only to peers listing it in POPT_SUPP_MSGS
+        SWIFT_MESSAGE_COUNT = 15
     } messageid_t;
 
+    /** Bit per messageid_t, as in POPT_SUPP_MSGS: those of PPSPP, assumed
+     *  when a peer doesn't say, and those we support */
+#define SWIFT_SUPP_MSGS_STANDARD    ((((uint64_t)1)<<SWIFT_HAVE_RUNS)-1)
+#define SWIFT_SUPP_MSGS_ALL         ((((uint64_t)1)<<SWIFT_MESSAGE_COUNT)-1)
+
     typedef enum {
         DDIR_UPLOAD,
         DDIR_DOWNLOAD
     } data_direction_t;
 
 
+    /** Channel::PACING modes. With pacing a channel queues the DATA for a
+     *  window at once, each datagram stamped with when it should leave.
+     *  PACING_TXTIME hands the stamps to the kernel (SO_TXTIME, needs the fq
+     *  or etf qdisc on the interface to take effect). Sockets that refuse
+     *  it, or a qdisc found to ignore it, fall back to PACING_USER, which
+     *  holds datagrams until due. */
+    typedef enum {
+        PACING_OFF=0,
+        PACING_USER=1,
+        PACING_TXTIME=2
+    } pacing_mode_t;
+
+
     /** Arno: enum to indicate when to send an explicit close to the peer when
      * doing a local close.
      */
@@ -385,6 +621,13 @@ namespace swift
         POPT_MERKLE_HASH_FUNC_SHA512 = 4
     } popt_merkle_func_t;
 
+    /** The one Merkle hash function of this build, see HASHSZ */
+#ifdef SWIFT_MERKLE_SHA256
+#define SWIFT_MERKLE_HASH_FUNC  POPT_MERKLE_HASH_FUNC_SHA256
+#else
+#define SWIFT_MERKLE_HASH_FUNC  POPT_MERKLE_HASH_FUNC_SHA1
+#endif
+
     typedef enum {
         POPT_CHUNK_ADDR_BIN32 = 0,
         POPT_CHUNK_ADDR_BYTE64 = 1,
@@ -400,13 +643,13 @@ namespace swift
     {
     public:
 #if ENABLE_IETF_PPSP_VERSION == 1
-        Handshake() : version_(VER_PPSPP_v1), min_version_(VER_PPSPP_v1), merkle_func_(POPT_MERKLE_HASH_FUNC_SHA1),
+        Handshake() : version_(VER_PPSPP_v1), min_version_(VER_PPSPP_v1), merkle_func_(SWIFT_MERKLE_HASH_FUNC),
             live_sig_alg_(DEFAULT_LIVE_SIG_ALG), chunk_addr_(POPT_CHUNK_ADDR_CHUNK32), live_disc_wnd_(POPT_LIVE_DISC_WND_ALL),
-            swarm_id_ptr_(NULL) {}
+            supp_msgs_(SWIFT_SUPP_MSGS_ALL), swarm_id_ptr_(NULL) {}
 #else
-        Handshake() : version_(VER_SWIFT_LEGACY), min_version_(VER_SWIFT_LEGACY), merkle_func_(POPT_MERKLE_HASH_FUNC_SHA1),
+        Handshake() : version_(VER_SWIFT_LEGACY), min_version_(VER_SWIFT_LEGACY), merkle_func_(SWIFT_MERKLE_HASH_FUNC),
             live_sig_alg_(DEFAULT_LIVE_SIG_ALG), chunk_addr_(POPT_CHUNK_ADDR_BIN32), live_disc_wnd_(POPT_LIVE_DISC_WND_ALL),
-            swarm_id_ptr_(NULL) {}
+            supp_msgs_(SWIFT_SUPP_MSGS_STANDARD), swarm_id_ptr_(NULL) {}
 #endif
         Handshake(Handshake &c) {
             version_ = c.version_;
@@ -416,6 +659,7 @@ namespace swift
             live_sig_alg_ = c.live_sig_alg_;
             chunk_addr_ = c.chunk_addr_;
             live_disc_wnd_ = c.live_disc_wnd_;
+            supp_msgs_ = c.supp_msgs_;
             if (c.swarm_id_ptr_ == NULL)
                 swarm_id_ptr_ = NULL;
             else
@@ -438,11 +682,10 @@ namespace swift
         bool IsSupported() {
             if (cont_int_prot_ == POPT_CONT_INT_PROT_SIGNALL)
                 return false; // PPSPTODO
-            else if (merkle_func_ >= POPT_MERKLE_HASH_FUNC_SHA224)
-                return false; // PPSPTODO
-            else if (chunk_addr_ == POPT_CHUNK_ADDR_BYTE64 || chunk_addr_ == POPT_CHUNK_ADDR_BIN64
-                     || chunk_addr_ == POPT_CHUNK_ADDR_CHUNK64)
-                return false; // PPSPTODO
+            else if (merkle_func_ != SWIFT_MERKLE_HASH_FUNC)
+                return false; // hashes of another size
+            else if (chunk_addr_ == POPT_CHUNK_ADDR_BYTE64)
+                return false; // PPSPTODO, needs the chunk size
             else if (!(live_sig_alg_ == POPT_LIVE_SIG_ALG_RSASHA1 || live_sig_alg_ == POPT_LIVE_SIG_ALG_ECDSAP256SHA256
                        || live_sig_alg_ == POPT_LIVE_SIG_ALG_ECDSAP384SHA384))
                 return false; // PPSPTODO
@@ -458,6 +701,29 @@ namespace swift
             chunk_addr_ =    POPT_CHUNK_ADDR_BIN32;
             live_disc_wnd_ = (uint32_t)POPT_LIVE_DISC_WND_ALL;
             live_sig_alg_ =  DEFAULT_LIVE_SIG_ALG;
+            supp_msgs_ =     SWIFT_SUPP_MSGS_STANDARD;
+        }
+        bool IsChunkAddr64() {
+            return chunk_addr_ == POPT_CHUNK_ADDR_BIN64 || chunk_addr_ == POPT_CHUNK_ADDR_CHUNK64;
+        }
+        /** Switch to 64-bit chunk addressing when content has more chunks
+         *  than 32 bits can address. In BIN32 the root of 2^31 chunks would
+         *  be taken for ALL. */
+        void FitChunkAddr(uint64_t nchunks) {
+            if (chunk_addr_ == POPT_CHUNK_ADDR_BIN32 && nchunks > ((uint64_t)1<<30))
+                chunk_addr_ = POPT_CHUNK_ADDR_BIN64;
+            else if (chunk_addr_ == POPT_CHUNK_ADDR_CHUNK32 && nchunks > ((uint64_t)1<<32))
+                chunk_addr_ = POPT_CHUNK_ADDR_CHUNK64;
+        }
+        /** The 64-bit variant of the 32-bit chunk addressing */
+        void ToChunkAddr64() {
+            if (chunk_addr_ == POPT_CHUNK_ADDR_BIN32)
+                chunk_addr_ = POPT_CHUNK_ADDR_BIN64;
+            else if (chunk_addr_ == POPT_CHUNK_ADDR_CHUNK32)
+                chunk_addr_ = POPT_CHUNK_ADDR_CHUNK64;
+        }
+        bool Supports(messageid_t msg) {
+            return (supp_msgs_ & (((uint64_t)1)<<msg)) != 0;
         }
 
         /**    Peer channel id; zero if we are trying to open a channel. */
@@ -469,6 +735,7 @@ namespace swift
         popt_live_sig_alg_t  live_sig_alg_;
         popt_chunk_addr_t    chunk_addr_;
         uint64_t             live_disc_wnd_;
+        uint64_t             supp_msgs_;
     protected:
         /** Dynamically allocated such that we can deallocate it and
          * save some bytes per channel */
@@ -482,7 +749,7 @@ namespace swift
     {
     public:
         SwarmMeta() : version_(VER_PPSPP_v1), min_version_(VER_PPSPP_v1), cont_int_prot_(POPT_CONT_INT_PROT_MERKLE),
-            merkle_func_(POPT_MERKLE_HASH_FUNC_SHA1),  live_sig_alg_(DEFAULT_LIVE_SIG_ALG), chunk_addr_(POPT_CHUNK_ADDR_CHUNK32),
+            merkle_func_(SWIFT_MERKLE_HASH_FUNC),  live_sig_alg_(DEFAULT_LIVE_SIG_ALG), chunk_addr_(POPT_CHUNK_ADDR_CHUNK32),
             live_disc_wnd_(POPT_LIVE_DISC_WND_ALL), injector_addr_(), chunk_size_(SWIFT_DEFAULT_CHUNK_SIZE), cont_dur_(0),
             cont_len_(0), ext_tracker_url_(""), mime_type_("") {
         }
@@ -507,9 +774,11 @@ namespace swift
     std::string URIToSwarmMeta(parseduri_t &map, SwarmMeta *sm);
 
     class PiecePicker;
-    //class CongestionController; // Arno: Currently part of Channel. See ::NextSendTime()
     class Channel;
     typedef std::vector<Channel *>  channels_t;
+    typedef std::unordered_multimap<Address,Channel *,AddressHash> addrchannels_t;
+    /** Remove the entry for channel c under addr, if any */
+    void addrchannels_erase(addrchannels_t &index, const Address &addr, Channel *c);
     typedef void (*ProgressCallback)(int td, bin_t bin);
     typedef std::pair<ProgressCallback,uint8_t> progcallbackreg_t;
     typedef std::vector<progcallbackreg_t> progcallbackregs_t;
@@ -561,6 +830,9 @@ namespace swift
         Channel *       RandomChannel(Channel *notc);
         /** Arno: Return the Channel to peer "addr" that is not equal to "notc". */
         Channel *       FindChannel(const Address &addr, Channel *notc);
+        /** Index c under addr (its peer or recv_peer) for FindChannel */
+        void            AddPeerIndex(const Address &addr, Channel *c);
+        void            RemovePeerIndex(const Address &addr, Channel *c);
         void            CloseChannels(channels_t delset, bool isall); // do not pass by reference
         void            GarbageCollectChannels();
 
@@ -579,6 +851,13 @@ namespace swift
         double          GetMaxSpeed(data_direction_t ddir);
         /** Arno: Set maximum speed for the given direction in bytes/s */
         void            SetMaxSpeed(data_direction_t ddir, double m);
+        /** Congestion control of channels opened from now on */
+        cc_algo_t       GetCongestionControl() {
+            return cc_algo_;
+        }
+        void            SetCongestionControl(cc_algo_t algo) {
+            cc_algo_ = algo;
+        }
         /** Arno: Return the number of non-seeders current channeled with. */
         uint32_t        GetNumLeechers();
         /** Arno: Return the number of seeders current channeled with. */
@@ -635,6 +914,20 @@ namespace swift
         void        RemoveProgressCallback(ProgressCallback cb);
         void        Progress(bin_t bin);  /** Called by channels when data comes in */
 
+        /** Log of the bins completed, for channels to announce. Entries
+         *  are numbered from 0, the oldest are dropped. A channel behind
+         *  have_log_start() has to find what's new in ack_out(). */
+        void        LogHave(bin_t bin);
+        uint64_t    have_log_start() {
+            return have_log_start_;
+        }
+        uint64_t    have_log_end() {
+            return have_log_start_+have_log_.size();
+        }
+        bin_t       have_log_at(uint64_t i) {
+            return have_log_[i-have_log_start_];
+        }
+
         /** Arno: Callback to do maintenance for all transfers */
         static void     LibeventGlobalCleanCallback(int fd, short event, void *arg);
         static struct event evclean; // Global for all Transfers
@@ -648,9 +941,13 @@ namespace swift
 
         /** Channels working for this transfer. */
         channels_t      mychannels_;
+        /** Same, by peer() and recv_peer() */
+        addrchannels_t  peer_index_;
 
         /** Progress callback management **/
         progcallbackregs_t callbacks_;
+        std::deque<bin_t>  have_log_;
+        uint64_t        have_log_start_;
 
         /** Piece picker strategy. */
         PiecePicker*    picker_;
@@ -658,6 +955,7 @@ namespace swift
         // RATELIMIT
         MovingAverageSpeed    cur_speed_[2];
         double          max_speed_[2];
+        cc_algo_t       cc_algo_;
         uint32_t        speedupcount_;
         uint32_t        speeddwcount_;
         // MULTIFILE
@@ -923,7 +1221,7 @@ namespace swift
             PING_PONG_CONTROL,
             SLOW_START_CONTROL,
             AIMD_CONTROL,
-            LEDBAT_CONTROL,
+            CC_CONTROL,     // the channel's CongestionController
             CLOSE_CONTROL
         } send_control_t;
 
@@ -937,6 +1235,12 @@ namespace swift
         } send_control_reason_t;
 
 #define DGRAM_MAX_SOCK_OPEN 128
+#define DGRAM_MAX_RECV_BATCH 256
+#define DGRAM_MAX_SEND_BATCH 256
+#define SWIFT_MAX_SHARDS     64
+#define SWIFT_SHARD_ID_SHIFT 26 // channel IDs carry the owning shard in the top bits,
+#define SWIFT_CHANNEL_GEN_SHIFT 20 // then the generation of the channel's slot,
+#define SWIFT_MAX_CHANNELS  (1<<SWIFT_CHANNEL_GEN_SHIFT) // then the slot
         static int sock_count;
         static sckrwecb_t sock_open[DGRAM_MAX_SOCK_OPEN];
         static std::string  trackerurl; // Global tracker for all transfers
@@ -947,18 +1251,93 @@ namespace swift
         static tint     epoch, start;
         static uint64_t global_dgrams_up, global_dgrams_down, global_raw_bytes_up, global_raw_bytes_down, global_bytes_up,
                global_bytes_down;
+        // Batched receive: number of receive callbacks and datagrams drained
+        // by them, so dgrams/wakeups is the average batch size.
+        static uint64_t global_recv_wakeups, global_recv_batch_dgrams, global_recv_batch_max;
+        // Coalesced send: number of send queue flushes and datagrams sent by
+        // them. last_flush_dgrams is what the most recent flush sent.
+        static uint64_t global_send_flushes, global_send_flush_dgrams, global_send_flush_max;
+        static int      last_flush_dgrams;
+        // UDP offload: GSO sends and the datagrams they carried, datagrams
+        // received as part of a GRO coalesced one.
+        static uint64_t global_gso_sends, global_gso_segments, global_gro_segments;
+        // SO_REUSEPORT sharding: this process' shard and the number of
+        // shards sharing the port. Datagrams for a channel owned by another
+        // shard are handed off to it.
+        static int      shard_id, shard_count;
+        static uint64_t global_shard_forwarded, global_shard_received;
+        // io_uring backend: datagrams sent and received and chunks read
+        // through the ring
+        static uint64_t global_uring_sends, global_uring_recvs, global_uring_reads;
+        // Zero-copy: chunks sent straight from the mmap'd content
+        static uint64_t global_zerocopy_chunks, global_zerocopy_bytes;
+        // Pacing: DATA queued ahead of its send time, of which stamped for
+        // the kernel, and wakeups of the userspace pacer
+        static uint64_t global_paced_dgrams, global_txtime_dgrams, global_pacer_wakeups;
+        // Initial handshakes dropped before parsing for exceeding the
+        // source's HANDSHAKE_RATE, and after for a swarm not served here
+        static uint64_t global_hs_rate_rejected, global_hs_unknown_rejected;
+        // ACK messages sent, and the chunks they acked
+        static uint64_t global_ack_msgs, global_ack_chunks;
+        // INTEGRITY messages sent with their bytes, and uncle hashes not
+        // sent again as the peer should have them
+        static uint64_t global_hash_msgs, global_hash_bytes_up, global_hash_skipped;
         static void     CloseChannelByAddress(const Address &addr);
+        /** Token bucket per source IP for initial handshakes, false when
+         *  over HANDSHAKE_RATE */
+        static bool     HandshakeRateOK(const Address &addr);
 
         // SOCKMGMT
         // Arno: channel is also a "singleton" class that manages all sockets
         // for a swift process
         static void     LibeventSendCallback(int fd, short event, void *arg);
         static void     LibeventReceiveCallback(int fd, short event, void *arg);
-        static void     RecvDatagram(evutil_socket_t socket);  // Called by LibeventReceiveCallback
-        static int      RecvFrom(evutil_socket_t sock, Address& addr, struct evbuffer *evb); // Called by RecvDatagram
-        static int      SendTo(evutil_socket_t sock, const Address& addr, struct evbuffer *evb); // Called by Channel::Send()
+        static int      RecvDatagram(evutil_socket_t socket);  // Called by LibeventReceiveCallback
+        static int      RecvFrom(evutil_socket_t sock, Address& addr, struct evbuffer *evb); // Direct receive
+        static int      RecvBatch(evutil_socket_t sock, recv_slot_t *slots, int n); // Called by RecvDatagram
+        static void     ProcessDatagram(evutil_socket_t socket, Address &addr, dgram_t *dg);
+        static int      SendTo(evutil_socket_t sock, const Address& addr, struct evbuffer *evb); // Direct send
+        static int      SendTo(evutil_socket_t sock, const Address& addr, dgram_t *d);
+        /** Queue datagram for sending at the end of this event loop iteration.
+         *  Takes ownership of d. Returns the number of bytes queued. */
+        static int      QueueTo(evutil_socket_t sock, const Address& addr, dgram_t *d,
+                                Channel *owner=NULL, tint txtime=0); // Called by Channel::Send()
+        /** Send all datagrams queued for sock, returns how many were sent */
+        static int      FlushSendQueue(evutil_socket_t sock);
+        static void     FlushSendQueues();
+        /** Unmap content that zero-copy DATA may point into. Datagrams still
+         *  queued or paced get a copy of their chunk, io_uring sends the
+         *  kernel is still reading from delay the munmap to their completion. */
+        static void     UnmapWhenSent(void *addr, size_t len);
+        static void     LibeventFlushCallback(int fd, short event, void *arg);
+        /** Userspace pacer: queue the datagrams held for sending later that
+         *  are due at NOW, earliest first, returns how many */
+        static int      PaceDue();
+        static void     LibeventPaceCallback(int fd, short event, void *arg);
         static evutil_socket_t Bind(Address address, sckrwecb_t callbacks=sckrwecb_t());
         static Address  BoundAddress(evutil_socket_t sock);
+        /** Create the handoff sockets for n shards, call before forking */
+        static int      ShardSetup(int n);
+        /** Become shard id after forking. Shards other than 0 rebind the
+         *  sockets with SO_REUSEPORT and drop inherited channels. */
+        static int      ShardStart(int id);
+        /** Shard that owns the channel with this (scrambled) ID */
+        static int      ShardOfID(uint32_t scrambled);
+        static void     ShardForward(int shard, const Address& addr, dgram_t *d);
+        static void     LibeventShardCallback(int fd, short event, void *arg);
+        /** Timing wheel for the send timers of all channels, runs from evbase */
+        static TimerWheel *Timers();
+        /** The io_uring ring, NULL when IO_URING is off or unavailable */
+        static IOUring *Uring();
+        static void     LibeventUringCallback(int fd, short event, void *arg);
+        /** Keep RECV_BATCH_SIZE receives posted on sock, returns false if
+         *  the socket should stay with libevent */
+        static bool     UringArmRecv(evutil_socket_t sock);
+        /** Submit the datagrams as async sends, takes the dgrams */
+        static int      UringSend(evutil_socket_t sock, send_slot_t *slots, int count);
+        static void     OnChunkRead(uring_req_t *req, int res);
+        /** Reschedule channels whose awaited chunk reads came in */
+        static void     OnChunkReadsDone();
         static evutil_socket_t default_socket() {
             return sock_count ? sock_open[0].sock : INVALID_SOCKET;
         }
@@ -966,6 +1345,9 @@ namespace swift
         /** close the port */
         static void     CloseSocket(evutil_socket_t sock);
         static void     Shutdown();
+        /** Put the paths of all channels in the path cache, for those
+         *  still open when shutting down */
+        static void     PutPaths();
         /** the current time */
         static tint     Time();
         static tint     last_tick;
@@ -976,6 +1358,9 @@ namespace swift
         float       GetCwnd() {
             return cwnd_;
         }
+        CongestionController *GetCongestionController() {
+            return cc_;
+        }
         uint64_t    GetHintSize(data_direction_t ddir) {
             return ddir ? hint_out_size_ : hint_in_size_;
         }
@@ -983,52 +1368,87 @@ namespace swift
         bool        Tocancel;
 
         // Arno: Per instance methods
-        void        Recv(struct evbuffer *evb);
+        void        Recv(dgram_t *dg);
         void        Send();   // Called by LibeventSendCallback
+        /** Queue DATA for the rest of the window, see PACING */
+        void        SendPacedWindow();
         void        Close(close_send_t closesend);
         void        ClearTransfer() {
             transfer_ = NULL;    // for swarm cleanup
         }
 
-        void        OnAck(struct evbuffer *evb);
-        void        OnHave(struct evbuffer *evb);
+        void        OnAck(dgram_t *dg);
+        void        OnHave(dgram_t *dg);
+        void        OnHaveBin(bin_t ackd_pos);
+        void        OnHaveRuns(dgram_t *dg);
         void        OnHaveLive(bin_t ackd_pos);
-        bin_t       OnData(struct evbuffer *evb);
-        void        OnHint(struct evbuffer *evb);
-        void        OnHash(struct evbuffer *evb);
-        void        OnPexAdd(struct evbuffer *evb, int family);
-        void        OnPexAddCert(struct evbuffer *evb);
+        bin_t       OnData(dgram_t *dg);
+        void        OnHint(dgram_t *dg);
+        void        OnHash(dgram_t *dg);
+        void        OnPexAdd(dgram_t *dg, int family);
+        void        OnPexAddCert(dgram_t *dg);
         static Handshake *StaticOnHandshake(Address &addr, uint32_t cid, bool ver_known, popt_version_t ver,
-                                            struct evbuffer *evb);
+                                            dgram_t *dg);
         void        OnHandshake(Handshake *hishs);
-        void        OnCancel(struct evbuffer *evb); // PPSP
-        void        OnChoke(struct evbuffer *evb);
-        void        OnUnchoke(struct evbuffer *evb);
-        void        OnSignedHash(struct evbuffer *evb);
-        void        AddHandshake(struct evbuffer *evb);
-        bin_t       AddData(struct evbuffer *evb);
-        void        SendIfTooBig(struct evbuffer *evb);
-        void        AddAck(struct evbuffer *evb);
-        void        AddHave(struct evbuffer *evb);
-        void        AddHint(struct evbuffer *evb);
-        void        AddCancel(struct evbuffer *evb);
-        void        AddRequiredHashes(struct evbuffer *evb, bin_t pos, bool isretransmit);
-        void        AddUnsignedPeakHashes(struct evbuffer *evb);
-        void        AddFileUncleHashes(struct evbuffer *evb, bin_t pos);
-        void        AddLiveSignedMunroHash(struct evbuffer *evb,bin_t munro); // SIGNMUNRO
-        void        AddLiveUncleHashes(struct evbuffer *evb, bin_t pos, bin_t munro, bool isretransmit);  // SIGNMUNRO
-        void        AddPex(struct evbuffer *evb);
+        void        OnCancel(dgram_t *dg); // PPSP
+        void        OnChoke(dgram_t *dg);
+        void        OnUnchoke(dgram_t *dg);
+        void        OnSignedHash(dgram_t *dg);
+        void        AddHandshake(dgram_t *dg);
+        bin_t       AddData(dgram_t *dg);
+        /** io_uring: false when tosend is still being read from disk, it
+         *  has then been put back in the queue. Otherwise *crp is the
+         *  completed read, or NULL to read synchronously. */
+        bool        ChunkReady(bin_t tosend, bool isretransmit, chunk_read_t **crp);
+        void        FreeChunkReads();
+        void        SendIfTooBig(dgram_t *dg);
+        /** Datagram with room for a DATA of the transfer's chunk size */
+        dgram_t *   NewDataDgram();
+        void        AddAck(dgram_t *dg);
+        /** Add b in the chunk addressing of our handshake. One it can't
+         *  express closes the channel at the send, rather than wrapping. */
+        void        AddChunkAddr(dgram_t *dg, bin_t b);
+        /** Close when something didn't fit the chunk addressing, see
+         *  AddChunkAddr(). True if so, dg is then freed. */
+        bool        CloseOnChunkAddrOverflow(dgram_t *dg);
+        /** Delayed ACKs: ACK the chunks received since the last, a message
+         *  per run of contiguous ones, with the latest one-way delay */
+        void        AddAckRanges(dgram_t *dg);
+        /** When the pending ACKs are due, TINT_NEVER when none are */
+        tint        AckDueTime();
+        void        AddHave(dgram_t *dg);
+        void        AddHaveMsg(dgram_t *dg, bin_t ack);
+        /** What we have in runs of chunks had and not, for a peer that
+         *  just connected. True when all is announced. */
+        bool        AddHaveRuns(dgram_t *dg);
+        void        AddHint(dgram_t *dg);
+        void        AddCancel(dgram_t *dg);
+        void        AddRequiredHashes(dgram_t *dg, bin_t pos, bool isretransmit);
+        void        AddUnsignedPeakHashes(dgram_t *dg);
+        void        AddFileUncleHashes(dgram_t *dg, bin_t pos, bool isretransmit);
+        void        AddLiveSignedMunroHash(dgram_t *dg,bin_t munro); // SIGNMUNRO
+        void        AddLiveUncleHashes(dgram_t *dg, bin_t pos, bin_t munro, bool isretransmit);  // SIGNMUNRO
+        /** Whether the uncle hash was sent within ack_timeout(), notes
+         *  it sent now if not or if we resend it anyway */
+        bool        UncleSent(bin_t uncle, bool resend=false);
+        void        AddPex(dgram_t *dg);
         void        OnPexReq(void);
-        void        AddPexReq(struct evbuffer *evb);
+        void        AddPexReq(dgram_t *dg);
         void        BackOffOnLosses(float ratio=0.5);
         tint        SwitchSendControl(send_control_t control_mode);
+        /** Note the RTT and window for the path cache */
+        void        NotePath();
+        /** Put what is known of the path to the peer in the path cache */
+        void        PutPath();
+        /** Slow start from half the window cached for the path, if clean */
+        void        GetPath();
         tint        NextSendTime();
         tint        KeepAliveNextSendTime();
         tint        PingPongNextSendTime();
         tint        CwndRateNextSendTime();
         tint        SlowStartNextSendTime();
         tint        AimdNextSendTime();
-        tint        LedbatNextSendTime();
+        tint        CcNextSendTime();
         /** Arno: return true if this peer has complete file. May be fuzzy if Peak Hashes not in */
         bool        IsComplete();
         /** Arno: return (UDP) port for this channel */
@@ -1036,14 +1456,24 @@ namespace swift
         bool        IsDiffSenderOrDuplicate(Address addr, uint32_t chid);
 
         static int  MAX_REORDERING;
+        static int  RECV_BATCH_SIZE;
+        static int  SEND_BATCH_SIZE;
+        static bool UDP_OFFLOAD;
+        static bool REUSE_PORT;
+        static bool IO_URING;
+        static bool ZERO_COPY;
+        static int  PACING;     // pacing_mode_t
+        static int  CC_ALGO;    // cc_algo_t of new transfers
+        static int  HANDSHAKE_RATE;     // per second per source IP, 0 for no limit
+        static int  HANDSHAKE_BURST;
+        static int  MAX_CHANNELS;   // slots in the channel table, at most SWIFT_MAX_CHANNELS
+        static tint ACK_DELAY;  // max an ACK is held back for others
+        static int  ACK_COUNT;  // chunks acked at once when coming in fast
+        static bool HAVE_RUNS;  // offer HAVE_RUNS in handshakes we initiate
+        static bool CHUNK_ADDR_64;  // 64-bit chunk addressing while the content size is unknown
         static tint TIMEOUT;
         static tint MIN_DEV;
         static tint MAX_SEND_INTERVAL;
-        static tint LEDBAT_TARGET;
-        static float LEDBAT_GAIN;
-        static tint LEDBAT_DELAY_BIN;
-        static uint32_t LEDBAT_BASE_HISTORY;
-        static uint32_t LEDBAT_ROLLOVER;
         static bool SELF_CONN_OK;
         static tint MAX_POSSIBLE_RTT;
         static tint MIN_PEX_REQUEST_INTERVAL;
@@ -1092,9 +1522,18 @@ namespace swift
 
         static int  DecodeID(int scrambled);
         static int  EncodeID(int unscrambled);
+        static int  GenOfID(uint32_t scrambled);
         static Channel* channel(int i) {
             return i<channels.size()?channels[i]:NULL;
         }
+        /** Channel a wire ID from EncodeID() refers to, NULL if it is
+         *  another shard's or the channel is gone, also when its slot has
+         *  been reused since. */
+        static Channel* ChannelOfID(uint32_t scrambled);
+        /** Whether a new channel can get a slot. The slot must stay below
+         *  the generation bits of the ID, so once MAX_CHANNELS are in use
+         *  no channel may be created until one is deleted. */
+        static bool SlotAvailable();
 
         // SAFECLOSE
         void        ClearEvents();
@@ -1107,12 +1546,12 @@ namespace swift
 
         //ZEROSTATE
         // Message handler replacements
-        void        OnDataZeroState(struct evbuffer *evb);
-        void        OnHaveZeroState(struct evbuffer *evb);
-        void        OnHashZeroState(struct evbuffer *evb);
-        void        OnPexAddZeroState(struct evbuffer *evb, int family);
-        void        OnPexAddCertZeroState(struct evbuffer *evb);
-        void        OnPexReqZeroState(struct evbuffer *evb);
+        void        OnDataZeroState(dgram_t *dg);
+        void        OnHaveZeroState(dgram_t *dg);
+        void        OnHashZeroState(dgram_t *dg);
+        void        OnPexAddZeroState(dgram_t *dg, int family);
+        void        OnPexAddCertZeroState(dgram_t *dg);
+        void        OnPexReqZeroState(dgram_t *dg);
         tint        GetOpenTime() {
             return open_time_;
         }
@@ -1132,9 +1571,9 @@ namespace swift
         bool        IsMovingForward();
 
     protected:
-        struct event    *evsend_ptr_; // Arno: timer per channel // SAFECLOSE
+        wheel_timer_t   *evsend_ptr_; // Arno: timer per channel // SAFECLOSE
         //LIVE
-        struct event    *evsendlive_ptr_; // Arno: timer per channel
+        wheel_timer_t   *evsendlive_ptr_; // Arno: timer per channel
 
         /** Channel id: index in the channel array. */
         uint32_t    id_;
@@ -1144,6 +1583,9 @@ namespace swift
         evutil_socket_t      socket_;
         /**    Descriptor of the file in question. */
         ContentTransfer*    transfer_;
+        /**    Chunk size of the transfer. Kept here, as the transfer is half
+         *     destroyed when it closes its channels. */
+        uint32_t    chunk_size_;
         bool        own_id_mentioned_;
         /**    Peer's progress, based on acknowledgements. */
         binmap_t    ack_in_;
@@ -1153,14 +1595,31 @@ namespace swift
         /**    Last data received; needs to be acked immediately. */
         tintbin     data_in_;
         bin_t       data_in_dbl_;
+        /** Data received but not acked yet, how many chunks, since when,
+         *  and the one-way delay of the last */
+        binmap_t    ack_agg_;
+        int         ack_agg_count_;
+        tint        ack_agg_first_;
+        tint        ack_agg_owd_;
         /** The history of data sent and still unacknowledged. */
-        tbqueue     data_out_;
-        uint32_t    data_out_size_; // pkts not acknowledged
+        tbinflight  data_out_; // pkts not acknowledged
         /** Timeouted data (potentially to be retransmitted). */
         tbqueue     data_out_tmo_; // it contains only leaf bins
         bin_t       data_out_cap_; // Ric: maybe we should remove it.. creates problems if lost
+        /** Chunk reads in flight or done but not sent yet (io_uring) */
+        std::deque<chunk_read_t *> chunk_reads_;
         /** Index in the history array. */
         binmap_t    have_out_;
+        /** Next in the transfer's HAVE log to announce, valid once all
+         *  had before is announced */
+        uint64_t    have_log_pos_;
+        bool        have_log_synced_;
+        /** Chunk from which to continue announcing in HAVE_RUNS */
+        uint64_t    have_runs_pos_;
+        /** Uncle hashes sent and when, to send each once. In send order
+         *  for forgetting those the peer didn't confirm in time. */
+        std::map<bin_t,tint> uncles_out_;
+        tbqueue     uncles_out_q_;
         /**    Transmit schedule: in most cases filled with the peer's hints */
         tbqueue     hint_in_;
         uint64_t    hint_in_size_;
@@ -1187,6 +1646,8 @@ namespace swift
         tint        last_send_time_;
         tint        last_recv_time_;
         tint        last_data_out_time_;
+        /** Departure time of the DATA being added when pacing, else 0 */
+        tint        pace_time_;
         tint        last_data_in_time_;
         tint        last_loss_time_;
         tint        next_send_time_;
@@ -1204,6 +1665,10 @@ namespace swift
         /** Arno: Fix for KEEP_ALIVE_CONTROL */
         bool        lastrecvwaskeepalive_;
         bool        lastsendwaskeepalive_;
+        /** Waiting for an io_uring chunk read, its completion reschedules */
+        bool        chunk_read_wait_;
+        /** A bin beyond our chunk addressing was to be sent, see AddChunkAddr() */
+        bool        chunk_addr_overflow_;
         send_control_reason_t keepalivereason_;
         /** Arno: For live, we may receive a HAVE but have no hints
             outstanding. In that case we should not wait till next_send_time_
@@ -1214,14 +1679,13 @@ namespace swift
         int         ack_rcvd_recent_; // Arno, 2013-07-01: appears broken at the moment
         /** Recent non-acknowlegements (losses) of data previously sent.    */
         int         ack_not_rcvd_recent_;
-        /** LEDBAT one-way delay machinery */
-        tint        owd_min_bins_[10];
-        int         owd_min_bin_;
-        tint        owd_min_bin_start_;
-        tint        owd_cur_;
-        tint        owd_min_;
-        /** LEDBAT current delay list should be > 4 && == RTT */
-        ttqueue     owd_current_;
+        /** Window and send interval in CC_CONTROL, as of the transfer */
+        CongestionController *cc_;
+        /** Path to the peer as last seen sending DATA, for the path cache,
+            and the slow start window from it */
+        path_metrics_t path_;
+        float       path_cwnd_;
+        uint64_t    data_out_sent_, data_out_lost_;
         ttqueue     dip_list_; // Ric: a list of dip values for smoothed avg
         /** Stats */
         int         dgrams_sent_;
@@ -1264,15 +1728,18 @@ namespace swift
         void        CleanHintOut(bin_t pos);
         void        Reschedule();
         void        UpdateDIP(bin_t pos); // RETRANSMIT
-        void        UpdateRTT(tint owd);
+        void        UpdateRTT(int acked, tint rtt, tint owd);
 
         bin_t       DequeueHintOut(uint64_t size);
 
-        // Arno, 2012-06-14: Replace with hashtable (unsorted_map). This
-        // currently grows for ever, filling with NULLs for old channels
-        // and results in channel IDs with are not really random.
-        //
+        // Channel table indexed by id_. Slots of deleted channels are
+        // NULL and reused oldest first, their generation goes up on every
+        // reuse so EncodeID() of a closed channel no longer matches.
         static channels_t channels;
+        static std::vector<uint8_t> slot_gens;
+        static std::deque<uint32_t> free_slots;
+        // Channels by peer(), for CloseChannelByAddress
+        static addrchannels_t peer_index;
     };
 
 
@@ -1375,6 +1842,17 @@ namespace swift
         /** UNIX pwrite approximation. Does change file pointer. Is not thread-safe */
         ssize_t     Write(const void *buf, size_t nbyte, int64_t offset);
 
+        /** File descriptor and offset in it to read [offset,offset+nbyte)
+         *  with a single pread, e.g. asynchronously. -1 if the range spans
+         *  files or the storage is not ready. */
+        int         GetReadFD(size_t nbyte, int64_t offset, int64_t *fdoffset);
+
+        /** Pointer to [offset,offset+nbyte) in a read-only mapping of the
+         *  content, *mappedlen is set to the bytes available there. NULL if
+         *  not single-file or mmap fails. Only for complete content, the
+         *  mapping is not extended when the file grows. */
+        const uint8_t *GetMappedRange(size_t nbyte, int64_t offset, size_t *mappedlen);
+
         /** Link to HashTree */
         void        SetHashTree(HashTree *ht) {
             ht_ = ht;
@@ -1442,6 +1920,8 @@ namespace swift
 
         storage_files_t    sfs_;
         int         single_fd_;
+        const uint8_t *single_map_;
+        int64_t     single_map_size_;
         int64_t     reserved_size_;
         int64_t     total_size_from_spec_;
         StorageFile *last_sf_;
@@ -1476,6 +1956,11 @@ namespace swift
         void SetMetaDir(std::string metadir);
         void SetConnectTimeout(tint timeout);
         int Find(const Sha1Hash &root_hash);
+        /** Pre-activation check for handshakes: false if the content dir
+         *  surely has no content for root_hash, from a Bloom filter of its
+         *  file names, i.e. without going to disk. The filter is rebuilt
+         *  when the dir changed, checked at most every second. */
+        bool MayHave(const Sha1Hash &root_hash);
 
         static void LibeventCleanCallback(int fd, short event, void *arg);
 
@@ -1486,6 +1971,11 @@ namespace swift
         std::string     contentdir_;
         std::string     metadir_;
 
+        std::vector<uint32_t> bloom_;   // bits, a power of 2
+        int64_t         bloom_time_;    // mtime of contentdir_ when built, -1 if not
+        tint            bloom_check_time_;
+        void            BuildBloom();
+
         /* Arno, 2012-07-20: A very slow peer can keep a transfer alive
           for a long time (3 minute channel close timeout not reached).
           This causes problems on Mac where there are just 256 file
@@ -1496,6 +1986,51 @@ namespace swift
     };
 
 
+    /**
+     * LRU cache of path metrics by peer address, so a channel to a peer
+     * talked to before starts from the RTT and window it had, rather than
+     * from a second and one chunk. Optionally kept in a file across runs.
+     */
+    class PathCache
+    {
+    public:
+        PathCache(size_t capacity=SWIFT_PATH_CACHE_SIZE);
+        ~PathCache();
+        static PathCache *GetInstance();
+
+        /** Metrics for peer, or else for its host, no older than MAX_AGE,
+         *  false if none */
+        bool    Get(const Address &peer, path_metrics_t *m);
+        /** Store m for peer and its host as most recently used, evicting
+         *  the least */
+        void    Put(const Address &peer, const path_metrics_t &m);
+        size_t  size() const {
+            return lru_.size();
+        }
+        void    Clear();
+
+        /** Load from filename, if there, and save to it on Save() */
+        int     SetFile(std::string filename);
+        /** Write to the file if changed, returns the entries written */
+        int     Save();
+
+        static tint MAX_AGE;
+
+    protected:
+        static PathCache *__singleton;
+
+        typedef std::list< std::pair<Address,path_metrics_t> > pathlru_t;
+        pathlru_t       lru_;   // most recent first
+        std::unordered_map<Address,pathlru_t::iterator,AddressHash> index_;
+        size_t          capacity_;
+        std::string     filename_;
+        bool            dirty_;
+
+        bool    Find(const Address &peer, path_metrics_t *m);
+        void    Store(const Address &peer, const path_metrics_t &m);
+    };
+
+
     /*************** The top-level API ****************/
     // See api.cpp for the implementation.
     /** Must be called by any client using the library */
@@ -1586,6 +2121,8 @@ namespace swift
     tdlist_t GetTransferDescriptors();
     /** Set the maximum speed in bytes/s for the transfer */
     void    SetMaxSpeed(int td, data_direction_t ddir, double speed);
+    /** Set the congestion control of new channels of the transfer */
+    void    SetCongestionControl(int td, cc_algo_t algo);
     /** Get the current speed in bytes/s for the transfer, if activated. */
     double  GetCurrentSpeed(int td, data_direction_t ddir);
     /** Get the number of incomplete peers for the transfer, if activated. */
@@ -1624,6 +2161,47 @@ namespace swift
     int evbuffer_add_chunkaddr(struct evbuffer *evb, bin_t &b, popt_chunk_addr_t chunk_addr); // PPSP
     int evbuffer_add_pexaddr(struct evbuffer *evb, Address& a);
 
+    // Same for pooled datagram buffers
+    dgram_t *dgram_new();
+    /** A buffer of at least size bytes, from the pool if it fits */
+    dgram_t *dgram_new_size(size_t size);
+    void dgram_free(dgram_t *d);
+    void dgram_wrap(dgram_t *d, void *buf, size_t len);
+    size_t dgram_get_length(const dgram_t *d);
+    uint8_t *dgram_pullup(dgram_t *d);
+    uint8_t *dgram_reserve(dgram_t *d, size_t n);
+    void dgram_commit(dgram_t *d, size_t n);
+    void dgram_drain(dgram_t *d, size_t n);
+    int dgram_add(dgram_t *d, const void *buf, size_t n);
+    int dgram_add_string(dgram_t *d, std::string str);
+    int dgram_add_8(dgram_t *d, uint8_t b);
+    int dgram_add_16be(dgram_t *d, uint16_t w);
+    int dgram_add_32be(dgram_t *d, uint32_t i);
+    int dgram_add_64be(dgram_t *d, uint64_t l);
+    int dgram_add_hash(dgram_t *d, const Sha1Hash& hash);
+    int dgram_add_chunkaddr(dgram_t *d, bin_t &b, popt_chunk_addr_t chunk_addr); // PPSP
+    /** Whether b can be expressed in chunk_addr. The add functions refuse
+     *  a bin that doesn't fit with -1, rather than truncate it. */
+    bool chunkaddr_fits(const bin_t &b, popt_chunk_addr_t chunk_addr);
+    int dgram_add_pexaddr(dgram_t *d, Address& a);
+    /** Unsigned LEB128: 7 bits a byte, the high bit set on all but the last */
+    int dgram_add_varint(dgram_t *d, uint64_t v);
+    /** Append n bytes at buf without copying, the send path gathers them
+     *  from buf. Must be the last thing added and buf must stay valid until
+     *  the dgram is sent. dgram_pullup() copies them in. */
+    int dgram_add_ref(dgram_t *d, const void *buf, size_t n);
+
+    int dgram_remove(dgram_t *d, void *buf, size_t n);
+    uint8_t dgram_remove_8(dgram_t *d);
+    uint16_t dgram_remove_16be(dgram_t *d);
+    uint32_t dgram_remove_32be(dgram_t *d);
+    uint64_t dgram_remove_64be(dgram_t *d);
+    Sha1Hash dgram_remove_hash(dgram_t *d);
+    binvector dgram_remove_chunkaddr(dgram_t *d, popt_chunk_addr_t chunk_addr); // PPSP
+    Address dgram_remove_pexaddr(dgram_t *d, int family);
+    /** False when the datagram ends first or it's over 64 bits */
+    bool dgram_remove_varint(dgram_t *d, uint64_t *v);
+
     uint8_t evbuffer_remove_8(struct evbuffer *evb);
     uint16_t evbuffer_remove_16be(struct evbuffer *evb);
     uint32_t evbuffer_remove_32be(struct evbuffer *evb);
@@ -1632,13 +2210,14 @@ namespace swift
     binvector evbuffer_remove_chunkaddr(struct evbuffer *evb, popt_chunk_addr_t chunk_addr); // PPSP
     Address evbuffer_remove_pexaddr(struct evbuffer *evb, int family);
     void chunk32_to_bin32(uint32_t schunk, uint32_t echunk, binvector *bvptr);
+    void chunk64_to_bin64(uint64_t schunk, uint64_t echunk, binvector *bvptr);
     binvector bin_fragment(bin_t &origbin, bin_t &cancelbin);
 
     const char* tintstr(tint t=0);
 
     // SOCKTUNNEL
     bool CmdGwTunnelCheckChannel(uint32_t tunnel_id); // messages prefixed with tunnel id will be forwarded
-    void CmdGwTunnelUDPDataCameIn(Address srcaddr, uint32_t srcchan, struct evbuffer* evb);
+    void CmdGwTunnelUDPDataCameIn(Address srcaddr, uint32_t srcchan, dgram_t *dg);
     void CmdGwTunnelSendUDP(struct evbuffer *evb); // for friendship with Channel
 
 } // namespace end
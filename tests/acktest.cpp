@@ -0,0 +1,220 @@
+/*
+ *  acktest.cpp
+ *
+ *  Tests of delayed ACKs: a range ACK as sent for a run of chunks received
+ *  credits every send it covers, and the split of a run into bins for the
+ *  BIN32 chunk addressing covers the run exactly. Past 2^32 chunks ACKs
+ *  need 64-bit chunk addressing, with 32 bits the channel is closed.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+#include "compat.h"
+
+using namespace swift;
+
+#define TESTFILE     "acktest.dat"
+#define TEST_CHUNKS  16
+#define TESTFILE64   "acktest64.dat"
+#define CHUNK32_END  (((uint64_t)1)<<32)
+
+
+// Channel with the state OnData() and sending DATA leave, set by hand
+class AckChannel : public Channel
+{
+  public:
+    AckChannel(ContentTransfer *t, popt_chunk_addr_t ca) : Channel(t) {
+        hs_out_->chunk_addr_ = ca;
+        hs_in_ = new Handshake();
+        hs_in_->chunk_addr_ = ca;
+    }
+    // With the chunk addressing the channel picked
+    AckChannel(ContentTransfer *t) : Channel(t) {
+        hs_in_ = new Handshake(*hs_out_);
+    }
+    popt_chunk_addr_t chunk_addr() {
+        return hs_out_->chunk_addr_;
+    }
+    bool closing() {
+        return send_control_ == CLOSE_CONTROL;
+    }
+    // As OnData()
+    void Received(bin_t pos, tint owd) {
+        ack_agg_.set(pos);
+        ack_agg_count_++;
+        ack_agg_owd_ = owd;
+    }
+    void Sent(bin_t pos, tint when) {
+        data_out_.push_back(tintbin(when,pos));
+    }
+    tbinflight &data_out() {
+        return data_out_;
+    }
+    tint rtt_avg() {
+        return rtt_avg_;
+    }
+};
+
+
+TEST(Ack,RangeCreditsAllSends)
+{
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open(TESTFILE,noswarmid);
+    ASSERT_GE(td,0);
+    ContentTransfer *ct = swift::GetActivatedTransfer(td);
+    ASSERT_TRUE(ct != NULL && ct->hashtree() != NULL);
+    ASSERT_EQ(TEST_CHUNKS, ct->hashtree()->size_in_chunks());
+    popt_chunk_addr_t addrs[] = { POPT_CHUNK_ADDR_CHUNK32, POPT_CHUNK_ADDR_BIN32 };
+    for (int a=0; a<2; a++) {
+        AckChannel *sender = new AckChannel(ct,addrs[a]);
+        AckChannel *receiver = new AckChannel(ct,addrs[a]);
+        for (int i=0; i<10; i++)
+            sender->Sent(bin_t(0,i),100+10*i);
+        for (int i=2; i<=7; i++)
+            receiver->Received(bin_t(0,i),1234);
+
+        dgram_t *dg = dgram_new();
+        receiver->AddAckRanges(dg);
+        if (addrs[a] == POPT_CHUNK_ADDR_CHUNK32) {
+            // One message for the run
+            EXPECT_EQ(1+4+4+8, dgram_get_length(dg));
+            EXPECT_LE(dgram_get_length(dg), SWIFT_ACK_RANGE_MAX_SIZE);
+        } else
+            EXPECT_GT(dgram_get_length(dg), 1+4+8);
+        EXPECT_EQ(TINT_NEVER, receiver->AckDueTime());
+
+        // As Recv()
+        Channel::Time();
+        tint rtt_avg = sender->rtt_avg();
+        int msgs = 0;
+        while (dgram_get_length(dg) > 0) {
+            ASSERT_EQ(SWIFT_ACK, dgram_remove_8(dg));
+            sender->OnAck(dg);
+            msgs++;
+        }
+        dgram_free(dg);
+
+        EXPECT_EQ(4, sender->data_out().size());
+        EXPECT_EQ(bin_t(0,0), sender->data_out().front().bin);
+        for (int i=0; i<10; i++)
+            EXPECT_EQ(i>=2 && i<=7, sender->ack_in().is_filled(bin_t(0,i)));
+        if (addrs[a] == POPT_CHUNK_ADDR_CHUNK32) {
+            // One RTT sample, from the latest send acked
+            EXPECT_EQ(1, msgs);
+            EXPECT_EQ((rtt_avg*7 + NOW-170) >> 3, sender->rtt_avg());
+        } else
+            EXPECT_GT(msgs, 1);
+        delete sender;
+        delete receiver;
+    }
+}
+
+
+TEST(Ack,RunToBins)
+{
+    for (uint32_t s=0; s<20; s++) {
+        for (uint32_t e=s; e<40; e++) {
+            binvector bv;
+            chunk32_to_bin32(s,e,&bv);
+            binmap_t covered;
+            binvector::iterator iter;
+            for (iter=bv.begin(); iter!=bv.end(); iter++) {
+                EXPECT_TRUE(covered.is_empty(*iter));
+                covered.set(*iter);
+            }
+            for (uint32_t c=0; c<64; c++)
+                EXPECT_EQ(c>=s && c<=e, covered.is_filled(bin_t(0,c)));
+            // Few messages even for a long run
+            EXPECT_LE(bv.size(), 2*(size_t)(log2((double)(e-s+1))+1));
+        }
+    }
+}
+
+
+TEST(Ack,PastChunk32)
+{
+    // Leeching from a swarm ID alone, the content size is not known yet
+    SwarmID swarmid(Sha1Hash(true,"0123456789abcdef0123456789abcdef01234567"));
+    int td = swift::Open(TESTFILE64,swarmid);
+    ASSERT_GE(td,0);
+    ContentTransfer *ct = swift::GetActivatedTransfer(td);
+    ASSERT_TRUE(ct != NULL && ct->hashtree() != NULL);
+    EXPECT_EQ(0, ct->hashtree()->size());
+
+    AckChannel *c32 = new AckChannel(ct);
+    EXPECT_EQ(POPT_CHUNK_ADDR_CHUNK32, c32->chunk_addr());
+    Channel::CHUNK_ADDR_64 = true;
+    AckChannel *sender = new AckChannel(ct);
+    AckChannel *receiver = new AckChannel(ct);
+    Channel::CHUNK_ADDR_64 = false;
+    EXPECT_EQ(POPT_CHUNK_ADDR_CHUNK64, sender->chunk_addr());
+
+    // A run across 2^32 goes in one 64-bit ACK
+    for (uint64_t i=CHUNK32_END-2; i<=CHUNK32_END+1; i++)
+        sender->Sent(bin_t(0,i),100);
+    for (uint64_t i=CHUNK32_END-1; i<=CHUNK32_END+1; i++)
+        receiver->Received(bin_t(0,i),1234);
+    dgram_t *dg = dgram_new();
+    receiver->AddAckRanges(dg);
+    EXPECT_EQ(1+8+8+8, dgram_get_length(dg));
+    EXPECT_FALSE(receiver->CloseOnChunkAddrOverflow(dg));
+    Channel::Time();
+    ASSERT_EQ(SWIFT_ACK, dgram_remove_8(dg));
+    sender->OnAck(dg);
+    EXPECT_EQ(0, dgram_get_length(dg));
+    dgram_free(dg);
+    EXPECT_EQ(1, sender->data_out().size());
+    EXPECT_EQ(bin_t(0,CHUNK32_END-2), sender->data_out().front().bin);
+    EXPECT_TRUE(sender->ack_in().is_filled(bin_t(0,CHUNK32_END)));
+    EXPECT_TRUE(sender->ack_in().is_filled(bin_t(0,CHUNK32_END+1)));
+
+    // With 32 bits it is not sent truncated, the channel closes
+    c32->Received(bin_t(0,CHUNK32_END),1234);
+    dg = dgram_new();
+    c32->AddAckRanges(dg);
+    EXPECT_EQ(0, dgram_get_length(dg));
+    EXPECT_FALSE(c32->closing());
+    EXPECT_TRUE(c32->CloseOnChunkAddrOverflow(dg));
+    EXPECT_TRUE(c32->closing());
+
+    // So does a HAVE
+    AckChannel *b32 = new AckChannel(ct,POPT_CHUNK_ADDR_BIN32);
+    dg = dgram_new();
+    b32->AddHaveMsg(dg,bin_t(0,CHUNK32_END/2));
+    EXPECT_TRUE(b32->CloseOnChunkAddrOverflow(dg));
+    EXPECT_TRUE(b32->closing());
+
+    delete b32;
+    delete c32;
+    delete sender;
+    delete receiver;
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+
+    unlink(TESTFILE);
+    unlink((std::string(TESTFILE)+".mhash").c_str());
+    unlink((std::string(TESTFILE)+".mbinmap").c_str());
+    int f = open(TESTFILE,O_RDWR|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (f < 0) {
+        eprintf("Error opening %s\n",TESTFILE);
+        return -1;
+    }
+    char buf[TEST_CHUNKS*SWIFT_DEFAULT_CHUNK_SIZE];
+    memset(buf,'A',sizeof(buf));
+    if (write(f,buf,sizeof(buf)) != sizeof(buf))
+        return -1;
+    close(f);
+    unlink(TESTFILE64);
+    unlink((std::string(TESTFILE64)+".mhash").c_str());
+    unlink((std::string(TESTFILE64)+".mbinmap").c_str());
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
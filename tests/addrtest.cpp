@@ -193,6 +193,25 @@ TEST(TAddress,IPv4MappedIPv6EqualSemi)
 }
 
 
+TEST(TAddress,HashFollowsEqual)
+{
+
+    Address a("130.37.193.65",8093);
+    Address b("::ffff:8225:c141",8093);
+    Address c("2001:0610:0110:06e1:7578:776f:e141:d2bb",8093);
+    Address d("2001:610:110:6e1:7578:776f:e141:d2bb",8093);
+    ASSERT_EQ(a.hash(),b.hash());
+    ASSERT_EQ(c.hash(),d.hash());
+    ASSERT_NE(a.hash(),Address("130.37.193.65",8094).hash());
+    ASSERT_NE(c.hash(),Address("2001:610:110:6e1:7578:776f:e141:d2bc",8093).hash());
+
+    addrchannels_t index;
+    index.insert(std::make_pair(a,(Channel *)NULL));
+    ASSERT_EQ(1,index.count(b));
+    ASSERT_EQ(0,index.count(c));
+}
+
+
 TEST(TAddress,IPv4Private168)
 {
 
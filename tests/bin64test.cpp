@@ -76,6 +76,11 @@ TEST(Bin64Test, Bits)
     EXPECT_EQ(0x7fffffff,a32);
     EXPECT_EQ(0xffffffff,n32);
     EXPECT_EQ(bin_t::NONE,bin_fromUInt32(b32));
+    uint64_t a64 = bin_toUInt64(all), n64 = bin_toUInt64(none), b64 = bin_toUInt64(big);
+    EXPECT_EQ(bin_t::ALL,bin_fromUInt64(a64));
+    EXPECT_EQ(bin_t::NONE,bin_fromUInt64(n64));
+    EXPECT_EQ(big,bin_fromUInt64(b64));
+    EXPECT_EQ(((uint64_t)18<<41)+((uint64_t)1<<40)-1,b64);
 }
 
 int main(int argc, char** argv)
@@ -133,6 +133,121 @@ TEST(ChunkAddrTest,Bin32)
 }
 
 
+TEST(ChunkAddrTest,Chunk64ToBin64)
+{
+    // Beyond 2^32 chunks, same bins as the 32-bit range shifted up
+    uint64_t base = ((uint64_t)1)<<40;
+    binvector bv, bv32;
+    swift::chunk64_to_bin64(base+5,base+25,&bv);
+    swift::chunk32_to_bin32(5,25,&bv32);
+    ASSERT_EQ(bv32.size(),bv.size());
+    for (int i=0; i<bv.size(); i++) {
+        EXPECT_EQ(bv32[i].layer(),bv[i].layer());
+        EXPECT_EQ(bv32[i].base_offset()+base,bv[i].base_offset());
+    }
+
+    // The largest range allowed is a single bin
+    bv.clear();
+    swift::chunk64_to_bin64(0,SWIFT_CHUNK64_MAX-1,&bv);
+    ASSERT_EQ(1,bv.size());
+    EXPECT_EQ(bin_t(62,0),bv[0]);
+}
+
+
+TEST(ChunkAddrTest,WireRoundTrip)
+{
+    popt_chunk_addr_t cas[] = { POPT_CHUNK_ADDR_BIN32, POPT_CHUNK_ADDR_CHUNK32,
+                                POPT_CHUNK_ADDR_BIN64, POPT_CHUNK_ADDR_CHUNK64 };
+    for (int i=0; i<4; i++) {
+        bin_t want(3,1000);
+        dgram_t *d = dgram_new();
+        dgram_add_chunkaddr(d,want,cas[i]);
+        binvector bv = dgram_remove_chunkaddr(d,cas[i]);
+        ASSERT_EQ(1,bv.size());
+        EXPECT_EQ(want,bv[0]);
+        EXPECT_EQ(0,dgram_get_length(d));
+        dgram_free(d);
+    }
+
+    // Chunks past 32 bits
+    bin_t big(5,((uint64_t)1)<<35);
+    dgram_t *d = dgram_new();
+    dgram_add_chunkaddr(d,big,POPT_CHUNK_ADDR_BIN64);
+    EXPECT_EQ(8,dgram_get_length(d));
+    dgram_add_chunkaddr(d,big,POPT_CHUNK_ADDR_CHUNK64);
+    EXPECT_EQ(8+16,dgram_get_length(d));
+    binvector bv = dgram_remove_chunkaddr(d,POPT_CHUNK_ADDR_BIN64);
+    ASSERT_EQ(1,bv.size());
+    EXPECT_EQ(big,bv[0]);
+    bv = dgram_remove_chunkaddr(d,POPT_CHUNK_ADDR_CHUNK64);
+    ASSERT_EQ(1,bv.size());
+    EXPECT_EQ(big,bv[0]);
+
+    // Bad input protection: reversed and out of range
+    dgram_add_64be(d,10);
+    dgram_add_64be(d,9);
+    EXPECT_EQ(0,dgram_remove_chunkaddr(d,POPT_CHUNK_ADDR_CHUNK64).size());
+    dgram_add_64be(d,0);
+    dgram_add_64be(d,SWIFT_CHUNK64_MAX);
+    EXPECT_EQ(0,dgram_remove_chunkaddr(d,POPT_CHUNK_ADDR_CHUNK64).size());
+    dgram_free(d);
+}
+
+
+TEST(ChunkAddrTest,Handshake)
+{
+    Handshake hs;
+    hs.chunk_addr_ = POPT_CHUNK_ADDR_CHUNK64;
+    EXPECT_TRUE(hs.IsSupported());
+    hs.chunk_addr_ = POPT_CHUNK_ADDR_BIN64;
+    EXPECT_TRUE(hs.IsSupported());
+    hs.chunk_addr_ = POPT_CHUNK_ADDR_BYTE64;
+    EXPECT_FALSE(hs.IsSupported());
+
+    hs.chunk_addr_ = POPT_CHUNK_ADDR_CHUNK32;
+    hs.FitChunkAddr(((uint64_t)1)<<32);
+    EXPECT_EQ(POPT_CHUNK_ADDR_CHUNK32,hs.chunk_addr_);
+    hs.FitChunkAddr((((uint64_t)1)<<32)+1);
+    EXPECT_EQ(POPT_CHUNK_ADDR_CHUNK64,hs.chunk_addr_);
+    hs.chunk_addr_ = POPT_CHUNK_ADDR_BIN32;
+    hs.FitChunkAddr((((uint64_t)1)<<30)+1);
+    EXPECT_EQ(POPT_CHUNK_ADDR_BIN64,hs.chunk_addr_);
+    hs.chunk_addr_ = POPT_CHUNK_ADDR_CHUNK32;
+    hs.ToChunkAddr64();
+    EXPECT_EQ(POPT_CHUNK_ADDR_CHUNK64,hs.chunk_addr_);
+}
+
+
+TEST(ChunkAddrTest,NoWrap)
+{
+    // A bin past 32 bits is refused, not truncated
+    uint64_t c32 = ((uint64_t)1)<<32;
+    EXPECT_TRUE(chunkaddr_fits(bin_t(0,c32-1),POPT_CHUNK_ADDR_CHUNK32));
+    EXPECT_FALSE(chunkaddr_fits(bin_t(0,c32),POPT_CHUNK_ADDR_CHUNK32));
+    EXPECT_FALSE(chunkaddr_fits(bin_t(33,0),POPT_CHUNK_ADDR_CHUNK32));
+    EXPECT_TRUE(chunkaddr_fits(bin_t(0,c32),POPT_CHUNK_ADDR_CHUNK64));
+    EXPECT_TRUE(chunkaddr_fits(bin_t(0,c32/2-1),POPT_CHUNK_ADDR_BIN32));
+    EXPECT_FALSE(chunkaddr_fits(bin_t(0,c32/2),POPT_CHUNK_ADDR_BIN32));
+    EXPECT_FALSE(chunkaddr_fits(bin_t(31,0),POPT_CHUNK_ADDR_BIN32));   // would be ALL
+    EXPECT_TRUE(chunkaddr_fits(bin_t(0,c32),POPT_CHUNK_ADDR_BIN64));
+    EXPECT_TRUE(chunkaddr_fits(bin_t::ALL,POPT_CHUNK_ADDR_BIN32));
+
+    dgram_t *d = dgram_new();
+    bin_t b(0,c32);
+    EXPECT_EQ(-1,dgram_add_chunkaddr(d,b,POPT_CHUNK_ADDR_CHUNK32));
+    EXPECT_EQ(-1,dgram_add_chunkaddr(d,b,POPT_CHUNK_ADDR_BIN32));
+    EXPECT_EQ(0,dgram_get_length(d));
+    EXPECT_EQ(0,dgram_add_chunkaddr(d,b,POPT_CHUNK_ADDR_CHUNK64));
+    EXPECT_EQ(16,dgram_get_length(d));
+    dgram_free(d);
+
+    struct evbuffer *evb = evbuffer_new();
+    EXPECT_EQ(-1,evbuffer_add_chunkaddr(evb,b,POPT_CHUNK_ADDR_CHUNK32));
+    EXPECT_EQ(0,evbuffer_get_length(evb));
+    evbuffer_free(evb);
+}
+
+
 
 int main(int argc, char** argv)
 {
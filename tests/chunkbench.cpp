@@ -0,0 +1,119 @@
+/*
+ *  chunkbench.cpp
+ *
+ *  Loopback benchmark of DATA datagrams for chunk sizes from the default
+ *  1 KB up to SWIFT_MAX_CHUNK_SIZE. Prints MB/s and chunks/s for each.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+
+using namespace swift;
+
+#define BENCH_BYTES     (256*1024*1024)
+// Bytes sent before draining, to stay within the socket receive buffer
+#define BENCH_BURST_BYTES   (128*1024)
+#define BENCH_SLOTS     64
+
+
+static double RunBench(uint32_t chunk_size, uint16_t port)
+{
+    char sndaddr[32], rcvaddr[32];
+    sprintf(sndaddr,"127.0.0.1:%u",port);
+    sprintf(rcvaddr,"127.0.0.1:%u",port+1);
+    evutil_socket_t sndsock = Channel::Bind(sndaddr);
+    evutil_socket_t rcvsock = Channel::Bind(rcvaddr);
+    EXPECT_TRUE(sndsock>0 && rcvsock>0);
+
+    recv_slot_t *slots = new recv_slot_t[BENCH_SLOTS];
+    char *bufs = new char[BENCH_SLOTS*SWIFT_MAX_RECV_DGRAM_SIZE];
+    for (int i=0; i<BENCH_SLOTS; i++) {
+        slots[i].buf = bufs+i*SWIFT_MAX_RECV_DGRAM_SIZE;
+        slots[i].size = SWIFT_MAX_RECV_DGRAM_SIZE;
+    }
+    // As Channel::AddData(): channel id, DATA, chunk addr, timestamp, chunk
+    size_t dgramsize = 4+1+4+4+8+chunk_size;
+    char *dgram = new char[dgramsize];
+    memset(dgram,'a',dgramsize);
+    Address dest(rcvaddr);
+    int burst = std::max(1,std::min(BENCH_SLOTS,(int)(BENCH_BURST_BYTES/dgramsize)));
+
+    tint start = usec_time();
+    uint64_t sent=0, rcvd=0, rcvdbytes=0;
+    while (sent*chunk_size < BENCH_BYTES) {
+        for (int i=0; i<burst; i++) {
+            dgram_t *d = dgram_new_size(dgramsize);
+            dgram_add(d,dgram,dgramsize);
+            Channel::QueueTo(sndsock,dest,d);
+        }
+        Channel::FlushSendQueue(sndsock);
+        sent += burst;
+        // Drain, loopback delivers synchronously
+        int n;
+        while ((n = Channel::RecvBatch(rcvsock,slots,BENCH_SLOTS)) > 0) {
+            for (int i=0; i<n; i++) {
+                rcvd++;
+                rcvdbytes += slots[i].length-(dgramsize-chunk_size);
+            }
+        }
+    }
+    tint elapsed = usec_time()-start;
+    double mbps = (double)rcvdbytes*TINT_SEC/elapsed/(1<<20);
+    fprintf(stderr,"chunkbench: chunk %5u: sent %" PRIu64 " rcvd %" PRIu64 " in %.3f s, %.1f MB/s, %.0f chunks/s\n",
+            chunk_size, sent, rcvd, (double)elapsed/TINT_SEC, mbps, (double)rcvd*TINT_SEC/elapsed);
+
+    delete[] dgram;
+    delete[] bufs;
+    delete[] slots;
+    Channel::CloseSocket(sndsock);
+    Channel::CloseSocket(rcvsock);
+    return mbps;
+}
+
+
+TEST(ChunkBench,Loopback)
+{
+    uint32_t sizes[] = { SWIFT_DEFAULT_CHUNK_SIZE, 4096, 8192, 16384, 32768, SWIFT_MAX_CHUNK_SIZE };
+    double base = 0.0;
+    for (int i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+        double mbps = RunBench(sizes[i],12101+2*i);
+        EXPECT_GT(mbps,0.0);
+        if (i == 0)
+            base = mbps;
+        else
+            fprintf(stderr,"chunkbench: chunk %5u: %.2fx the default\n", sizes[i], mbps/base);
+    }
+}
+
+
+TEST(ChunkBench,BigDgrams)
+{
+    // Datagrams for the largest chunk come from the pool of large buffers
+    dgram_t *d = dgram_new_size(SWIFT_MAX_UDP_PAYLOAD);
+    EXPECT_EQ(SWIFT_DGRAM_BIG_BUF_SIZE,d->cap);
+    ASSERT_TRUE(dgram_reserve(d,SWIFT_MAX_UDP_PAYLOAD) != NULL);
+    dgram_free(d);
+    dgram_t *d2 = dgram_new_size(SWIFT_DGRAM_BUF_SIZE-8192+SWIFT_MAX_CHUNK_SIZE);
+    EXPECT_EQ(d,d2);
+    EXPECT_EQ(0u,dgram_get_length(d2));
+    dgram_free(d2);
+    // Beyond it they are allocated to size and not kept
+    dgram_t *u = dgram_new_size(SWIFT_DGRAM_BIG_BUF_SIZE+1);
+    EXPECT_EQ(SWIFT_DGRAM_BIG_BUF_SIZE+1,u->cap);
+    EXPECT_TRUE(dgram_reserve(u,SWIFT_DGRAM_BIG_BUF_SIZE+2) == NULL);
+    dgram_free(u);
+    dgram_t *p = dgram_new_size(SWIFT_DEFAULT_CHUNK_SIZE);
+    EXPECT_EQ(SWIFT_DGRAM_BUF_SIZE,p->cap);
+    dgram_free(p);
+    EXPECT_EQ(SWIFT_MAX_UDP_PAYLOAD,SWIFT_MAX_CHUNK_SIZE+SWIFT_MAX_DATA_HDR_SIZE);
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
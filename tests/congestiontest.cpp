@@ -0,0 +1,152 @@
+/*
+ *  congestiontest.cpp
+ *
+ *  Tests of the congestion controllers on a simulated bottleneck: a FIFO
+ *  link of fixed capacity in chunks/s and a fixed base RTT, with the
+ *  sender clocked by the controller's send interval as a channel is.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+
+using namespace swift;
+
+
+struct sim_ack_t {
+    tint    arrive;
+    tint    sent;
+    tint    owd;
+};
+
+struct sim_result_t {
+    double  goodput;    // chunks/s over the second half
+    tint    avg_rtt;    // over the second half
+};
+
+static sim_result_t RunLink(CongestionController *cc, double capacity, tint base_rtt, tint duration)
+{
+    tint start = NOW = 100*TINT_SEC;
+    tint service = (tint)(TINT_SEC/capacity);
+    tint link_free = NOW, rtt_avg = base_rtt, last_send = NOW;
+    std::deque<sim_ack_t> inflight;
+    uint64_t acked = 0;
+    tint rtt_total = 0;
+
+    // As out of slow start
+    cc->Start(4,base_rtt);
+    cc->Update(rtt_avg,0);
+    tint next_send = NOW;
+    while (NOW < start+duration) {
+        if (!inflight.empty() && inflight.front().arrive <= next_send) {
+            sim_ack_t ack = inflight.front();
+            inflight.pop_front();
+            NOW = ack.arrive;
+            tint rtt = NOW-ack.sent;
+            rtt_avg = (rtt_avg*7 + rtt) >> 3;
+            cc->OnAck(1,rtt,ack.owd);
+            if (NOW > start+duration/2) {
+                acked++;
+                rtt_total += rtt;
+            }
+        } else {
+            NOW = next_send;
+            tint depart = std::max(NOW,link_free) + service;
+            link_free = depart;
+            sim_ack_t ack = { depart+base_rtt, NOW, depart+base_rtt/2-NOW };
+            inflight.push_back(ack);
+            last_send = NOW;
+        }
+        // Reschedule, after a send or an ack, as in CwndRateNextSendTime
+        cc->Update(rtt_avg,inflight.size());
+        next_send = std::max(NOW,last_send+cc->send_interval());
+    }
+    sim_result_t r;
+    r.goodput = (double)acked*TINT_SEC/(duration/2);
+    r.avg_rtt = acked ? rtt_total/acked : TINT_NEVER;
+    return r;
+}
+
+
+TEST(Congestion,Factory)
+{
+    EXPECT_EQ(CC_LEDBAT, CongestionController::ByName("ledbat"));
+    EXPECT_EQ(CC_BBR, CongestionController::ByName("bbr"));
+    EXPECT_EQ(-1, CongestionController::ByName("reno"));
+    for (int a=CC_LEDBAT; a<=CC_BBR; a++) {
+        CongestionController *cc = CongestionController::Create((cc_algo_t)a,1024);
+        EXPECT_EQ(a, cc->algo());
+        EXPECT_EQ(a, CongestionController::ByName(CongestionController::Name(cc->algo())));
+        delete cc;
+    }
+}
+
+
+TEST(Congestion,BbrFillsPipe)
+{
+    // 1000 chunks/s, 40 ms: 40 chunks in flight to fill it. Short of
+    // the min RTT window, so no PROBE_RTT yet.
+    BbrController bbr;
+    sim_result_t r = RunLink(&bbr,1000,40*TINT_MSEC,8*TINT_SEC);
+    fprintf(stderr,"congestion: bbr 1000/s 40ms: goodput %.0f/s rtt %" PRIi64 "us bw %.0f/s min_rtt %" PRIi64 "us\n",
+            r.goodput,r.avg_rtt,bbr.bw(),bbr.min_rtt());
+    EXPECT_EQ(BbrController::BBR_PROBE_BW, bbr.state());
+    EXPECT_NEAR(1000, bbr.bw(), 100);
+    EXPECT_GE(bbr.min_rtt(), 40*TINT_MSEC);
+    EXPECT_LT(bbr.min_rtt(), 45*TINT_MSEC);
+    EXPECT_GT(r.goodput, 900);
+    // Paced at the bottleneck rate, so hardly a queue
+    EXPECT_LT(r.avg_rtt, 60*TINT_MSEC);
+}
+
+
+TEST(Congestion,BbrRefreshesMinRtt)
+{
+    // Past the min RTT window it drains to look at the empty pipe again
+    BbrController bbr;
+    sim_result_t r = RunLink(&bbr,2000,20*TINT_MSEC,25*TINT_SEC);
+    fprintf(stderr,"congestion: bbr 2000/s 20ms: goodput %.0f/s rtt %" PRIi64 "us min_rtt %" PRIi64 "us\n",
+            r.goodput,r.avg_rtt,bbr.min_rtt());
+    EXPECT_NE(BbrController::BBR_STARTUP, bbr.state());
+    EXPECT_LT(bbr.min_rtt(), 25*TINT_MSEC);
+    EXPECT_GT(r.goodput, 1700);
+}
+
+
+TEST(Congestion,LedbatKeepsTarget)
+{
+    // LEDBAT fills the pipe too, by keeping its queueing delay at target
+    LedbatController ledbat;
+    sim_result_t r = RunLink(&ledbat,1000,40*TINT_MSEC,20*TINT_SEC);
+    fprintf(stderr,"congestion: ledbat 1000/s 40ms: goodput %.0f/s rtt %" PRIi64 "us cwnd %.1f\n",
+            r.goodput,r.avg_rtt,ledbat.cwnd());
+    EXPECT_GT(r.goodput, 900);
+    EXPECT_GT(r.avg_rtt, 40*TINT_MSEC+LedbatController::TARGET/2);
+    EXPECT_LT(r.avg_rtt, 40*TINT_MSEC+LedbatController::TARGET*2);
+}
+
+
+TEST(Congestion,LongFatPipe)
+{
+    // 10000 chunks/s, 200 ms: both slow start, LEDBAT leaves it a bit
+    // short and then grows its window by a chunk per RTT
+    LedbatController ledbat;
+    BbrController bbr;
+    sim_result_t l = RunLink(&ledbat,10000,200*TINT_MSEC,10*TINT_SEC);
+    sim_result_t b = RunLink(&bbr,10000,200*TINT_MSEC,10*TINT_SEC);
+    fprintf(stderr,"congestion: 10000/s 200ms: ledbat %.0f/s rtt %" PRIi64 "us, bbr %.0f/s rtt %" PRIi64 "us\n",
+            l.goodput,l.avg_rtt,b.goodput,b.avg_rtt);
+    EXPECT_GT(l.goodput, 8000);
+    EXPECT_GT(b.goodput, 9000);
+    EXPECT_GT(b.goodput, l.goodput);
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -108,6 +108,278 @@ TEST(Datagram,TwoPortTest)
     Channel::CloseSocket(sock2);
 }
 
+TEST(Datagram,BatchRecvTest)
+{
+    int sock1 = Channel::Bind("0.0.0.0:10003");
+    int sock2 = Channel::Bind("0.0.0.0:10004");
+    ASSERT_TRUE(sock1>0);
+    ASSERT_TRUE(sock2>0);
+    int ndgrams = 5;
+    for (int i=0; i<ndgrams; i++) {
+        struct evbuffer *snd = evbuffer_new();
+        evbuffer_add_32be(snd, 1000+i);
+        Channel::SendTo(sock1,Address("127.0.0.1:10004"),snd);
+        evbuffer_free(snd);
+    }
+    event_assign(&evrecv, evbase, sock2, EV_READ, ReceiveCallback, NULL);
+    event_add(&evrecv, NULL);
+    event_base_dispatch(evbase);
+
+    // All pending datagrams in one call, in order
+    recv_slot_t *slots = new recv_slot_t[8];
+    char *bufs = new char[8*SWIFT_MAX_RECV_DGRAM_SIZE];
+    for (int i=0; i<8; i++) {
+        slots[i].buf = bufs+i*SWIFT_MAX_RECV_DGRAM_SIZE;
+        slots[i].size = SWIFT_MAX_RECV_DGRAM_SIZE;
+    }
+    uint64_t before = Channel::global_dgrams_down;
+    ASSERT_EQ(ndgrams,Channel::RecvBatch(sock2, slots, 8));
+    EXPECT_EQ(before+ndgrams,Channel::global_dgrams_down);
+    for (int i=0; i<ndgrams; i++) {
+        ASSERT_EQ(4,slots[i].length);
+        EXPECT_EQ(1000+i,ntohl(*(uint32_t *)slots[i].buf));
+        EXPECT_EQ(10003,slots[i].addr.port());
+    }
+    // Nothing left, must not block
+    EXPECT_EQ(0,Channel::RecvBatch(sock2, slots, 8));
+    delete[] bufs;
+    delete[] slots;
+    Channel::CloseSocket(sock1);
+    Channel::CloseSocket(sock2);
+}
+
+TEST(Datagram,QueuedSendTest)
+{
+    int sock1 = Channel::Bind("0.0.0.0:10005");
+    int sock2 = Channel::Bind("0.0.0.0:10006");
+    ASSERT_TRUE(sock1>0);
+    ASSERT_TRUE(sock2>0);
+    uint64_t dgrams = Channel::global_dgrams_up, bytes = Channel::global_raw_bytes_up;
+    int ndgrams = 3;
+    for (int i=0; i<ndgrams; i++) {
+        dgram_t *snd = dgram_new();
+        dgram_add_32be(snd, 2000+i);
+        ASSERT_EQ(4,Channel::QueueTo(sock1,Address("127.0.0.1:10006"),snd));
+    }
+    // Nothing leaves before the flush
+    EXPECT_EQ(dgrams,Channel::global_dgrams_up);
+    EXPECT_EQ(ndgrams,Channel::FlushSendQueue(sock1));
+    EXPECT_EQ(ndgrams,Channel::last_flush_dgrams);
+    EXPECT_EQ(dgrams+ndgrams,Channel::global_dgrams_up);
+    EXPECT_EQ(bytes+ndgrams*4,Channel::global_raw_bytes_up);
+    EXPECT_EQ(0,Channel::FlushSendQueue(sock1));
+
+    event_assign(&evrecv, evbase, sock2, EV_READ, ReceiveCallback, NULL);
+    event_add(&evrecv, NULL);
+    event_base_dispatch(evbase);
+    recv_slot_t *slots = new recv_slot_t[8];
+    char *bufs = new char[8*SWIFT_MAX_RECV_DGRAM_SIZE];
+    for (int i=0; i<8; i++) {
+        slots[i].buf = bufs+i*SWIFT_MAX_RECV_DGRAM_SIZE;
+        slots[i].size = SWIFT_MAX_RECV_DGRAM_SIZE;
+    }
+    ASSERT_EQ(ndgrams,Channel::RecvBatch(sock2, slots, 8));
+    for (int i=0; i<ndgrams; i++)
+        EXPECT_EQ(2000+i,ntohl(*(uint32_t *)slots[i].buf));
+    delete[] bufs;
+    delete[] slots;
+    Channel::CloseSocket(sock1);
+    Channel::CloseSocket(sock2);
+}
+
+TEST(Datagram,DgramCursorTest)
+{
+    dgram_t *d = dgram_new();
+    const char * text = "text";
+    dgram_add(d, text, strlen(text));
+    dgram_add_8(d, 0xab);
+    dgram_add_16be(d, 0xabcd);
+    dgram_add_32be(d, 0xabcdef01);
+    dgram_add_64be(d, 0xabcdefabcdeffULL);
+    ASSERT_EQ(4+1+2+4+8,dgram_get_length(d));
+    uint8_t *data = dgram_pullup(d);
+    EXPECT_EQ(0,memcmp(data,"text\xab\xab\xcd",7));
+
+    char buf[8];
+    EXPECT_EQ(4,dgram_remove(d, buf, 4));
+    EXPECT_EQ(0,memcmp(buf,text,4));
+    EXPECT_EQ(0xab,dgram_remove_8(d));
+    EXPECT_EQ(0xabcd,dgram_remove_16be(d));
+    EXPECT_EQ(0xabcdef01,dgram_remove_32be(d));
+    EXPECT_EQ(0xabcdefabcdeffULL,dgram_remove_64be(d));
+    EXPECT_EQ(0,dgram_get_length(d));
+    // Reading past the end gives 0 and keeps the buffer empty
+    EXPECT_EQ(0,dgram_remove_32be(d));
+    EXPECT_EQ(0,dgram_get_length(d));
+
+    // Short read consumes what is there, like evbuffer_remove
+    dgram_add_16be(d, 0x1234);
+    EXPECT_EQ(0,dgram_remove_32be(d));
+    EXPECT_EQ(0,dgram_get_length(d));
+
+    // Fixed size, refuses to overflow
+    uint8_t *space = dgram_reserve(d, SWIFT_DGRAM_BUF_SIZE);
+    ASSERT_TRUE(space != NULL);
+    dgram_commit(d, SWIFT_DGRAM_BUF_SIZE);
+    EXPECT_EQ(-1,dgram_add_8(d, 1));
+    EXPECT_TRUE(dgram_reserve(d, 1) == NULL);
+
+    // Freed buffers are reused
+    dgram_free(d);
+    dgram_t *d2 = dgram_new();
+    EXPECT_EQ(d,d2);
+    EXPECT_EQ(0,dgram_get_length(d2));
+    dgram_free(d2);
+
+    // Wrap external memory, e.g. a receive slot
+    char wire[6] = { 0, 0, 0, 7, 0x12, 0x34 };
+    dgram_t w;
+    dgram_wrap(&w, wire, sizeof(wire));
+    EXPECT_EQ(7,dgram_remove_32be(&w));
+    EXPECT_EQ(0x1234,dgram_remove_16be(&w));
+}
+
+TEST(Datagram,VarintTest)
+{
+    dgram_t *d = dgram_new();
+    dgram_add_varint(d, 0);
+    dgram_add_varint(d, 0x7f);
+    dgram_add_varint(d, 300);
+    dgram_add_varint(d, 0xffffffffffffffffULL);
+    ASSERT_EQ(1+1+2+10,dgram_get_length(d));
+    EXPECT_EQ(0,memcmp(dgram_pullup(d),"\x00\x7f\xac\x02",4));
+
+    uint64_t v;
+    EXPECT_TRUE(dgram_remove_varint(d,&v));
+    EXPECT_EQ(0,v);
+    EXPECT_TRUE(dgram_remove_varint(d,&v));
+    EXPECT_EQ(0x7f,v);
+    EXPECT_TRUE(dgram_remove_varint(d,&v));
+    EXPECT_EQ(300,v);
+    EXPECT_TRUE(dgram_remove_varint(d,&v));
+    EXPECT_EQ(0xffffffffffffffffULL,v);
+
+    // Cut short
+    dgram_add_8(d, 0x80);
+    EXPECT_FALSE(dgram_remove_varint(d,&v));
+    dgram_free(d);
+}
+
+TEST(Datagram,ShardIDTest)
+{
+    // Channel IDs on the wire carry the shard that owns the channel
+    for (int shard=0; shard<SWIFT_MAX_SHARDS; shard+=21) {
+        Channel::shard_id = shard;
+        for (int id=1; id<SWIFT_MAX_CHANNELS; id=id*7+3) {
+            uint32_t wire = Channel::EncodeID(id);
+            EXPECT_EQ(shard,Channel::ShardOfID(wire));
+            EXPECT_EQ(id,Channel::DecodeID(wire));
+        }
+    }
+    Channel::shard_id = 0;
+}
+
+TEST(Datagram,ChannelSlotTest)
+{
+    // Slots are reused, the wire ID of a closed channel goes stale
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open("test_file0.dat",noswarmid);
+    ASSERT_TRUE(td >= 0);
+    FileTransfer *ft = new FileTransfer(td,"test_file0.dat");
+    Channel *a = new Channel(ft);
+    Channel *b = new Channel(ft);
+    uint32_t aid = Channel::EncodeID(a->id());
+    EXPECT_EQ(a,Channel::ChannelOfID(aid));
+    EXPECT_EQ(b,Channel::ChannelOfID(Channel::EncodeID(b->id())));
+    int aslot = a->id();
+    delete a;
+    EXPECT_TRUE(Channel::ChannelOfID(aid) == NULL);
+
+    Channel *c = new Channel(ft);
+    EXPECT_EQ(aslot,c->id());
+    EXPECT_NE(aid,(uint32_t)Channel::EncodeID(c->id()));
+    EXPECT_TRUE(Channel::ChannelOfID(aid) == NULL);
+    EXPECT_EQ(c,Channel::ChannelOfID(Channel::EncodeID(c->id())));
+
+    // Churn doesn't grow the table
+    uint32_t maxid = 0;
+    for (int i=0; i<1000; i++) {
+        Channel *d = new Channel(ft);
+        maxid = std::max(maxid,d->id());
+        delete d;
+    }
+    EXPECT_EQ(std::max(b->id(),c->id())+1,maxid);
+    delete b;
+    delete c;
+    delete ft;
+}
+
+TEST(Datagram,ChannelLimitTest)
+{
+    // Once all slots are taken no channel is created, until one is freed
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open("test_file0.dat",noswarmid);
+    ASSERT_TRUE(td >= 0);
+    FileTransfer *ft = new FileTransfer(td,"test_file0.dat");
+    int oldmax = Channel::MAX_CHANNELS;
+    Channel::MAX_CHANNELS = 16;
+    std::vector<Channel *> made;
+    while (Channel::SlotAvailable() && made.size() < 16)
+        made.push_back(new Channel(ft));
+    ASSERT_FALSE(Channel::SlotAvailable());
+    for (int i=0; i<made.size(); i++)
+        EXPECT_LT(made[i]->id(),16u);
+
+    size_t nchan = ft->GetChannels()->size();
+    Address peer("130.37.193.67",8093);
+    ft->AddPeer(peer);
+    EXPECT_EQ(nchan,ft->GetChannels()->size());
+    EXPECT_TRUE(ft->FindChannel(peer,NULL) == NULL);
+
+    uint32_t slot = made.back()->id();
+    delete made.back();
+    made.pop_back();
+    EXPECT_TRUE(Channel::SlotAvailable());
+    ft->AddPeer(peer);
+    Channel *c = ft->FindChannel(peer,NULL);
+    ASSERT_TRUE(c != NULL);
+    EXPECT_EQ(slot,c->id());
+    EXPECT_FALSE(Channel::SlotAvailable());
+
+    Channel::MAX_CHANNELS = oldmax;
+    delete c;
+    for (int i=0; i<made.size(); i++)
+        delete made[i];
+    delete ft;
+}
+
+TEST(Datagram,ChannelIndexTest)
+{
+    // Channels are found by peer and recv_peer, and forgotten when deleted
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open("test_file0.dat",noswarmid);
+    ASSERT_TRUE(td >= 0);
+    FileTransfer *ft = new FileTransfer(td,"test_file0.dat");
+    Address pa("130.37.193.65",8093), pb("130.37.193.66",8093), pc("192.168.1.2",8093);
+    Channel *a = new Channel(ft,INVALID_SOCKET,pa);
+    Channel *b = new Channel(ft,INVALID_SOCKET,pb);
+    EXPECT_EQ(a,ft->FindChannel(pa,NULL));
+    EXPECT_EQ(b,ft->FindChannel(pb,NULL));
+    EXPECT_TRUE(ft->FindChannel(pa,a) == NULL);
+    EXPECT_TRUE(ft->FindChannel(pc,NULL) == NULL);
+
+    // Reply to b's handshake from behind a NAT
+    EXPECT_FALSE(b->IsDiffSenderOrDuplicate(pc,b->id()));
+    EXPECT_EQ(b,ft->FindChannel(pc,NULL));
+
+    Channel::CloseChannelByAddress(pa);
+    EXPECT_TRUE(ft->FindChannel(pa,NULL) == NULL);
+    delete b;
+    EXPECT_TRUE(ft->FindChannel(pb,NULL) == NULL);
+    EXPECT_TRUE(ft->FindChannel(pc,NULL) == NULL);
+    delete ft;
+}
+
 int main(int argc, char** argv)
 {
     swift::LibraryInit();
@@ -65,14 +65,23 @@ void BTTrackerServerRequestCallback(struct evhttp_request *evreq, void *arg)
     int ret = evhttp_parse_query(evhttp_request_get_uri(evreq),&qheaders);
     ASSERT_EQ(0,ret);
 
-    // Check query string
-    const char *infohashcstr =evhttp_find_header(&qheaders,"info_hash");
-
-    char *decoded_infohashcstr = evhttp_uridecode(infohashcstr,0,NULL);
+    // Check query string. Decode info_hash from the raw query, the parsed
+    // value ends at the first NUL byte of the hash
+    const char *querycstr = evhttp_uri_get_query(evu);
+    ASSERT_FALSE(querycstr == NULL);
+    const char *infohashcstr = strstr(querycstr,"info_hash=");
+    ASSERT_FALSE(infohashcstr == NULL);
+    infohashcstr += strlen("info_hash=");
+    std::string infohashesc(infohashcstr,strcspn(infohashcstr,"&"));
+
+    size_t decodedlen = 0;
+    char *decoded_infohashcstr = evhttp_uridecode(infohashesc.c_str(),0,&decodedlen);
     ASSERT_FALSE(decoded_infohashcstr == NULL);
 
     Sha1Hash roothash(ROOTHASH_PLAINTEXT,strlen(ROOTHASH_PLAINTEXT));
-    ret = memcmp(decoded_infohashcstr,roothash.bytes(),Sha1Hash::SIZE);
+    // Trackers get the first 20 bytes of longer root hashes
+    ASSERT_EQ(std::min((size_t)20,Sha1Hash::SIZE),decodedlen);
+    ret = memcmp(decoded_infohashcstr,roothash.bytes(),decodedlen);
     ASSERT_EQ(0,ret);
     free(decoded_infohashcstr);
 
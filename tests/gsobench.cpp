@@ -0,0 +1,92 @@
+/*
+ *  gsobench.cpp
+ *
+ *  Loopback benchmark of the coalesced send path with and without UDP
+ *  GSO/GRO (Channel::UDP_OFFLOAD). Prints chunks/sec for each mode.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+
+using namespace swift;
+
+#define BENCH_CHUNKS    200000
+#define BENCH_BURST     64
+
+// Size of a DATA datagram for a default size chunk: channel id, DATA
+// message id, chunk addr, timestamp, chunk
+#define BENCH_DGRAM_SIZE    (4+1+4+8+SWIFT_DEFAULT_CHUNK_SIZE)
+
+
+static double RunBench(bool offload, uint16_t port)
+{
+    Channel::UDP_OFFLOAD = offload;
+    char sndaddr[32], rcvaddr[32];
+    sprintf(sndaddr,"127.0.0.1:%u",port);
+    sprintf(rcvaddr,"127.0.0.1:%u",port+1);
+    evutil_socket_t sndsock = Channel::Bind(sndaddr);
+    evutil_socket_t rcvsock = Channel::Bind(rcvaddr);
+    EXPECT_TRUE(sndsock>0 && rcvsock>0);
+
+    int slotsize = offload ? SWIFT_MAX_GRO_DGRAM_SIZE : SWIFT_MAX_RECV_DGRAM_SIZE;
+    recv_slot_t *slots = new recv_slot_t[BENCH_BURST];
+    char *bufs = new char[BENCH_BURST*slotsize];
+    for (int i=0; i<BENCH_BURST; i++) {
+        slots[i].buf = bufs+i*slotsize;
+        slots[i].size = slotsize;
+    }
+    char chunk[BENCH_DGRAM_SIZE];
+    memset(chunk,'a',sizeof(chunk));
+    Address dest(rcvaddr);
+
+    uint64_t gso = Channel::global_gso_segments, dgrams = Channel::global_dgrams_up;
+    tint start = usec_time();
+    int sent=0, rcvd=0;
+    while (sent < BENCH_CHUNKS) {
+        for (int i=0; i<BENCH_BURST; i++) {
+            dgram_t *d = dgram_new();
+            dgram_add(d,chunk,sizeof(chunk));
+            Channel::QueueTo(sndsock,dest,d);
+        }
+        // QueueTo flushes by itself when SEND_BATCH_SIZE is reached
+        Channel::FlushSendQueue(sndsock);
+        sent = Channel::global_dgrams_up-dgrams;
+        // Drain, loopback delivers synchronously
+        int n;
+        while ((n = Channel::RecvBatch(rcvsock,slots,BENCH_BURST)) > 0) {
+            for (int i=0; i<n; i++)
+                rcvd += slots[i].segsize ? (slots[i].length+slots[i].segsize-1)/slots[i].segsize : 1;
+        }
+    }
+    tint elapsed = usec_time()-start;
+    double cps = (double)rcvd*TINT_SEC/elapsed;
+    fprintf(stderr,"gsobench: offload %s: sent %d rcvd %d chunks in %.3f s, %.0f chunks/s, %" PRIu64 " via GSO\n",
+            offload ? "on " : "off", sent, rcvd, (double)elapsed/TINT_SEC, cps, Channel::global_gso_segments-gso);
+
+    delete[] bufs;
+    delete[] slots;
+    Channel::CloseSocket(sndsock);
+    Channel::CloseSocket(rcvsock);
+    Channel::UDP_OFFLOAD = false;
+    return cps;
+}
+
+
+TEST(GSOBench,Loopback)
+{
+    double off = RunBench(false,12001);
+    double on = RunBench(true,12003);
+    EXPECT_GT(off,0.0);
+    EXPECT_GT(on,0.0);
+    fprintf(stderr,"gsobench: speedup %.2fx\n", on/off);
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,124 @@
+/*
+ *  hashbench.cpp
+ *
+ *  Hash tree construction (MmapHashTree::Submit) from 1 thread up to one
+ *  per core. Prints GB/s for each and checks all build the same tree.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include <thread>
+#include "swift.h"
+#include "bin_utils.h"
+
+using namespace swift;
+
+#define BENCH_FILE      "hashbench.dat"
+#define BENCH_HASHFILE  "hashbench.dat.mhash"
+#define BENCH_BYTES     (256*1024*1024)
+
+
+static void WriteFile(uint64_t size)
+{
+    FILE *fp = fopen(BENCH_FILE,"wb");
+    ASSERT_TRUE(fp != NULL);
+    char buf[4096];
+    for (uint64_t off=0; off<size; off+=sizeof(buf)) {
+        for (int i=0; i<sizeof(buf); i++)
+            buf[i] = (off+i)*7 >> 10;
+        fwrite(buf,std::min((uint64_t)sizeof(buf),size-off),1,fp);
+    }
+    fclose(fp);
+}
+
+
+static Sha1Hash Build(int nthreads, uint32_t chunk_size, double *gbps, bin_t *peaks=NULL, Sha1Hash *peak_hashes=NULL)
+{
+    MmapHashTree::SUBMIT_THREADS = nthreads;
+    remove(BENCH_HASHFILE);
+    Storage storage(BENCH_FILE,".",-1,0);
+    tint start = usec_time();
+    MmapHashTree ht(&storage,Sha1Hash::ZERO,chunk_size,BENCH_HASHFILE,true,"");
+    tint elapsed = usec_time()-start;
+    EXPECT_TRUE(ht.IsOperational());
+    EXPECT_EQ(ht.size(),ht.complete());
+    if (gbps != NULL)
+        *gbps = (double)ht.size()*TINT_SEC/std::max(elapsed,(tint)1)/(1<<30);
+    for (int p=0; peaks!=NULL && p<ht.peak_count(); p++) {
+        peaks[p] = ht.peak(p);
+        peak_hashes[p] = ht.peak_hash(p);
+    }
+    return ht.root_hash();
+}
+
+
+static Sha1Hash NodeHash(bin_t pos, uint32_t chunk_size)
+{
+    if (pos.is_base()) {
+        char *buf = new char[chunk_size];
+        FILE *fp = fopen(BENCH_FILE,"rb");
+        fseeko(fp,pos.base_offset()*chunk_size,SEEK_SET);
+        size_t rd = fread(buf,1,chunk_size,fp);
+        fclose(fp);
+        Sha1Hash h(buf,rd);
+        delete[] buf;
+        return h;
+    }
+    return Sha1Hash(NodeHash(pos.left(),chunk_size),NodeHash(pos.right(),chunk_size));
+}
+
+
+TEST(HashBench,OddSizes)
+{
+    // Content that doesn't fill its blocks, compared to a plain recursive tree
+    uint64_t sizes[] = { 1, 1023, 1025, 1000*1024+17, 4099*1024 };
+    for (int s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++) {
+        WriteFile(sizes[s]);
+        bin_t peaks[64];
+        Sha1Hash peak_hashes[64];
+        Sha1Hash serial = Build(1,1024,NULL);
+        Sha1Hash parallel = Build(4,1024,NULL,peaks,peak_hashes);
+        EXPECT_EQ(serial,parallel);
+        int peak_count = gen_peaks((sizes[s]+1023)/1024,peaks);
+        for (int p=0; p<peak_count; p++)
+            EXPECT_EQ(NodeHash(peaks[p],1024),peak_hashes[p]);
+    }
+    remove(BENCH_FILE);
+    remove(BENCH_HASHFILE);
+}
+
+
+TEST(HashBench,Threads)
+{
+    WriteFile(BENCH_BYTES);
+    // Warm the page cache
+    Build(1,SWIFT_DEFAULT_CHUNK_SIZE,NULL);
+
+    int maxthreads = std::max(1u,std::thread::hardware_concurrency());
+    double base = 0.0;
+    Sha1Hash root;
+    for (int t=1; t<=maxthreads; t*=2) {
+        double gbps;
+        Sha1Hash h = Build(t,SWIFT_DEFAULT_CHUNK_SIZE,&gbps);
+        if (t == 1) {
+            root = h;
+            base = gbps;
+        }
+        EXPECT_EQ(root,h);
+        EXPECT_GT(gbps,0.0);
+        fprintf(stderr,"hashbench: %2d threads: %.2f GB/s, %.2fx 1 thread\n", t, gbps, gbps/base);
+        if (t < maxthreads && t*2 > maxthreads)
+            t = maxthreads/2;
+    }
+    remove(BENCH_FILE);
+    remove(BENCH_HASHFILE);
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -11,15 +11,26 @@
 #include <gtest/gtest.h>
 #include "hashtree.h"
 #include "swift.h"
+#include "sha1.h"
+#include "sha256.h"
 
 using namespace swift;
 
+#ifdef SWIFT_MERKLE_SHA256
+char hash123[] = "181210f8f9c779c26da1d9b2075bde0127302ee0e3fca38c9a83f5b1dd8e5d3b";
+char rooth123[] = "181210f8f9c779c26da1d9b2075bde0127302ee0e3fca38c9a83f5b1dd8e5d3b";
+
+char hash456a[] = "54b5a03e26b99259570c6f302ac6268119d441583798f6d219f60417eef8f9fe";
+char hash456b[] = "0d1a6f01c06f2ac5c7267a5f40c746a09196a2dd3a56687b49ce42f2c0d70fac";
+char rooth456[] = "062c7130ba18b20f6d3b7aa76a4c63530255fe2bac6304aec9d71d029e128acd";
+#else
 char hash123[] = "a8fdc205a9f19cc1c7507a60c4f01b13d11d7fd0";
 char rooth123[] = "a8fdc205a9f19cc1c7507a60c4f01b13d11d7fd0";
 
 char hash456a[] = "4d38c7459a659d769bb956c2d758d266008199a4";
 char hash456b[] = "a923e4b60d2a2a2a5ede87479e0314b028e3ae60";
 char rooth456[] = "5b53677d3a695f29f1b4e18ab6d705312ef7f8c3";
+#endif
 
 
 TEST(Sha1HashTest,Trivial)
@@ -104,6 +115,132 @@ TEST(Sha1HashTest,OfferDataTest2)
 }
 
 
+static std::string RawHex(const unsigned char *bytes, int len)
+{
+    char hex[2*32+1];
+    for (int i=0; i<len; i++)
+        sprintf(hex+2*i,"%02x",bytes[i]);
+    return std::string(hex,2*len);
+}
+
+
+static std::string Sha1Hex(int backend, const unsigned char *data, unsigned long len)
+{
+    EXPECT_EQ(0,blk_SHA1_SetBackend(backend));
+    const unsigned char *ptrs[1] = { data };
+    unsigned long lens[1] = { len };
+    unsigned char out[1][20];
+    blk_SHA1_Multi(ptrs,lens,out,1);
+    return RawHex(out[0],20);
+}
+
+
+TEST(Sha1HashTest,Backends)
+{
+    int best = blk_SHA1_Backend();
+    std::string a(1000000,'a');
+    const char *msgs[] = { "", "abc", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", a.c_str() };
+    const char *kat[] = { "da39a3ee5e6b4b0d3255bfef95601890afd80709", "a9993e364706816aba3e25717850c26c9cd0d89d",
+                          "84983e441c3bd26ebaae4aa1f95129e5e54670f1", "34aa973cd4c4daa4f61eeb2bdbad27316534016f" };
+    unsigned char data[4096];
+    for (int i=0; i<sizeof(data); i++)
+        data[i] = (i*131+7) >> 3;
+
+    int backends[] = { SHA1_BACKEND_PORTABLE, SHA1_BACKEND_AVX2, SHA1_BACKEND_SHANI,
+                       SHA1_BACKEND_AVX2|SHA1_BACKEND_SHANI };
+    for (int b=0; b<4; b++) {
+        if (blk_SHA1_SetBackend(backends[b]) < 0) {
+            fprintf(stderr,"sha1: backend %d not supported here\n", backends[b]);
+            continue;
+        }
+        for (int m=0; m<4; m++)
+            EXPECT_EQ(std::string(kat[m]),Sha1Hex(backends[b],(const unsigned char *)msgs[m],strlen(msgs[m])));
+        // Against the portable code, around the block and padding boundaries
+        for (unsigned long len=0; len<300; len++)
+            EXPECT_EQ(Sha1Hex(SHA1_BACKEND_PORTABLE,data,len),Sha1Hex(backends[b],data,len));
+
+        // Batches: 8 of a length, mixed lengths and a short tail
+        const unsigned char *ptrs[19];
+        unsigned long lens[19];
+        unsigned char out[19][20];
+        for (int i=0; i<19; i++) {
+            ptrs[i] = data+i*97;
+            lens[i] = (i < 8) ? 1024 : (i < 16 ? 40 : 55+i);
+        }
+        lens[12] = 64;
+        ASSERT_EQ(0,blk_SHA1_SetBackend(backends[b]));
+        blk_SHA1_Multi(ptrs,lens,out,19);
+        for (int i=0; i<19; i++)
+            EXPECT_EQ(Sha1Hex(SHA1_BACKEND_PORTABLE,ptrs[i],lens[i]),RawHex(out[i],20));
+    }
+    blk_SHA1_SetBackend(best);
+
+    // Batch API of the hash tree
+    const uint8_t *ptrs[9];
+    size_t lens[9];
+    Sha1Hash out[9];
+    for (int i=0; i<9; i++) {
+        ptrs[i] = data+i*2*HASHSZ;
+        lens[i] = 2*HASHSZ;
+    }
+    Sha1Hash::HashChunks(ptrs,lens,out,9);
+    Sha1Hash left(false,(const char *)data), right(false,(const char *)data+HASHSZ);
+    EXPECT_EQ(Sha1Hash(left,right),out[0]);
+    EXPECT_EQ(Sha1Hash(data+8*2*HASHSZ,2*HASHSZ),out[8]);
+}
+
+static std::string Sha256Hex(int backend, const unsigned char *data, unsigned long len)
+{
+    EXPECT_EQ(0,blk_SHA256_SetBackend(backend));
+    const unsigned char *ptrs[1] = { data };
+    unsigned long lens[1] = { len };
+    unsigned char out[1][32];
+    blk_SHA256_Multi(ptrs,lens,out,1);
+    return RawHex(out[0],32);
+}
+
+
+TEST(Sha1HashTest,Sha256Backends)
+{
+    int best = blk_SHA256_Backend();
+    std::string a(1000000,'a');
+    const char *msgs[] = { "", "abc", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", a.c_str() };
+    const char *kat[] = { "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+                          "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+                          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+                          "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" };
+    unsigned char data[4096];
+    for (int i=0; i<sizeof(data); i++)
+        data[i] = (i*131+7) >> 3;
+
+    int backends[] = { SHA256_BACKEND_PORTABLE, SHA256_BACKEND_AVX2, SHA256_BACKEND_SHANI,
+                       SHA256_BACKEND_AVX2|SHA256_BACKEND_SHANI };
+    for (int b=0; b<4; b++) {
+        if (blk_SHA256_SetBackend(backends[b]) < 0) {
+            fprintf(stderr,"sha256: backend %d not supported here\n", backends[b]);
+            continue;
+        }
+        for (int m=0; m<4; m++)
+            EXPECT_EQ(std::string(kat[m]),Sha256Hex(backends[b],(const unsigned char *)msgs[m],strlen(msgs[m])));
+        for (unsigned long len=0; len<300; len++)
+            EXPECT_EQ(Sha256Hex(SHA256_BACKEND_PORTABLE,data,len),Sha256Hex(backends[b],data,len));
+
+        const unsigned char *ptrs[19];
+        unsigned long lens[19];
+        unsigned char out[19][32];
+        for (int i=0; i<19; i++) {
+            ptrs[i] = data+i*97;
+            lens[i] = (i < 8) ? 1024 : (i < 16 ? 64 : 55+i);
+        }
+        lens[12] = 40;
+        ASSERT_EQ(0,blk_SHA256_SetBackend(backends[b]));
+        blk_SHA256_Multi(ptrs,lens,out,19);
+        for (int i=0; i<19; i++)
+            EXPECT_EQ(Sha256Hex(SHA256_BACKEND_PORTABLE,ptrs[i],lens[i]),RawHex(out[i],32));
+    }
+    blk_SHA256_SetBackend(best);
+}
+
 
 int main(int argc, char** argv)
 {
@@ -0,0 +1,71 @@
+/*
+ *  havelogtest.cpp
+ *
+ *  Tests of the log of bins a transfer completed, from which channels
+ *  announce HAVEs, and its dropping of the oldest.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+#include "compat.h"
+
+using namespace swift;
+
+#define TESTFILE     "havelog.dat"
+
+
+TEST(HaveLog,Progress)
+{
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open(TESTFILE,noswarmid);
+    ASSERT_GE(td,0);
+    ContentTransfer *ct = swift::GetActivatedTransfer(td);
+    ASSERT_TRUE(ct != NULL);
+
+    // Content had on open is not logged, channels find it in ack_out()
+    EXPECT_EQ(0, ct->have_log_start());
+    EXPECT_EQ(0, ct->have_log_end());
+
+    ct->Progress(bin_t(0,0));
+    ct->Progress(bin_t(1,0));
+    EXPECT_EQ(0, ct->have_log_start());
+    EXPECT_EQ(2, ct->have_log_end());
+    EXPECT_EQ(bin_t(0,0), ct->have_log_at(0));
+    EXPECT_EQ(bin_t(1,0), ct->have_log_at(1));
+
+    // A cursor on the first entry falls off when the log is full
+    for (int i=0; i<SWIFT_HAVE_LOG_SIZE; i++)
+        ct->LogHave(bin_t(0,i));
+    EXPECT_EQ(2, ct->have_log_start());
+    EXPECT_EQ(SWIFT_HAVE_LOG_SIZE+2, ct->have_log_end());
+    EXPECT_EQ(bin_t(0,0), ct->have_log_at(2));
+    EXPECT_EQ(bin_t(0,SWIFT_HAVE_LOG_SIZE-1), ct->have_log_at(SWIFT_HAVE_LOG_SIZE+1));
+
+    swift::Close(td,true,true);
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+
+    unlink(TESTFILE);
+    unlink((std::string(TESTFILE)+".mhash").c_str());
+    unlink((std::string(TESTFILE)+".mbinmap").c_str());
+    int f = open(TESTFILE,O_RDWR|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (f < 0) {
+        eprintf("Error opening %s\n",TESTFILE);
+        return -1;
+    }
+    char buf[4100];
+    memset(buf,'H',sizeof(buf));
+    if (write(f,buf,sizeof(buf)) != sizeof(buf))
+        return -1;
+    close(f);
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
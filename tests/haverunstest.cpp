@@ -0,0 +1,325 @@
+/*
+ *  haverunstest.cpp
+ *
+ *  Tests of HAVE_RUNS: what we have announced in runs of chunks had and
+ *  not, continued over datagrams when it doesn't fit in one, checked on
+ *  receipt, and only offered in handshakes to peers that list it.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+#include "compat.h"
+
+using namespace swift;
+
+#define TESTFILE     "haveruns.dat"
+#define TEST_CHUNKS  1024
+// Had: every other chunk of [10,610), all of [610,1000)
+#define FIRST_HAD    10
+#define ALT_END      610
+#define HAD_END      1000
+
+
+class RunsChannel : public Channel
+{
+  public:
+    RunsChannel(ContentTransfer *t, popt_chunk_addr_t ca=POPT_CHUNK_ADDR_CHUNK32) : Channel(t) {
+        hs_out_->chunk_addr_ = ca;
+        hs_in_ = new Handshake(*hs_out_);
+    }
+    void SetPeer(Handshake *hs) {
+        delete hs_in_;
+        hs_in_ = hs;
+    }
+    bool HaveRuns(dgram_t *dg) {
+        return AddHaveRuns(dg);
+    }
+    void OnRuns(dgram_t *dg) {
+        OnHaveRuns(dg);
+    }
+    void HandshakeOut(dgram_t *dg) {
+        AddHandshake(dg);
+    }
+    static swift::Handshake *ParseHandshake(dgram_t *dg) {
+        Address addr;
+        return StaticOnHandshake(addr,0,false,VER_PPSPP_v1,dg);
+    }
+    uint64_t have_runs_pos() {
+        return have_runs_pos_;
+    }
+    bool closing() {
+        return send_control_ == CLOSE_CONTROL;
+    }
+};
+
+// A HAVE_RUNS message as in dg, left as it is
+struct runs_t {
+    uint64_t start;
+    std::vector<uint64_t> runs;
+};
+
+static std::vector<runs_t> Decode(dgram_t *dg)
+{
+    std::vector<runs_t> msgs;
+    dgram_t *copy = dgram_new();
+    dgram_add(copy,dgram_pullup(dg),dgram_get_length(dg));
+    while (dgram_get_length(copy) > 0) {
+        EXPECT_EQ(SWIFT_HAVE_RUNS, dgram_remove_8(copy));
+        runs_t m;
+        m.start = dgram_remove_32be(copy);
+        int nruns = dgram_remove_16be(copy);
+        for (int i=0; i<nruns; i++) {
+            uint64_t len;
+            EXPECT_TRUE(dgram_remove_varint(copy,&len));
+            m.runs.push_back(len);
+        }
+        msgs.push_back(m);
+    }
+    dgram_free(copy);
+    return msgs;
+}
+
+static ContentTransfer *OpenFragmented()
+{
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open(TESTFILE,noswarmid);
+    EXPECT_GE(td,0);
+    ContentTransfer *ct = swift::GetActivatedTransfer(td);
+    EXPECT_TRUE(ct != NULL && ct->hashtree() != NULL);
+    EXPECT_EQ(TEST_CHUNKS, ct->hashtree()->size_in_chunks());
+    binmap_t *ack_out = ct->ack_out();
+    for (int i=0; i<TEST_CHUNKS; i++)
+        if (i < FIRST_HAD || (i < ALT_END && (i-FIRST_HAD)%2 == 1) || i >= HAD_END)
+            ack_out->reset(bin_t(0,i));
+    return ct;
+}
+
+
+TEST(HaveRuns,RoundTrip)
+{
+    ContentTransfer *ct = OpenFragmented();
+    RunsChannel *a = new RunsChannel(ct);
+    RunsChannel *b = new RunsChannel(ct);
+
+    // 600 one-chunk runs take more than a datagram
+    std::vector<runs_t> msgs;
+    bool done = false;
+    int dgrams = 0;
+    while (!done && dgrams < 10) {
+        dgram_t *dg = dgram_new();
+        dgram_add_32be(dg,0);   // channel ID, as Send() starts
+        done = a->HaveRuns(dg);
+        EXPECT_LE(dgram_get_length(dg), SWIFT_MAX_NONDATA_DGRAM_SIZE);
+        dgram_remove_32be(dg);
+        std::vector<runs_t> m = Decode(dg);
+        ASSERT_EQ(1u, m.size());
+        msgs.push_back(m[0]);
+        while (dgram_get_length(dg) > 0) {
+            EXPECT_EQ(SWIFT_HAVE_RUNS, dgram_remove_8(dg));
+            b->OnRuns(dg);
+        }
+        dgram_free(dg);
+        dgrams++;
+    }
+    EXPECT_TRUE(done);
+    EXPECT_GE(dgrams, 2);
+    EXPECT_EQ(TEST_CHUNKS, a->have_runs_pos());
+    EXPECT_FALSE(b->closing());
+
+    // Runs from the first had, each message continuing where the last
+    // left off, up to the last had
+    EXPECT_EQ(FIRST_HAD, msgs[0].start);
+    uint64_t end = 0;
+    for (size_t i=0; i<msgs.size(); i++) {
+        EXPECT_GE(msgs[i].start, end);
+        end = msgs[i].start;
+        for (size_t j=0; j<msgs[i].runs.size(); j++) {
+            if (end < ALT_END)
+                EXPECT_EQ(1u, msgs[i].runs[j]);
+            end += msgs[i].runs[j];
+        }
+    }
+    EXPECT_EQ(HAD_END-ALT_END, msgs.back().runs.back());
+    EXPECT_EQ(HAD_END, end);
+
+    // The peer has exactly what we have
+    int wrong = 0;
+    for (int i=0; i<TEST_CHUNKS; i++)
+        if (ct->ack_out()->is_filled(bin_t(0,i)) != b->ack_in().is_filled(bin_t(0,i)))
+            wrong++;
+    EXPECT_EQ(0, wrong);
+
+    delete a;
+    delete b;
+    swift::Close(ct->td(),true,false);
+}
+
+
+TEST(HaveRuns,Room)
+{
+    ContentTransfer *ct = OpenFragmented();
+    RunsChannel *c = new RunsChannel(ct);
+    uint8_t filler[SWIFT_MAX_NONDATA_DGRAM_SIZE];
+    memset(filler,0,sizeof(filler));
+
+    // No room for a run: nothing added, next time from the first had
+    dgram_t *dg = dgram_new();
+    dgram_add(dg,filler,SWIFT_MAX_NONDATA_DGRAM_SIZE-SWIFT_HAVE_RUNS_HDR_SIZE);
+    EXPECT_FALSE(c->HaveRuns(dg));
+    EXPECT_EQ(SWIFT_MAX_NONDATA_DGRAM_SIZE-SWIFT_HAVE_RUNS_HDR_SIZE, dgram_get_length(dg));
+    EXPECT_EQ(FIRST_HAD, c->have_runs_pos());
+    dgram_free(dg);
+
+    // Room for three: had 10, not 11, had 12. The room kept is for a
+    // 64-bit start, this one is 32.
+    dg = dgram_new();
+    dgram_add(dg,filler,SWIFT_MAX_NONDATA_DGRAM_SIZE-SWIFT_HAVE_RUNS_HDR_SIZE-3);
+    EXPECT_FALSE(c->HaveRuns(dg));
+    EXPECT_EQ(SWIFT_MAX_NONDATA_DGRAM_SIZE-4, dgram_get_length(dg));
+    EXPECT_EQ(FIRST_HAD+3, c->have_runs_pos());
+    dgram_drain(dg,SWIFT_MAX_NONDATA_DGRAM_SIZE-SWIFT_HAVE_RUNS_HDR_SIZE-3);
+    std::vector<runs_t> m = Decode(dg);
+    ASSERT_EQ(1u, m.size());
+    EXPECT_EQ(FIRST_HAD, m[0].start);
+    ASSERT_EQ(3u, m[0].runs.size());
+    dgram_free(dg);
+
+    // Continued from there, skipping the run not had it ended in
+    dg = dgram_new();
+    EXPECT_FALSE(c->HaveRuns(dg));
+    m = Decode(dg);
+    ASSERT_EQ(1u, m.size());
+    EXPECT_EQ(FIRST_HAD+4, m[0].start);
+    EXPECT_EQ(SWIFT_MAX_NONDATA_DGRAM_SIZE-SWIFT_HAVE_RUNS_HDR_SIZE, m[0].runs.size());
+    dgram_free(dg);
+
+    delete c;
+    swift::Close(ct->td(),true,false);
+}
+
+
+TEST(HaveRuns,BadRuns)
+{
+    ContentTransfer *ct = OpenFragmented();
+
+    // Well-formed: chunks 4 and 5, what follows is left
+    RunsChannel *c = new RunsChannel(ct);
+    dgram_t *dg = dgram_new();
+    dgram_add_32be(dg,4);
+    dgram_add_16be(dg,1);
+    dgram_add_varint(dg,2);
+    dgram_add_8(dg,SWIFT_HAVE);
+    c->OnRuns(dg);
+    EXPECT_FALSE(c->closing());
+    EXPECT_EQ(1u, dgram_get_length(dg));
+    EXPECT_FALSE(c->ack_in().is_filled(bin_t(0,3)));
+    EXPECT_TRUE(c->ack_in().is_filled(bin_t(1,2)));
+    EXPECT_FALSE(c->ack_in().is_filled(bin_t(0,6)));
+    dgram_free(dg);
+    delete c;
+
+    // Past what 32 bits address
+    c = new RunsChannel(ct);
+    dg = dgram_new();
+    dgram_add_32be(dg,0xffffff00);
+    dgram_add_16be(dg,1);
+    dgram_add_varint(dg,0x101);
+    c->OnRuns(dg);
+    EXPECT_TRUE(c->closing());
+    EXPECT_EQ(0u, dgram_get_length(dg));
+    dgram_free(dg);
+    delete c;
+
+    // Past what 64 bits address
+    c = new RunsChannel(ct,POPT_CHUNK_ADDR_CHUNK64);
+    dg = dgram_new();
+    dgram_add_64be(dg,0);
+    dgram_add_16be(dg,1);
+    dgram_add_varint(dg,SWIFT_CHUNK64_MAX+1);
+    c->OnRuns(dg);
+    EXPECT_TRUE(c->closing());
+    dgram_free(dg);
+    delete c;
+
+    // Fewer runs than said, the last cut short
+    c = new RunsChannel(ct);
+    dg = dgram_new();
+    dgram_add_32be(dg,0);
+    dgram_add_16be(dg,3);
+    dgram_add_varint(dg,1);
+    dgram_add_8(dg,0x80);
+    c->OnRuns(dg);
+    EXPECT_TRUE(c->closing());
+    EXPECT_EQ(0u, dgram_get_length(dg));
+    dgram_free(dg);
+    delete c;
+
+    swift::Close(ct->td(),true,false);
+}
+
+
+// Whether the handshake c sends offers HAVE_RUNS
+static bool Offers(RunsChannel *c)
+{
+    dgram_t *dg = dgram_new();
+    c->HandshakeOut(dg);
+    swift::Handshake *hs = RunsChannel::ParseHandshake(dg);
+    EXPECT_TRUE(hs != NULL);
+    EXPECT_EQ(0u, dgram_get_length(dg));
+    bool offers = hs != NULL && hs->Supports(SWIFT_HAVE_RUNS);
+    delete hs;
+    dgram_free(dg);
+    return offers;
+}
+
+TEST(HaveRuns,SuppMsgs)
+{
+    ContentTransfer *ct = OpenFragmented();
+    RunsChannel *c = new RunsChannel(ct);
+
+    // Initiating: only when told all peers understand it
+    c->SetPeer(NULL);
+    Channel::HAVE_RUNS = false;
+    EXPECT_FALSE(Offers(c));
+    Channel::HAVE_RUNS = true;
+    EXPECT_TRUE(Offers(c));
+
+    // Answering: only to peers that list it, whatever we were told
+    swift::Handshake *peer = new swift::Handshake();
+    peer->supp_msgs_ = SWIFT_SUPP_MSGS_STANDARD;
+    c->SetPeer(peer);
+    EXPECT_FALSE(Offers(c));
+    Channel::HAVE_RUNS = false;
+    peer->supp_msgs_ = SWIFT_SUPP_MSGS_ALL;
+    EXPECT_TRUE(Offers(c));
+
+    delete c;
+    swift::Close(ct->td(),true,false);
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+
+    unlink(TESTFILE);
+    unlink((std::string(TESTFILE)+".mhash").c_str());
+    unlink((std::string(TESTFILE)+".mbinmap").c_str());
+    int f = open(TESTFILE,O_RDWR|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (f < 0) {
+        eprintf("Error opening %s\n",TESTFILE);
+        return -1;
+    }
+    char buf[SWIFT_DEFAULT_CHUNK_SIZE];
+    memset(buf,'R',sizeof(buf));
+    for (int i=0; i<TEST_CHUNKS; i++)
+        if (write(f,buf,sizeof(buf)) != sizeof(buf))
+            return -1;
+    close(f);
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,150 @@
+/*
+ *  hsfiltertest.cpp
+ *
+ *  Tests of the fast-reject path for initiating handshakes: the per-IP
+ *  handshake rate limit and the zero-state Bloom filter of the content dir.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+
+using namespace swift;
+
+#define TEST_CONTENT_DIR    "hsfiltertest_content"
+#define TEST_HASHES         20
+#define TEST_PROBES         1000
+
+
+static Sha1Hash RandomHash()
+{
+    char buf[64];
+    sprintf(buf,"%d %d %d",rand(),rand(),rand());
+    return Sha1Hash(buf,strlen(buf));
+}
+
+static void TouchContent(const Sha1Hash &hash)
+{
+    std::string path = std::string(TEST_CONTENT_DIR)+FILE_SEP+hash.hex();
+    FILE *fp = fopen(path.c_str(),"wb");
+    ASSERT_TRUE(fp != NULL);
+    fclose(fp);
+}
+
+// Initiating PPSPP handshake for hash, as in Channel::AddHandshake
+static dgram_t *MakeHandshake(const Sha1Hash &hash)
+{
+    dgram_t *d = dgram_new();
+    dgram_add_32be(d,0);
+    dgram_add_8(d,SWIFT_HANDSHAKE);
+    dgram_add_32be(d,1234);
+    dgram_add_8(d,POPT_VERSION);
+    dgram_add_8(d,VER_PPSPP_v1);
+    dgram_add_8(d,POPT_SWARMID);
+    dgram_add_16be(d,Sha1Hash::SIZE);
+    dgram_add_hash(d,hash);
+    dgram_add_8(d,POPT_END);
+    return d;
+}
+
+
+TEST(HandshakeFilter,ZeroStateBloom)
+{
+    mkdir_utf8(TEST_CONTENT_DIR);
+    srand(7);
+    Sha1Hash hashes[TEST_HASHES];
+    for (int i=0; i<TEST_HASHES; i++) {
+        hashes[i] = RandomHash();
+        TouchContent(hashes[i]);
+    }
+
+    ZeroState *zs = ZeroState::GetInstance();
+    zs->SetContentDir(TEST_CONTENT_DIR);
+    Channel::Time();
+    for (int i=0; i<TEST_HASHES; i++)
+        EXPECT_TRUE(zs->MayHave(hashes[i]));
+    int maybes = 0;
+    for (int i=0; i<TEST_PROBES; i++)
+        maybes += zs->MayHave(RandomHash());
+    fprintf(stderr,"hsfiltertest: %d of %d unknown hashes passed the filter\n",maybes,TEST_PROBES);
+    EXPECT_LT(maybes,TEST_PROBES/100);
+
+    // New content shows up once the dir is looked at again
+    Sha1Hash added = RandomHash();
+    EXPECT_FALSE(zs->MayHave(added));
+    TouchContent(added);
+    EXPECT_FALSE(zs->MayHave(added));
+    usleep(1100*1000);
+    Channel::Time();
+    EXPECT_TRUE(zs->MayHave(added));
+
+    for (int i=0; i<TEST_HASHES; i++)
+        remove_utf8(std::string(TEST_CONTENT_DIR)+FILE_SEP+hashes[i].hex());
+    remove_utf8(std::string(TEST_CONTENT_DIR)+FILE_SEP+added.hex());
+    remove_utf8(TEST_CONTENT_DIR);
+    zs->SetContentDir(".");
+}
+
+
+TEST(HandshakeFilter,HandshakeRate)
+{
+    int rate = Channel::HANDSHAKE_RATE, burst = Channel::HANDSHAKE_BURST;
+    Channel::HANDSHAKE_RATE = 10;
+    Channel::HANDSHAKE_BURST = 5;
+    Channel::Time();
+
+    Address flooder("10.1.2.3:6000");
+    for (int i=0; i<5; i++)
+        EXPECT_TRUE(Channel::HandshakeRateOK(flooder));
+    EXPECT_FALSE(Channel::HandshakeRateOK(flooder));
+    // Same host, other port: same bucket
+    EXPECT_FALSE(Channel::HandshakeRateOK(Address("10.1.2.3:6001")));
+    EXPECT_TRUE(Channel::HandshakeRateOK(Address("10.1.2.4:6000")));
+
+    // One token per 1/RATE s
+    NOW += 100*TINT_MSEC;
+    EXPECT_TRUE(Channel::HandshakeRateOK(flooder));
+    EXPECT_FALSE(Channel::HandshakeRateOK(flooder));
+
+    Channel::HANDSHAKE_RATE = 0;
+    EXPECT_TRUE(Channel::HandshakeRateOK(flooder));
+    Channel::HANDSHAKE_RATE = rate;
+    Channel::HANDSHAKE_BURST = burst;
+}
+
+
+TEST(HandshakeFilter,UnknownSwarmRejected)
+{
+    int rate = Channel::HANDSHAKE_RATE, burst = Channel::HANDSHAKE_BURST;
+    Channel::HANDSHAKE_RATE = 10;
+    Channel::HANDSHAKE_BURST = 3;
+    evutil_socket_t sock = Channel::Bind("127.0.0.1:12041");
+    ASSERT_TRUE(sock>0);
+    Channel::Time();
+
+    Address stranger("10.9.8.7:7000");
+    uint64_t unknown = Channel::global_hs_unknown_rejected;
+    uint64_t overrate = Channel::global_hs_rate_rejected;
+    for (int i=0; i<5; i++) {
+        dgram_t *d = MakeHandshake(RandomHash());
+        Channel::ProcessDatagram(sock,stranger,d);
+        dgram_free(d);
+    }
+    // No reply to any; the last two not even parsed
+    EXPECT_EQ((uint64_t)3,Channel::global_hs_unknown_rejected-unknown);
+    EXPECT_EQ((uint64_t)2,Channel::global_hs_rate_rejected-overrate);
+
+    Channel::CloseSocket(sock);
+    Channel::HANDSHAKE_RATE = rate;
+    Channel::HANDSHAKE_BURST = burst;
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
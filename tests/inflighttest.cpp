@@ -0,0 +1,180 @@
+/*
+ *  inflighttest.cpp
+ *
+ *  Tests of tbinflight, the queue of DATA sent and not yet acknowledged,
+ *  and a benchmark of the cost of an ACK at various congestion windows,
+ *  against the linear scan of a tintbin deque as before.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+
+using namespace swift;
+
+#define BENCH_ACKS      1000000
+#define BENCH_LOSS      100
+
+
+TEST(InFlight,QueueOrder)
+{
+    tbinflight q;
+    for (int i=0; i<8; i++)
+        q.push_back(tintbin(100+i,bin_t(0,i)));
+    EXPECT_EQ(8, q.size());
+    EXPECT_EQ(bin_t(0,0), q.front().bin);
+
+    // Acks out of order unlink from the middle
+    tint sent;
+    EXPECT_EQ(1, q.remove(bin_t(0,3),&sent));
+    EXPECT_EQ(103, sent);
+    EXPECT_EQ(0, q.remove(bin_t(0,3),&sent));
+    EXPECT_EQ(1, q.remove(bin_t(0,0),&sent));
+    EXPECT_EQ(6, q.size());
+    EXPECT_EQ(bin_t(0,1), q.front().bin);
+
+    // A resend replaces the send in flight, and goes to the back
+    q.push_back(tintbin(200,bin_t(0,1)));
+    EXPECT_EQ(6, q.size());
+    EXPECT_EQ(bin_t(0,2), q.front().bin);
+
+    // Acks of resends are flagged, their RTT is ambiguous
+    bool resent;
+    q.push_back(tintbin(201,bin_t(0,8)),true);
+    EXPECT_EQ(1, q.remove(bin_t(0,8),&sent,&resent));
+    EXPECT_TRUE(resent);
+    q.push_back(tintbin(202,bin_t(0,9)));
+    EXPECT_EQ(1, q.remove(bin_t(0,9),&sent,&resent));
+    EXPECT_FALSE(resent);
+
+    int n = 0;
+    tint last = 0;
+    while (!q.empty()) {
+        EXPECT_GT(q.front().time, last);
+        last = q.front().time;
+        q.pop_front();
+        n++;
+    }
+    EXPECT_EQ(6, n);
+    EXPECT_EQ(200, last);
+    EXPECT_EQ(0, q.size());
+    q.push_back(tintbin(300,bin_t(0,1)));
+    q.push_back(tintbin(301,bin_t(0,1)));
+    EXPECT_EQ(1, q.remove(bin_t(0,1),&sent,&resent));
+    EXPECT_TRUE(resent);
+    EXPECT_EQ(0, q.size());
+}
+
+
+TEST(InFlight,RangeAck)
+{
+    tbinflight q;
+    for (int i=0; i<64; i++)
+        q.push_back(tintbin(1000+i,bin_t(0,i)));
+
+    // Small range: looked up chunk by chunk
+    tint sent;
+    EXPECT_EQ(4, q.remove(bin_t(2,1),&sent));
+    EXPECT_EQ(1007, sent);
+    EXPECT_EQ(60, q.size());
+    EXPECT_EQ(4, q.remove(bin_t(2,1).parent(),&sent)); // 0-7, 4-7 gone
+    EXPECT_EQ(1003, sent);
+
+    // Range larger than the window: walks the queue
+    EXPECT_EQ(56, q.remove(bin_t::ALL,&sent));
+    EXPECT_EQ(1063, sent);
+    EXPECT_TRUE(q.empty());
+    EXPECT_EQ(0, q.remove(bin_t(10,0),&sent));
+
+    // Freed entries are reused
+    q.push_back(tintbin(5,bin_t(0,1000)));
+    EXPECT_EQ(1, q.size());
+    EXPECT_EQ(bin_t(0,1000), q.front().bin);
+}
+
+
+// The in-flight queue as before: acks leave tombstones, found by scanning
+static bool DequeAck(tbqueue &q, bin_t ackd, tint *sent)
+{
+    int di = 0;
+    while (di<q.size() && (q[di]==tintbin() || !ackd.contains(q[di].bin)))
+        di++;
+    if (di == q.size())
+        return false;
+    *sent = q[di].time;
+    q[di] = tintbin();
+    return true;
+}
+
+// Keep cwnd chunks in flight, ack one at random out of the oldest few
+// (reordering) and send the next, returns ns per ack. One in BENCH_LOSS
+// sends is lost and times out after two windows (times count sends), as
+// in TimeoutDataOut. Until then the tombstones behind it pile up.
+static double BenchAcks(int cwnd, bool indexed)
+{
+    srand(cwnd);
+    tbqueue old;
+    tbinflight q;
+    std::deque<uint64_t> window;
+    uint64_t next = 0;
+    for (; next<cwnd; next++) {
+        window.push_back(next);
+        if (indexed)
+            q.push_back(tintbin(next,bin_t(0,next)));
+        else
+            old.push_back(tintbin(next,bin_t(0,next)));
+    }
+    tint sent, total = 0;
+    tint start = usec_time();
+    for (int i=0; i<BENCH_ACKS; i++) {
+        int w = rand() % std::min(cwnd,4);
+        bin_t ackd(0,window[w]);
+        window.erase(window.begin()+w);
+        // Very late acks may find their send timed out
+        if (indexed ? q.remove(ackd,&sent)>0 : DequeAck(old,ackd,&sent))
+            total += sent;
+
+        // Send until one will be acked
+        bool lost;
+        do {
+            lost = rand() % BENCH_LOSS == 0;
+            if (!lost)
+                window.push_back(next);
+            tint timeout = (tint)next-2*cwnd;
+            if (indexed) {
+                q.push_back(tintbin(next,bin_t(0,next)));
+                while (q.front().time < timeout)
+                    q.pop_front();
+            } else {
+                old.push_back(tintbin(next,bin_t(0,next)));
+                while (old.front().time < timeout || old.front()==tintbin())
+                    old.pop_front();
+            }
+            next++;
+        } while (lost);
+    }
+    tint elapsed = usec_time()-start;
+    EXPECT_GT(total, 0);
+    return (double)elapsed*1000/BENCH_ACKS;
+}
+
+TEST(InFlight,AckBench)
+{
+    int cwnds[] = { 10, 100, 1000 };
+    for (int i=0; i<3; i++) {
+        double scan = BenchAcks(cwnds[i],false);
+        double indexed = BenchAcks(cwnds[i],true);
+        fprintf(stderr,"inflight: cwnd %4d: scan %.1f ns/ack, indexed %.1f ns/ack, speedup %.2fx\n",
+                cwnds[i], scan, indexed, scan/indexed);
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
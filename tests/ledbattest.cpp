@@ -1,188 +1,254 @@
 /*
  *  ledbattest.cpp
  *
- *  BROKEN: Arno: must be rewritten to libevent
+ *  Tests of LedbatController, RFC 6817, replaying one-way delay traces
+ *  as the peer reports them in ACKs. The delays include an arbitrary
+ *  clock offset between the peers, only their differences count.
  *
  *  Created by Victor Grishchenko on 3/22/09.
  *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
  *
  */
-#include <stdio.h>
-#include <stdlib.h>
-#include <vector>
-#include <deque>
-#include "swift.h"
 #include <gtest/gtest.h>
+#include "swift.h"
 
 using namespace swift;
-using namespace std;
 
-/**
-  TODO
-  * losses
-  * smooth rate
-  * seq 12345 stop
-  * busy pipe => negative cwnd
-*/
+#define CLOCK_OFFSET    1000000
+
+struct trace_t {
+    int     ms;     // since the start
+    tint    owd;
+};
+
+#define TRACE_LEN(t)    (int)(sizeof(t)/sizeof(t[0]))
+
+// Idle path, 40 ms with jitter and single late acks, acks every 10 ms
+static const trace_t trace_noisy[] = {
+    {0,1040250}, {10,1039557}, {20,1039696}, {30,1039531}, {40,1039726}, {50,1039840}, {60,1039847},
+    {70,1039867}, {80,1040485}, {90,1040209}, {100,1039667}, {110,1040431}, {120,1040162},
+    {130,1072931}, {140,1039677}, {150,1039753}, {160,1039936}, {170,1040011}, {180,1039600},
+    {190,1039658}, {200,1039652}, {210,1040251}, {220,1040439}, {230,1039846}, {240,1040448},
+    {250,1039784}, {260,1040470}, {270,1074694}, {280,1039809}, {290,1039903}, {300,1039523},
+    {310,1039601}, {320,1040178}, {330,1040271}, {340,1040179}, {350,1039949}, {360,1039593},
+    {370,1039741}, {380,1040424}, {390,1040362}, {400,1039989}, {410,1070540}, {420,1040255},
+    {430,1040349}, {440,1039559}, {450,1040029}, {460,1039830}, {470,1040005}, {480,1039514},
+    {490,1039694}, {500,1040477}, {510,1040226}, {520,1071451}, {530,1040264}, {540,1039538},
+    {550,1039550}, {560,1040357}, {570,1039699}, {580,1040042}, {590,1039984},
+};
+
+// Queue building from 200 ms on, 1 ms per ack up to 50 ms, acks every 10 ms
+static const trace_t trace_queue[] = {
+    {0,1029981}, {10,1029887}, {20,1029818}, {30,1030128}, {40,1029844}, {50,1029847}, {60,1030115},
+    {70,1029881}, {80,1029844}, {90,1029810}, {100,1030070}, {110,1030138}, {120,1029901},
+    {130,1030150}, {140,1030108}, {150,1029930}, {160,1029937}, {170,1029969}, {180,1029960},
+    {190,1029902}, {200,1031114}, {210,1032009}, {220,1032998}, {230,1034067}, {240,1034843},
+    {250,1036039}, {260,1037103}, {270,1037966}, {280,1039057}, {290,1040095}, {300,1041176},
+    {310,1042094}, {320,1042853}, {330,1043844}, {340,1045100}, {350,1045865}, {360,1046922},
+    {370,1047887}, {380,1048925}, {390,1050015}, {400,1050836}, {410,1052200}, {420,1053177},
+    {430,1054071}, {440,1054835}, {450,1056083}, {460,1057140}, {470,1058190}, {480,1059112},
+    {490,1060129}, {500,1061015}, {510,1062192}, {520,1062871}, {530,1063944}, {540,1065118},
+    {550,1066097}, {560,1066820}, {570,1068174}, {580,1068953}, {590,1070136}, {600,1071123},
+    {610,1071995}, {620,1072835}, {630,1074127}, {640,1075013}, {650,1076085}, {660,1076803},
+    {670,1078149}, {680,1079178}, {690,1079957}, {700,1080012}, {710,1079897}, {720,1079872},
+    {730,1079878}, {740,1079857}, {750,1079924}, {760,1080053}, {770,1079973}, {780,1079808},
+    {790,1080151},
+};
+
+// Route changes: 50 ms, 30 ms from 2 min, 60 ms from 4 min, acks every 10 s
+static const trace_t trace_route[] = {
+    {0,1051392}, {10000,1050204}, {20000,1051652}, {30000,1051731}, {40000,1050439},
+    {50000,1050000}, {60000,1052266}, {70000,1051503}, {80000,1052569}, {90000,1051804},
+    {100000,1051909}, {110000,1052947}, {120000,1031622}, {130000,1032975}, {140000,1030988},
+    {150000,1032923}, {160000,1032991}, {170000,1032523}, {180000,1032781}, {190000,1031434},
+    {200000,1032477}, {210000,1032599}, {220000,1031943}, {230000,1031784}, {240000,1060672},
+    {250000,1062790}, {260000,1061727}, {270000,1061119}, {280000,1062285}, {290000,1062143},
+    {300000,1062722}, {310000,1060422}, {320000,1060466}, {330000,1062599}, {340000,1061645},
+    {350000,1062103}, {360000,1060991}, {370000,1061963}, {380000,1061821}, {390000,1060726},
+    {400000,1062802}, {410000,1062829}, {420000,1062353}, {430000,1060759}, {440000,1061489},
+    {450000,1061218}, {460000,1060754}, {470000,1062111}, {480000,1061892}, {490000,1062947},
+    {500000,1062278}, {510000,1060730}, {520000,1060500}, {530000,1061118}, {540000,1062745},
+    {550000,1062986}, {560000,1060016}, {570000,1061756}, {580000,1061871}, {590000,1061744},
+    {600000,1060566}, {610000,1062615}, {620000,1062896}, {630000,1060055}, {640000,1061117},
+    {650000,1060058}, {660000,1062232}, {670000,1060960}, {680000,1061281}, {690000,1061329},
+    {700000,1060062}, {710000,1061993}, {720000,1062603}, {730000,1060676}, {740000,1061319},
+    {750000,1060883}, {760000,1061338}, {770000,1062864}, {780000,1061341}, {790000,1062506},
+    {800000,1061850}, {810000,1061122}, {820000,1060450}, {830000,1061820}, {840000,1062601},
+    {850000,1062153}, {860000,1061892}, {870000,1060402}, {880000,1062668}, {890000,1060156},
+    {900000,1061143}, {910000,1061792}, {920000,1060428}, {930000,1060222}, {940000,1062216},
+    {950000,1061247},
+};
+
+
+
+struct replay_t {
+    double  cwnd;
+    tint    base;
+    tint    current;
+    bool    slow_start;
+    tint    send_interval;
+};
 
-TEST(Datagram,LedbatTest)
+// Replay trace on a path of the given RTT. The sender is taken to use
+// all of its window, so a sample acks what the window sends in the time
+// since the one before, in units of ack_unit bytes, the rest carried over.
+static std::vector<replay_t> Replay(LedbatController &cc, uint32_t chunk_size, const trace_t *trace, int n,
+                                    tint rtt, uint32_t ack_unit=1024)
 {
+    std::vector<replay_t> r;
+    tint start = NOW = 1000*TINT_SEC;
+    cc.Start(16384.0/chunk_size,rtt);
+    double carry = 0;
+    for (int i=0; i<n; i++) {
+        NOW = start + trace[i].ms*TINT_MSEC;
+        cc.Update(rtt,(int)cc.cwnd()+1);
+        tint dt = (i ? trace[i].ms-trace[i-1].ms : trace[1].ms-trace[0].ms)*TINT_MSEC;
+        carry += cc.cwnd_bytes()*dt/rtt;
+        int units = std::max(1,(int)(carry/ack_unit));
+        carry -= units*ack_unit;
+        cc.OnAck(units*ack_unit/chunk_size,rtt,trace[i].owd);
+        cc.Update(rtt,(int)cc.cwnd()+1);
+        replay_t s = { cc.cwnd_bytes(), cc.base_delay(), cc.current_delay(), cc.slow_start(), cc.send_interval() };
+        r.push_back(s);
+    }
+    return r;
+}
+
 
-    int MAX_REORDERING = 3;
-    tint TARGET = 25*TINT_MSEC;
-    float GAIN = 1.0/TARGET;
-    int seq_off = 0;
-    float cwnd = 1;
-    tint DELAY_BIN = TINT_SEC*30;
-    tint min_delay = TINT_NEVER;
-    tint rtt_avg = TINT_NEVER>>4, dev_avg = TINT_NEVER>>4;
-    tint last_bin_time = 0;
-    tint last_drop_time = 0;
-    int delay_bin = 0;
-    deque<tint> history, delay_history;
-    tint min_delay_bins[4] = {TINT_NEVER,TINT_NEVER,
-                              TINT_NEVER,TINT_NEVER
-                             };
-    tint cur_delays[4] = {TINT_NEVER,TINT_NEVER,
-                          TINT_NEVER,TINT_NEVER
-                         };
-    tint last_sec = 0;
-    int sec_ackd = 0;
-
-    evutil_socket_t send_sock = Datagram::Bind(10001); // bind sending socket
-    evutil_socket_t ack_sock = Datagram::Bind(10002);  // bind receiving socket
-    struct sockaddr_in send_to, ack_to;
-    send_to.sin_family = AF_INET;
-    send_to.sin_port = htons(10002);
-    send_to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    ack_to.sin_family = AF_INET;
-    ack_to.sin_port = htons(10001);
-    ack_to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    uint8_t* garbage = (uint8_t*) malloc(1024);
-    evutil_socket_t socks[2] = {send_sock,ack_sock};
-    evutil_socket_t sock2read;
-    tint wait_time = 100*TINT_MSEC;
-
-    while (sock2read = Datagram::Wait(2,socks,wait_time)) {
-        tint now = Datagram::Time();
-        if (sock2read==ack_sock) {
-            Datagram data(ack_sock); // send an acknowledgement
-            data.Recv();
-            int seq = data.Pull32();
-            Datagram ack(ack_sock,ack_to);
-            ack.Push32(seq);
-            ack.Push64(now);
-            if (4+8!=ack.Send())
-                fprintf(stderr,"short write\n");
-            fprintf(stderr,"%" PRIi64 " rcvd%i\n",now/TINT_SEC,seq);
-            //cc->OnDataRecv(bin64_t(0,seq));
-            // TODO: peer cwnd !!!
-            continue;
-        }
-        if (sock2read==send_sock) {        // process an acknowledgement
-            Datagram ack(send_sock);
-            ack.Recv();
-            int seq = ack.Pull32();
-            tint arrival_time = ack.Pull64();
-            seq -= seq_off;
-            if (seq<0)
-                continue;
-            if (seq>=history.size())
-                continue;
-            if (history[seq]==0)
-                continue;
-            tint send_time = history[seq];
-            history[seq] = 0;
-            if (seq>MAX_REORDERING*2) { //loss
-                if (last_drop_time<now-rtt_avg) {
-                    cwnd /= 2;
-                    last_drop_time = now;
-                }
-                fprintf(stderr,"got %i. LOSS, cwnd drop: %f\n",seq,cwnd);
-                for (int i=0; i<MAX_REORDERING*2 && history.size(); i++) {
-                    seq_off++;
-                    history.pop_front();
-                }
-                continue;
-            }
-            tint delay = arrival_time - send_time;
-            if (seq==0 && seq_off==0) { // FIXME
-                rtt_avg = now - send_time;
-                dev_avg = rtt_avg;
-            }
-            if (send_time/DELAY_BIN != last_bin_time) {
-                last_bin_time = send_time/DELAY_BIN;
-                delay_bin = (delay_bin+1) % 4;
-                min_delay_bins[delay_bin] = TINT_NEVER;
-                min_delay = TINT_NEVER;
-                for (int i=0; i<4; i++)
-                    if (min_delay_bins[i]<min_delay)
-                        min_delay = min_delay_bins[i];
-            }
-            if (min_delay_bins[delay_bin] > delay)
-                min_delay_bins[delay_bin] = delay;
-            if (delay < min_delay)
-                min_delay = delay;
-            cur_delays[(seq_off+seq)%4] = delay;
-            tint current_delay = TINT_NEVER;
-            for (int i=0; i<4; i++)
-                if (current_delay > cur_delays[i])
-                    current_delay = cur_delays[i];  // FIXME avg
-            tint queueing_delay = current_delay - min_delay;
-            // adjust cwnd
-            tint off_target = TARGET - queueing_delay;
-            //cerr<<"\t"<<cwnd<<"+="<<GAIN<<"*"<<off_target<<"/"<<cwnd<<endl;
-            cwnd += GAIN * off_target / cwnd;
-            fprintf(stderr,"ackd cwnd%f cur%" PRIi64 " min%" PRIi64 " seq%i off%i\n",
-                    cwnd,current_delay,min_delay,seq_off+seq,seq);
-
-            if (now/TINT_SEC!=last_sec/TINT_SEC) {
-                fprintf(stderr,"%i KB/sec\n",sec_ackd);
-                sec_ackd = 0;
-                last_sec = now; // FIXME
-            } else
-                sec_ackd++;
-
-        } // if
-        while (history[0]==0 && history.size()) {
-            history.pop_front();
-            seq_off++;
-        }
-        if (history.size() && history[0]<now-rtt_avg-5*dev_avg) {
-            if (last_drop_time<now-rtt_avg) {
-                cwnd /= 2;
-                last_drop_time = now;
-            }
-            fprintf(stderr,"TIMEOUT LOSS, cwnd drop: %f\n",cwnd);
-            seq_off++;
-            history.pop_front();
-        }
-        // fill cwnd
-        if (history.size()<cwnd) {
-            int sendseq = history.size() + seq_off;
-            Datagram send(send_sock,send_to);
-            send.Push32(sendseq);
-            send.Push(garbage,1024);
-            history.push_back(now);
-            fprintf(stderr,"sent%i\n",sendseq);
-            if (4+1024!=send.Send())
-                fprintf(stderr,"short data write\n");
-        }
-        if (cwnd<1)
-            cwnd = 1;
-        if (history.size()<cwnd)
-            wait_time = rtt_avg/cwnd;
-        else
-            wait_time = 100*TINT_MSEC;
-    } // while
+TEST(Ledbat,NoisyPath)
+{
+    // Single late acks are filtered out, slow start goes on
+    LedbatController cc;
+    std::vector<replay_t> r = Replay(cc,1024,trace_noisy,TRACE_LEN(trace_noisy),80*TINT_MSEC);
+    tint base = TINT_NEVER;
+    for (int i=0; i<TRACE_LEN(trace_noisy); i++)
+        base = std::min(base,trace_noisy[i].owd);
+    EXPECT_EQ(base, cc.base_delay());
+    EXPECT_TRUE(cc.slow_start());
+    // Up to twice what was acked in the last RTT
+    for (int i=1; i<r.size(); i++)
+        EXPECT_GE(r[i].cwnd, r[i-1].cwnd);
+    EXPECT_GT(r.back().cwnd, 32*r[0].cwnd);
+    EXPECT_LT(cc.current_delay()-cc.base_delay(), TINT_MSEC);
+
+    // Unfiltered, the first late ack would have ended it
+    int filter = LedbatController::CURRENT_FILTER;
+    LedbatController::CURRENT_FILTER = 1;
+    LedbatController raw;
+    r = Replay(raw,1024,trace_noisy,TRACE_LEN(trace_noisy),80*TINT_MSEC);
+    LedbatController::CURRENT_FILTER = filter;
+    EXPECT_TRUE(r[12].slow_start);
+    EXPECT_FALSE(r[13].slow_start);
 }
 
-int main(int argc, char** argv)
+
+TEST(Ledbat,QueueBuilds)
+{
+    LedbatController cc;
+    std::vector<replay_t> r = Replay(cc,1024,trace_queue,TRACE_LEN(trace_queue),60*TINT_MSEC);
+
+    // Slow start ends once the filtered delay is half the target over
+    // base, and undoes its last doubling
+    int exit = 0;
+    while (exit<r.size() && r[exit].slow_start)
+        exit++;
+    ASSERT_LT(exit, r.size());
+    EXPECT_GT(r[exit].current-r[exit].base, LedbatController::TARGET/2);
+    EXPECT_LE(r[exit-1].current-r[exit-1].base, LedbatController::TARGET/2);
+    EXPECT_LT(r[exit].cwnd, r[exit-1].cwnd*0.6);
+    fprintf(stderr,"ledbattest: slow start done at sample %d, %.0f bytes\n",exit,r[exit].cwnd);
+
+    // Then grows below the target and shrinks above it
+    for (int i=exit+1; i<r.size(); i++) {
+        tint queuing = r[i].current-r[i].base;
+        if (queuing < LedbatController::TARGET)
+            EXPECT_GT(r[i].cwnd, r[i-1].cwnd);
+        else if (queuing > LedbatController::TARGET)
+            EXPECT_LT(r[i].cwnd, r[i-1].cwnd);
+    }
+    EXPECT_LT(r.back().cwnd, r[exit].cwnd);
+}
+
+
+TEST(Ledbat,BaseDelayHistory)
+{
+    // Lower base delays are taken at once; higher ones once the lower
+    // have rolled out of the history, BASE_HISTORY minutes
+    LedbatController cc;
+    std::vector<replay_t> r = Replay(cc,1024,trace_route,TRACE_LEN(trace_route),100*TINT_MSEC);
+    for (int i=0; i<r.size(); i++) {
+        int s = trace_route[i].ms/1000;
+        tint path = s<120 ? 50*TINT_MSEC : s<240 ? 30*TINT_MSEC : 60*TINT_MSEC;
+        // The 30 ms minutes, 2 and 3, are gone at 13
+        tint expect = s<120 ? path : s<13*60 ? 30*TINT_MSEC : 60*TINT_MSEC;
+        EXPECT_NEAR(CLOCK_OFFSET+expect, r[i].base, 3*TINT_MSEC) << "at " << s << " s";
+        EXPECT_NEAR(CLOCK_OFFSET+path, r[i].current, 3*TINT_MSEC) << "at " << s << " s";
+    }
+}
+
+
+TEST(Ledbat,ReceiverQueue)
+{
+    // A slow receiver's socket buffer: the RTT grows, the one-way delay
+    // hardly, and the buffer overflows long before TARGET/2
+    LedbatController cc;
+    tint start = NOW = 1000*TINT_SEC;
+    cc.Start(4,TINT_MSEC);
+    int i;
+    for (i=0; i<100 && cc.slow_start(); i++) {
+        NOW = start + i*100;
+        tint rtt = TINT_MSEC + i*100;
+        cc.Update(rtt,(int)cc.cwnd()+1);
+        cc.OnAck(1,rtt,CLOCK_OFFSET+200+i);
+    }
+    // Past 1 ms + 4 ms
+    EXPECT_EQ(42, i);
+}
+
+
+TEST(Ledbat,ChunkSize)
 {
-    printf("Warning: use the script to set up dummynet!\n");
+    // The same bytes acked at the same delays: the same window in bytes,
+    // and the same rate in bytes, whatever the chunk size
+    LedbatController small(1024), large(8192);
+    std::vector<replay_t> rs = Replay(small,1024,trace_queue,TRACE_LEN(trace_queue),60*TINT_MSEC,8192);
+    std::vector<replay_t> rl = Replay(large,8192,trace_queue,TRACE_LEN(trace_queue),60*TINT_MSEC,8192);
+    for (int i=0; i<rs.size(); i++) {
+        EXPECT_NEAR(rs[i].cwnd, rl[i].cwnd, rs[i].cwnd*1e-6);
+        EXPECT_NEAR(rs[i].send_interval*8, rl[i].send_interval, 8);
+        EXPECT_EQ(rs[i].slow_start, rl[i].slow_start);
+    }
+}
+
+
+TEST(Ledbat,LossHalvesOncePerRtt)
+{
+    LedbatController cc;
+    Replay(cc,1024,trace_noisy,20,80*TINT_MSEC);
+    double cwnd = cc.cwnd_bytes();
+    cc.OnLoss();
+    EXPECT_FALSE(cc.slow_start());
+    EXPECT_DOUBLE_EQ(cwnd/2, cc.cwnd_bytes());
+    NOW += 10*TINT_MSEC;
+    cc.OnLoss();
+    EXPECT_DOUBLE_EQ(cwnd/2, cc.cwnd_bytes());
+    NOW += 80*TINT_MSEC;
+    cc.OnLoss();
+    EXPECT_DOUBLE_EQ(cwnd/4, cc.cwnd_bytes());
+
+    // Never below two MSS
+    for (int i=0; i<20; i++) {
+        NOW += 100*TINT_MSEC;
+        cc.OnLoss();
+    }
+    EXPECT_DOUBLE_EQ(2*LedbatController::MSS, cc.cwnd_bytes());
+}
+
 
+int main(int argc, char** argv)
+{
     swift::LibraryInit();
+    Channel::evbase = event_base_new();
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
-
 }
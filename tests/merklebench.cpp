@@ -0,0 +1,147 @@
+/*
+ *  merklebench.cpp
+ *
+ *  Merkle tree build and verification throughput with SHA-1 and SHA-256,
+ *  using the batch hashing of each backend. A build hashes all chunks and
+ *  parents, a verification hashes a chunk and its uncles up to the root.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+#include "sha1.h"
+#include "sha256.h"
+
+using namespace swift;
+
+#define BENCH_CHUNKS    (64*1024)   // of SWIFT_DEFAULT_CHUNK_SIZE, a power of 2
+#define BENCH_BATCH     64
+#define BENCH_VERIFY    (16*1024)   // chunks verified
+
+
+struct Sha1Func {
+    static const int SIZE = 20;
+    static const char *Name() {
+        return "sha1";
+    }
+    static int SetBackend(int backend) {
+        return blk_SHA1_SetBackend(backend);
+    }
+    static void Multi(const unsigned char *data[], const unsigned long len[], unsigned char *out, int n) {
+        blk_SHA1_Multi(data,len,(unsigned char (*)[20])out,n);
+    }
+};
+
+struct Sha256Func {
+    static const int SIZE = 32;
+    static const char *Name() {
+        return "sha256";
+    }
+    static int SetBackend(int backend) {
+        return blk_SHA256_SetBackend(backend);
+    }
+    static void Multi(const unsigned char *data[], const unsigned long len[], unsigned char *out, int n) {
+        blk_SHA256_Multi(data,len,(unsigned char (*)[32])out,n);
+    }
+};
+
+
+/** Hashes n messages of len bytes, stride apart, into out */
+template<class F> static void HashLayer(const uint8_t *in, size_t stride, unsigned long len, uint8_t *out, uint64_t n)
+{
+    const unsigned char *ptrs[BENCH_BATCH];
+    unsigned long lens[BENCH_BATCH];
+    for (uint64_t i=0; i<n; i+=BENCH_BATCH) {
+        int m = (int)std::min((uint64_t)BENCH_BATCH,n-i);
+        for (int j=0; j<m; j++) {
+            ptrs[j] = in+(i+j)*stride;
+            lens[j] = len;
+        }
+        F::Multi(ptrs,lens,out+i*F::SIZE,m);
+    }
+}
+
+
+/** Layer l of the tree is levels[l], children of a node side by side below */
+template<class F> static void Build(const uint8_t *content, std::vector<uint8_t> *levels, int nlevels)
+{
+    HashLayer<F>(content,SWIFT_DEFAULT_CHUNK_SIZE,SWIFT_DEFAULT_CHUNK_SIZE,&levels[0][0],BENCH_CHUNKS);
+    for (int l=1; l<nlevels; l++)
+        HashLayer<F>(&levels[l-1][0],2*F::SIZE,2*F::SIZE,&levels[l][0],BENCH_CHUNKS>>l);
+}
+
+
+template<class F> static bool Verify(const uint8_t *content, std::vector<uint8_t> *levels, int nlevels, uint64_t chunk)
+{
+    uint8_t h[F::SIZE], pair[2*F::SIZE];
+    const unsigned char *ptrs[1];
+    unsigned long lens[1];
+    ptrs[0] = content+chunk*SWIFT_DEFAULT_CHUNK_SIZE;
+    lens[0] = SWIFT_DEFAULT_CHUNK_SIZE;
+    F::Multi(ptrs,lens,h,1);
+    for (int l=0; l<nlevels-1; l++, chunk>>=1) {
+        const uint8_t *uncle = &levels[l][(chunk^1)*F::SIZE];
+        memcpy(pair+(chunk&1)*F::SIZE,h,F::SIZE);
+        memcpy(pair+((chunk&1)^1)*F::SIZE,uncle,F::SIZE);
+        ptrs[0] = pair;
+        lens[0] = 2*F::SIZE;
+        F::Multi(ptrs,lens,h,1);
+    }
+    return memcmp(h,&levels[nlevels-1][0],F::SIZE) == 0;
+}
+
+
+template<class F> static void RunBench(const uint8_t *content, int backend, const char *bname)
+{
+    if (F::SetBackend(backend) < 0)
+        return;
+    int nlevels = 1;
+    while ((BENCH_CHUNKS>>(nlevels-1)) > 1)
+        nlevels++;
+    std::vector<uint8_t> *levels = new std::vector<uint8_t>[nlevels];
+    for (int l=0; l<nlevels; l++)
+        levels[l].resize((BENCH_CHUNKS>>l)*F::SIZE);
+
+    tint start = usec_time();
+    Build<F>(content,levels,nlevels);
+    tint built = usec_time();
+    uint64_t ok = 0;
+    for (uint64_t i=0; i<BENCH_VERIFY; i++)
+        ok += Verify<F>(content,levels,nlevels,(i*7919)%BENCH_CHUNKS);
+    tint verified = usec_time();
+    EXPECT_EQ(BENCH_VERIFY,ok);
+
+    double buildmbps = (double)BENCH_CHUNKS*SWIFT_DEFAULT_CHUNK_SIZE*TINT_SEC/std::max(built-start,(tint)1)/(1<<20);
+    double verifyps = (double)BENCH_VERIFY*TINT_SEC/std::max(verified-built,(tint)1);
+    fprintf(stderr,"merklebench: %-6s %-8s build %7.1f MB/s, verify %8.0f chunks/s\n",
+            F::Name(), bname, buildmbps, verifyps);
+    delete[] levels;
+}
+
+
+TEST(MerkleBench,Sha1VsSha256)
+{
+    uint8_t *content = new uint8_t[(size_t)BENCH_CHUNKS*SWIFT_DEFAULT_CHUNK_SIZE];
+    for (size_t i=0; i<(size_t)BENCH_CHUNKS*SWIFT_DEFAULT_CHUNK_SIZE; i++)
+        content[i] = (i*131) >> 7;
+
+    int best1 = blk_SHA1_Backend(), best256 = blk_SHA256_Backend();
+    const char *names[] = { "portable", "avx2 x8", "sha-ni", "both" };
+    for (int b=SHA1_BACKEND_PORTABLE; b<=(SHA1_BACKEND_AVX2|SHA1_BACKEND_SHANI); b++) {
+        RunBench<Sha1Func>(content,b,names[b]);
+        RunBench<Sha256Func>(content,b,names[b]);
+    }
+    blk_SHA1_SetBackend(best1);
+    blk_SHA256_SetBackend(best256);
+    fprintf(stderr,"merklebench: this build hashes trees with %s\n", HASHSZ == 32 ? "sha256" : "sha1");
+    delete[] content;
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,309 @@
+/*
+ *  pacingtest.cpp
+ *
+ *  Tests of DATA pacing (Channel::PACING): datagrams queued with a send
+ *  time either go out with an SO_TXTIME stamp or are held by the userspace
+ *  pacer until due. A channel queues DATA a send interval apart, up to the
+ *  horizon.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+#include "compat.h"
+
+using namespace swift;
+
+#define TEST_DGRAMS     20
+#define TEST_SPACING    (2*TINT_MSEC)
+#define TESTFILE        "pacing.dat"
+#define TEST_CHUNKS     64
+
+
+// Channel serving a peer that hinted, with the window set by hand
+class PacedChannel : public Channel
+{
+  public:
+    PacedChannel(ContentTransfer *t, evutil_socket_t sock, Address peer) : Channel(t,sock,peer) {
+        hs_in_ = new Handshake(*hs_out_);
+        hs_in_->peer_channel_id_ = 1;
+    }
+    void Window(tint last, tint interval, tint rtt, float cwnd) {
+        last_data_out_time_ = last;
+        send_interval_ = interval;
+        rtt_avg_ = rtt;
+        cwnd_ = cwnd;
+        last_recv_time_ = NOW;
+        send_control_ = SLOW_START_CONTROL;
+    }
+    void Hint(bin_t b) {
+        hint_in_.push_back(tintbin(NOW,b));
+        hint_in_size_ += b.base_length();
+    }
+    tbinflight &data_out() {
+        return data_out_;
+    }
+};
+
+
+struct pace_run_t {
+    tint    txtime[TEST_DGRAMS];
+    tint    arrived[TEST_DGRAMS];
+    int     rcvd;
+};
+
+// Queue TEST_DGRAMS dgrams, pairs due at the same time, and receive them
+static void RunPaced(uint16_t port, pace_run_t *run)
+{
+    char sndaddr[32], rcvaddr[32];
+    sprintf(sndaddr,"127.0.0.1:%u",port);
+    sprintf(rcvaddr,"127.0.0.1:%u",port+1);
+    evutil_socket_t sndsock = Channel::Bind(sndaddr);
+    evutil_socket_t rcvsock = Channel::Bind(rcvaddr);
+    ASSERT_TRUE(sndsock>0 && rcvsock>0);
+    Address dest(rcvaddr);
+
+    Channel::Time();
+    tint start = NOW;
+    for (int i=0; i<TEST_DGRAMS; i++) {
+        dgram_t *d = dgram_new();
+        dgram_add_32be(d,i);
+        run->txtime[i] = start + (i/2+1)*TEST_SPACING;
+        run->arrived[i] = TINT_NEVER;
+        Channel::QueueTo(sndsock,dest,d,NULL,run->txtime[i]);
+    }
+    Channel::FlushSendQueue(sndsock);
+
+    recv_slot_t slots[TEST_DGRAMS];
+    char bufs[TEST_DGRAMS][SWIFT_MAX_RECV_DGRAM_SIZE];
+    for (int i=0; i<TEST_DGRAMS; i++) {
+        slots[i].buf = bufs[i];
+        slots[i].size = SWIFT_MAX_RECV_DGRAM_SIZE;
+    }
+    run->rcvd = 0;
+    // Generous, the loop ends when all are in
+    tint end = start + (TEST_DGRAMS/2)*TEST_SPACING + 5*TINT_SEC;
+    while (run->rcvd < TEST_DGRAMS && usec_time() < end) {
+        event_base_loop(Channel::evbase,EVLOOP_NONBLOCK);
+        int n = Channel::RecvBatch(rcvsock,slots,TEST_DGRAMS);
+        tint now = usec_time();
+        for (int i=0; i<n; i++) {
+            ASSERT_EQ(4,slots[i].length);
+            uint32_t idx = ntohl(*(uint32_t *)slots[i].buf);
+            ASSERT_LT(idx,(uint32_t)TEST_DGRAMS);
+            run->arrived[idx] = now;
+            run->rcvd++;
+        }
+    }
+    Channel::CloseSocket(sndsock);
+    Channel::CloseSocket(rcvsock);
+}
+
+
+TEST(Pacing,UserPacer)
+{
+    // Held dgrams leave in txtime order, each exactly when due at NOW. Runs
+    // the pacer by hand with a set NOW, not by the clock.
+    Channel::PACING = PACING_USER;
+    evutil_socket_t sndsock = Channel::Bind("127.0.0.1:12031");
+    evutil_socket_t rcvsock = Channel::Bind("127.0.0.1:12032");
+    ASSERT_TRUE(sndsock>0 && rcvsock>0);
+    Address dest("127.0.0.1:12032");
+
+    // Pairs due at the same time, queued out of order. Set back in time,
+    // not to leave the timer wheel ahead of the clock.
+    Channel::Time();
+    tint start = NOW - TINT_SEC;
+    NOW = start;
+    int step[TEST_DGRAMS];
+    for (int i=0; i<TEST_DGRAMS; i++) {
+        step[i] = (i/2)*3 % (TEST_DGRAMS/2) + 1;
+        dgram_t *d = dgram_new();
+        dgram_add_32be(d,i);
+        Channel::QueueTo(sndsock,dest,d,NULL,start+step[i]*TEST_SPACING);
+    }
+    EXPECT_EQ(0,Channel::FlushSendQueue(sndsock));
+    EXPECT_EQ(0,Channel::PaceDue());
+
+    recv_slot_t slots[TEST_DGRAMS];
+    char bufs[TEST_DGRAMS][SWIFT_MAX_RECV_DGRAM_SIZE];
+    for (int i=0; i<TEST_DGRAMS; i++) {
+        slots[i].buf = bufs[i];
+        slots[i].size = SWIFT_MAX_RECV_DGRAM_SIZE;
+    }
+    for (int s=1; s<=TEST_DGRAMS/2; s++) {
+        tint txtime = start + s*TEST_SPACING;
+        NOW = txtime - SWIFT_PACING_SLACK - 1;
+        EXPECT_EQ(0,Channel::PaceDue());
+        NOW = txtime - SWIFT_PACING_SLACK;
+        EXPECT_EQ(2,Channel::PaceDue());
+        EXPECT_EQ(2,Channel::FlushSendQueue(sndsock));
+
+        // Loopback, they are there already; the deadline is only a guard
+        int rcvd = 0;
+        tint giveup = usec_time() + TINT_SEC;
+        while (rcvd < 2 && usec_time() < giveup) {
+            int n = Channel::RecvBatch(rcvsock,slots,TEST_DGRAMS);
+            for (int i=0; i<n; i++) {
+                ASSERT_EQ(4,slots[i].length);
+                uint32_t idx = ntohl(*(uint32_t *)slots[i].buf);
+                ASSERT_LT(idx,(uint32_t)TEST_DGRAMS);
+                EXPECT_EQ(s,step[idx]);
+                rcvd++;
+            }
+        }
+        EXPECT_EQ(2,rcvd);
+    }
+    EXPECT_EQ(0,Channel::PaceDue());
+    Channel::CloseSocket(sndsock);
+    Channel::CloseSocket(rcvsock);
+    Channel::Time();
+    Channel::PACING = PACING_OFF;
+}
+
+
+TEST(Pacing,UserPacerLoop)
+{
+    // Same through the event loop, against the clock
+    Channel::PACING = PACING_USER;
+    uint64_t wakeups = Channel::global_pacer_wakeups;
+    pace_run_t run;
+    RunPaced(12037,&run);
+    EXPECT_EQ(TEST_DGRAMS,run.rcvd);
+    for (int i=0; i<TEST_DGRAMS; i++)
+        EXPECT_GE(run.arrived[i],run.txtime[i]-SWIFT_PACING_SLACK);
+    // Dgrams due together leave together, a late wakeup takes all due
+    uint64_t woke = Channel::global_pacer_wakeups-wakeups;
+    EXPECT_GE(woke,(uint64_t)1);
+    EXPECT_LE(woke,(uint64_t)TEST_DGRAMS/2);
+    fprintf(stderr,"pacingtest: user: %d dgrams, %" PRIu64 " pacer wakeups\n",run.rcvd,woke);
+    Channel::PACING = PACING_OFF;
+}
+
+
+TEST(Pacing,KernelTxTime)
+{
+    Channel::PACING = PACING_TXTIME;
+    uint64_t stamped = Channel::global_txtime_dgrams;
+    uint64_t wakeups = Channel::global_pacer_wakeups;
+    pace_run_t run;
+    RunPaced(12033,&run);
+    EXPECT_EQ(TEST_DGRAMS,run.rcvd);
+    if (Channel::global_txtime_dgrams == stamped) {
+        // Kernel without SO_TXTIME: the userspace pacer took over
+        fprintf(stderr,"pacingtest: no SO_TXTIME, fell back to the userspace pacer\n");
+        EXPECT_GT(Channel::global_pacer_wakeups,wakeups);
+        for (int i=0; i<TEST_DGRAMS; i++)
+            EXPECT_GE(run.arrived[i],run.txtime[i]-SWIFT_PACING_SLACK);
+    } else {
+        // All went down at once with a stamp. Loopback has no fq qdisc, so
+        // they may arrive before their time.
+        EXPECT_EQ((uint64_t)TEST_DGRAMS,Channel::global_txtime_dgrams-stamped);
+        EXPECT_EQ(wakeups,Channel::global_pacer_wakeups);
+        fprintf(stderr,"pacingtest: kernel: %d dgrams stamped\n",run.rcvd);
+    }
+    Channel::PACING = PACING_OFF;
+}
+
+
+TEST(Pacing,CloseDropsHeld)
+{
+    // Held datagrams of a closed socket are freed, the pacer runs on
+    Channel::PACING = PACING_USER;
+    evutil_socket_t sock = Channel::Bind("127.0.0.1:12035");
+    ASSERT_TRUE(sock>0);
+    Address dest("127.0.0.1:12036");
+    Channel::Time();
+    for (int i=0; i<4; i++) {
+        dgram_t *d = dgram_new();
+        dgram_add_32be(d,i);
+        Channel::QueueTo(sock,dest,d,NULL,NOW+TINT_SEC);
+    }
+    EXPECT_EQ(0,Channel::FlushSendQueue(sock));
+    uint64_t sent = Channel::global_dgrams_up;
+    Channel::CloseSocket(sock);
+    event_base_loop(Channel::evbase,EVLOOP_NONBLOCK);
+    EXPECT_EQ(sent,Channel::global_dgrams_up);
+    Channel::PACING = PACING_OFF;
+}
+
+
+TEST(Pacing,Window)
+{
+    // Each DATA is stamped a send interval after the last, as far as an
+    // RTT ahead, capped at SWIFT_PACING_HORIZON. NOW is set by hand, back
+    // in time, not to leave the timer wheel ahead of the clock.
+    Channel::PACING = PACING_USER;
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open(TESTFILE,noswarmid);
+    ASSERT_GE(td,0);
+    ContentTransfer *ct = swift::GetActivatedTransfer(td);
+    ASSERT_TRUE(ct != NULL);
+    evutil_socket_t sock = Channel::Bind("127.0.0.1:12039");
+    ASSERT_TRUE(sock>0);
+    PacedChannel *c = new PacedChannel(ct,sock,Address("127.0.0.1:12040"));
+
+    Channel::Time();
+    tint start = NOW - TINT_SEC;
+    NOW = start;
+    c->Window(start,TINT_MSEC,10*TINT_MSEC,TEST_CHUNKS);
+    c->Hint(bin_t(6,0));
+    uint64_t paced = Channel::global_paced_dgrams;
+    c->SendPacedWindow();
+    ASSERT_EQ(10,c->data_out().size());
+    EXPECT_EQ(10u,Channel::global_paced_dgrams-paced);
+    for (int i=0; i<10; i++) {
+        EXPECT_EQ(start+(i+1)*TINT_MSEC,c->data_out().front().time);
+        EXPECT_EQ(bin_t(0,i),c->data_out().front().bin);
+        c->data_out().pop_front();
+    }
+
+    // Later, the rest up to the horizon moved along
+    NOW = start + 4*TINT_MSEC;
+    c->SendPacedWindow();
+    ASSERT_EQ(4,c->data_out().size());
+    for (int i=10; i<14; i++) {
+        EXPECT_EQ(start+(i+1)*TINT_MSEC,c->data_out().front().time);
+        c->data_out().pop_front();
+    }
+
+    // A long RTT doesn't queue further than the horizon
+    c->Window(start+14*TINT_MSEC,TINT_MSEC,TINT_SEC,TEST_CHUNKS);
+    c->SendPacedWindow();
+    EXPECT_EQ(SWIFT_PACING_HORIZON/TINT_MSEC-10,c->data_out().size());
+    while (c->data_out().size() > 1)
+        c->data_out().pop_front();
+    EXPECT_EQ(NOW+SWIFT_PACING_HORIZON,c->data_out().front().time);
+
+    // Held ones are dropped with the socket
+    Channel::CloseSocket(sock);
+    delete c;
+    Channel::Time();
+    swift::Close(td,false,false);
+    Channel::PACING = PACING_OFF;
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+
+    unlink(TESTFILE);
+    unlink((std::string(TESTFILE)+".mhash").c_str());
+    unlink((std::string(TESTFILE)+".mbinmap").c_str());
+    int f = open(TESTFILE,O_RDWR|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (f < 0) {
+        eprintf("Error opening %s\n",TESTFILE);
+        return -1;
+    }
+    char buf[TEST_CHUNKS*SWIFT_DEFAULT_CHUNK_SIZE];
+    memset(buf,'P',sizeof(buf));
+    if (write(f,buf,sizeof(buf)) != sizeof(buf))
+        return -1;
+    close(f);
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,216 @@
+/*
+ *  pathcachetest.cpp
+ *
+ *  Tests of the path cache: LRU order and eviction, expiry, and keeping
+ *  it in a file across runs.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+#include "compat.h"
+
+using namespace swift;
+
+#define TEST_CACHE_FILE     "pathcachetest.txt"
+#define TEST_FILE_1K        "pathcache1k.dat"
+#define TEST_FILE_8K        "pathcache8k.dat"
+
+
+static path_metrics_t Metrics(tint rtt, float cwnd_bytes)
+{
+    path_metrics_t m;
+    m.rtt_avg = rtt;
+    m.dev_avg = rtt/4;
+    m.cwnd_bytes = cwnd_bytes;
+    m.loss_rate = 0.01;
+    m.updated = NOW;
+    return m;
+}
+
+
+TEST(PathCache,LruEviction)
+{
+    Channel::Time();
+    // An entry for the address and one for the host each
+    PathCache cache(6);
+    Address a("10.0.0.1:7000"), b("10.0.0.2:7000"), c("10.0.0.3:7000"), d("10.0.0.4:7000");
+    cache.Put(a,Metrics(10*TINT_MSEC,10));
+    cache.Put(b,Metrics(20*TINT_MSEC,20));
+    cache.Put(c,Metrics(30*TINT_MSEC,30));
+
+    // Using a makes b the least recently used
+    path_metrics_t m;
+    ASSERT_TRUE(cache.Get(a,&m));
+    EXPECT_EQ(10*TINT_MSEC, m.rtt_avg);
+    EXPECT_EQ(10, m.cwnd_bytes);
+    cache.Put(d,Metrics(40*TINT_MSEC,40));
+    EXPECT_EQ(6, cache.size());
+    EXPECT_FALSE(cache.Get(b,&m));
+    EXPECT_TRUE(cache.Get(a,&m));
+    EXPECT_TRUE(cache.Get(c,&m));
+    EXPECT_TRUE(cache.Get(d,&m));
+
+    // Updates replace
+    cache.Put(a,Metrics(15*TINT_MSEC,12));
+    EXPECT_EQ(6, cache.size());
+    ASSERT_TRUE(cache.Get(a,&m));
+    EXPECT_EQ(15*TINT_MSEC, m.rtt_avg);
+
+    // The same host on another port: what was last seen to the host
+    cache.Put(Address("10.0.0.1:7001"),Metrics(16*TINT_MSEC,13));
+    ASSERT_TRUE(cache.Get(Address("10.0.0.1:7002"),&m));
+    EXPECT_EQ(16*TINT_MSEC, m.rtt_avg);
+    ASSERT_TRUE(cache.Get(a,&m));
+    EXPECT_EQ(15*TINT_MSEC, m.rtt_avg);
+}
+
+
+TEST(PathCache,Expiry)
+{
+    Channel::Time();
+    PathCache cache;
+    Address a("10.0.0.1:7000");
+    path_metrics_t m = Metrics(10*TINT_MSEC,10);
+    m.updated = NOW-PathCache::MAX_AGE-TINT_SEC;
+    cache.Put(a,m);
+    EXPECT_FALSE(cache.Get(a,&m));
+    EXPECT_EQ(0, cache.size());
+}
+
+
+TEST(PathCache,SaveLoad)
+{
+    Channel::Time();
+    remove_utf8(TEST_CACHE_FILE);
+    PathCache saved;
+    EXPECT_EQ(0, saved.SetFile(TEST_CACHE_FILE));
+    Address a("10.0.0.1:7000"), b("[2001:db8::1]:7001"), old("10.0.0.9:7000");
+    path_metrics_t m = Metrics(100*TINT_MSEC,64);
+    m.updated = NOW-PathCache::MAX_AGE-TINT_SEC;
+    saved.Put(old,m);
+    saved.Put(a,Metrics(10*TINT_MSEC,10));
+    saved.Put(b,Metrics(20*TINT_MSEC,20480));
+    EXPECT_EQ(6, saved.Save());
+
+    // The expired one is not loaded, the rest in the same order
+    PathCache loaded(1);
+    EXPECT_EQ(4, loaded.SetFile(TEST_CACHE_FILE));
+    EXPECT_EQ(1, loaded.size());
+    ASSERT_TRUE(loaded.Get(b,&m));
+    EXPECT_EQ(20*TINT_MSEC, m.rtt_avg);
+    EXPECT_EQ(5*TINT_MSEC, m.dev_avg);
+    EXPECT_FLOAT_EQ(20480, m.cwnd_bytes);
+    EXPECT_NEAR(0.01, m.loss_rate, 1e-4);
+    remove_utf8(TEST_CACHE_FILE);
+}
+
+
+// Channel on a path it measured, set by hand
+class PathChannel : public Channel
+{
+  public:
+    PathChannel(ContentTransfer *t, Address peer) : Channel(t,INVALID_SOCKET,peer) {}
+    void Measured(tint rtt, float cwnd) {
+        send_control_ = CC_CONTROL;
+        rtt_avg_ = rtt;
+        dev_avg_ = rtt/4;
+        cwnd_ = cwnd;
+    }
+    float path_cwnd() {
+        return path_cwnd_;
+    }
+};
+
+
+TEST(PathCache,ChunkSizes)
+{
+    // The window is kept in bytes, so it holds across chunk sizes
+    Channel::Time();
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td1 = swift::Open(TEST_FILE_1K,noswarmid,"",true,POPT_CONT_INT_PROT_MERKLE,false,true,1024);
+    int td8 = swift::Open(TEST_FILE_8K,noswarmid,"",true,POPT_CONT_INT_PROT_MERKLE,false,true,8192);
+    ASSERT_TRUE(td1 >= 0 && td8 >= 0);
+    ContentTransfer *ct1 = swift::GetActivatedTransfer(td1);
+    ContentTransfer *ct8 = swift::GetActivatedTransfer(td8);
+    ASSERT_TRUE(ct1 != NULL && ct8 != NULL);
+    ASSERT_EQ(1024, ct1->chunk_size());
+    ASSERT_EQ(8192, ct8->chunk_size());
+    Address a("10.0.0.6:7000");
+
+    PathChannel *c = new PathChannel(ct1,a);
+    c->Measured(30*TINT_MSEC,64);
+    delete c;
+    path_metrics_t m;
+    ASSERT_TRUE(PathCache::GetInstance()->Get(a,&m));
+    EXPECT_FLOAT_EQ(64*1024, m.cwnd_bytes);
+
+    // Half of 64 KB in 8 KB chunks
+    c = new PathChannel(ct8,a);
+    c->GetPath();
+    EXPECT_FLOAT_EQ(4, c->path_cwnd());
+    c->Measured(30*TINT_MSEC,16);
+    delete c;
+
+    // And half of 128 KB in 1 KB ones
+    c = new PathChannel(ct1,a);
+    c->GetPath();
+    EXPECT_FLOAT_EQ(64, c->path_cwnd());
+    delete c;
+}
+
+
+TEST(PathCache,LiveChannelOnShutdown)
+{
+    // Open channels are not deleted on shutdown, their paths are saved
+    Channel::Time();
+    remove_utf8(TEST_CACHE_FILE);
+    EXPECT_EQ(0, PathCache::GetInstance()->SetFile(TEST_CACHE_FILE));
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open("pathcachetest.dat",noswarmid);
+    ASSERT_TRUE(td >= 0);
+    FileTransfer *ft = new FileTransfer(td,"pathcachetest.dat");
+    Address a("10.0.0.5:7000");
+    PathChannel *c = new PathChannel(ft,a);
+    c->Measured(30*TINT_MSEC,24);
+
+    swift::Shutdown();
+    PathCache loaded;
+    EXPECT_LT(0, loaded.SetFile(TEST_CACHE_FILE));
+    path_metrics_t m;
+    ASSERT_TRUE(loaded.Get(a,&m));
+    EXPECT_EQ(30*TINT_MSEC, m.rtt_avg);
+    EXPECT_FLOAT_EQ(24*ft->chunk_size(), m.cwnd_bytes);
+    delete c;
+    delete ft;
+    remove_utf8(TEST_CACHE_FILE);
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+
+    // Different content, else both are the same swarm
+    const char *files[] = { TEST_FILE_1K, TEST_FILE_8K };
+    for (int i=0; i<2; i++) {
+        unlink(files[i]);
+        unlink((std::string(files[i])+".mhash").c_str());
+        unlink((std::string(files[i])+".mbinmap").c_str());
+        int f = open(files[i],O_RDWR|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+        if (f < 0) {
+            eprintf("Error opening %s\n",files[i]);
+            return -1;
+        }
+        char buf[16384];
+        memset(buf,'1'+i,sizeof(buf));
+        if (write(f,buf,sizeof(buf)) != sizeof(buf))
+            return -1;
+        close(f);
+    }
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,79 @@
+/*
+ *  sha1bench.cpp
+ *
+ *  SHA-1 throughput of each backend the CPU supports, for chunks of the
+ *  default size and for the 40-byte parent hashes of the hash tree.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+#include "sha1.h"
+
+using namespace swift;
+
+#define BENCH_BYTES     (256*1024*1024)
+#define BENCH_BATCH     64
+
+
+static double RunBench(int backend, size_t msglen, bool batch, Sha1Hash *last)
+{
+    EXPECT_EQ(0,blk_SHA1_SetBackend(backend));
+    uint8_t *data = new uint8_t[BENCH_BATCH*msglen];
+    for (size_t i=0; i<BENCH_BATCH*msglen; i++)
+        data[i] = i*7;
+    const uint8_t *ptrs[BENCH_BATCH];
+    size_t lens[BENCH_BATCH];
+    Sha1Hash out[BENCH_BATCH];
+    for (int i=0; i<BENCH_BATCH; i++) {
+        ptrs[i] = data+i*msglen;
+        lens[i] = msglen;
+    }
+
+    uint64_t rounds = BENCH_BYTES/(BENCH_BATCH*msglen);
+    tint start = usec_time();
+    for (uint64_t r=0; r<rounds; r++) {
+        if (batch)
+            Sha1Hash::HashChunks(ptrs,lens,out,BENCH_BATCH);
+        else {
+            for (int i=0; i<BENCH_BATCH; i++)
+                out[i] = Sha1Hash(ptrs[i],lens[i]);
+        }
+    }
+    tint elapsed = std::max(usec_time()-start,(tint)1);
+    *last = out[BENCH_BATCH-1];
+    delete[] data;
+    return (double)rounds*BENCH_BATCH*msglen*TINT_SEC/elapsed/(1<<20);
+}
+
+
+TEST(Sha1Bench,Backends)
+{
+    const char *names[] = { "portable", "avx2 x8", "sha-ni", "both" };
+    size_t msglens[] = { SWIFT_DEFAULT_CHUNK_SIZE, 2*HASHSZ };
+    int best = blk_SHA1_Backend();
+    for (int m=0; m<2; m++) {
+        Sha1Hash ref;
+        double base = RunBench(SHA1_BACKEND_PORTABLE,msglens[m],false,&ref);
+        fprintf(stderr,"sha1bench: %4u bytes %-8s %8.1f MB/s\n", (unsigned)msglens[m], names[0], base);
+        for (int b=SHA1_BACKEND_AVX2; b<=(SHA1_BACKEND_AVX2|SHA1_BACKEND_SHANI); b++) {
+            if (blk_SHA1_SetBackend(b) < 0)
+                continue;
+            Sha1Hash h;
+            double mbps = RunBench(b,msglens[m],true,&h);
+            EXPECT_EQ(ref,h);
+            fprintf(stderr,"sha1bench: %4u bytes %-8s %8.1f MB/s, %.2fx portable\n",
+                    (unsigned)msglens[m], names[b], mbps, mbps/base);
+        }
+    }
+    blk_SHA1_SetBackend(best);
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,227 @@
+/*
+ *  timerwheeltest.cpp
+ *
+ *  Tests of the timing wheel that drives the channel send timers, and a
+ *  benchmark of reschedules per second for 50k timers, wheel vs. one
+ *  libevent timer each as before.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+
+using namespace swift;
+
+#define BENCH_TIMERS        50000
+#define BENCH_RESCHEDULES   2000000
+
+
+struct test_timer_t {
+    wheel_timer_t   t;
+    tint            due;
+    tint            fired;
+    int             count;
+};
+
+static tint wheel_now = 0, wheel_prev = 0;
+
+static void TestCallback(int fd, short event, void *arg)
+{
+    test_timer_t *tt = (test_timer_t *)arg;
+    // Fires in the first Advance at or past its deadline
+    EXPECT_GE(wheel_now, tt->due);
+    EXPECT_LT(wheel_prev, tt->due);
+    tt->fired = wheel_now;
+    tt->count++;
+}
+
+static int AdvanceTo(TimerWheel &wheel, tint now)
+{
+    wheel_prev = wheel_now;
+    wheel_now = now;
+    return wheel.Advance(now);
+}
+
+static void InitTimer(test_timer_t *tt)
+{
+    tt->t.callback = TestCallback;
+    tt->t.arg = tt;
+    tt->due = 0;
+    tt->fired = TINT_NEVER;
+    tt->count = 0;
+}
+
+
+TEST(TimerWheel,FireNotEarly)
+{
+    // Deadlines over all levels, advancing in uneven steps: every timer
+    // fires once, in the first Advance at or past its deadline.
+    TimerWheel wheel;
+    NOW = wheel_now = wheel_prev = 1000000;
+    srand(1);
+    const int n = 2000;
+    test_timer_t *tts = new test_timer_t[n];
+    for (int i=0; i<n; i++) {
+        InitTimer(&tts[i]);
+        int level = rand() % 4;
+        tint delay = 1 + rand() % ((tint)1 << (8*level+7));
+        tts[i].due = NOW+delay;
+        wheel.Schedule(&tts[i].t, tts[i].due);
+    }
+    EXPECT_EQ(n, wheel.Size());
+
+    int fired = 0;
+    while (wheel.Size() > 0) {
+        tint step = 1 + (rand() % 3 == 0 ? rand() % 1000000 : rand() % 300);
+        fired += AdvanceTo(wheel, wheel_now+step);
+    }
+    EXPECT_EQ(n, fired);
+    for (int i=0; i<n; i++)
+        EXPECT_EQ(1, tts[i].count);
+    delete[] tts;
+}
+
+
+TEST(TimerWheel,RescheduleCancel)
+{
+    TimerWheel wheel;
+    NOW = wheel_now = wheel_prev = 5000000;
+    test_timer_t a, b, c;
+    InitTimer(&a);
+    InitTimer(&b);
+    InitTimer(&c);
+    wheel.Schedule(&a.t, NOW+100);
+    wheel.Schedule(&b.t, NOW+10*TINT_SEC);
+    wheel.Schedule(&c.t, NOW+200);
+    EXPECT_EQ(NOW+100, wheel.NextDue());
+
+    // Moving a keep-alive close and a near one far out
+    b.due = NOW+150;
+    wheel.Schedule(&b.t, b.due);
+    a.due = NOW+TINT_MIN;
+    wheel.Schedule(&a.t, a.due);
+    wheel.Cancel(&c.t);
+    EXPECT_FALSE(wheel.IsPending(&c.t));
+    EXPECT_EQ(2, wheel.Size());
+    EXPECT_EQ(NOW+150, wheel.NextDue());
+
+    EXPECT_EQ(0, AdvanceTo(wheel, NOW+149));
+    EXPECT_EQ(1, AdvanceTo(wheel, NOW+150));
+    EXPECT_EQ(1, b.count);
+    EXPECT_EQ(0, c.count);
+
+    // Past deadlines fire on the next Advance to a later time
+    c.due = NOW+151;
+    wheel.Schedule(&c.t, NOW);
+    EXPECT_EQ(NOW+151, wheel.NextDue());
+    EXPECT_EQ(1, AdvanceTo(wheel, NOW+151));
+    EXPECT_EQ(1, c.count);
+
+    EXPECT_EQ(0, AdvanceTo(wheel, NOW+TINT_MIN-1));
+    EXPECT_EQ(1, AdvanceTo(wheel, NOW+TINT_MIN));
+    EXPECT_EQ(1, a.count);
+    EXPECT_EQ(0, wheel.Size());
+    EXPECT_EQ(TINT_NEVER, wheel.NextDue());
+}
+
+
+static TimerWheel *cancel_wheel = NULL;
+static test_timer_t *cancel_victim = NULL;
+
+static void CancelCallback(int fd, short event, void *arg)
+{
+    // Like a send that deletes another channel due in the same tick
+    TestCallback(fd, event, arg);
+    if (cancel_victim != NULL)
+        cancel_wheel->Cancel(&cancel_victim->t);
+}
+
+TEST(TimerWheel,CancelInBatch)
+{
+    TimerWheel wheel;
+    NOW = wheel_now = wheel_prev = 7000000;
+    test_timer_t tts[3];
+    for (int i=0; i<3; i++) {
+        InitTimer(&tts[i]);
+        tts[i].t.callback = CancelCallback;
+        tts[i].due = NOW+50;
+        wheel.Schedule(&tts[i].t, tts[i].due);
+    }
+    cancel_wheel = &wheel;
+    // Slots are LIFO, so tts[2] runs first and cancels tts[1]
+    cancel_victim = &tts[1];
+    EXPECT_EQ(2, AdvanceTo(wheel, NOW+50));
+    EXPECT_EQ(1, tts[0].count);
+    EXPECT_EQ(0, tts[1].count);
+    EXPECT_EQ(1, tts[2].count);
+    cancel_victim = NULL;
+}
+
+
+static void NopCallback(int fd, short event, void *arg)
+{
+}
+
+TEST(TimerWheel,RescheduleBench)
+{
+    // Channel sends reschedule their timer a few ms out, keep-alives
+    // seconds out.
+    srand(42);
+    tint *delays = new tint[BENCH_RESCHEDULES];
+    int *which = new int[BENCH_RESCHEDULES];
+    for (int i=0; i<BENCH_RESCHEDULES; i++) {
+        which[i] = rand() % BENCH_TIMERS;
+        delays[i] = i % 10 == 0 ? TINT_SEC + rand() % (10*TINT_SEC) : 100 + rand() % (20*TINT_MSEC);
+    }
+
+    struct event_base *evbase = event_base_new();
+    struct event *evs = new struct event[BENCH_TIMERS];
+    for (int i=0; i<BENCH_TIMERS; i++) {
+        evtimer_assign(&evs[i], evbase, NopCallback, NULL);
+        evtimer_add(&evs[i], tint2tv(delays[i]));
+    }
+    tint start = usec_time();
+    for (int i=0; i<BENCH_RESCHEDULES; i++) {
+        evtimer_del(&evs[which[i]]);
+        evtimer_add(&evs[which[i]], tint2tv(delays[i]));
+    }
+    tint elapsed = usec_time()-start;
+    double libevent = (double)BENCH_RESCHEDULES*TINT_SEC/elapsed;
+    for (int i=0; i<BENCH_TIMERS; i++)
+        evtimer_del(&evs[i]);
+
+    TimerWheel *wheel = new TimerWheel();
+    wheel->Init(evbase);
+    wheel_timer_t *timers = new wheel_timer_t[BENCH_TIMERS];
+    NOW = usec_time();
+    for (int i=0; i<BENCH_TIMERS; i++) {
+        timers[i].callback = NopCallback;
+        wheel->Schedule(&timers[i], NOW+delays[i]);
+    }
+    start = usec_time();
+    for (int i=0; i<BENCH_RESCHEDULES; i++)
+        wheel->Schedule(&timers[which[i]], NOW+delays[i]);
+    elapsed = usec_time()-start;
+    double wheeled = (double)BENCH_RESCHEDULES*TINT_SEC/elapsed;
+
+    fprintf(stderr,"timerwheel: %d timers, libevent %.0f reschedules/s, wheel %.0f reschedules/s, speedup %.2fx\n",
+            BENCH_TIMERS, libevent, wheeled, wheeled/libevent);
+    EXPECT_GT(wheeled, 0.0);
+
+    delete wheel;
+    delete[] timers;
+    delete[] evs;
+    event_base_free(evbase);
+    delete[] which;
+    delete[] delays;
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
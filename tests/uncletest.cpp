@@ -0,0 +1,126 @@
+/*
+ *  uncletest.cpp
+ *
+ *  Tests of sending uncle hashes once per peer: an uncle sent within
+ *  ack_timeout() is not sent again, unless the DATA it went with is
+ *  retransmitted or the timeout passed without the peer acking.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+#include "compat.h"
+
+using namespace swift;
+
+#define TESTFILE     "uncle.dat"
+#define TEST_CHUNKS  8
+
+
+class UncleChannel : public Channel
+{
+  public:
+    UncleChannel(ContentTransfer *t) : Channel(t) {
+        hs_out_->chunk_addr_ = POPT_CHUNK_ADDR_BIN32;
+    }
+};
+
+// Uncles in the INTEGRITY messages of dg, checked against the tree
+static binvector Uncles(dgram_t *dg, HashTree *tree)
+{
+    binvector uncles;
+    while (dgram_get_length(dg) > 0) {
+        EXPECT_EQ(SWIFT_INTEGRITY, dgram_remove_8(dg));
+        binvector bv = dgram_remove_chunkaddr(dg,POPT_CHUNK_ADDR_BIN32);
+        EXPECT_EQ(1u, bv.size());
+        if (bv.size() != 1)
+            break;
+        EXPECT_TRUE(tree->hash(bv[0]) == dgram_remove_hash(dg));
+        uncles.push_back(bv[0]);
+    }
+    dgram_free(dg);
+    return uncles;
+}
+
+static binvector SendUncles(Channel *c, bin_t pos, bool isretransmit)
+{
+    dgram_t *dg = dgram_new();
+    c->AddFileUncleHashes(dg,pos,isretransmit);
+    return Uncles(dg,c->hashtree());
+}
+
+
+TEST(Uncle,SentOncePerTimeout)
+{
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open(TESTFILE,noswarmid);
+    ASSERT_GE(td,0);
+    ContentTransfer *ct = swift::GetActivatedTransfer(td);
+    ASSERT_TRUE(ct != NULL && ct->hashtree() != NULL);
+    ASSERT_EQ(TEST_CHUNKS, ct->hashtree()->size_in_chunks());
+    UncleChannel *c = new UncleChannel(ct);
+
+    Channel::Time();
+    tint start = NOW;
+    tint timeout = c->ack_timeout();
+
+    // All up to the peak, in descending layer order
+    binvector bv = SendUncles(c,bin_t(0,5),false);
+    ASSERT_EQ(3u, bv.size());
+    EXPECT_EQ(bin_t(2,0), bv[0]);
+    EXPECT_EQ(bin_t(1,3), bv[1]);
+    EXPECT_EQ(bin_t(0,4), bv[2]);
+
+    // Within the timeout only the one not sent yet goes
+    uint64_t msgs = Channel::global_hash_msgs, skipped = Channel::global_hash_skipped;
+    NOW = start + timeout/2;
+    bv = SendUncles(c,bin_t(0,4),false);
+    ASSERT_EQ(1u, bv.size());
+    EXPECT_EQ(bin_t(0,5), bv[0]);
+    EXPECT_EQ(msgs+1, Channel::global_hash_msgs);
+    EXPECT_EQ(skipped+2, Channel::global_hash_skipped);
+    EXPECT_EQ(0u, SendUncles(c,bin_t(0,5),false).size());
+
+    // After it, they are sent again
+    NOW = start + timeout + 1;
+    bv = SendUncles(c,bin_t(0,5),false);
+    ASSERT_EQ(3u, bv.size());
+    EXPECT_EQ(bin_t(2,0), bv[0]);
+    EXPECT_EQ(bin_t(1,3), bv[1]);
+    EXPECT_EQ(bin_t(0,4), bv[2]);
+
+    // With a retransmit always, the peer may have lost them
+    EXPECT_EQ(0u, SendUncles(c,bin_t(0,5),false).size());
+    skipped = Channel::global_hash_skipped;
+    EXPECT_EQ(3u, SendUncles(c,bin_t(0,5),true).size());
+    EXPECT_EQ(skipped, Channel::global_hash_skipped);
+    EXPECT_EQ(3u, SendUncles(c,bin_t(0,5),true).size());
+
+    Channel::Time();
+    delete c;
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+
+    unlink(TESTFILE);
+    unlink((std::string(TESTFILE)+".mhash").c_str());
+    unlink((std::string(TESTFILE)+".mbinmap").c_str());
+    int f = open(TESTFILE,O_RDWR|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (f < 0) {
+        eprintf("Error opening %s\n",TESTFILE);
+        return -1;
+    }
+    char buf[TEST_CHUNKS*SWIFT_DEFAULT_CHUNK_SIZE];
+    memset(buf,'U',sizeof(buf));
+    if (write(f,buf,sizeof(buf)) != sizeof(buf))
+        return -1;
+    close(f);
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,191 @@
+/*
+ *  uringbench.cpp
+ *
+ *  Benchmark of the io_uring I/O backend (Channel::IO_URING) against the
+ *  libevent path: loopback DATA sends via the send queue, and random chunk
+ *  reads from a file with pread vs. a batch of ring reads. Prints chunks/sec
+ *  for each. Skipped when built without SWIFT_IOURING or when the kernel
+ *  has no io_uring.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include "swift.h"
+
+using namespace swift;
+
+#define BENCH_CHUNKS    200000
+#define BENCH_BURST     64
+#define BENCH_FILE      "uringbench.dat"
+#define BENCH_FILE_CHUNKS   16384
+#define BENCH_QDEPTH    32
+
+// Size of a DATA datagram for a default size chunk: channel id, DATA
+// message id, chunk addr, timestamp, chunk
+#define BENCH_DGRAM_SIZE    (4+1+4+8+SWIFT_DEFAULT_CHUNK_SIZE)
+
+
+static double RunSendBench(bool uring, uint16_t port)
+{
+    Channel::IO_URING = uring;
+    char sndaddr[32], rcvaddr[32];
+    sprintf(sndaddr,"127.0.0.1:%u",port);
+    sprintf(rcvaddr,"127.0.0.1:%u",port+1);
+    evutil_socket_t sndsock = Channel::Bind(sndaddr);
+    evutil_socket_t rcvsock = Channel::Bind(rcvaddr);
+    EXPECT_TRUE(sndsock>0 && rcvsock>0);
+
+    recv_slot_t *slots = new recv_slot_t[BENCH_BURST];
+    char *bufs = new char[BENCH_BURST*SWIFT_MAX_RECV_DGRAM_SIZE];
+    for (int i=0; i<BENCH_BURST; i++) {
+        slots[i].buf = bufs+i*SWIFT_MAX_RECV_DGRAM_SIZE;
+        slots[i].size = SWIFT_MAX_RECV_DGRAM_SIZE;
+    }
+    char chunk[BENCH_DGRAM_SIZE];
+    memset(chunk,'a',sizeof(chunk));
+    Address dest(rcvaddr);
+
+    uint64_t dgrams = Channel::global_dgrams_up, viauring = Channel::global_uring_sends;
+    tint start = usec_time();
+    int sent=0, rcvd=0;
+    while (sent < BENCH_CHUNKS) {
+        for (int i=0; i<BENCH_BURST; i++) {
+            dgram_t *d = dgram_new();
+            dgram_add(d,chunk,sizeof(chunk));
+            Channel::QueueTo(sndsock,dest,d);
+        }
+        Channel::FlushSendQueue(sndsock);
+        sent = Channel::global_dgrams_up-dgrams;
+        // Let the sends complete, then drain
+        if (uring) {
+            while (Channel::Uring()->InFlight() > 0)
+                Channel::Uring()->Reap();
+        }
+        int n;
+        while ((n = Channel::RecvBatch(rcvsock,slots,BENCH_BURST)) > 0)
+            rcvd += n;
+    }
+    tint elapsed = usec_time()-start;
+    double cps = (double)rcvd*TINT_SEC/elapsed;
+    fprintf(stderr,"uringbench: send %s: sent %d rcvd %d chunks in %.3f s, %.0f chunks/s, %" PRIu64 " via ring\n",
+            uring ? "uring   " : "libevent", sent, rcvd, (double)elapsed/TINT_SEC, cps,
+            Channel::global_uring_sends-viauring);
+
+    delete[] bufs;
+    delete[] slots;
+    Channel::CloseSocket(sndsock);
+    Channel::CloseSocket(rcvsock);
+    Channel::IO_URING = false;
+    return cps;
+}
+
+
+struct bench_read_t {
+    uring_req_t req;
+    int         res;
+};
+
+static int bench_reads_done = 0;
+
+static void BenchReadDone(uring_req_t *req, int res)
+{
+    ((bench_read_t *)req)->res = res;
+    bench_reads_done++;
+}
+
+static double RunReadBench(bool uring)
+{
+    int fd = open_utf8(BENCH_FILE,ROOPENFLAGS,0);
+    EXPECT_TRUE(fd >= 0);
+    char *bufs = new char[BENCH_QDEPTH*SWIFT_DEFAULT_CHUNK_SIZE];
+    bench_read_t reqs[BENCH_QDEPTH];
+    srand(42);
+
+    tint start = usec_time();
+    int nread = 0;
+    if (!uring) {
+        for (int i=0; i<BENCH_CHUNKS; i++) {
+            uint64_t off = (uint64_t)(rand() % BENCH_FILE_CHUNKS)*SWIFT_DEFAULT_CHUNK_SIZE;
+            if (pread(fd,bufs,SWIFT_DEFAULT_CHUNK_SIZE,off) == SWIFT_DEFAULT_CHUNK_SIZE)
+                nread++;
+        }
+    } else {
+        IOUring *ring = Channel::Uring();
+        for (int i=0; i<BENCH_CHUNKS; i+=BENCH_QDEPTH) {
+            bench_reads_done = 0;
+            for (int j=0; j<BENCH_QDEPTH; j++) {
+                uint64_t off = (uint64_t)(rand() % BENCH_FILE_CHUNKS)*SWIFT_DEFAULT_CHUNK_SIZE;
+                reqs[j].req.done = BenchReadDone;
+                reqs[j].res = 0;
+                ring->PrepRead(fd,bufs+j*SWIFT_DEFAULT_CHUNK_SIZE,SWIFT_DEFAULT_CHUNK_SIZE,off,&reqs[j].req);
+            }
+            ring->SubmitAndWait(BENCH_QDEPTH);
+            while (bench_reads_done < BENCH_QDEPTH)
+                ring->Reap();
+            for (int j=0; j<BENCH_QDEPTH; j++)
+                if (reqs[j].res == SWIFT_DEFAULT_CHUNK_SIZE)
+                    nread++;
+        }
+    }
+    tint elapsed = usec_time()-start;
+    double cps = (double)nread*TINT_SEC/elapsed;
+    fprintf(stderr,"uringbench: read %s: %d chunks in %.3f s, %.0f chunks/s\n",
+            uring ? "uring   " : "pread   ", nread, (double)elapsed/TINT_SEC, cps);
+
+    delete[] bufs;
+    close(fd);
+    return cps;
+}
+
+
+TEST(URingBench,Send)
+{
+    Channel::IO_URING = true;
+    if (Channel::Uring() == NULL) {
+        fprintf(stderr,"uringbench: no io_uring, skipping\n");
+        Channel::IO_URING = false;
+        return;
+    }
+    double off = RunSendBench(false,12011);
+    double on = RunSendBench(true,12013);
+    EXPECT_GT(off,0.0);
+    EXPECT_GT(on,0.0);
+    fprintf(stderr,"uringbench: send speedup %.2fx\n", on/off);
+}
+
+
+TEST(URingBench,Read)
+{
+    Channel::IO_URING = true;
+    if (Channel::Uring() == NULL) {
+        fprintf(stderr,"uringbench: no io_uring, skipping\n");
+        Channel::IO_URING = false;
+        return;
+    }
+    FILE *fp = fopen(BENCH_FILE,"wb");
+    ASSERT_TRUE(fp != NULL);
+    char chunk[SWIFT_DEFAULT_CHUNK_SIZE];
+    for (int i=0; i<BENCH_FILE_CHUNKS; i++) {
+        memset(chunk,i&0xff,sizeof(chunk));
+        fwrite(chunk,sizeof(chunk),1,fp);
+    }
+    fclose(fp);
+
+    double off = RunReadBench(false);
+    double on = RunReadBench(true);
+    EXPECT_GT(off,0.0);
+    EXPECT_GT(on,0.0);
+    fprintf(stderr,"uringbench: read speedup %.2fx\n", on/off);
+    remove(BENCH_FILE);
+    Channel::IO_URING = false;
+}
+
+
+int main(int argc, char** argv)
+{
+    swift::LibraryInit();
+    Channel::evbase = event_base_new();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
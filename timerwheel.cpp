@@ -0,0 +1,247 @@
+/*
+ *  timerwheel.cpp
+ *  Hierarchical timing wheel, see timerwheel.h.
+ *
+ *  A timer due at tick t (= usec) lives at the lowest level whose span
+ *  covers t-cur_, in the slot given by that level's digit of t. When the
+ *  wheel passes a level boundary the slot for it is cascaded, i.e. its
+ *  timers are relinked a level (or more) down. Level 0 slots hold timers
+ *  for exactly that tick.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+#include "timerwheel.h"
+
+using namespace swift;
+
+#define WHEEL_SPAN(level)   ((uint64_t)1 << (SWIFT_WHEEL_SLOT_BITS*(level)))
+#define WHEEL_MAX_DELTA     (WHEEL_SPAN(SWIFT_WHEEL_LEVELS)-1)
+
+
+// Distance from start to the first set bit in a slot bitmap, wrapping
+// around, -1 if none.
+static int wheel_find_slot(const uint64_t *bits, int start)
+{
+    for (int d=0; d<SWIFT_WHEEL_SLOTS; ) {
+        int s = (start+d) & (SWIFT_WHEEL_SLOTS-1);
+        uint64_t w = bits[s>>6] >> (s&63);
+        if (w == 0) {
+            d += 64-(s&63);
+            continue;
+        }
+        while (!(w & 1)) {
+            w >>= 1;
+            d++;
+        }
+        return d < SWIFT_WHEEL_SLOTS ? d : -1;
+    }
+    return -1;
+}
+
+
+TimerWheel::TimerWheel() : cur_(0), size_(0), started_(false), advancing_(false),
+    evbase_(NULL), armed_(TINT_NEVER)
+{
+    memset(slots_, 0, sizeof(slots_));
+    memset(bits_, 0, sizeof(bits_));
+}
+
+TimerWheel::~TimerWheel()
+{
+    if (evbase_ != NULL)
+        evtimer_del(&ev_);
+}
+
+void TimerWheel::Init(struct event_base *evbase)
+{
+    evbase_ = evbase;
+    evtimer_assign(&ev_, evbase_, &TimerWheel::LibeventCallback, this);
+    armed_ = TINT_NEVER;
+    Arm();
+}
+
+void TimerWheel::Link(wheel_timer_t *t)
+{
+    uint64_t delta = t->tick-cur_;
+    if (delta > WHEEL_MAX_DELTA)
+        delta = WHEEL_MAX_DELTA; // relinked with the real tick when cascaded
+    int level = 0;
+    while (level < SWIFT_WHEEL_LEVELS-1 && delta >= WHEEL_SPAN(level+1))
+        level++;
+    int s = ((cur_+delta) >> (SWIFT_WHEEL_SLOT_BITS*level)) & (SWIFT_WHEEL_SLOTS-1);
+    wheel_timer_t **head = &slots_[level][s];
+    t->next = *head;
+    if (t->next != NULL)
+        t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+    bits_[level][s>>6] |= (uint64_t)1 << (s&63);
+    size_++;
+}
+
+void TimerWheel::Unlink(wheel_timer_t *t)
+{
+    wheel_timer_t **head = t->pprev;
+    *head = t->next;
+    if (t->next != NULL)
+        t->next->pprev = head;
+    // Last one out of a slot clears its bit
+    wheel_timer_t **first = &slots_[0][0];
+    if (*head == NULL && head >= first && head < first+SWIFT_WHEEL_LEVELS*SWIFT_WHEEL_SLOTS) {
+        int i = head-first;
+        bits_[i/SWIFT_WHEEL_SLOTS][(i%SWIFT_WHEEL_SLOTS)>>6] &= ~((uint64_t)1 << (i&63));
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+    size_--;
+}
+
+void TimerWheel::Schedule(wheel_timer_t *t, tint due)
+{
+    if (t->pprev != NULL)
+        Unlink(t);
+    if (!started_ || (size_ == 0 && cur_ < (uint64_t)NOW)) {
+        // Nothing pending, so no need to walk the idle time
+        cur_ = NOW;
+        started_ = true;
+    }
+    t->tick = due < (tint)cur_ ? cur_ : due;
+    Link(t);
+    if (!advancing_ && evbase_ != NULL && (tint)t->tick < armed_) {
+        armed_ = t->tick;
+        evtimer_add(&ev_, tint2tv(std::max((tint)0, armed_-NOW)));
+    }
+}
+
+void TimerWheel::Cancel(wheel_timer_t *t)
+{
+    // Leave ev_ armed, a spurious wakeup is cheaper than finding the next
+    if (t->pprev != NULL)
+        Unlink(t);
+}
+
+void TimerWheel::Cascade(int level)
+{
+    int s = (cur_ >> (SWIFT_WHEEL_SLOT_BITS*level)) & (SWIFT_WHEEL_SLOTS-1);
+    wheel_timer_t *t = slots_[level][s];
+    slots_[level][s] = NULL;
+    bits_[level][s>>6] &= ~((uint64_t)1 << (s&63));
+    while (t != NULL) {
+        wheel_timer_t *next = t->next;
+        size_--;
+        Link(t);
+        t = next;
+    }
+}
+
+uint64_t TimerWheel::NextTick()
+{
+    uint64_t best = (uint64_t)-1;
+    for (int level=0; level<SWIFT_WHEEL_LEVELS; level++) {
+        int shift = SWIFT_WHEEL_SLOT_BITS*level;
+        uint64_t pos = cur_ >> shift;
+        int start = pos & (SWIFT_WHEEL_SLOTS-1);
+        uint64_t tick;
+        if (level == 0) {
+            int d = wheel_find_slot(bits_[0], start);
+            if (d < 0)
+                continue;
+            tick = cur_+d;
+        } else {
+            // The current slot is cascaded now if on the boundary, else a
+            // full turn from now
+            bool curset = (bits_[level][start>>6] >> (start&63)) & 1;
+            if (curset && (cur_ & (WHEEL_SPAN(level)-1)) == 0)
+                tick = cur_;
+            else {
+                int d = wheel_find_slot(bits_[level], (start+1) & (SWIFT_WHEEL_SLOTS-1));
+                if (d >= 0)
+                    tick = (pos+d+1) << shift;
+                else if (curset)
+                    tick = (pos+SWIFT_WHEEL_SLOTS) << shift;
+                else
+                    continue;
+            }
+        }
+        if (tick < best)
+            best = tick;
+    }
+    return best;
+}
+
+tint TimerWheel::NextDue()
+{
+    if (size_ == 0)
+        return TINT_NEVER;
+    return NextTick();
+}
+
+int TimerWheel::Advance(tint now)
+{
+    if (!started_)
+        return 0;
+    advancing_ = true;
+    int fired = 0;
+    uint64_t target = now;
+    while (cur_ <= target && size_ > 0) {
+        for (int level=SWIFT_WHEEL_LEVELS-1; level>0; level--)
+            if ((cur_ & (WHEEL_SPAN(level)-1)) == 0)
+                Cascade(level);
+
+        int s = cur_ & (SWIFT_WHEEL_SLOTS-1);
+        wheel_timer_t *expired = slots_[0][s];
+        cur_++;
+        if (expired == NULL) {
+            // Skip ticks without work
+            uint64_t next = NextTick();
+            if (next > cur_)
+                cur_ = std::min(next, target+1);
+            continue;
+        }
+
+        // Batch: take the slot, then fire. Callbacks may cancel or
+        // reschedule any timer, also the ones still in the batch.
+        slots_[0][s] = NULL;
+        bits_[0][s>>6] &= ~((uint64_t)1 << (s&63));
+        expired->pprev = &expired;
+        while (expired != NULL) {
+            wheel_timer_t *t = expired;
+            Unlink(t);
+            if (t->tick >= cur_) {
+                // Placed at the far end of the wheel, not due yet
+                Link(t);
+                continue;
+            }
+            fired++;
+            t->callback(-1, EV_TIMEOUT, t->arg);
+        }
+    }
+    if (cur_ <= target)
+        cur_ = target+1;
+    advancing_ = false;
+    if (evbase_ != NULL)
+        Arm();
+    return fired;
+}
+
+void TimerWheel::Arm()
+{
+    tint due = NextDue();
+    if (due == TINT_NEVER) {
+        if (armed_ != TINT_NEVER)
+            evtimer_del(&ev_);
+        armed_ = TINT_NEVER;
+        return;
+    }
+    armed_ = due;
+    evtimer_add(&ev_, tint2tv(std::max((tint)0, due-NOW)));
+}
+
+void TimerWheel::LibeventCallback(int fd, short event, void *arg)
+{
+    TimerWheel *wheel = (TimerWheel *)arg;
+    wheel->armed_ = TINT_NEVER;
+    wheel->Advance(Channel::Time());
+}
@@ -0,0 +1,85 @@
+/*
+ *  timerwheel.h
+ *  Hierarchical timing wheel for the channel send timers, driven by a
+ *  single libevent timer. Level 0 has a slot per microsecond, each next
+ *  level covers 256 slots of the one below, so near deadlines are exact
+ *  and keep-alives seconds away sit in a coarse slot until they are close.
+ *  Scheduling and cancelling are O(1), timers due are run in one batch.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "compat.h"
+#include <event2/event.h>
+#include <event2/event_struct.h>
+
+#define SWIFT_WHEEL_LEVELS      4
+#define SWIFT_WHEEL_SLOT_BITS   8
+#define SWIFT_WHEEL_SLOTS       (1<<SWIFT_WHEEL_SLOT_BITS)
+
+namespace swift
+{
+
+    /** Timer to embed or allocate, see TimerWheel::Schedule(). The
+     *  callback gets called like a libevent one, with fd -1 and EV_TIMEOUT. */
+    struct wheel_timer_t {
+        wheel_timer_t   *next;
+        wheel_timer_t   **pprev;    // NULL when not pending
+        uint64_t        tick;
+        event_callback_fn callback;
+        void            *arg;
+
+        wheel_timer_t(event_callback_fn cb=NULL, void *cbarg=NULL) :
+            next(NULL), pprev(NULL), tick(0), callback(cb), arg(cbarg) {}
+    };
+
+    class TimerWheel
+    {
+    public:
+        TimerWheel();
+        ~TimerWheel();
+
+        /** Run timers from the event loop of evbase. Without this, call
+         *  Advance() yourself. */
+        void    Init(struct event_base *evbase);
+
+        /** (Re)schedule t to fire at due (usec_time), at the earliest in
+         *  the next Advance() when due is past. */
+        void    Schedule(wheel_timer_t *t, tint due);
+        void    Cancel(wheel_timer_t *t);
+        bool    IsPending(const wheel_timer_t *t) const {
+            return t->pprev != NULL;
+        }
+
+        /** Fire all timers due at or before now, returns how many */
+        int     Advance(tint now);
+        /** Earliest time a timer may fire, TINT_NEVER if none pending */
+        tint    NextDue();
+        size_t  Size() const {
+            return size_;
+        }
+
+    protected:
+        wheel_timer_t   *slots_[SWIFT_WHEEL_LEVELS][SWIFT_WHEEL_SLOTS];
+        uint64_t        bits_[SWIFT_WHEEL_LEVELS][SWIFT_WHEEL_SLOTS/64];  // non-empty slots
+        uint64_t        cur_;       // next tick to process
+        size_t          size_;
+        bool            started_, advancing_;
+        struct event    ev_;
+        struct event_base *evbase_;
+        tint            armed_;     // when ev_ fires, TINT_NEVER if not added
+
+        void    Link(wheel_timer_t *t);
+        void    Unlink(wheel_timer_t *t);
+        void    Cascade(int level);
+        uint64_t NextTick();
+        void    Arm();
+        static void LibeventCallback(int fd, short event, void *arg);
+    };
+
+}
+
+#endif
@@ -22,7 +22,14 @@ ZeroState * ZeroState::__singleton = NULL;
 
 #define CLEANUP_INTERVAL            30  // seconds
 
-ZeroState::ZeroState() : contentdir_("."), metadir_(""), connect_timeout_(TINT_NEVER)
+// Bloom filter of the content dir: bits per root hash (~0.25% false
+// positives) and number of hash functions, i.e. 32-bit words of the hash
+#define SWIFT_ZS_BLOOM_BITS_PER_HASH 16
+#define SWIFT_ZS_BLOOM_HASHES       4
+#define SWIFT_ZS_BLOOM_MIN_BITS     4096
+
+ZeroState::ZeroState() : contentdir_("."), metadir_(""), bloom_time_(-1), bloom_check_time_(0),
+    connect_timeout_(TINT_NEVER)
 {
     if (__singleton == NULL) {
         __singleton = this;
@@ -128,6 +135,7 @@ ZeroState * ZeroState::GetInstance()
 void ZeroState::SetContentDir(std::string contentdir)
 {
     contentdir_ = contentdir;
+    bloom_time_ = -1;
 }
 
 
@@ -178,42 +186,97 @@ int ZeroState::Find(const Sha1Hash &root_hash)
 }
 
 
-void Channel::OnDataZeroState(struct evbuffer *evb)
+bool ZeroState::MayHave(const Sha1Hash &root_hash)
+{
+    if (bloom_time_ < 0 || NOW-bloom_check_time_ >= TINT_SEC) {
+        // Rebuild if the dir changed in or after the second it was built
+        bloom_check_time_ = NOW;
+        if (bloom_time_ < 0 || file_mtime_utf8(contentdir_) >= bloom_time_)
+            BuildBloom();
+    }
+    // Root hashes are random enough to be their own Bloom hashes
+    uint32_t mask = bloom_.size()*32-1;
+    for (int i=0; i<SWIFT_ZS_BLOOM_HASHES; i++) {
+        uint32_t w;
+        memcpy(&w,root_hash.bits+i*sizeof(uint32_t),sizeof(uint32_t));
+        w &= mask;
+        if (!(bloom_[w>>5] & (1u << (w&31))))
+            return false;
+    }
+    return true;
+}
+
+
+void ZeroState::BuildBloom()
+{
+    bloom_time_ = NOW/TINT_SEC;
+    std::vector<Sha1Hash> hashes;
+    DirEntry *de = opendir_utf8(contentdir_);
+    while (de != NULL) {
+        // Content is named by its root hash in hex, see Find
+        const std::string &name = de->filename_;
+        if (!de->isdir_ && name.length() == Sha1Hash::SIZE*2
+                && name.find_first_not_of("0123456789abcdef") == std::string::npos)
+            hashes.push_back(Sha1Hash(true,name.c_str()));
+        DirEntry *newde = readdir_utf8(de);
+        delete de;
+        de = newde;
+    }
+
+    size_t nbits = SWIFT_ZS_BLOOM_MIN_BITS;
+    while (nbits < hashes.size()*SWIFT_ZS_BLOOM_BITS_PER_HASH)
+        nbits <<= 1;
+    bloom_.assign(nbits/32,0);
+    uint32_t mask = nbits-1;
+    for (int j=0; j<hashes.size(); j++) {
+        for (int i=0; i<SWIFT_ZS_BLOOM_HASHES; i++) {
+            uint32_t w;
+            memcpy(&w,hashes[j].bits+i*sizeof(uint32_t),sizeof(uint32_t));
+            w &= mask;
+            bloom_[w>>5] |= 1u << (w&31);
+        }
+    }
+    dprintf("%s zero bloom %s: " PRISIZET " hashes in " PRISIZET " bits\n",tintstr(),contentdir_.c_str(),
+            hashes.size(),nbits);
+}
+
+
+void Channel::OnDataZeroState(dgram_t *dg)
 {
     dprintf("%s #%" PRIu32 " zero -data, don't need it, am a seeder\n",tintstr(),id_);
 }
 
-void Channel::OnHaveZeroState(struct evbuffer *evb)
+void Channel::OnHaveZeroState(dgram_t *dg)
 {
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = dgram_remove_chunkaddr(dg,hs_in_->chunk_addr_);
     // Forget about it, i.e.. don't build peer binmap.
 }
 
-void Channel::OnHashZeroState(struct evbuffer *evb)
+void Channel::OnHashZeroState(dgram_t *dg)
 {
     dprintf("%s #%" PRIu32 " zero -hash, don't need it, am a seeder\n",tintstr(),id_);
 }
 
-void Channel::OnPexAddZeroState(struct evbuffer *evb, int family)
+void Channel::OnPexAddZeroState(dgram_t *dg, int family)
 {
-    evbuffer_remove_pexaddr(evb, family);
+    dgram_remove_pexaddr(dg, family);
     // Forget about it
 }
 
-void Channel::OnPexAddCertZeroState(struct evbuffer *evb)
+void Channel::OnPexAddCertZeroState(dgram_t *dg)
 {
-    uint16_t size = evbuffer_remove_16be(evb);
-    if (size > PEX_RES_MAX_CERT_SIZE || evbuffer_get_length(evb) < size) {
+    uint16_t size = dgram_remove_16be(dg);
+    if (size > PEX_RES_MAX_CERT_SIZE || dgram_get_length(dg) < size) {
         dprintf("%s #%" PRIu32 " ?pex cert too big\n",tintstr(),id_);
         return;
     }
-    //swarmidbytes = evbuffer_pullup(evb,size);
-    evbuffer_drain(evb, size);
+    //swarmidbytes = evbuffer_pullup(dg,size);
+    dgram_drain(dg, size);
     // Forget about it
 }
 
 
-void Channel::OnPexReqZeroState(struct evbuffer *evb)
+void Channel::OnPexReqZeroState(dgram_t *dg)
 {
     // Ignore it
 }